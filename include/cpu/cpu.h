@@ -112,6 +112,7 @@
 
 #define STATE_CODE16 0x0001
 #define STATE_ADDR16 0x0002
+#define STATE_FLAT 0x0008 // ES, CS, SS and DS all have a base of zero
 
 #define IS_USER_MODE() cpu.cpl == 3
 
@@ -364,6 +365,7 @@ struct cpu {
     uint8_t tlb_tags[1 << 20];
 #define TLB_ATTR_NX 1
 #define TLB_ATTR_NON_GLOBAL 2
+#define TLB_ATTR_RAM_REGION 4
     // Interesting information on TLB
     uint8_t tlb_attrs[1 << 20];
     uint8_t* tlb[1 << 20];
@@ -384,6 +386,9 @@ uint32_t cpulib_ptr_to_phys(void*);
 #define PTR_TO_PHYS(ptr) (uint32_t)(uintptr_t)((uint8_t *)ptr - (uint8_t *)cpu.mem)
 #endif
 
+// Same as PTR_TO_PHYS, but for a linear address that has already been translated. Pages in RAM regions don't point into cpu.mem.
+#define TLB_TO_PHYS(lin) (cpu.tlb_attrs[(lin) >> 12] & TLB_ATTR_RAM_REGION ? cpu_mmu_region_phys(lin) : PTR_TO_PHYS(cpu.tlb[(lin) >> 12] + (lin)))
+
 // Based on the linear address, the TLB tag for this entry, and the shift for the current mode
 #define TLB_ENTRY_INVALID8(addr, tag, shift) (tag >> shift & 1)
 #define TLB_ENTRY_INVALID16(addr, tag, shift) ((addr | tag >> shift) & 1)
@@ -546,6 +551,7 @@ int cpu_access_write8(uint32_t addr, uint32_t data, uint32_t tag, int shift);
 int cpu_access_write16(uint32_t addr, uint32_t data, uint32_t tag, int shift);
 int cpu_access_write32(uint32_t addr, uint32_t data, uint32_t tag, int shift);
 int cpu_access_verify(uint32_t addr, uint32_t end, int shift);
+int cpu_access_write_block(uint32_t addr, const uint8_t* data, uint32_t length, int shift);
 
 // seg.c
 void cpu_seg_load_virtual(int id, uint16_t sel);
@@ -558,6 +564,7 @@ uint32_t cpu_seg_get_base(struct seg_desc* info);
 uint32_t cpu_seg_get_limit(struct seg_desc* info);
 uint32_t cpu_seg_gate_target_segment(struct seg_desc* info);
 uint32_t cpu_seg_gate_target_offset(struct seg_desc* info);
+void cpu_seg_update_flat(void);
 uint32_t cpu_seg_gate_parameter_count(struct seg_desc* info);
 uint32_t cpu_seg_descriptor_address(int tbl, uint16_t sel);
 int cpu_load_seg_value_mov(int seg, uint16_t val);
@@ -577,12 +584,18 @@ void cpu_mmu_tlb_flush(void);
 void cpu_mmu_tlb_flush_nonglobal(void);
 int cpu_mmu_translate(uint32_t lin, int shift);
 void cpu_mmu_tlb_invalidate(uint32_t lin);
+void cpu_mmu_region_write(uint32_t lin);
+uint32_t cpu_mmu_region_phys(uint32_t lin);
 
 // trace.c
 struct trace_info* cpu_trace_get_entry(uint32_t phys);
 struct decoded_instruction* cpu_get_trace(void);
 void cpu_trace_flush(void);
 
+// profile.c
+extern int cpu_profile_enabled;
+void cpu_profile_trace(void);
+
 // eflags.c
 int cpu_get_of(void);
 int cpu_get_sf(void);
@@ -55,6 +55,11 @@ struct fpu {
     uint16_t fpu_cs, fpu_opcode, fpu_data_seg;
     // <<< END STRUCT "struct" >>>
 
+    // Cleared whenever anything visible to FXSAVE changes (x87 and MMX instructions, FXRSTOR, savestates). Lets
+    // FXSAVE reuse the x87 half of its previous image. Keep this above the FLOATX80-only fields so that every
+    // translation unit agrees on its offset.
+    int clean;
+
     // These are all values used internally. They are regenerated every time fpu.control_word is modified
 #ifdef FLOATX80
     float_status_t status;
@@ -23,6 +23,7 @@ typedef __insn_t* (*insn_handler_t)(__insn_t*);
 #define I_SCALE_SHIFT 20
 #define I_SEG_SHIFT 22
 #define I_OP_SHIFT 25
+#define I_EA_SHIFT 29
 
 #define I_RM(i) i >> I_RM_SHIFT & 15
 #define I_BASE(i) i >> I_BASE_SHIFT & 15 // Same thing as R/M, but with 4 bits
@@ -33,6 +34,7 @@ typedef __insn_t* (*insn_handler_t)(__insn_t*);
 #define I_OP(i) i >> I_OP_SHIFT & 7
 #define I_OP2(i) (i&(1 << I_OP_SHIFT))
 #define I_OP3(i) i >> I_OP_SHIFT & 15
+#define I_EA(i) (i >> I_EA_SHIFT & 3)
 
 #define I_SET_ADDR16(i, j) i |= (j) << I_ADDR16_SHIFT
 #define I_SET_RM(i, j) i |= (j) << I_RM_SHIFT
@@ -42,6 +44,14 @@ typedef __insn_t* (*insn_handler_t)(__insn_t*);
 #define I_SET_SCALE(i, j) i |= (j) << I_SCALE_SHIFT
 #define I_SET_OP(i, j) i |= (j) << I_OP_SHIFT
 #define I_SET_SEG_BASE(i, j) i |= (j) << I_SEG_SHIFT
+#define I_SET_EA(i, j) i |= (j) << I_EA_SHIFT
+
+// Effective address forms. parse_modrm picks one so that cpu_get_linaddr only does the adds the ModRM byte asks for.
+#define I_EA_GENERIC 0 // [base+index*scale+disp], truncated to 16 bits if ADDR16 is set
+#define I_EA_BASE 1 // [base+disp32]
+#define I_EA_DISP 2 // [disp32] or [disp16]
+#define I_EA_SIB 3 // [base+index*scale+disp32]
+#define I_EA_FLAT 4 // Segment base is zero (see STATE_FLAT), don't add it
 
 // Represents one decoded CPU instruction. Takes up 16 bytes on 32-bit, 20 bytes (padded out to 24 bytes) on 64-bit
 struct decoded_instruction {
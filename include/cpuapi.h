@@ -99,9 +99,22 @@ int cpu_interrupts_masked(void);
 // Debug API
 void cpu_debug(void);
 
+// Sample guest code and write a report to "path" on exit
+void cpu_profile_init(const char* path);
+
 // mmu.c
 uint32_t cpu_read_phys(uint32_t addr);
 
+// Map a page-aligned physical range outside of RAM directly to host memory, so that guest accesses to it skip the MMIO
+// handlers. "dirty" is called with the offset of a page the first time it's written after the region was protected.
+// Returns the region ID, or -1 if it can't be added.
+typedef void (*cpu_region_dirty)(uint32_t offset);
+int cpu_add_ram_region(uint32_t base, uint32_t size, void* ptr, cpu_region_dirty dirty);
+// Point the region to "ptr", or pass NULL to send accesses to the MMIO handlers again
+void cpu_set_ram_region(int id, void* ptr);
+// Make every page of the region report its next write
+void cpu_protect_ram_region(int id);
+
 #define MEM_RDONLY 1
 
 #endif
\ No newline at end of file
@@ -16,6 +16,8 @@ void ide_init(struct pc_settings* pc);
 void fdc_init(struct pc_settings* pc);
 void acpi_init(struct pc_settings* pc);
 void ne2000_init(struct ne2000_settings* conf);
+void virtio_init(struct pc_settings* pc);
+void ahci_init(struct pc_settings* pc);
 
 // XXX:
 #define floppy_get_type(id) 0
@@ -29,20 +31,39 @@ int pic_has_interrupt(void);
 void kbd_add_key(uint8_t data);
 void kbd_mouse_down(int left, int center, int right);
 void kbd_send_mouse_move(int xrel, int yre, int wxrel, int wyrel);
+void kbd_defer_input(void);
+void kbd_process_input(void);
 
 void vga_update(void);
+void vga_use_render_thread(void);
+int vga_render_snapshot(void);
+void vga_benchmark(int frames);
 void vga_restore_from_ptr(void* ptr);
 void* vga_get_ptr(void);
 
-// Timer functions, in lieu of "real" timer functions
-int cmos_clock(itick_t now);
-int pit_timer(itick_t now);
+// Timer event queue (timer.c). Each timed device owns one slot and keeps it armed with its next deadline.
+enum {
+    TIMER_CMOS,
+    TIMER_PIT,
+    TIMER_APIC,
+    TIMER_ACPI,
+    TIMER_NE2000,
+    TIMER_VIRTIO_NET,
+    TIMER_VIRTIO_BLK,
+    TIMER_AHCI,
+    TIMER_COUNT
+};
+#define TIMER_NONE ((itick_t)-1)
+// Called with the deadline that the event was armed with, which may be slightly before get_now()
+typedef void (*timer_handler)(itick_t deadline);
+void timer_register(int id, timer_handler cb);
+void timer_arm(int id, itick_t deadline);
+void timer_cancel(int id);
+itick_t timer_run(itick_t now);
+itick_t timer_get_next(void);
+void timer_set_run_limit(itick_t limit);
 
-int cmos_next(itick_t now);
-int pit_next(itick_t now);
-int apic_next(itick_t now);
 int floppy_next(itick_t now);
-int acpi_next(itick_t now);
 
 void dma_raise_dreq(int);
 // DMA handlers
@@ -64,6 +85,12 @@ void pci_init(struct pc_settings* pc);
 void pci_init_mem(void*);
 void* pci_create_device(uint32_t bus, uint32_t device, uint32_t function, pci_conf_write_cb cb);
 void pci_set_irq_line(int dev, int state);
+// Raises the line in a way that the PIC notices, even if it was already high
+void pci_pulse_irq_line(int dev);
+// Bus master DMA: a direct pointer to a range of guest RAM, or NULL if it isn't all RAM. Anything written through it
+// has to be followed by pci_dma_written so that code translated from those pages gets thrown away.
+void* pci_dma_ptr(uint32_t addr, uint32_t len);
+void pci_dma_written(uint32_t addr, uint32_t len);
 
 // PCI IDE support
 void ide_write_prdt(uint32_t addr, uint32_t data);
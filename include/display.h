@@ -9,6 +9,8 @@ void* display_get_pixels(void);
 void display_handle_events(void);
 void display_update_cycles(int cycles_elapsed, int us);
 void display_sleep(int ms);
+// Sleep for up to "us" microseconds, returning early if there are host events to handle
+void display_wait(int us);
 void* display_get_handle(int handle_id);
 
 void display_release_mouse(void);
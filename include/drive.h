@@ -10,9 +10,16 @@
 
 #ifdef ALLOW_64BIT_OFFSETS
 #define _FILE_OFFSET_BITS 64
+// These may already be defined by <features.h> if a file asks for _GNU_SOURCE
+#ifndef __USE_LARGEFILE64
 #define __USE_LARGEFILE64
+#endif
+#ifndef _LARGEFILE_SOURCE
 #define _LARGEFILE_SOURCE
+#endif
+#ifndef _LARGEFILE64_SOURCE
 #define _LARGEFILE64_SOURCE
+#endif
 typedef uint64_t drv_offset_t;
 #else
 typedef uint32_t drv_offset_t;
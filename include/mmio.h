@@ -7,6 +7,8 @@
 typedef uint32_t (*io_read)(uint32_t port);
 typedef void (*io_write)(uint32_t port, uint32_t data);
 typedef void (*io_reset)(void);
+// Writes "length" bytes to consecutive addresses, starting at "addr"
+typedef void (*io_write_block)(uint32_t addr, const uint8_t* data, uint32_t length);
 
 void io_register_read(int port, int length, io_read b, io_read w, io_read d);
 void io_register_write(int port, int length, io_write b, io_write w, io_write d);
@@ -14,6 +16,7 @@ void io_unregister_read(int port, int length);
 void io_unregister_write(int port, int length);
 void io_register_mmio_read(uint32_t start, uint32_t length, io_read b, io_read w, io_read d);
 void io_register_mmio_write(uint32_t start, uint32_t length, io_write b, io_write w, io_write d);
+void io_register_mmio_write_block(uint32_t start, io_write_block cb);
 void io_remap_mmio_read(uint32_t oldstart, uint32_t newstart);
 
 void io_register_reset(io_reset cb);
@@ -27,6 +30,7 @@ void io_writew(uint32_t port, uint16_t data);
 void io_writed(uint32_t port, uint32_t data);
 
 void io_handle_mmio_write(uint32_t addr, uint32_t data, int size);
+int io_handle_mmio_write_block(uint32_t addr, const uint8_t* data, uint32_t length);
 uint32_t io_handle_mmio_read(uint32_t addr, int size);
 int io_addr_mmio_read(uint32_t addr);
 
@@ -3,6 +3,7 @@
 
 int net_init(char* netarg);
 int net_send(void* req, int reqlen);
-void net_poll(void (*)(void* data, int len));
+// Hands up to "max" received packets to the callback, and returns how many there were
+int net_poll(void (*cb)(void* data, int len), int max);
 
 #endif
\ No newline at end of file
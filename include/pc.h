@@ -16,7 +16,9 @@ enum {
     DRIVE_TYPE_CDROM
 };
 enum {
-    VIRTIO_9P
+    VIRTIO_9P,
+    VIRTIO_NET,
+    VIRTIO_BLK
 };
 
 struct ne2000_settings {
@@ -30,13 +32,26 @@ struct ne2000_settings {
 #define MAX_VIRTIO_DEVICES 2
 struct virtio_9p_cfg {
     char* path;
+    char* tag; // Name that the guest mounts the share by
     int ro;
 };
 
+struct virtio_net_cfg {
+    uint8_t mac_address[6];
+};
+
+struct virtio_blk_cfg {
+    struct drive_info drive;
+};
+
+#define MAX_AHCI_PORTS 4
+
 struct virtio_cfg {
     int type;
     union {
         struct virtio_9p_cfg fs9p;
+        struct virtio_net_cfg net;
+        struct virtio_blk_cfg blk;
     };
 };
 
@@ -57,6 +72,9 @@ struct pc_settings {
         // Setting pci_vga_enabled to zero will disable PCI VGA accleration. Note that in some cases, it will make screen updating slower due to how the Halfix fetch-decode-execute loop is implemented
         pci_vga_enabled;
 
+    // How many frames are drawn per second of host time. Zero draws a frame every time the CPU stops running.
+    int refresh_rate;
+
     // Current time according to the CMOS clock
     uint64_t current_time;
 
@@ -77,9 +95,21 @@ struct pc_settings {
     struct drive_info floppy_drives[2];
 
     struct cpu_config cpu;
+    // Emulated CPU speed, in millions of instructions per second of emulated time. Zero keeps the default.
+    int cpu_mips;
 
     struct virtio_cfg virtio[MAX_VIRTIO_DEVICES];
 
+    // Disks attached to the AHCI controller, one per port
+    struct drive_info ahci_drives[MAX_AHCI_PORTS];
+
+    // Event tracing (see tracelog.h). Nothing is recorded if no categories are enabled.
+    struct {
+        uint32_t categories; // One bit for each TRACELOG_* category
+        int entries; // Size of the ring buffer, in events
+        char* file;
+    } trace;
+
     int boot_kernel;
 
     // Kernel loading options
@@ -0,0 +1,68 @@
+#ifndef TRACELOG_H
+#define TRACELOG_H
+
+// Binary event tracing for hot paths, where LOG would be far too slow.
+// Each trace point belongs to a category that is turned on from the [trace] section of the configuration file. While a
+// category is off, its trace points cost a single test of tracelog_mask. Events that are on are appended to a ring
+// buffer of fixed-size records, which is written out on exit and can be decoded with tools/tracedump.js.
+
+#include "util.h"
+#include <stdint.h>
+
+enum {
+    TRACELOG_IO, // I/O port accesses
+    TRACELOG_MMIO, // Accesses to memory-mapped devices
+    TRACELOG_IRQ, // Interrupt lines, acknowledgements and EOIs
+    TRACELOG_DISK, // Reads and writes to drive images
+    TRACELOG_TLB, // TLB misses and flushes
+    TRACELOG_FLUSH, // Trace cache flushes
+    TRACELOG_CATEGORIES
+};
+
+// The category of an event is in its upper byte. The numbers end up in trace files, so only ever add to the end of a
+// category, and keep tools/tracedump.js in sync.
+enum {
+    TRACE_IO_READ = TRACELOG_IO << 8, // a=port, b=data
+    TRACE_IO_WRITE, // a=port, b=data
+    TRACE_MMIO_READ = TRACELOG_MMIO << 8, // a=address, b=data
+    TRACE_MMIO_WRITE, // a=address, b=data
+    TRACE_MMIO_WRITE_BLOCK, // a=address, b=length
+    TRACE_IRQ_RAISE = TRACELOG_IRQ << 8, // a=line
+    TRACE_IRQ_LOWER, // a=line
+    TRACE_IRQ_ACK, // a=vector, b=1 if it came from the APIC
+    TRACE_IRQ_EOI, // a=vector, sent to the APIC
+    TRACE_IRQ_PIC_EOI, // a=1 for the slave PIC, b=ISR before the EOI, c=OCW2
+    TRACE_DISK_READ = TRACELOG_DISK << 8, // a/b=low/high half of the offset, c=length
+    TRACE_DISK_WRITE, // a/b=low/high half of the offset, c=length
+    TRACE_DISK_PREFETCH, // a/b=low/high half of the offset, c=length
+    TRACE_TLB_MISS = TRACELOG_TLB << 8, // a=linear address, b=TLB shift (which says what kind of access it was)
+    TRACE_TLB_FLUSH, // a=number of entries in use, b=1 if global entries were kept
+    TRACE_CODE_FLUSH = TRACELOG_FLUSH << 8, // a=bytes of trace cache in use
+};
+
+struct tracelog_record {
+    itick_t time; // get_now() when the event happened
+    uint16_t event;
+    uint16_t size; // Access size in bytes, or 0 if it doesn't apply
+    uint32_t a, b, c;
+};
+
+// One bit for every category that is being recorded
+extern uint32_t tracelog_mask;
+
+void tracelog_init(uint32_t categories, int entries, const char* path);
+void tracelog_add(int event, int size, uint32_t a, uint32_t b, uint32_t c);
+void tracelog_dump(void);
+
+#ifdef LIBCPU
+// The CPU library is built without the rest of the emulator
+#define TRACELOG(event, size, a, b, c) NOP()
+#else
+#define TRACELOG(event, size, a, b, c)             \
+    do {                                           \
+        if (tracelog_mask & (1 << ((event) >> 8))) \
+            tracelog_add(event, size, a, b, c);    \
+    } while (0)
+#endif
+
+#endif
@@ -110,6 +110,34 @@ struct tm* localtime(const time_t* time);
 
 // Functions that mess around with timing
 void add_now(itick_t a);
+void set_ticks_per_second(uint32_t value);
+uint64_t h_get_us(void);
+
+// Keeping emulated time in step with the wall clock
+struct pace_stats {
+    int64_t drift_us; // Emulated time minus wall clock time, as of the last pace_sync. Positive if the guest is ahead
+    int64_t max_ahead_us, max_behind_us;
+    uint64_t slept_us; // Total time spent sleeping so that the guest wouldn't run ahead
+    uint64_t dropped_us; // Total lag that was given up on instead of being caught up
+    uint64_t syncs;
+};
+void pace_init(void);
+int pace_sync(void);
+void pace_get_stats(struct pace_stats* stats);
+
+// Threads
+typedef int (*h_thread_func)(void* arg);
+int h_thread_create(h_thread_func func, void* arg);
+
+// Atomic int loads (acquire) and stores (release), for handing data between threads without locks
+#ifdef _MSC_VER
+#include <intrin.h>
+#define h_atomic_load(ptr) _InterlockedOr((volatile long*)(ptr), 0)
+#define h_atomic_store(ptr, value) _InterlockedExchange((volatile long*)(ptr), (long)(value))
+#else
+#define h_atomic_load(ptr) __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+#define h_atomic_store(ptr, value) __atomic_store_n((ptr), (value), __ATOMIC_RELEASE)
+#endif
 
 // Quick Malloc API
 void qmalloc_init(void);
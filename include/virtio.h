@@ -0,0 +1,92 @@
+#ifndef VIRTIO_H
+#define VIRTIO_H
+
+// Legacy (0.9.5) virtio-over-PCI transport shared by the virtio devices.
+// Each device fills in the first part of a struct virtio_device and registers it. The transport takes care of PCI
+// configuration, the I/O BAR and the split virtqueues in guest RAM, and calls back into the device whenever the guest
+// kicks one of its queues. Descriptor chains are popped with virtq_pop, completed with virtq_push, and once a batch has
+// been completed, virtq_notify interrupts the guest (if it wants to be).
+// https://ozlabs.org/~rusty/virtio-spec/virtio-0.9.5.pdf
+
+#include "devices.h"
+#include <stdint.h>
+
+#define VIRTIO_MAX_QUEUES 4
+// Longest descriptor chain that we'll follow
+#define VIRTQ_MAX_SEGS 256
+
+// Device IDs (subsystem IDs in PCI configuration space)
+#define VIRTIO_ID_NET 1
+#define VIRTIO_ID_BLOCK 2
+#define VIRTIO_ID_9P 9
+
+// Bits in the device status register
+#define VIRTIO_STATUS_ACKNOWLEDGE 1
+#define VIRTIO_STATUS_DRIVER 2
+#define VIRTIO_STATUS_DRIVER_OK 4
+#define VIRTIO_STATUS_FAILED 0x80
+
+struct virtq {
+    int size; // Number of descriptors, or 0 if the queue doesn't exist
+    uint32_t pfn; // Guest page that the ring starts at, or 0 if the guest hasn't set it up
+    uint32_t desc, avail, used; // Physical addresses of the three parts of the ring
+    uint16_t last_avail; // Next entry of the available ring that we haven't popped yet
+};
+
+struct virtq_seg {
+    uint32_t addr, len;
+};
+
+// A descriptor chain, split into the parts that the device reads ("out") and writes ("in")
+struct virtq_elem {
+    int head;
+    int out_count, in_count;
+    uint32_t out_len, in_len;
+    struct virtq_seg out[VIRTQ_MAX_SEGS], in[VIRTQ_MAX_SEGS];
+};
+
+struct virtio_device {
+    // Filled in by the device before calling virtio_register
+    int device_id; // VIRTIO_ID_*
+    uint32_t class_code; // PCI class, subclass and programming interface
+    uint32_t host_features;
+    int queue_count, queue_size;
+    uint8_t* config; // Device-specific configuration, which the guest sees right after the common registers
+    int config_size;
+    void (*notify)(struct virtio_device* dev, int queue); // The guest added buffers to "queue"
+    void (*reset)(struct virtio_device* dev); // Optional
+    // Optional. Saves or restores whatever the device keeps outside of this struct, after the transport's own state.
+    void (*state)(struct virtio_device* dev);
+
+    // Transport state
+    int pci_slot;
+    uint8_t* pci;
+    uint32_t iobase, iosize;
+    uint32_t guest_features;
+    int queue_select;
+    uint8_t status, isr;
+    struct virtq queue[VIRTIO_MAX_QUEUES];
+};
+
+void virtio_register(struct virtio_device* dev);
+
+// Number of descriptor chains that the guest has made available on a queue, but that haven't been popped yet
+int virtq_pending(struct virtio_device* dev, int queue);
+// Take the next available descriptor chain. Returns -1 if there is none, or if it's malformed.
+int virtq_pop(struct virtio_device* dev, int queue, struct virtq_elem* elem);
+// Hand a chain back to the guest, saying that "len" bytes were written to it
+void virtq_push(struct virtio_device* dev, int queue, struct virtq_elem* elem, uint32_t len);
+// Interrupt the guest about the chains pushed so far, unless it has asked not to be
+void virtq_notify(struct virtio_device* dev, int queue);
+
+// Copy between the host and the readable/writable parts of a chain, starting "offset" bytes in. Both return the number
+// of bytes actually copied, which is less than "len" if the chain is too short.
+uint32_t virtq_read(struct virtq_elem* elem, uint32_t offset, void* dst, uint32_t len);
+uint32_t virtq_write(struct virtq_elem* elem, uint32_t offset, const void* src, uint32_t len);
+
+// Devices
+void virtio_net_init(struct virtio_net_cfg* cfg);
+void virtio_9p_init(struct virtio_9p_cfg* cfg);
+void virtio_blk_init(struct virtio_blk_cfg* cfg);
+
+#endif
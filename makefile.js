@@ -103,6 +103,15 @@ for (var i = 0; i < argv.length; i++) {
                 end_flags.splice(end_flags.indexOf('-lSDL2main'), 1);
             end_flags.push('-lgdi32', '-lcomdlg32');
             break;
+        case 'headless':
+            build_type = 'headless';
+            if (end_flags.includes('-lSDL2'))
+                end_flags.splice(end_flags.indexOf('-lSDL2'), 1);
+            if (end_flags.includes('-lSDL2main'))
+                end_flags.splice(end_flags.indexOf('-lSDL2main'), 1);
+            flags.push('-DPREFER_STD');
+            end_flags.push('-lpthread');
+            break;
         case 'mobile':
             build_type = 'mobile';
             flags.push('-DMOBILE_BUILD');
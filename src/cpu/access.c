@@ -12,7 +12,7 @@ int cpu_access_read8(uint32_t addr, uint32_t tag, int shift)
     void* host_ptr = cpu.tlb[addr >> 12] + addr;
     uint32_t phys = PTR_TO_PHYS(host_ptr);
     // Check for MMIO areas
-    if ((phys >= 0xA0000 && phys < 0xC0000) || (phys >= cpu.memory_size)) {
+    if (!(cpu.tlb_attrs[addr >> 12] & TLB_ATTR_RAM_REGION) && ((phys >= 0xA0000 && phys < 0xC0000) || (phys >= cpu.memory_size))) {
         cpu.read_result = io_handle_mmio_read(phys, 0);
         return 0;
     }
@@ -40,7 +40,7 @@ int cpu_access_read16(uint32_t addr, uint32_t tag, int shift)
     }
     void* host_ptr = cpu.tlb[addr >> 12] + addr;
     uint32_t phys = PTR_TO_PHYS(host_ptr);
-    if ((phys >= 0xA0000 && phys < 0xC0000) || (phys >= cpu.memory_size)) {
+    if (!(cpu.tlb_attrs[addr >> 12] & TLB_ATTR_RAM_REGION) && ((phys >= 0xA0000 && phys < 0xC0000) || (phys >= cpu.memory_size))) {
         cpu.read_result = io_handle_mmio_read(phys, 1);
         return 0;
     }
@@ -67,7 +67,7 @@ int cpu_access_read32(uint32_t addr, uint32_t tag, int shift)
     }
     void* host_ptr = cpu.tlb[addr >> 12] + addr;
     uint32_t phys = PTR_TO_PHYS(host_ptr);
-    if ((phys >= 0xA0000 && phys < 0xC0000) || (phys >= cpu.memory_size)) {
+    if (!(cpu.tlb_attrs[addr >> 12] & TLB_ATTR_RAM_REGION) && ((phys >= 0xA0000 && phys < 0xC0000) || (phys >= cpu.memory_size))) {
         cpu.read_result = io_handle_mmio_read(phys, 2);
         return 0;
     }
@@ -85,6 +85,12 @@ int cpu_access_write8(uint32_t addr, uint32_t data, uint32_t tag, int shift)
     void* host_ptr = cpu.tlb[addr >> 12] + addr;
     uint32_t phys = PTR_TO_PHYS(host_ptr);
 
+    // Pages in RAM regions are written directly, but the device has to know about it
+    if (cpu.tlb_attrs[addr >> 12] & TLB_ATTR_RAM_REGION) {
+        cpu_mmu_region_write(addr);
+        *(uint8_t*)host_ptr = data;
+        return 0;
+    }
     // Check for MMIO areas
     if ((phys >= 0xA0000 && phys < 0x100000) || (phys >= cpu.memory_size)) {
         io_handle_mmio_write(phys, data, 0);
@@ -111,6 +117,11 @@ int cpu_access_write16(uint32_t addr, uint32_t data, uint32_t tag, int shift)
     }
     void* host_ptr = cpu.tlb[addr >> 12] + addr;
     uint32_t phys = PTR_TO_PHYS(host_ptr);
+    if (cpu.tlb_attrs[addr >> 12] & TLB_ATTR_RAM_REGION) {
+        cpu_mmu_region_write(addr);
+        *(uint16_t*)host_ptr = data;
+        return 0;
+    }
     if ((phys >= 0xA0000 && phys < 0x100000) || (phys >= cpu.memory_size)) {
         io_handle_mmio_write(phys, data, 1);
         return 0;
@@ -137,6 +148,11 @@ int cpu_access_write32(uint32_t addr, uint32_t data, uint32_t tag, int shift)
     }
     void* host_ptr = cpu.tlb[addr >> 12] + addr;
     uint32_t phys = PTR_TO_PHYS(host_ptr);
+    if (cpu.tlb_attrs[addr >> 12] & TLB_ATTR_RAM_REGION) {
+        cpu_mmu_region_write(addr);
+        *(uint32_t*)host_ptr = data;
+        return 0;
+    }
     if ((phys >= 0xA0000 && phys < 0x100000) || (phys >= cpu.memory_size)) {
         io_handle_mmio_write(phys, data, 2);
         return 0;
@@ -147,6 +163,25 @@ int cpu_access_write32(uint32_t addr, uint32_t data, uint32_t tag, int shift)
     return 0;
 }
 
+// Hands "length" bytes to an MMIO device that takes block writes, like the VGA. The run must not cross a page boundary.
+// Returns 1 if the device took it, 0 if the destination has to be written the normal way, and -1 on a page fault.
+int cpu_access_write_block(uint32_t addr, const uint8_t* data, uint32_t length, int shift)
+{
+    uint32_t tag = cpu.tlb_tags[addr >> 12] >> shift;
+    if (tag & 2) {
+        if (cpu_mmu_translate(addr, shift))
+            return -1;
+        tag = cpu.tlb_tags[addr >> 12] >> shift;
+    }
+    // Ordinary RAM and RAM regions are already fast
+    if (!(tag & 1) || cpu.tlb_attrs[addr >> 12] & TLB_ATTR_RAM_REGION)
+        return 0;
+    uint32_t phys = PTR_TO_PHYS(cpu.tlb[addr >> 12] + addr);
+    if ((phys >= 0xA0000 && phys < 0x100000) || (phys >= cpu.memory_size))
+        return io_handle_mmio_write_block(phys, data, length);
+    return 0;
+}
+
 
 // Verifies an address for read/write
 int cpu_access_verify(uint32_t addr, uint32_t end, int shift)
@@ -334,6 +334,6 @@ void cpu_debug(void)
     h_printf("ESP: %08x EBP: %08x ESI: %08x EDI: %08x\n", cpu.reg32[ESP], cpu.reg32[EBP], cpu.reg32[ESI], cpu.reg32[EDI]);
     h_printf("EFLAGS: %08x\n", cpu_get_eflags());
     h_printf("CS:EIP: %04x:%08x (lin: %08x) Physical EIP: %08x\n", cpu.seg[CS], VIRT_EIP(), LIN_EIP(), cpu.phys_eip);
-    h_printf("Translation mode: %d-bit\n", cpu.state_hash ? 16 : 32);
+    h_printf("Translation mode: %d-bit\n", cpu.state_hash & STATE_CODE16 ? 16 : 32);
     h_printf("Physical RAM base: %p Cycles to run: %d Cycles executed: %d\n", cpu.mem, cpu.cycles_to_run, (uint32_t)cpu_get_cycles());
 }
\ No newline at end of file
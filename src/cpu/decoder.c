@@ -357,6 +357,7 @@ static int parse_modrm(struct decoded_instruction* i, uint8_t modrm, int is8)
             I_SET_INDEX(flags, EZR);
             I_SET_SCALE(flags, 0);
             I_SET_SEG_BASE(flags, seg_prefix[0]);
+            I_SET_EA(flags, I_EA_DISP);
             i->disp32 = rw();
             break;
         case 8:
@@ -418,6 +419,7 @@ static int parse_modrm(struct decoded_instruction* i, uint8_t modrm, int is8)
             I_SET_INDEX(flags, EZR);
             I_SET_SCALE(flags, 0);
             I_SET_SEG_BASE(flags, seg_prefix[addr32_lut[rm]]);
+            I_SET_EA(flags, I_EA_BASE);
             i->disp32 = 0;
             break;
         case 4: // [sib]
@@ -435,8 +437,11 @@ static int parse_modrm(struct decoded_instruction* i, uint8_t modrm, int is8)
             if (index != 4) {
                 I_SET_INDEX(flags, index);
                 I_SET_SCALE(flags, sib >> 6);
-            } else
+                I_SET_EA(flags, I_EA_SIB);
+            } else {
                 I_SET_INDEX(flags, EZR);
+                I_SET_EA(flags, (sib & 7) == 5 ? I_EA_DISP : I_EA_BASE);
+            }
             I_SET_SEG_BASE(flags, seg_prefix[addr32_lut2[base]]);
             break;
         case 5: // [disp32]
@@ -445,6 +450,7 @@ static int parse_modrm(struct decoded_instruction* i, uint8_t modrm, int is8)
             I_SET_INDEX(flags, EZR);
             I_SET_SCALE(flags, 0);
             I_SET_SEG_BASE(flags, seg_prefix[0]);
+            I_SET_EA(flags, I_EA_DISP);
             i->disp32 = rd();
             break;
         case 0x08:
@@ -459,6 +465,7 @@ static int parse_modrm(struct decoded_instruction* i, uint8_t modrm, int is8)
             I_SET_INDEX(flags, EZR);
             I_SET_SCALE(flags, 0);
             I_SET_SEG_BASE(flags, seg_prefix[addr32_lut[rm]]);
+            I_SET_EA(flags, I_EA_BASE);
             i->disp32 = rbs();
             break;
         case 0x0C: // [sib+disp8s]
@@ -469,8 +476,11 @@ static int parse_modrm(struct decoded_instruction* i, uint8_t modrm, int is8)
             if (index != 4) {
                 I_SET_INDEX(flags, index);
                 I_SET_SCALE(flags, sib >> 6);
-            } else
+                I_SET_EA(flags, I_EA_SIB);
+            } else {
                 I_SET_INDEX(flags, EZR);
+                I_SET_EA(flags, I_EA_BASE);
+            }
             I_SET_SEG_BASE(flags, seg_prefix[addr32_lut2[base]]);
             i->disp32 = rbs();
             break;
@@ -486,6 +496,7 @@ static int parse_modrm(struct decoded_instruction* i, uint8_t modrm, int is8)
             I_SET_INDEX(flags, EZR);
             I_SET_SCALE(flags, 0);
             I_SET_SEG_BASE(flags, seg_prefix[addr32_lut[rm]]);
+            I_SET_EA(flags, I_EA_BASE);
             i->disp32 = rd();
             break;
         case 0x14: // [sib+disp32]
@@ -496,8 +507,11 @@ static int parse_modrm(struct decoded_instruction* i, uint8_t modrm, int is8)
             if (index != 4) {
                 I_SET_INDEX(flags, index);
                 I_SET_SCALE(flags, sib >> 6);
-            } else
+                I_SET_EA(flags, I_EA_SIB);
+            } else {
                 I_SET_INDEX(flags, EZR);
+                I_SET_EA(flags, I_EA_BASE);
+            }
             I_SET_SEG_BASE(flags, seg_prefix[addr32_lut2[base]]);
             i->disp32 = rd();
             break;
@@ -519,6 +533,8 @@ static int parse_modrm(struct decoded_instruction* i, uint8_t modrm, int is8)
             break;
         }
     }
+    if (new_modrm < 24 && (state_hash & STATE_FLAT) && (I_SEG_BASE(flags)) < FS)
+        I_SET_EA(flags, I_EA_FLAT);
     return flags;
 }
 
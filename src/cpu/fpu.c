@@ -187,8 +187,10 @@ static void fpu_state(void)
         h_sprintf(name, "fpu.st[%d].exponent", i);
         state_field(obj, 2, name, &fpu.st[i].exp);
     }
-    if (state_is_reading())
+    if (state_is_reading()) {
         fpu_set_control_word(fpu.control_word);
+        fpu.clean = 0;
+    }
 #endif
 }
 
@@ -371,6 +373,7 @@ static void fninit(void)
     fpu.fpu_eip = 0;
     fpu.fpu_cs = 0; // Not in the docs, but assuming that it's the case
     fpu.fpu_opcode = 0;
+    fpu.clean = 0;
 }
 
 static inline int fpu_nm_check(void)
@@ -563,8 +566,99 @@ static int fpu_fcomi(floatx80 op1, floatx80 op2, int unordered)
     return 0;
 }
 
+// Context areas (FSTENV/FLDENV, FSAVE/FRSTOR, FXSAVE/FXRSTOR) are assembled in a host buffer and then moved to or
+// from guest memory in one go. The area is translated once, and if every page it touches is ordinary RAM, it is
+// copied with host memory operations. MMIO and pages holding translated code go through the usual byte path.
+// Fields are stored a byte at a time, in the guest's (little-endian) byte order.
+static inline uint16_t fpu_area_get16(void* area, int offs)
+{
+    uint8_t* ptr = (uint8_t*)area + offs;
+    return ptr[0] | ptr[1] << 8;
+}
+static inline uint32_t fpu_area_get32(void* area, int offs)
+{
+    return fpu_area_get16(area, offs) | (uint32_t)fpu_area_get16(area, offs + 2) << 16;
+}
+static inline void fpu_area_set16(void* area, int offs, uint16_t data)
+{
+    uint8_t* ptr = (uint8_t*)area + offs;
+    ptr[0] = data;
+    ptr[1] = data >> 8;
+}
+static inline void fpu_area_set32(void* area, int offs, uint32_t data)
+{
+    fpu_area_set16(area, offs, data);
+    fpu_area_set16(area, offs + 2, data >> 16);
+}
+
+static inline int fpu_area_is_ram(uint32_t addr, int shift)
+{
+    return (cpu.tlb_tags[addr >> 12] >> shift & 3) == 0;
+}
+static int fpu_area_write(uint32_t linaddr, void* area, int length)
+{
+    uint8_t* src = area;
+    int shift = cpu.tlb_shift_write;
+    uint32_t end = linaddr + length - 1;
+    if (cpu_access_verify(linaddr, end, shift))
+        return 1;
+    if (fpu_area_is_ram(linaddr, shift) && fpu_area_is_ram(end, shift)) {
+        int first = 0x1000 - (linaddr & 0xFFF);
+        if (first > length)
+            first = length;
+        h_memcpy(cpu.tlb[linaddr >> 12] + linaddr, src, first);
+        if (first != length)
+            h_memcpy(cpu.tlb[end >> 12] + linaddr + first, src + first, length - first);
+        return 0;
+    }
+    for (int i = 0; i < length; i++)
+        cpu_write8(linaddr + i, src[i], shift);
+    return 0;
+}
+static int fpu_area_read(uint32_t linaddr, void* area, int length)
+{
+    uint8_t* dest = area;
+    int shift = cpu.tlb_shift_read;
+    uint32_t end = linaddr + length - 1;
+    if (cpu_access_verify(linaddr, end, shift))
+        return 1;
+    if (fpu_area_is_ram(linaddr, shift) && fpu_area_is_ram(end, shift)) {
+        int first = 0x1000 - (linaddr & 0xFFF);
+        if (first > length)
+            first = length;
+        h_memcpy(dest, cpu.tlb[linaddr >> 12] + linaddr, first);
+        if (first != length)
+            h_memcpy(dest + first, cpu.tlb[end >> 12] + linaddr + first, length - first);
+        return 0;
+    }
+    for (int i = 0; i < length; i++)
+        cpu_read8(linaddr + i, dest[i], shift);
+    return 0;
+}
+
+// 80-bit registers are stored as four 16-bit pieces of the mantissa followed by the exponent
+static void fpu_area_store_f80(void* area, floatx80* data)
+{
+    uint16_t exponent;
+    uint64_t mantissa;
+    floatx80_unpack(data, exponent, mantissa);
+    for (int i = 0; i < 4; i++)
+        fpu_area_set16(area, i << 1, (uint16_t)(mantissa >> (i << 4)));
+    fpu_area_set16(area, 8, exponent);
+}
+static void fpu_area_load_f80(void* area, floatx80* data)
+{
+    uint64_t mantissa = 0;
+    for (int i = 0; i < 4; i++)
+        mantissa |= (uint64_t)fpu_area_get16(area, i << 1) << (i << 4);
+    floatx80_repack(data, fpu_area_get16(area, 8), mantissa);
+}
+
+// Size of the environment image, in bytes
+#define FPU_ENV_SIZE(code16) (14 << !(code16))
+
 //void fpu_debug(void);
-static int fstenv(uint32_t linaddr, int code16)
+static void fstenv(void* area, int code16)
 {
     //fpu_debug();
     for (int i = 0; i < 8; i++) {
@@ -573,109 +667,99 @@ static int fstenv(uint32_t linaddr, int code16)
     }
     // https://www.intel.com/content/dam/www/public/us/en/documents/manuals/64-ia-32-architectures-software-developer-vol-1-manual.pdf
     // page 203
-    int x = cpu.tlb_shift_write;
-    //fpu_debug();
-    //__asm__("int3");
     if (!code16) {
-        cpu_write32(linaddr, 0xFFFF0000 | fpu.control_word, x);
-        cpu_write32(linaddr + 4, 0xFFFF0000 | fpu_get_status_word(), x);
-        cpu_write32(linaddr + 8, 0xFFFF0000 | fpu.tag_word, x);
+        fpu_area_set32(area, 0, 0xFFFF0000 | fpu.control_word);
+        fpu_area_set32(area, 4, 0xFFFF0000 | fpu_get_status_word());
+        fpu_area_set32(area, 8, 0xFFFF0000 | fpu.tag_word);
         if (cpu.cr[0] & CR0_PE) {
-            cpu_write32(linaddr + 12, fpu.fpu_eip, x);
-            cpu_write32(linaddr + 16, fpu.fpu_cs | (fpu.fpu_opcode << 16), x);
-            cpu_write32(linaddr + 20, fpu.fpu_data_ptr, x);
-            cpu_write32(linaddr + 24, 0xFFFF0000 | fpu.fpu_data_seg, x);
+            fpu_area_set32(area, 12, fpu.fpu_eip);
+            fpu_area_set32(area, 16, fpu.fpu_cs | (fpu.fpu_opcode << 16));
+            fpu_area_set32(area, 20, fpu.fpu_data_ptr);
+            fpu_area_set32(area, 24, 0xFFFF0000 | fpu.fpu_data_seg);
         } else {
             uint32_t linear_fpu_eip = fpu.fpu_eip + (fpu.fpu_cs << 4);
             uint32_t linear_fpu_data = fpu.fpu_data_ptr + (fpu.fpu_data_seg << 4);
-            cpu_write32(linaddr + 12, linear_fpu_eip | 0xFFFF0000, x);
-            cpu_write32(linaddr + 16, (fpu.fpu_opcode & 0x7FF) | (linear_fpu_eip >> 4 & 0x0FFFF000), x);
-            cpu_write32(linaddr + 20, linear_fpu_data | 0xFFFF0000, x);
-            cpu_write32(linaddr + 24, linear_fpu_data >> 4 & 0x0FFFF000, x);
+            fpu_area_set32(area, 12, linear_fpu_eip | 0xFFFF0000);
+            fpu_area_set32(area, 16, (fpu.fpu_opcode & 0x7FF) | (linear_fpu_eip >> 4 & 0x0FFFF000));
+            fpu_area_set32(area, 20, linear_fpu_data | 0xFFFF0000);
+            fpu_area_set32(area, 24, linear_fpu_data >> 4 & 0x0FFFF000);
         }
     } else {
-        cpu_write16(linaddr, fpu.control_word, x);
-        cpu_write16(linaddr + 2, fpu_get_status_word(), x);
-        cpu_write16(linaddr + 4, fpu.tag_word, x);
+        fpu_area_set16(area, 0, fpu.control_word);
+        fpu_area_set16(area, 2, fpu_get_status_word());
+        fpu_area_set16(area, 4, fpu.tag_word);
         if (cpu.cr[0] & CR0_PE) {
-            cpu_write16(linaddr + 6, fpu.fpu_eip, x);
-            cpu_write16(linaddr + 8, fpu.fpu_cs, x);
-            cpu_write16(linaddr + 10, fpu.fpu_data_ptr, x);
-            cpu_write16(linaddr + 12, fpu.fpu_data_seg, x);
+            fpu_area_set16(area, 6, fpu.fpu_eip);
+            fpu_area_set16(area, 8, fpu.fpu_cs);
+            fpu_area_set16(area, 10, fpu.fpu_data_ptr);
+            fpu_area_set16(area, 12, fpu.fpu_data_seg);
         } else {
             uint32_t linear_fpu_eip = fpu.fpu_eip + (fpu.fpu_cs << 4);
             uint32_t linear_fpu_data = fpu.fpu_data_ptr + (fpu.fpu_data_seg << 4);
-            cpu_write16(linaddr + 6, linear_fpu_eip, x);
-            cpu_write16(linaddr + 8, (fpu.fpu_opcode & 0x7FF) | (linear_fpu_eip >> 4 & 0xF000), x);
-            cpu_write16(linaddr + 10, linear_fpu_data, x);
-            cpu_write16(linaddr + 12, linear_fpu_data >> 4 & 0xF000, x);
+            fpu_area_set16(area, 6, linear_fpu_eip);
+            fpu_area_set16(area, 8, (fpu.fpu_opcode & 0x7FF) | (linear_fpu_eip >> 4 & 0xF000));
+            fpu_area_set16(area, 10, linear_fpu_data);
+            fpu_area_set16(area, 12, linear_fpu_data >> 4 & 0xF000);
         }
     }
-    return 0;
 }
-static int fldenv(uint32_t linaddr, int code16)
+static void fldenv(void* area, int code16)
 {
     uint32_t temp32;
     if (!code16) {
-        cpu_read32(linaddr, temp32, cpu.tlb_shift_read);
-        fpu_set_control_word(temp32);
+        fpu_set_control_word(fpu_area_get32(area, 0));
 
-        cpu_read16(linaddr + 4, fpu.status_word, cpu.tlb_shift_read);
+        fpu.status_word = fpu_area_get16(area, 4);
         fpu.ftop = fpu.status_word >> 11 & 7;
         fpu.status_word &= ~(7 << 11); // Clear FTOP.
 
-        cpu_read16(linaddr + 8, fpu.tag_word, cpu.tlb_shift_read);
+        fpu.tag_word = fpu_area_get16(area, 8);
         if (cpu.cr[0] & CR0_PE) {
-            cpu_read32(linaddr + 12, fpu.fpu_eip, cpu.tlb_shift_read);
+            fpu.fpu_eip = fpu_area_get32(area, 12);
 
-            cpu_read32(linaddr + 16, temp32, cpu.tlb_shift_read);
+            temp32 = fpu_area_get32(area, 16);
             fpu.fpu_cs = temp32 & 0xFFFF;
             fpu.fpu_opcode = temp32 >> 16 & 0x7FF;
 
-            cpu_read32(linaddr + 20, fpu.fpu_data_ptr, cpu.tlb_shift_read);
-            cpu_read32(linaddr + 24, fpu.fpu_data_seg, cpu.tlb_shift_read);
+            fpu.fpu_data_ptr = fpu_area_get32(area, 20);
+            fpu.fpu_data_seg = fpu_area_get32(area, 24);
         } else {
             fpu.fpu_cs = 0;
-            fpu.fpu_eip = 0;
-            cpu_read16(linaddr + 12, fpu.fpu_eip, cpu.tlb_shift_read);
+            fpu.fpu_eip = fpu_area_get16(area, 12);
 
-            cpu_read32(linaddr + 16, temp32, cpu.tlb_shift_read);
+            temp32 = fpu_area_get32(area, 16);
             fpu.fpu_opcode = temp32 & 0x7FF;
             fpu.fpu_eip |= temp32 << 4 & 0xFFFF0000;
 
-            cpu_read32(linaddr + 20, temp32, cpu.tlb_shift_read);
-            fpu.fpu_data_ptr = temp32 & 0xFFFF;
+            fpu.fpu_data_ptr = fpu_area_get32(area, 20) & 0xFFFF;
 
-            cpu_read32(linaddr + 24, temp32, cpu.tlb_shift_read);
+            temp32 = fpu_area_get32(area, 24);
             fpu.fpu_eip |= temp32 << 4 & 0xFFFF0000;
         }
     } else {
-        cpu_read16(linaddr, temp32, cpu.tlb_shift_read);
-        fpu_set_control_word(temp32);
+        fpu_set_control_word(fpu_area_get16(area, 0));
 
-        cpu_read16(linaddr + 2, fpu.status_word, cpu.tlb_shift_read);
+        fpu.status_word = fpu_area_get16(area, 2);
         fpu.ftop = fpu.status_word >> 11 & 7;
         fpu.status_word &= ~(7 << 11); // Clear FTOP.
 
-        cpu_read16(linaddr + 4, fpu.tag_word, cpu.tlb_shift_read);
+        fpu.tag_word = fpu_area_get16(area, 4);
         if (cpu.cr[0] & CR0_PE) {
-            cpu_read16(linaddr + 6, fpu.fpu_eip, cpu.tlb_shift_read);
-            cpu_read16(linaddr + 8, fpu.fpu_cs, cpu.tlb_shift_read);
-            cpu_read16(linaddr + 10, fpu.fpu_data_ptr, cpu.tlb_shift_read);
-            cpu_read16(linaddr + 12, fpu.fpu_data_seg, cpu.tlb_shift_read);
+            fpu.fpu_eip = fpu_area_get16(area, 6);
+            fpu.fpu_cs = fpu_area_get16(area, 8);
+            fpu.fpu_data_ptr = fpu_area_get16(area, 10);
+            fpu.fpu_data_seg = fpu_area_get16(area, 12);
         } else {
             fpu.fpu_cs = 0;
-            fpu.fpu_eip = 0;
-            cpu_read16(linaddr + 6, fpu.fpu_eip, cpu.tlb_shift_read);
+            fpu.fpu_eip = fpu_area_get16(area, 6);
 
-            cpu_read16(linaddr + 8, temp32, cpu.tlb_shift_read);
+            temp32 = fpu_area_get16(area, 8);
             fpu.fpu_opcode = temp32 & 0x7FF;
             fpu.fpu_eip |= temp32 << 4 & 0xF0000;
 
-            cpu_read16(linaddr + 10, temp32, cpu.tlb_shift_read);
-            fpu.fpu_data_ptr = temp32 & 0xFFFF;
+            fpu.fpu_data_ptr = fpu_area_get16(area, 10);
 
-            cpu_read32(linaddr + 12, temp32, cpu.tlb_shift_read);
+            temp32 = fpu_area_get16(area, 12);
             fpu.fpu_eip |= temp32 << 4 & 0xF0000;
         }
     }
@@ -683,7 +767,6 @@ static int fldenv(uint32_t linaddr, int code16)
         fpu.status_word |= 0x8080;
     else
         fpu.status_word &= ~0x8080;
-    return 0;
 }
 
 static void fpu_watchpoint(void)
@@ -716,6 +799,7 @@ int fpu_reg_op(struct decoded_instruction* i, uint32_t flags)
     floatx80 temp80;
     if (fpu_nm_check())
         return 1;
+    fpu.clean = 0;
 #ifdef INSTRUMENT
     cpu_instrument_pre_fpu();
 #endif
@@ -1281,6 +1365,7 @@ int fpu_mem_op(struct decoded_instruction* i, uint32_t virtaddr, uint32_t seg)
 
     if (fpu_nm_check())
         return 1;
+    fpu.clean = 0;
 
 #ifdef INSTRUMENT
     cpu_instrument_pre_fpu();
@@ -1438,8 +1523,10 @@ int fpu_mem_op(struct decoded_instruction* i, uint32_t virtaddr, uint32_t seg)
     }
     case OP(0xD9, 6): { // FSTENV
         int is16 = I_OP2(i->flags);
-        if (fstenv(linaddr, is16))
-            FPU_ABORT();
+        uint8_t area[28];
+        fstenv(area, is16);
+        if (fpu_area_write(linaddr, area, FPU_ENV_SIZE(is16)))
+            FPU_EXCEP();
         break;
     }
     case OP(0xD9, 7): // FSTCW - Store control word to memory
@@ -1501,8 +1588,10 @@ int fpu_mem_op(struct decoded_instruction* i, uint32_t virtaddr, uint32_t seg)
     }
     case OP(0xD9, 4): { // FLDENV - Load floating point environment from memory
         int is16 = I_OP2(i->flags);
-        if (fldenv(linaddr, is16))
-            FPU_ABORT();
+        uint8_t area[28];
+        if (fpu_area_read(linaddr, area, FPU_ENV_SIZE(is16)))
+            FPU_EXCEP();
+        fldenv(area, is16);
         break;
     }
     case OP(0xDB, 5): { // FLD - Load floating point register from memory
@@ -1547,27 +1636,27 @@ int fpu_mem_op(struct decoded_instruction* i, uint32_t virtaddr, uint32_t seg)
         break;
     }
     case OP(0xDD, 4): { // FRSTOR -- Load FPU context
-        int is16 = I_OP2(i->flags);
-        if (fldenv(linaddr, is16))
-            FPU_ABORT();
-        int offset = 14 << !is16;
+        int is16 = I_OP2(i->flags), offset = FPU_ENV_SIZE(is16);
+        uint8_t area[108];
+        if (fpu_area_read(linaddr, area, offset + 80))
+            FPU_EXCEP();
+        fldenv(area, is16);
         for (int i = 0; i < 8; i++) {
-            if (fpu_read_f80(offset + linaddr, &fpu.st[(fpu.ftop + i) & 7]))
-                FPU_EXCEP();
+            fpu_area_load_f80(area + offset, &fpu.st[(fpu.ftop + i) & 7]);
             offset += 10;
         }
         break;
     }
     case OP(0xDD, 6): { // FSAVE - Save FPU environment to memory
-        int is16 = I_OP2(i->flags);
-        if (fstenv(linaddr, is16))
-            FPU_ABORT();
-        int offset = 14 << !is16;
+        int is16 = I_OP2(i->flags), offset = FPU_ENV_SIZE(is16);
+        uint8_t area[108];
+        fstenv(area, is16);
         for (int i = 0; i < 8; i++) {
-            if (fpu_store_f80(offset + linaddr, &fpu.st[(fpu.ftop + i) & 7]))
-                FPU_EXCEP();
+            fpu_area_store_f80(area + offset, &fpu.st[(fpu.ftop + i) & 7]);
             offset += 10;
         }
+        if (fpu_area_write(linaddr, area, offset))
+            FPU_EXCEP();
         fninit();
         break;
     }
@@ -1685,104 +1774,89 @@ int fpu_mem_op(struct decoded_instruction* i, uint32_t virtaddr, uint32_t seg)
     return 0;
 }
 
+// The x87 half of the most recent FXSAVE image (bytes 0-159, minus MXCSR). While fpu.clean is set, nothing that
+// feeds into it has changed, so a kernel that saves the context of a thread that never touched the FPU only pays
+// for the copy to guest memory.
+static uint8_t fxsave_image[160];
+
 // FXSAVE -- save floating point state
 int fpu_fxsave(uint32_t linaddr)
 {
+    uint8_t area[288];
     if (linaddr & 15)
         EXCEPTION_GP(0);
     if (fpu_nm_check())
         return 1;
 
-    if (cpu_access_verify(linaddr, linaddr + 288 - 1, cpu.tlb_shift_write))
-        return 1;
-    cpu_write16(linaddr + 0, fpu.control_word, cpu.tlb_shift_write);
-    cpu_write16(linaddr + 2, fpu_get_status_word(), cpu.tlb_shift_write);
-    // "Abridge" tag word
-    uint8_t tag = 0;
-    for (int i = 0; i < 8; i++)
-        if ((fpu.tag_word >> (i * 2) & 3) != FPU_TAG_EMPTY)
-            tag |= 1 << i;
-
-    // Some fields are less than 16 or 32 bits wide, but we write them anyways.
-    // They are filled with zeros.
-    cpu_write16(linaddr + 4, tag, cpu.tlb_shift_write);
-    cpu_write16(linaddr + 6, fpu.fpu_opcode, cpu.tlb_shift_write);
-    cpu_write32(linaddr + 8, fpu.fpu_eip, cpu.tlb_shift_write);
-    cpu_write32(linaddr + 12, fpu.fpu_cs, cpu.tlb_shift_write);
-    cpu_write32(linaddr + 16, fpu.fpu_data_ptr, cpu.tlb_shift_write);
-    cpu_write32(linaddr + 20, fpu.fpu_data_seg, cpu.tlb_shift_write);
-    cpu_write32(linaddr + 24, cpu.mxcsr, cpu.tlb_shift_write);
-    cpu_write32(linaddr + 28, MXCSR_MASK, cpu.tlb_shift_write);
-    uint32_t tempaddr = linaddr + 32;
-    for (int i = 0; i < 8; i++) {
-        fpu_store_f80(tempaddr, fpu_get_st_ptr(i));
-        // Fill other bytes with zeros
-        cpu_write16(tempaddr + 10, 0, cpu.tlb_shift_write);
-        cpu_write32(tempaddr + 12, 0, cpu.tlb_shift_write);
-        tempaddr += 16;
+    if (!fpu.clean) {
+        fpu_area_set16(fxsave_image, 0, fpu.control_word);
+        fpu_area_set16(fxsave_image, 2, fpu_get_status_word());
+        // "Abridge" tag word
+        uint8_t tag = 0;
+        for (int i = 0; i < 8; i++)
+            if ((fpu.tag_word >> (i * 2) & 3) != FPU_TAG_EMPTY)
+                tag |= 1 << i;
+
+        // Some fields are less than 16 or 32 bits wide, but we write them anyways.
+        // They are filled with zeros.
+        fpu_area_set16(fxsave_image, 4, tag);
+        fpu_area_set16(fxsave_image, 6, fpu.fpu_opcode);
+        fpu_area_set32(fxsave_image, 8, fpu.fpu_eip);
+        fpu_area_set32(fxsave_image, 12, fpu.fpu_cs);
+        fpu_area_set32(fxsave_image, 16, fpu.fpu_data_ptr);
+        fpu_area_set32(fxsave_image, 20, fpu.fpu_data_seg);
+        for (int i = 0; i < 8; i++) {
+            uint8_t* reg = fxsave_image + 32 + (i << 4);
+            fpu_area_store_f80(reg, fpu_get_st_ptr(i));
+            // Fill other bytes with zeros
+            fpu_area_set16(reg, 10, 0);
+            fpu_area_set32(reg, 12, 0);
+        }
+        fpu.clean = 1;
     }
+    h_memcpy(area, fxsave_image, 160);
+    fpu_area_set32(area, 24, cpu.mxcsr);
+    fpu_area_set32(area, 28, MXCSR_MASK);
 
     // TODO: Find out what happens on real hardware when OSFXSR isn't set.
-    tempaddr = linaddr + 160;
-    for (int i = 0; i < 8; i++) {
-        cpu_write32(tempaddr, cpu.xmm32[(i * 4)], cpu.tlb_shift_write);
-        cpu_write32(tempaddr + 4, cpu.xmm32[(i * 4) + 1], cpu.tlb_shift_write);
-        cpu_write32(tempaddr + 8, cpu.xmm32[(i * 4) + 2], cpu.tlb_shift_write);
-        cpu_write32(tempaddr + 12, cpu.xmm32[(i * 4) + 3], cpu.tlb_shift_write);
-        tempaddr += 16;
-    }
-    return 0;
+    h_memcpy(area + 160, cpu.xmm32, 128);
+    return fpu_area_write(linaddr, area, 288);
 }
 // FXRSTOR -- restore floating point state
 int fpu_fxrstor(uint32_t linaddr)
 {
+    uint8_t area[288];
     if (linaddr & 15)
         EXCEPTION_GP(0);
     if (fpu_nm_check())
         return 1;
-    if (cpu_access_verify(linaddr, linaddr + 288 - 1, cpu.tlb_shift_read))
+    if (fpu_area_read(linaddr, area, 288))
         return 1;
 
-    uint32_t mxcsr;
-    cpu_read32(linaddr + 24, mxcsr, cpu.tlb_shift_read);
+    uint32_t mxcsr = fpu_area_get32(area, 24);
     if (mxcsr & ~MXCSR_MASK)
         EXCEPTION_GP(0);
     cpu.mxcsr = mxcsr;
     cpu_update_mxcsr();
 
-    uint32_t temp = 0;
-    cpu_read16(linaddr + 0, temp, cpu.tlb_shift_read);
-    fpu_set_control_word(temp);
-    cpu_read16(linaddr + 2, temp, cpu.tlb_shift_read);
-    fpu.status_word = temp;
+    fpu.clean = 0;
+    fpu_set_control_word(fpu_area_get16(area, 0));
+    fpu.status_word = fpu_area_get16(area, 2);
     fpu.ftop = fpu.status_word >> 11 & 7;
     fpu.status_word &= ~(7 << 11);
 
-    uint8_t small_tag_word;
-    cpu_read8(linaddr + 4, small_tag_word, cpu.tlb_shift_read);
+    uint8_t small_tag_word = fpu_area_get16(area, 4) & 0xFF;
 
-    cpu_read16(linaddr + 6, fpu.fpu_opcode, cpu.tlb_shift_read);
-    fpu.fpu_opcode &= 0x7FF;
-    cpu_read32(linaddr + 8, fpu.fpu_eip, cpu.tlb_shift_read);
-    cpu_read16(linaddr + 12, fpu.fpu_cs, cpu.tlb_shift_read); // Note: 16-bit with 4 byte gap
-    cpu_read32(linaddr + 16, fpu.fpu_data_ptr, cpu.tlb_shift_read);
-    cpu_read16(linaddr + 20, fpu.fpu_data_seg, cpu.tlb_shift_read); // Note: 16-bit with 4 byte gap
-    uint32_t tempaddr = linaddr + 32;
-    for (int i = 0; i < 8; i++) {
-        if (fpu_read_f80(tempaddr, fpu_get_st_ptr(i)))
-            return 1;
-        tempaddr += 16;
-    }
+    fpu.fpu_opcode = fpu_area_get16(area, 6) & 0x7FF;
+    fpu.fpu_eip = fpu_area_get32(area, 8);
+    fpu.fpu_cs = fpu_area_get16(area, 12); // Note: 16-bit with 4 byte gap
+    fpu.fpu_data_ptr = fpu_area_get32(area, 16);
+    fpu.fpu_data_seg = fpu_area_get16(area, 20); // Note: 16-bit with 4 byte gap
+    for (int i = 0; i < 8; i++)
+        fpu_area_load_f80(area + 32 + (i << 4), fpu_get_st_ptr(i));
 
     // TODO: Find out what happens on real hardware when OSFXSR isn't set.
-    tempaddr = linaddr + 160;
-    for (int i = 0; i < 8; i++) {
-        cpu_read32(tempaddr, cpu.xmm32[(i * 4)], cpu.tlb_shift_read);
-        cpu_read32(tempaddr + 4, cpu.xmm32[(i * 4) + 1], cpu.tlb_shift_read);
-        cpu_read32(tempaddr + 8, cpu.xmm32[(i * 4) + 2], cpu.tlb_shift_read);
-        cpu_read32(tempaddr + 12, cpu.xmm32[(i * 4) + 3], cpu.tlb_shift_read);
-        tempaddr += 16;
-    }
+    h_memcpy(cpu.xmm32, area + 160, 128);
 
     // Now find out tag word
     uint16_t tag_word = 0;
@@ -89,6 +89,14 @@ void io_handle_mmio_write(uint32_t addr, uint32_t data, int size)
     UNUSED(addr | data | size);
 }
 
+// Same as above, but for a whole span of bytes from REP MOVS/STOS. Return 0 to have it written one element at a time instead.
+int io_handle_mmio_write_block(uint32_t addr, const uint8_t* data, uint32_t length)
+{
+    UNUSED(addr | length);
+    UNUSED(data);
+    return 0;
+}
+
 // Remember to truncate this value before returning it. So if the emulator requests size=1 (a word), don't give it 0xFFFF1234, for instance.
 uint32_t io_handle_mmio_read(uint32_t addr, int size)
 {
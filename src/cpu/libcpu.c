@@ -169,6 +169,13 @@ void io_handle_mmio_write(uint32_t addr, uint32_t data, int size)
 {
     mmio_write(addr, data, size);
 }
+// The host only gets MMIO one access at a time
+int io_handle_mmio_write_block(uint32_t addr, const uint8_t* data, uint32_t length)
+{
+    UNUSED(addr | length);
+    UNUSED(data);
+    return 0;
+}
 // handle io read
 EXPORT
 uint8_t io_readb(uint32_t addr)
@@ -1,7 +1,9 @@
 // Handles memory mapping
 #include "cpu/cpu.h"
 #include "cpu/instrument.h"
+#include "cpuapi.h"
 #include "mmio.h"
+#include "tracelog.h"
 
 #define EXCEPTION_HANDLER return 1
 
@@ -15,6 +17,7 @@ void* get_lin_ram_ptr(uint32_t addr, int flags, int* fault);
 
 void cpu_mmu_tlb_flush(void)
 {
+    TRACELOG(TRACE_TLB_FLUSH, 0, cpu.tlb_entry_count, 0, 0);
     for (unsigned int i = 0; i < cpu.tlb_entry_count; i++) {
         uint32_t entry = cpu.tlb_entry_indexes[i];
         if (entry == (uint32_t)-1)
@@ -28,6 +31,7 @@ void cpu_mmu_tlb_flush(void)
 }
 void cpu_mmu_tlb_flush_nonglobal(void)
 {
+    TRACELOG(TRACE_TLB_FLUSH, 0, cpu.tlb_entry_count, 1, 0);
     for (unsigned int i = 0; i < cpu.tlb_entry_count; i++) {
         uint32_t entry = cpu.tlb_entry_indexes[i];
         if (entry == (uint32_t)-1)
@@ -42,6 +46,107 @@ void cpu_mmu_tlb_flush_nonglobal(void)
     cpu.tlb_entry_count = cpu.tlb_entry_count; // We may still have global entries.
 }
 
+// Physical ranges outside of RAM that are backed by host memory instead of MMIO handlers, like the VBE linear
+// framebuffer. Reads go straight to the host pointer. Writes do too, except for the first write to each page after the
+// region was protected, which takes the slow path so that the device can be told which pages changed.
+#define MAX_RAM_REGIONS 4
+struct ram_region {
+    uint32_t base, size;
+    uint8_t* ptr; // NULL if the region is disabled
+    cpu_region_dirty dirty;
+    uint32_t* writable; // One bit per page
+    int has_writable;
+};
+static struct ram_region ram_regions[MAX_RAM_REGIONS];
+static int ram_region_count = 0;
+
+static struct ram_region* cpu_mmu_find_region(uint32_t phys)
+{
+    for (int i = 0; i < ram_region_count; i++) {
+        struct ram_region* r = &ram_regions[i];
+        if (r->ptr && phys - r->base < r->size)
+            return r;
+    }
+    return NULL;
+}
+
+// Removes all TLB entries that point into a RAM region
+static void cpu_mmu_invalidate_regions(void)
+{
+    for (unsigned int i = 0; i < cpu.tlb_entry_count; i++) {
+        uint32_t entry = cpu.tlb_entry_indexes[i];
+        if (entry != (uint32_t)-1 && cpu.tlb_attrs[entry] & TLB_ATTR_RAM_REGION)
+            cpu_mmu_tlb_invalidate(entry << 12);
+    }
+}
+
+int cpu_add_ram_region(uint32_t base, uint32_t size, void* ptr, cpu_region_dirty dirty)
+{
+    if (ram_region_count == MAX_RAM_REGIONS || (base | size) & 0xFFF)
+        return -1;
+    struct ram_region* r = &ram_regions[ram_region_count];
+    r->base = base;
+    r->size = size;
+    r->ptr = ptr;
+    r->dirty = dirty;
+    r->writable = h_calloc(((size >> 12) + 31) >> 5, 4);
+    r->has_writable = 0;
+    cpu_mmu_tlb_flush();
+    return ram_region_count++;
+}
+
+void cpu_set_ram_region(int id, void* ptr)
+{
+    if (ram_regions[id].ptr == ptr)
+        return;
+    ram_regions[id].ptr = ptr;
+    cpu_protect_ram_region(id);
+    // MMIO pages in this range have to be retranslated too
+    cpu_mmu_tlb_flush();
+}
+
+void cpu_protect_ram_region(int id)
+{
+    struct ram_region* r = &ram_regions[id];
+    if (!r->has_writable)
+        return;
+    h_memset(r->writable, 0, (((r->size >> 12) + 31) >> 5) * 4);
+    r->has_writable = 0;
+    cpu_mmu_invalidate_regions();
+}
+
+// Called by the slow path when "lin", which maps to a RAM region, is written to. The page is reported to the device and
+// becomes writable until the region is protected again.
+void cpu_mmu_region_write(uint32_t lin)
+{
+    uint8_t* ptr = cpu.tlb[lin >> 12] + lin;
+    for (int i = 0; i < ram_region_count; i++) {
+        struct ram_region* r = &ram_regions[i];
+        if (!r->ptr || ptr < r->ptr || (uint32_t)(ptr - r->ptr) >= r->size)
+            continue;
+        uint32_t offset = (uint32_t)(ptr - r->ptr), page = offset >> 12;
+        if (!(r->writable[page >> 5] >> (page & 31) & 1)) {
+            r->writable[page >> 5] |= 1 << (page & 31);
+            r->has_writable = 1;
+            r->dirty(offset);
+        }
+        cpu_mmu_tlb_invalidate(lin);
+        return;
+    }
+}
+
+// Returns the physical address of a translated linear address inside a RAM region
+uint32_t cpu_mmu_region_phys(uint32_t lin)
+{
+    uint8_t* ptr = cpu.tlb[lin >> 12] + lin;
+    for (int i = 0; i < ram_region_count; i++) {
+        struct ram_region* r = &ram_regions[i];
+        if (r->ptr && ptr >= r->ptr && (uint32_t)(ptr - r->ptr) < r->size)
+            return r->base + (uint32_t)(ptr - r->ptr);
+    }
+    return -1;
+}
+
 static void cpu_set_tlb_entry(uint32_t lin, uint32_t phys, void* ptr, int user, int write, int global, int nx)
 {
     // Mask out the A20 gate line here so that we don't have to do it after every access
@@ -56,9 +161,19 @@ static void cpu_set_tlb_entry(uint32_t lin, uint32_t phys, void* ptr, int user,
         tag = (phys & 0x40000) == 0;
         tag_write = 1;
     }
+    struct ram_region* region = NULL;
     if (phys >= cpu.memory_size) {
-        tag = 1;
-        tag_write = 1;
+        region = cpu_mmu_find_region(phys);
+        if (region) {
+            uint32_t page = (phys - region->base) >> 12;
+            tag = 0;
+            tag_write = !(region->writable[page >> 5] >> (page & 31) & 1);
+            if (!ptr)
+                ptr = region->ptr + (phys - region->base);
+        } else {
+            tag = 1;
+            tag_write = 1;
+        }
     }
 
     if (cpu_smc_page_has_code(phys)) {
@@ -80,7 +195,7 @@ static void cpu_set_tlb_entry(uint32_t lin, uint32_t phys, void* ptr, int user,
 
     uint32_t entry = lin >> 12;
     cpu.tlb_entry_indexes[cpu.tlb_entry_count++] = entry;
-    cpu.tlb_attrs[entry] = (nx ? TLB_ATTR_NX : 0) | (global ? 0 : TLB_ATTR_NON_GLOBAL);
+    cpu.tlb_attrs[entry] = (nx ? TLB_ATTR_NX : 0) | (global ? 0 : TLB_ATTR_NON_GLOBAL) | (region ? TLB_ATTR_RAM_REGION : 0);
     if (!ptr)
         ptr = get_phys_ram_ptr(phys, write);
     cpu.tlb[entry] = (void*)(((uintptr_t)ptr) - lin);
@@ -108,6 +223,7 @@ static void cpu_write_phys(uint32_t addr, uint32_t data)
 // Converts linear to physical address.
 int cpu_mmu_translate(uint32_t lin, int shift)
 {
+    TRACELOG(TRACE_TLB_MISS, 0, lin, shift, 0);
 #ifdef LIBCPU
     int fault;
     void* ptr = get_lin_ram_ptr(lin & ~0xFFF, shift, &fault);
@@ -45,6 +45,15 @@
         return cpu_get_trace(); \
     } while (0)
 #define STOP2() return i
+// Loading ES, SS, or DS can flip STATE_FLAT, and the rest of the trace was decoded with the old value
+#define NEXT_SEG(flags, old_state_hash)         \
+    do {                                        \
+        if (cpu.state_hash != old_state_hash) { \
+            cpu.phys_eip += flags & 15;         \
+            STOP();                             \
+        }                                       \
+        NEXT(flags);                            \
+    } while (0)
 #define R8(i) cpu.reg8[i]
 #define R16(i) cpu.reg16[i]
 #define R32(i) cpu.reg32[i]
@@ -155,19 +164,28 @@ static union {
 } temp;
 
 #define FAST_BRANCHLESS_MASK(addr, i) (addr & ((i << 12 & 65536) - 1))
-static inline uint32_t cpu_get_linaddr(uint32_t i, struct decoded_instruction* j)
+static inline uint32_t cpu_get_virtaddr(uint32_t i, struct decoded_instruction* j)
 {
-    uint32_t addr = cpu.reg32[I_BASE(i)];
-    addr += cpu.reg32[I_INDEX(i)] << (I_SCALE(i));
-    addr += j->disp32;
-    return FAST_BRANCHLESS_MASK(addr, i) + cpu.seg_base[I_SEG_BASE(i)];
+    uint32_t addr;
+    switch (I_EA(i)) {
+    case I_EA_BASE:
+        return cpu.reg32[I_BASE(i)] + j->disp32;
+    case I_EA_DISP:
+        return j->disp32;
+    case I_EA_SIB:
+        return cpu.reg32[I_BASE(i)] + (cpu.reg32[I_INDEX(i)] << (I_SCALE(i))) + j->disp32;
+    default:
+        addr = cpu.reg32[I_BASE(i)];
+        addr += cpu.reg32[I_INDEX(i)] << (I_SCALE(i));
+        addr += j->disp32;
+        return FAST_BRANCHLESS_MASK(addr, i);
+    }
 }
-static inline uint32_t cpu_get_virtaddr(uint32_t i, struct decoded_instruction* j)
+static inline uint32_t cpu_get_linaddr(uint32_t i, struct decoded_instruction* j)
 {
-    uint32_t addr = cpu.reg32[I_BASE(i)];
-    addr += cpu.reg32[I_INDEX(i)] << (I_SCALE(i));
-    addr += j->disp32;
-    return FAST_BRANCHLESS_MASK(addr, i);
+    if (i >> I_EA_SHIFT & I_EA_FLAT)
+        return cpu_get_virtaddr(i, j);
+    return cpu_get_virtaddr(i, j) + cpu.seg_base[I_SEG_BASE(i)];
 }
 
 void cpu_execute(void)
@@ -758,26 +776,28 @@ OPTYPE op_pop_s16(struct decoded_instruction* i)
     // We cannot use pop16 for this operation
     int flags = i->flags, seg_dest = I_RM(flags);
     uint16_t dest;
+    uint32_t old_state_hash = cpu.state_hash;
     cpu_read16((cpu.reg32[ESP] & cpu.esp_mask) + cpu.seg_base[SS], dest, cpu.tlb_shift_read);
     if (cpu_load_seg_value_mov(seg_dest, dest))
         EXCEP();
     cpu.reg32[ESP] = ((cpu.reg32[ESP] + 2) & cpu.esp_mask) | (cpu.reg32[ESP] & ~cpu.esp_mask);
     if (seg_dest == SS)
         interrupt_guard();
-    NEXT(flags);
+    NEXT_SEG(flags, old_state_hash);
 }
 OPTYPE op_pop_s32(struct decoded_instruction* i)
 {
     // Identical to above except ESP is incremented by 4
     int flags = i->flags, seg_dest = I_RM(flags);
     uint16_t dest;
+    uint32_t old_state_hash = cpu.state_hash;
     cpu_read16((cpu.reg32[ESP] & cpu.esp_mask) + cpu.seg_base[SS], dest, cpu.tlb_shift_read);
     if (cpu_load_seg_value_mov(seg_dest, dest))
         EXCEP();
     cpu.reg32[ESP] = ((cpu.reg32[ESP] + 4) & cpu.esp_mask) | (cpu.reg32[ESP] & ~cpu.esp_mask);
     if (seg_dest == SS)
         interrupt_guard();
-    NEXT(flags);
+    NEXT_SEG(flags, old_state_hash);
 }
 OPTYPE op_pusha(struct decoded_instruction* i)
 {
@@ -1717,22 +1737,24 @@ OPTYPE op_mov_e32i32(struct decoded_instruction* i)
 OPTYPE op_mov_s16r16(struct decoded_instruction* i)
 {
     int flags = i->flags, dest = I_REG(flags);
+    uint32_t old_state_hash = cpu.state_hash;
     if (cpu_load_seg_value_mov(dest, R16(I_RM(flags))))
         EXCEP();
     if (dest == SS)
         interrupt_guard();
-    NEXT(flags);
+    NEXT_SEG(flags, old_state_hash);
 }
 OPTYPE op_mov_s16e16(struct decoded_instruction* i)
 {
     uint32_t flags = i->flags, dest = I_REG(flags), linaddr = cpu_get_linaddr(flags, i);
     uint16_t src;
+    uint32_t old_state_hash = cpu.state_hash;
     cpu_read16(linaddr, src, cpu.tlb_shift_read);
     if (cpu_load_seg_value_mov(dest, src))
         EXCEP();
     if (dest == SS)
         interrupt_guard();
-    NEXT(flags);
+    NEXT_SEG(flags, old_state_hash);
 }
 OPTYPE op_mov_e16s16(struct decoded_instruction* i)
 {
@@ -1850,62 +1872,68 @@ OPTYPE op_lea_r32e32(struct decoded_instruction* i)
 OPTYPE op_lds_r16e16(struct decoded_instruction* i)
 {
     uint32_t flags = i->flags, linaddr = cpu_get_linaddr(flags, i), data;
+    uint32_t old_state_hash = cpu.state_hash;
     cpu_read16(linaddr + 2, data, cpu.tlb_shift_read);
     if (cpu_load_seg_value_mov(DS, data))
         EXCEP();
     cpu_read16(linaddr, data, cpu.tlb_shift_read);
     R16(I_REG(flags)) = data;
-    NEXT(flags);
+    NEXT_SEG(flags, old_state_hash);
 }
 OPTYPE op_lds_r32e32(struct decoded_instruction* i)
 {
     uint32_t flags = i->flags, linaddr = cpu_get_linaddr(flags, i), data;
+    uint32_t old_state_hash = cpu.state_hash;
     cpu_read16(linaddr + 4, data, cpu.tlb_shift_read);
     if (cpu_load_seg_value_mov(DS, data))
         EXCEP();
     cpu_read32(linaddr, data, cpu.tlb_shift_read);
     R32(I_REG(flags)) = data;
-    NEXT(flags);
+    NEXT_SEG(flags, old_state_hash);
 }
 OPTYPE op_les_r16e16(struct decoded_instruction* i)
 {
     uint32_t flags = i->flags, linaddr = cpu_get_linaddr(flags, i), data;
+    uint32_t old_state_hash = cpu.state_hash;
     cpu_read16(linaddr + 2, data, cpu.tlb_shift_read);
     if (cpu_load_seg_value_mov(ES, data))
         EXCEP();
     cpu_read16(linaddr, data, cpu.tlb_shift_read);
     R16(I_REG(flags)) = data;
-    NEXT(flags);
+    NEXT_SEG(flags, old_state_hash);
 }
 OPTYPE op_les_r32e32(struct decoded_instruction* i)
 {
     uint32_t flags = i->flags, linaddr = cpu_get_linaddr(flags, i), data;
+    uint32_t old_state_hash = cpu.state_hash;
     cpu_read16(linaddr + 4, data, cpu.tlb_shift_read);
     if (cpu_load_seg_value_mov(ES, data))
         EXCEP();
     cpu_read32(linaddr, data, cpu.tlb_shift_read);
     R32(I_REG(flags)) = data;
-    NEXT(flags);
+    NEXT_SEG(flags, old_state_hash);
 }
 OPTYPE op_lss_r16e16(struct decoded_instruction* i)
 {
     uint32_t flags = i->flags, linaddr = cpu_get_linaddr(flags, i), data;
+    uint32_t old_state_hash = cpu.state_hash;
     cpu_read16(linaddr + 2, data, cpu.tlb_shift_read);
     if (cpu_load_seg_value_mov(SS, data))
         EXCEP();
     cpu_read16(linaddr, data, cpu.tlb_shift_read);
     R16(I_REG(flags)) = data;
-    NEXT(flags);
+    NEXT_SEG(flags, old_state_hash);
 }
 OPTYPE op_lss_r32e32(struct decoded_instruction* i)
 {
     uint32_t flags = i->flags, linaddr = cpu_get_linaddr(flags, i), data;
+    uint32_t old_state_hash = cpu.state_hash;
     cpu_read16(linaddr + 4, data, cpu.tlb_shift_read);
     if (cpu_load_seg_value_mov(SS, data))
         EXCEP();
     cpu_read32(linaddr, data, cpu.tlb_shift_read);
     R32(I_REG(flags)) = data;
-    NEXT(flags);
+    NEXT_SEG(flags, old_state_hash);
 }
 OPTYPE op_lfs_r16e16(struct decoded_instruction* i)
 {
@@ -1638,14 +1638,13 @@ static void reload_cs_base(void)
 {
     // For sysenter/sysexit, virt_eip == lin_eip
     uint32_t virt_eip = VIRT_EIP();
-    uint32_t lin_page = virt_eip >> 12,
-             shift = cpu.tlb_shift_read,
+    uint32_t shift = cpu.tlb_shift_read,
              tag = cpu.tlb_tags[virt_eip >> 12] >> shift;
     if (tag & 2) {
         cpu.last_phys_eip = cpu.phys_eip + 0x1000;
         return;
     }
-    cpu.phys_eip = PTR_TO_PHYS(cpu.tlb[lin_page] + virt_eip);
+    cpu.phys_eip = TLB_TO_PHYS(virt_eip);
     cpu.last_phys_eip = cpu.phys_eip & ~0xFFF;
     cpu.eip_phys_bias = virt_eip - cpu.phys_eip;
 }
@@ -1668,13 +1667,14 @@ int sysenter(void)
     cpu.seg_access[CS] = ACCESS_S | 0x0B | ACCESS_P | ACCESS_G; // 32-bit, r/x code, accessed, present, 4kb granularity
     cpu.cpl = 0;
     cpu_prot_update_cpl();
-    cpu.state_hash = 0; // 32-bit code/data
+    cpu.state_hash &= STATE_FLAT; // 32-bit code/data
 
     cpu.seg[SS] = (cs_offset + 8) & 0xFFFC;
     cpu.seg_base[SS] = 0;
     cpu.seg_limit[SS] = -1;
     cpu.seg_access[SS] = ACCESS_S | 0x03 | ACCESS_P | ACCESS_G | ACCESS_B; // 32-bit, r/x data, accessed, present, 4kb granularity, 32-bit
     cpu.esp_mask = -1;
+    cpu_seg_update_flat();
 
     reload_cs_base();
     return 0;
@@ -1695,13 +1695,14 @@ int sysexit(void)
     cpu.seg_access[CS] = ACCESS_S | 0x0B | ACCESS_P | ACCESS_G | ACCESS_DPL_MASK; // 32-bit, r/x code, accessed, present, 4kb granularity, dpl=3
     cpu.cpl = 3;
     cpu_prot_update_cpl();
-    cpu.state_hash = 0; // 32-bit code/data
+    cpu.state_hash &= STATE_FLAT; // 32-bit code/data
 
     cpu.seg[SS] = (cpu.sysenter[SYSENTER_CS] | 3) + 24;
     cpu.seg_base[SS] = 0;
     cpu.seg_limit[SS] = -1;
     cpu.seg_access[SS] = ACCESS_S | 0x03 | ACCESS_P | ACCESS_G | ACCESS_B | ACCESS_DPL_MASK; // 32-bit, r/x data, accessed, present, 4kb granularity, 32-bit, dpl=3
     cpu.esp_mask = -1;
+    cpu_seg_update_flat();
 
     reload_cs_base();
     return 0;
@@ -42,6 +42,7 @@ int cpu_mmx_check(void)
     // MMX transitions clear the tag word and reset the stack
     fpu.ftop = 0;
     fpu.tag_word = 0;
+    fpu.clean = 0;
     return 0;
 }
 #ifdef INSTRUMENT
@@ -90,12 +91,28 @@ int cpu_sse_handle_exceptions(void)
 #define MM32(n) fpu.mm[n].reg.r32[0]
 
 #define FAST_BRANCHLESS_MASK(addr, i) (addr & ((i << 12 & 65536) - 1))
+static inline uint32_t cpu_get_virtaddr(uint32_t i, struct decoded_instruction* j)
+{
+    uint32_t addr;
+    switch (I_EA(i)) {
+    case I_EA_BASE:
+        return cpu.reg32[I_BASE(i)] + j->disp32;
+    case I_EA_DISP:
+        return j->disp32;
+    case I_EA_SIB:
+        return cpu.reg32[I_BASE(i)] + (cpu.reg32[I_INDEX(i)] << (I_SCALE(i))) + j->disp32;
+    default:
+        addr = cpu.reg32[I_BASE(i)];
+        addr += cpu.reg32[I_INDEX(i)] << (I_SCALE(i));
+        addr += j->disp32;
+        return FAST_BRANCHLESS_MASK(addr, i);
+    }
+}
 static inline uint32_t cpu_get_linaddr(uint32_t i, struct decoded_instruction* j)
 {
-    uint32_t addr = cpu.reg32[I_BASE(i)];
-    addr += cpu.reg32[I_INDEX(i)] << (I_SCALE(i));
-    addr += j->disp32;
-    return FAST_BRANCHLESS_MASK(addr, i) + cpu.seg_base[I_SEG_BASE(i)];
+    if (i >> I_EA_SHIFT & I_EA_FLAT)
+        return cpu_get_virtaddr(i, j);
+    return cpu_get_virtaddr(i, j) + cpu.seg_base[I_SEG_BASE(i)];
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -144,7 +161,7 @@ static int get_read_ptr(uint32_t flags, struct decoded_instruction* i, int dword
 
     uint32_t* host_ptr = (uint32_t*)(cpu.tlb[linaddr >> 12] + linaddr);
     uint32_t phys = PTR_TO_PHYS(host_ptr);
-    if ((phys >= 0xA0000 && phys < 0xC0000) || (phys >= cpu.memory_size)) {
+    if (!(cpu.tlb_attrs[linaddr >> 12] & TLB_ATTR_RAM_REGION) && ((phys >= 0xA0000 && phys < 0xC0000) || (phys >= cpu.memory_size))) {
         for (int i = 0, j = 0; i < dwords; i++, j += 4)
             temp.d128[i] = io_handle_mmio_read(phys + j, 2);
         result_ptr = (uint8_t*)temp.d128;
@@ -176,7 +193,8 @@ static int get_write_ptr(uint32_t flags, struct decoded_instruction* i, int dwor
 
     uint32_t* host_ptr = (uint32_t*)(cpu.tlb[linaddr >> 12] + linaddr);
     uint32_t phys = PTR_TO_PHYS(host_ptr);
-    if ((phys >= 0xA0000 && phys < 0xC0000) || (phys >= cpu.memory_size)) {
+    // RAM region pages are written back too, so that the slow path sees the first write
+    if ((cpu.tlb_attrs[linaddr >> 12] & TLB_ATTR_RAM_REGION) || (phys >= 0xA0000 && phys < 0xC0000) || (phys >= cpu.memory_size)) {
         write_back = 1;
         result_ptr = (uint8_t*)temp.d128;
         write_back_dwords = dwords;
@@ -243,6 +261,9 @@ static int get_reg_write_ptr(uint32_t flags, struct decoded_instruction* i)
 static void* get_mmx_reg_dest(int x)
 {
     fpu.mm[x].dummy = 0xFFFF; // STn.exponent is set to all ones
+    // Some SSE instructions write MMX registers without going through cpu_mmx_check, so the saved FXSAVE image has to
+    // be thrown away here
+    fpu.clean = 0;
     return &fpu.mm[x].reg;
 }
 static void* get_mmx_reg_src(int x)
@@ -7,6 +7,78 @@
 #define EXCEPTION_HANDLER return -1 // Note: -1, not 1 like most other exception handlers
 #define MAX_CYCLES_TO_RUN 65536
 
+// REP STOS/MOVS into MMIO, like VGA memory, would otherwise reach the device one element at a time. These hand it
+// everything up to the end of the destination page at once, and return how many elements that was. 0 means that it has
+// to be done the normal way, and -1 means a page fault.
+
+// Elements that fit before the end of the page and before the index register wraps around
+static int string_block_count(uint32_t lin, uint32_t offset, uint32_t offset_mask, int size, int count)
+{
+    uint32_t page = (0x1000 - (lin & 0xFFF)) / size;
+    uint64_t wrap = ((uint64_t)offset_mask - offset + 1) / size;
+    if ((uint32_t)count > page)
+        count = page;
+    if ((uint64_t)count > wrap)
+        count = (int)wrap;
+    return count;
+}
+
+// Moves a single element that straddles a page boundary. It goes the normal way, and the rest of the run can carry on
+// in blocks afterwards.
+static int string_write_straddled(uint32_t lin, uint32_t data, int size)
+{
+    int shift = cpu.tlb_shift_write;
+    uint32_t tag = cpu.tlb_tags[lin >> 12] >> shift;
+    if (size == 2 ? cpu_access_write16(lin, data, tag, shift) : cpu_access_write32(lin, data, tag, shift))
+        return -1;
+    return 1;
+}
+
+static int stos_block(uint32_t offset, uint32_t offset_mask, uint32_t data, int size, int count)
+{
+    uint8_t buf[4096];
+    uint32_t lin = cpu.seg_base[ES] + offset;
+    // Don't bother with ordinary memory
+    if (!(cpu.tlb_tags[lin >> 12] >> cpu.tlb_shift_write & 1))
+        return 0;
+    count = string_block_count(lin, offset, offset_mask, size, count);
+    if (!count)
+        return string_write_straddled(lin, data, size);
+    // Fill in one element, then keep doubling it
+    int length = count * size;
+    h_memcpy(buf, &data, size);
+    for (int filled = size; filled < length; filled <<= 1)
+        h_memcpy(buf + filled, buf, filled < length - filled ? filled : length - filled);
+    int res = cpu_access_write_block(lin, buf, length, cpu.tlb_shift_write);
+    return res > 0 ? count : res;
+}
+
+static int movs_block(uint32_t src_base, uint32_t src_offset, uint32_t offset, uint32_t offset_mask, int size, int count)
+{
+    uint32_t lin = cpu.seg_base[ES] + offset, src = src_base + src_offset, tag;
+    if (!(cpu.tlb_tags[lin >> 12] >> cpu.tlb_shift_write & 1))
+        return 0;
+    count = string_block_count(lin, offset, offset_mask, size, count);
+    count = string_block_count(src, src_offset, offset_mask, size, count);
+    tag = cpu.tlb_tags[src >> 12] >> cpu.tlb_shift_read;
+    if (!count) {
+        if (size == 2 ? cpu_access_read16(src, tag, cpu.tlb_shift_read) : cpu_access_read32(src, tag, cpu.tlb_shift_read))
+            return -1;
+        return string_write_straddled(lin, cpu.read_result, size);
+    }
+    if (tag & 2) {
+        if (cpu_mmu_translate(src, cpu.tlb_shift_read))
+            return -1;
+        tag = cpu.tlb_tags[src >> 12] >> cpu.tlb_shift_read;
+    }
+    // The source has to be readable in place. VGA to VGA copies reload the latches on every read, so they still go one
+    // element at a time.
+    if (tag & 1)
+        return 0;
+    int res = cpu_access_write_block(lin, cpu.tlb[src >> 12] + src, count * size, cpu.tlb_shift_write);
+    return res > 0 ? count : res;
+}
+
 // <<< BEGIN AUTOGENERATE "ops" >>>
 int movsb16(int flags)
 {
@@ -20,6 +92,17 @@ int movsb16(int flags)
         cpu.reg16[DI] += add;
         return 0;
     }
+    if (add > 0) {
+        int done = movs_block(ds_base, cpu.reg16[SI], cpu.reg16[DI], 0xFFFF, 1, count);
+        if (done < 0)
+        EXCEPTION_HANDLER;
+        if (done) {
+            cpu.reg16[SI] += done * add;
+            cpu.reg16[DI] += done * add;
+            cpu.reg16[CX] -= done;
+            return cpu.reg16[CX] != 0;
+        }
+    }
     for (int i = 0; i < count; i++) {
         cpu_read8(ds_base + cpu.reg16[SI], src, cpu.tlb_shift_read);
         cpu_write8(cpu.seg_base[ES] + cpu.reg16[DI], src, cpu.tlb_shift_write);
@@ -42,6 +125,17 @@ int movsb32(int flags)
         cpu.reg32[EDI] += add;
         return 0;
     }
+    if (add > 0) {
+        int done = movs_block(ds_base, cpu.reg32[ESI], cpu.reg32[EDI], 0xFFFFFFFF, 1, count);
+        if (done < 0)
+        EXCEPTION_HANDLER;
+        if (done) {
+            cpu.reg32[ESI] += done * add;
+            cpu.reg32[EDI] += done * add;
+            cpu.reg32[ECX] -= done;
+            return cpu.reg32[ECX] != 0;
+        }
+    }
     for (int i = 0; i < count; i++) {
         cpu_read8(ds_base + cpu.reg32[ESI], src, cpu.tlb_shift_read);
         cpu_write8(cpu.seg_base[ES] + cpu.reg32[EDI], src, cpu.tlb_shift_write);
@@ -64,6 +158,17 @@ int movsw16(int flags)
         cpu.reg16[DI] += add;
         return 0;
     }
+    if (add > 0) {
+        int done = movs_block(ds_base, cpu.reg16[SI], cpu.reg16[DI], 0xFFFF, 2, count);
+        if (done < 0)
+        EXCEPTION_HANDLER;
+        if (done) {
+            cpu.reg16[SI] += done * add;
+            cpu.reg16[DI] += done * add;
+            cpu.reg16[CX] -= done;
+            return cpu.reg16[CX] != 0;
+        }
+    }
     for (int i = 0; i < count; i++) {
         cpu_read16(ds_base + cpu.reg16[SI], src, cpu.tlb_shift_read);
         cpu_write16(cpu.seg_base[ES] + cpu.reg16[DI], src, cpu.tlb_shift_write);
@@ -86,6 +191,17 @@ int movsw32(int flags)
         cpu.reg32[EDI] += add;
         return 0;
     }
+    if (add > 0) {
+        int done = movs_block(ds_base, cpu.reg32[ESI], cpu.reg32[EDI], 0xFFFFFFFF, 2, count);
+        if (done < 0)
+        EXCEPTION_HANDLER;
+        if (done) {
+            cpu.reg32[ESI] += done * add;
+            cpu.reg32[EDI] += done * add;
+            cpu.reg32[ECX] -= done;
+            return cpu.reg32[ECX] != 0;
+        }
+    }
     for (int i = 0; i < count; i++) {
         cpu_read16(ds_base + cpu.reg32[ESI], src, cpu.tlb_shift_read);
         cpu_write16(cpu.seg_base[ES] + cpu.reg32[EDI], src, cpu.tlb_shift_write);
@@ -108,6 +224,17 @@ int movsd16(int flags)
         cpu.reg16[DI] += add;
         return 0;
     }
+    if (add > 0) {
+        int done = movs_block(ds_base, cpu.reg16[SI], cpu.reg16[DI], 0xFFFF, 4, count);
+        if (done < 0)
+        EXCEPTION_HANDLER;
+        if (done) {
+            cpu.reg16[SI] += done * add;
+            cpu.reg16[DI] += done * add;
+            cpu.reg16[CX] -= done;
+            return cpu.reg16[CX] != 0;
+        }
+    }
     for (int i = 0; i < count; i++) {
         cpu_read32(ds_base + cpu.reg16[SI], src, cpu.tlb_shift_read);
         cpu_write32(cpu.seg_base[ES] + cpu.reg16[DI], src, cpu.tlb_shift_write);
@@ -130,6 +257,17 @@ int movsd32(int flags)
         cpu.reg32[EDI] += add;
         return 0;
     }
+    if (add > 0) {
+        int done = movs_block(ds_base, cpu.reg32[ESI], cpu.reg32[EDI], 0xFFFFFFFF, 4, count);
+        if (done < 0)
+        EXCEPTION_HANDLER;
+        if (done) {
+            cpu.reg32[ESI] += done * add;
+            cpu.reg32[EDI] += done * add;
+            cpu.reg32[ECX] -= done;
+            return cpu.reg32[ECX] != 0;
+        }
+    }
     for (int i = 0; i < count; i++) {
         cpu_read32(ds_base + cpu.reg32[ESI], src, cpu.tlb_shift_read);
         cpu_write32(cpu.seg_base[ES] + cpu.reg32[EDI], src, cpu.tlb_shift_write);
@@ -150,6 +288,16 @@ int stosb16(int flags)
         cpu.reg16[DI] += add;
         return 0;
     }
+    if (add > 0) {
+        int done = stos_block(cpu.reg16[DI], 0xFFFF, src, 1, count);
+        if (done < 0)
+        EXCEPTION_HANDLER;
+        if (done) {
+            cpu.reg16[DI] += done * add;
+            cpu.reg16[CX] -= done;
+            return cpu.reg16[CX] != 0;
+        }
+    }
     for (int i = 0; i < count; i++) {
         cpu_write8(cpu.seg_base[ES] + cpu.reg16[DI], src, cpu.tlb_shift_write);
         cpu.reg16[DI] += add;
@@ -168,6 +316,16 @@ int stosb32(int flags)
         cpu.reg32[EDI] += add;
         return 0;
     }
+    if (add > 0) {
+        int done = stos_block(cpu.reg32[EDI], 0xFFFFFFFF, src, 1, count);
+        if (done < 0)
+        EXCEPTION_HANDLER;
+        if (done) {
+            cpu.reg32[EDI] += done * add;
+            cpu.reg32[ECX] -= done;
+            return cpu.reg32[ECX] != 0;
+        }
+    }
     for (int i = 0; i < count; i++) {
         cpu_write8(cpu.seg_base[ES] + cpu.reg32[EDI], src, cpu.tlb_shift_write);
         cpu.reg32[EDI] += add;
@@ -186,6 +344,16 @@ int stosw16(int flags)
         cpu.reg16[DI] += add;
         return 0;
     }
+    if (add > 0) {
+        int done = stos_block(cpu.reg16[DI], 0xFFFF, src, 2, count);
+        if (done < 0)
+        EXCEPTION_HANDLER;
+        if (done) {
+            cpu.reg16[DI] += done * add;
+            cpu.reg16[CX] -= done;
+            return cpu.reg16[CX] != 0;
+        }
+    }
     for (int i = 0; i < count; i++) {
         cpu_write16(cpu.seg_base[ES] + cpu.reg16[DI], src, cpu.tlb_shift_write);
         cpu.reg16[DI] += add;
@@ -204,6 +372,16 @@ int stosw32(int flags)
         cpu.reg32[EDI] += add;
         return 0;
     }
+    if (add > 0) {
+        int done = stos_block(cpu.reg32[EDI], 0xFFFFFFFF, src, 2, count);
+        if (done < 0)
+        EXCEPTION_HANDLER;
+        if (done) {
+            cpu.reg32[EDI] += done * add;
+            cpu.reg32[ECX] -= done;
+            return cpu.reg32[ECX] != 0;
+        }
+    }
     for (int i = 0; i < count; i++) {
         cpu_write16(cpu.seg_base[ES] + cpu.reg32[EDI], src, cpu.tlb_shift_write);
         cpu.reg32[EDI] += add;
@@ -222,6 +400,16 @@ int stosd16(int flags)
         cpu.reg16[DI] += add;
         return 0;
     }
+    if (add > 0) {
+        int done = stos_block(cpu.reg16[DI], 0xFFFF, src, 4, count);
+        if (done < 0)
+        EXCEPTION_HANDLER;
+        if (done) {
+            cpu.reg16[DI] += done * add;
+            cpu.reg16[CX] -= done;
+            return cpu.reg16[CX] != 0;
+        }
+    }
     for (int i = 0; i < count; i++) {
         cpu_write32(cpu.seg_base[ES] + cpu.reg16[DI], src, cpu.tlb_shift_write);
         cpu.reg16[DI] += add;
@@ -240,6 +428,16 @@ int stosd32(int flags)
         cpu.reg32[EDI] += add;
         return 0;
     }
+    if (add > 0) {
+        int done = stos_block(cpu.reg32[EDI], 0xFFFFFFFF, src, 4, count);
+        if (done < 0)
+        EXCEPTION_HANDLER;
+        if (done) {
+            cpu.reg32[EDI] += done * add;
+            cpu.reg32[ECX] -= done;
+            return cpu.reg32[ECX] != 0;
+        }
+    }
     for (int i = 0; i < count; i++) {
         cpu_write32(cpu.seg_base[ES] + cpu.reg32[EDI], src, cpu.tlb_shift_write);
         cpu.reg32[EDI] += add;
@@ -0,0 +1,155 @@
+// Guest code profiler.
+// Counts every trace lookup, and samples the current instruction every PROFILE_SAMPLE_INTERVAL cycles. Both are written
+// out on exit as folded stacks ("frame;frame;frame count", sorted by count) which flamegraph.pl and speedscope can read:
+//   <path>         cr3=XXXXXXXX;cplN;LINEAR@PHYSICAL <samples>
+//   <path>.traces  cr3=XXXXXXXX;cplN;LINEAR@PHYSICAL <trace executions>
+// cr3 is reported as zero while paging is disabled.
+#include "cpu/cpu.h"
+#include <stdlib.h>
+
+#define PROFILE_LOG(x, ...) LOG("PROF", x, ##__VA_ARGS__)
+
+#define PROFILE_SAMPLE_INTERVAL 4096
+
+struct profile_entry {
+    uint32_t cr3, lin, phys, cpl;
+    uint64_t count;
+};
+
+struct profile_table {
+    struct profile_entry* entries;
+    uint32_t size, used; // size is always a power of two
+};
+
+int cpu_profile_enabled = 0;
+
+static struct profile_table traces, samples;
+static itick_t next_sample;
+static char* profile_path;
+
+static uint32_t profile_hash(uint32_t cr3, uint32_t lin, uint32_t phys)
+{
+    uint32_t h = lin * 0x9E3779B1;
+    h ^= phys + 0x7F4A7C15 + (h << 6) + (h >> 2);
+    h ^= cr3 + 0x7F4A7C15 + (h << 6) + (h >> 2);
+    return h;
+}
+
+static struct profile_entry* profile_lookup(struct profile_table* t, uint32_t cr3, uint32_t lin, uint32_t phys, uint32_t cpl);
+static void profile_grow(struct profile_table* t)
+{
+    struct profile_entry* old = t->entries;
+    uint32_t old_size = t->size;
+
+    t->size = old_size ? old_size * 2 : 4096;
+    t->entries = h_calloc(t->size, sizeof(struct profile_entry));
+    t->used = 0;
+    for (unsigned int i = 0; i < old_size; i++) {
+        if (old[i].count)
+            profile_lookup(t, old[i].cr3, old[i].lin, old[i].phys, old[i].cpl)->count = old[i].count;
+    }
+    h_free(old);
+}
+
+// Returns the entry for this location, creating it if needed
+static struct profile_entry* profile_lookup(struct profile_table* t, uint32_t cr3, uint32_t lin, uint32_t phys, uint32_t cpl)
+{
+    if ((t->used + 1) * 4 >= t->size * 3)
+        profile_grow(t);
+
+    uint32_t mask = t->size - 1, idx = profile_hash(cr3, lin, phys) & mask;
+    while (1) {
+        struct profile_entry* e = &t->entries[idx];
+        if (!e->count) {
+            e->cr3 = cr3;
+            e->lin = lin;
+            e->phys = phys;
+            e->cpl = cpl;
+            t->used++;
+            return e;
+        }
+        if (e->lin == lin && e->phys == phys && e->cr3 == cr3 && e->cpl == cpl)
+            return e;
+        idx = (idx + 1) & mask;
+    }
+}
+
+static void profile_record(struct profile_table* t)
+{
+    uint32_t cr3 = cpu.cr[0] & CR0_PG ? cpu.cr[3] & ~0xFFF : 0;
+    struct profile_entry* e = profile_lookup(t, cr3, LIN_EIP(), cpu.phys_eip, cpu.cpl);
+    e->count++;
+}
+
+// Called by cpu_get_trace every time a trace is about to run
+void cpu_profile_trace(void)
+{
+    profile_record(&traces);
+    if (cpu_get_cycles() >= next_sample) {
+        profile_record(&samples);
+        next_sample = cpu_get_cycles() + PROFILE_SAMPLE_INTERVAL;
+    }
+}
+
+static int profile_compare(const void* a, const void* b)
+{
+    uint64_t x = ((const struct profile_entry*)a)->count, y = ((const struct profile_entry*)b)->count;
+    return (x < y) - (x > y); // Highest count first
+}
+
+static void profile_write(struct profile_table* t, const char* path)
+{
+    struct profile_entry* sorted;
+    uint32_t n = 0;
+    uint64_t total = 0;
+    char line[160];
+
+    void* f = h_fopen(path, "wb");
+    if (!f) {
+        PROFILE_LOG("Unable to open %s\n", path);
+        return;
+    }
+
+    sorted = h_malloc((t->used + 1) * sizeof(struct profile_entry));
+    for (unsigned int i = 0; i < t->size; i++)
+        if (t->entries[i].count)
+            sorted[n++] = t->entries[i];
+    qsort(sorted, n, sizeof(struct profile_entry), profile_compare);
+
+    for (unsigned int i = 0; i < n; i++) {
+        int len = h_sprintf(line, "cr3=%08x;cpl%d;%08x@%08x %llu\n", sorted[i].cr3, sorted[i].cpl, sorted[i].lin,
+            sorted[i].phys, (unsigned long long)sorted[i].count);
+        h_fwrite(line, len, 1, f);
+        total += sorted[i].count;
+    }
+    h_fclose(f);
+    h_free(sorted);
+    PROFILE_LOG("Wrote %u locations (%llu hits) to %s\n", n, (unsigned long long)total, path);
+}
+
+static void profile_dump(void)
+{
+    size_t len = h_strlen(profile_path);
+    char* traces_path = h_malloc(len + sizeof(".traces"));
+
+    h_memcpy(traces_path, profile_path, len);
+    h_memcpy(traces_path + len, ".traces", sizeof(".traces"));
+
+    profile_write(&samples, profile_path);
+    profile_write(&traces, traces_path);
+    h_free(traces_path);
+}
+
+// Start profiling. The report is written to "path" when the emulator exits.
+void cpu_profile_init(const char* path)
+{
+    size_t len = h_strlen(path) + 1;
+    profile_path = h_malloc(len);
+    h_memcpy(profile_path, path, len);
+
+    profile_grow(&traces);
+    profile_grow(&samples);
+    next_sample = cpu_get_cycles();
+    cpu_profile_enabled = 1;
+    atexit(profile_dump);
+}
@@ -8,8 +8,7 @@ static void reload_cs_base(void)
     uint32_t virt_eip = VIRT_EIP(), lin_eip = virt_eip + cpu.seg_base[CS];
     // Calculate physical EIP
     // Refresh cpu.last_phys_eip
-    uint32_t lin_page = lin_eip >> 12,
-             shift = cpu.tlb_shift_read,
+    uint32_t shift = cpu.tlb_shift_read,
              tag = cpu.tlb_tags[lin_eip >> 12] >> shift;
 
     if (tag & 2) {
@@ -19,7 +18,7 @@ static void reload_cs_base(void)
     }
 
     // Recompute the physical EIP state
-    cpu.phys_eip = PTR_TO_PHYS(cpu.tlb[lin_page] + lin_eip);
+    cpu.phys_eip = TLB_TO_PHYS(lin_eip);
     cpu.last_phys_eip = cpu.phys_eip & ~0xFFF;
     cpu.eip_phys_bias = virt_eip - cpu.phys_eip;
 }
@@ -52,9 +51,10 @@ void cpu_seg_load_virtual(int id, uint16_t sel)
     cpu.seg_base[id] = sel << 4;
     cpu.seg_limit[id] = 0xFFFF;
     cpu.seg_access[id] &= ~(ACCESS_DPL_MASK | ACCESS_B);
+    cpu_seg_update_flat();
     switch (id) {
     case CS:
-        cpu.state_hash = STATE_ADDR16 | STATE_CODE16;
+        cpu.state_hash = (cpu.state_hash & STATE_FLAT) | STATE_ADDR16 | STATE_CODE16;
         break;
     case SS:
         cpu.esp_mask = 0xFFFF;
@@ -67,10 +67,11 @@ void cpu_seg_load_real(int id, uint16_t sel)
     cpu.seg_base[id] = sel << 4;
     cpu.seg_limit[id] = 0xFFFF;
     cpu.seg_access[id] &= ~(ACCESS_DPL_MASK | ACCESS_B);
+    cpu_seg_update_flat();
 
     switch (id) {
     case CS:
-        cpu.state_hash = STATE_ADDR16 | STATE_CODE16;
+        cpu.state_hash = (cpu.state_hash & STATE_FLAT) | STATE_ADDR16 | STATE_CODE16;
         break;
     case SS:
         cpu.esp_mask = 0xFFFF;
@@ -84,6 +85,7 @@ int cpu_seg_load_protected(int id, uint16_t sel, struct seg_desc* info)
     cpu.seg_base[id] = cpu_seg_get_base(info);
     cpu.seg_limit[id] = cpu_seg_get_limit(info);
     cpu.seg_access[id] = DESC_ACCESS(info);
+    cpu_seg_update_flat();
 
     uint32_t linaddr = cpu_seg_descriptor_address(-1, sel);
     if (linaddr == RESULT_INVALID)
@@ -94,9 +96,9 @@ int cpu_seg_load_protected(int id, uint16_t sel, struct seg_desc* info)
     switch (id) {
     case CS:
         if (cpu.seg_access[CS] & ACCESS_B)
-            cpu.state_hash = 0;
+            cpu.state_hash &= STATE_FLAT;
         else
-            cpu.state_hash = STATE_ADDR16 | STATE_CODE16;
+            cpu.state_hash = (cpu.state_hash & STATE_FLAT) | STATE_ADDR16 | STATE_CODE16;
         cpu.cpl = sel & 3;
         cpu_prot_update_cpl();
         break;
@@ -193,6 +195,18 @@ uint32_t cpu_seg_descriptor_address(int tbl, uint16_t sel)
     return (sel & ~7) + cpu.seg_base[tbl];
 }
 
+// Memory operands using ES, CS, SS, or DS are decoded without a segment base add while STATE_FLAT is set. FS and GS
+// often hold thread-local storage with a nonzero base, so they are never folded and don't affect the bit.
+void cpu_seg_update_flat(void)
+{
+#ifndef LIBCPU // Library users can write cpu.seg_base directly
+    if (cpu.seg_base[ES] | cpu.seg_base[CS] | cpu.seg_base[SS] | cpu.seg_base[DS])
+        cpu.state_hash &= ~STATE_FLAT;
+    else
+        cpu.state_hash |= STATE_FLAT;
+#endif
+}
+
 // For use by mov sreg, r/m functions
 int cpu_load_seg_value_mov(int seg, uint16_t val)
 {
@@ -278,6 +292,7 @@ int cpu_load_seg_value_mov(int seg, uint16_t val)
                 cpu.seg_base[seg] = 0;
                 cpu.seg_limit[seg] = 0;
                 cpu.seg_access[seg] = 0;
+                cpu_seg_update_flat();
             }
             break;
         }
@@ -1011,6 +1011,269 @@ static float32 subFloat32Sigs(float32 a, float32 b, int zSign, float_status_t *s
     return normalizeRoundAndPackFloat32(zSign, zExp, zSig, status);
 }
 
+/*----------------------------------------------------------------------------
+| Host floating-point fast paths.
+|
+| When every operand is zero or normal and the rounding mode is round-to-
+| nearest-even, the host's own IEEE arithmetic gives the same result as the
+| code below. Single-precision operations are carried out in double precision,
+| which is wide enough (53 >= 2*24+2) for the second rounding to be harmless.
+| The inexact and rounded-up (C1) flags are rebuilt from the exact error of
+| the operation, recovered with TwoSum or a Dekker product. Anything that could
+| overflow or underflow, or that involves NaNs, infinities or denormals, is
+| left to the bit-exact code, so the results and flags are identical.
+|
+| The host must evaluate double expressions in double precision (i.e. not on a
+| 32-bit x87 FPU), so the fast paths are only enabled when FLT_EVAL_METHOD
+| says so. Define SOFTFLOAT_NO_HOST_FASTPATH to disable them altogether.
+*----------------------------------------------------------------------------*/
+
+#include <float.h>
+#if !defined(SOFTFLOAT_NO_HOST_FASTPATH) && \
+    ((defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0) || defined(_M_X64) || defined(_M_ARM64))
+#define SOFTFLOAT_HOST_FASTPATH
+#endif
+
+#ifdef SOFTFLOAT_HOST_FASTPATH
+#include <math.h>
+
+typedef union {
+    float32 u;
+    float f;
+} host_float32;
+typedef union {
+    float64 u;
+    double f;
+} host_float64;
+
+enum {
+    host_op_add,
+    host_op_sub,
+    host_op_mul,
+    host_op_div
+};
+
+BX_CPP_INLINE int host_float32_usable(float32 a)
+{
+    int aExp = extractFloat32Exp(a);
+    return aExp ? (aExp != 0xFF) : (extractFloat32Frac(a) == 0);
+}
+
+// Products and quotients are checked with a Dekker product, which is only
+// exact as long as none of its partial products over- or underflow.
+BX_CPP_INLINE int host_float64_usable(float64 a, int limit_range)
+{
+    int aExp = extractFloat64Exp(a);
+    if (aExp == 0)
+        return extractFloat64Frac(a) == 0;
+    if (limit_range)
+        return (aExp >= 0x3FF - 480) && (aExp <= 0x3FF + 480);
+    return aExp != 0x7FF;
+}
+
+// Results are only taken if they are comfortably normal (so that tininess
+// never comes into question) or an exact zero.
+BX_CPP_INLINE int host_float32_result(float32 z, int inexact)
+{
+    uint32_t mag = z & 0x7FFFFFFF;
+    if (mag == 0)
+        return !inexact;
+    return (mag > 0x00800000) && (mag < 0x7F800000);
+}
+BX_CPP_INLINE int host_float64_result(float64 z, int inexact)
+{
+    uint64_t mag = z & U64(0x7FFFFFFFFFFFFFFF);
+    if (mag == 0)
+        return !inexact;
+    return (mag > U64(0x0010000000000000)) && (mag < U64(0x7FF0000000000000));
+}
+
+BX_CPP_INLINE void host_raise(float_status_t *status, int inexact, int rounded_up)
+{
+    if (inexact) {
+        float_raise(status, float_flag_inexact);
+        if (rounded_up) set_float_rounding_up(status);
+    }
+}
+
+// hi + lo == x * y, exactly. Dekker's splitting falls apart if the compiler
+// contracts it into fused multiply-adds, so use fma() wherever that is cheap.
+static void host_two_product(double x, double y, double *hi, double *lo)
+{
+#ifdef FP_FAST_FMA
+    *hi = x * y;
+    *lo = fma(x, y, -*hi);
+#else
+    const double split = 134217729.0; // 2^27 + 1
+    double c, xh, xl, yh, yl, p = x * y;
+    c = split * x;
+    xh = c - (c - x);
+    xl = x - xh;
+    c = split * y;
+    yh = c - (c - y);
+    yl = y - yh;
+    *hi = p;
+    *lo = ((xh * yh - p) + xh * yl + xl * yh) + xl * yl;
+#endif
+}
+
+static int host_float32_op(float32 a, float32 b, int op, float_status_t *status, float32 *z)
+{
+    host_float32 ha, hb, hz;
+    double x, y, r, err, t;
+    int inexact, rounded_up;
+
+    if (get_float_rounding_mode(status) != float_round_nearest_even) return 0;
+    if (!host_float32_usable(a) || !host_float32_usable(b)) return 0;
+    ha.u = a;
+    hb.u = b;
+    x = ha.f;
+    y = hb.f;
+
+    switch (op) {
+    case host_op_sub:
+        y = -y;
+        // fallthrough
+    default: // host_op_add
+        r = x + y;
+        t = r - x;
+        err = (x - (r - t)) + (y - t);
+        hz.f = (float) r;
+        // (z - r) is exact, so this has the sign of (z - (x + y))
+        t = ((double) hz.f - r) - err;
+        inexact = t != 0;
+        rounded_up = (t > 0) == (hz.f > 0);
+        break;
+    case host_op_mul:
+        r = x * y; // exact: 24 + 24 bits fit in 53
+        hz.f = (float) r;
+        inexact = (double) hz.f != r;
+        rounded_up = fabs((double) hz.f) > fabs(r);
+        break;
+    case host_op_div:
+        if (y == 0) return 0;
+        hz.f = (float) (x / y);
+        r = x - (double) hz.f * y; // exact remainder
+        inexact = r != 0;
+        rounded_up = (r > 0) != (x > 0);
+        break;
+    }
+
+    if (!host_float32_result(hz.u, inexact)) return 0;
+    host_raise(status, inexact, rounded_up);
+    *z = hz.u;
+    return 1;
+}
+
+static int host_float32_sqrt(float32 a, float_status_t *status, float32 *z)
+{
+    host_float32 ha, hz;
+    double x, r;
+
+    if (get_float_rounding_mode(status) != float_round_nearest_even) return 0;
+    if (!host_float32_usable(a) || extractFloat32Sign(a)) return 0;
+    ha.u = a;
+    x = ha.f;
+    hz.f = (float) sqrt(x);
+    r = x - (double) hz.f * hz.f; // exact remainder
+    host_raise(status, r != 0, r < 0);
+    *z = hz.u;
+    return 1;
+}
+
+static int host_float64_op(float64 a, float64 b, int op, float_status_t *status, float64 *z)
+{
+    host_float64 ha, hb, hz;
+    double x, y, t, err;
+    int inexact, rounded_up, limit_range = (op == host_op_mul) || (op == host_op_div);
+
+    if (get_float_rounding_mode(status) != float_round_nearest_even) return 0;
+    if (!host_float64_usable(a, limit_range) || !host_float64_usable(b, limit_range)) return 0;
+    ha.u = a;
+    hb.u = b;
+    x = ha.f;
+    y = hb.f;
+
+    switch (op) {
+    case host_op_sub:
+        y = -y;
+        // fallthrough
+    default: // host_op_add
+        hz.f = x + y;
+        t = hz.f - x;
+        err = (x - (hz.f - t)) + (y - t);
+        // z - (x + y) == -err
+        inexact = err != 0;
+        rounded_up = (err < 0) == (hz.f > 0);
+        break;
+    case host_op_mul:
+        host_two_product(x, y, &hz.f, &err);
+        inexact = err != 0;
+        rounded_up = (err < 0) == (hz.f > 0);
+        break;
+    case host_op_div:
+        if (y == 0) return 0;
+        hz.f = x / y;
+        host_two_product(hz.f, y, &t, &err);
+        err = (x - t) - err; // remainder; (x - t) is exact
+        inexact = err != 0;
+        rounded_up = (err > 0) != (x > 0);
+        break;
+    }
+
+    if (!host_float64_result(hz.u, inexact)) return 0;
+    host_raise(status, inexact, rounded_up);
+    *z = hz.u;
+    return 1;
+}
+
+static int host_float64_sqrt(float64 a, float_status_t *status, float64 *z)
+{
+    host_float64 ha, hz;
+    double hi, lo, r;
+
+    if (get_float_rounding_mode(status) != float_round_nearest_even) return 0;
+    if (!host_float64_usable(a, 1) || extractFloat64Sign(a)) return 0;
+    ha.u = a;
+    hz.f = sqrt(ha.f);
+    host_two_product(hz.f, hz.f, &hi, &lo);
+    r = (ha.f - hi) - lo; // remainder; (a - hi) is exact
+    host_raise(status, r != 0, r < 0);
+    *z = hz.u;
+    return 1;
+}
+
+#define HOST_FLOAT32_OP(a, b, op, status)                    \
+    do {                                                     \
+        float32 host_z;                                      \
+        if (host_float32_op(a, b, op, status, &host_z))      \
+            return host_z;                                   \
+    } while (0)
+#define HOST_FLOAT64_OP(a, b, op, status)                    \
+    do {                                                     \
+        float64 host_z;                                      \
+        if (host_float64_op(a, b, op, status, &host_z))      \
+            return host_z;                                   \
+    } while (0)
+#define HOST_FLOAT32_SQRT(a, status)                         \
+    do {                                                     \
+        float32 host_z;                                      \
+        if (host_float32_sqrt(a, status, &host_z))           \
+            return host_z;                                   \
+    } while (0)
+#define HOST_FLOAT64_SQRT(a, status)                         \
+    do {                                                     \
+        float64 host_z;                                      \
+        if (host_float64_sqrt(a, status, &host_z))           \
+            return host_z;                                   \
+    } while (0)
+#else
+#define HOST_FLOAT32_OP(a, b, op, status)
+#define HOST_FLOAT64_OP(a, b, op, status)
+#define HOST_FLOAT32_SQRT(a, status)
+#define HOST_FLOAT64_SQRT(a, status)
+#endif
+
 /*----------------------------------------------------------------------------
 | Returns the result of adding the single-precision floating-point values `a'
 | and `b'.  The operation is performed according to the IEC/IEEE Standard for
@@ -1019,6 +1282,8 @@ static float32 subFloat32Sigs(float32 a, float32 b, int zSign, float_status_t *s
 
 float32 float32_add(float32 a, float32 b, float_status_t *status)
 {
+    HOST_FLOAT32_OP(a, b, host_op_add, status);
+
     int aSign = extractFloat32Sign(a);
     int bSign = extractFloat32Sign(b);
 
@@ -1038,6 +1303,8 @@ float32 float32_add(float32 a, float32 b, float_status_t *status)
 
 float32 float32_sub(float32 a, float32 b, float_status_t *status)
 {
+    HOST_FLOAT32_OP(a, b, host_op_sub, status);
+
     int aSign = extractFloat32Sign(a);
     int bSign = extractFloat32Sign(b);
 
@@ -1063,6 +1330,8 @@ float32 float32_mul(float32 a, float32 b, float_status_t *status)
     uint64_t zSig64;
     uint32_t zSig;
 
+    HOST_FLOAT32_OP(a, b, host_op_mul, status);
+
     aSig = extractFloat32Frac(a);
     aExp = extractFloat32Exp(a);
     aSign = extractFloat32Sign(a);
@@ -1133,6 +1402,8 @@ float32 float32_div(float32 a, float32 b, float_status_t *status)
     int16_t aExp, bExp, zExp;
     uint32_t aSig, bSig, zSig;
 
+    HOST_FLOAT32_OP(a, b, host_op_div, status);
+
     aSig = extractFloat32Frac(a);
     aExp = extractFloat32Exp(a);
     aSign = extractFloat32Sign(a);
@@ -1205,6 +1476,8 @@ float32 float32_sqrt(float32 a, float_status_t *status)
     uint32_t aSig, zSig;
     uint64_t rem, term;
 
+    HOST_FLOAT32_SQRT(a, status);
+
     aSig = extractFloat32Frac(a);
     aExp = extractFloat32Exp(a);
     aSign = extractFloat32Sign(a);
@@ -2245,6 +2518,8 @@ static float64 subFloat64Sigs(float64 a, float64 b, int zSign, float_status_t *s
 
 float64 float64_add(float64 a, float64 b, float_status_t *status)
 {
+    HOST_FLOAT64_OP(a, b, host_op_add, status);
+
     int aSign = extractFloat64Sign(a);
     int bSign = extractFloat64Sign(b);
 
@@ -2264,6 +2539,8 @@ float64 float64_add(float64 a, float64 b, float_status_t *status)
 
 float64 float64_sub(float64 a, float64 b, float_status_t *status)
 {
+    HOST_FLOAT64_OP(a, b, host_op_sub, status);
+
     int aSign = extractFloat64Sign(a);
     int bSign = extractFloat64Sign(b);
 
@@ -2287,6 +2564,8 @@ float64 float64_mul(float64 a, float64 b, float_status_t *status)
     int16_t aExp, bExp, zExp;
     uint64_t aSig, bSig, zSig0, zSig1;
 
+    HOST_FLOAT64_OP(a, b, host_op_mul, status);
+
     aSig = extractFloat64Frac(a);
     aExp = extractFloat64Exp(a);
     aSign = extractFloat64Sign(a);
@@ -2359,6 +2638,8 @@ float64 float64_div(float64 a, float64 b, float_status_t *status)
     uint64_t rem0, rem1;
     uint64_t term0, term1;
 
+    HOST_FLOAT64_OP(a, b, host_op_div, status);
+
     aSig = extractFloat64Frac(a);
     aExp = extractFloat64Exp(a);
     aSign = extractFloat64Sign(a);
@@ -2437,6 +2718,8 @@ float64 float64_sqrt(float64 a, float_status_t *status)
     uint64_t aSig, zSig, doubleZSig;
     uint64_t rem0, rem1, term0, term1;
 
+    HOST_FLOAT64_SQRT(a, status);
+
     aSig = extractFloat64Frac(a);
     aExp = extractFloat64Exp(a);
     aSign = extractFloat64Sign(a);
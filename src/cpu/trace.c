@@ -1,5 +1,6 @@
 #include "cpu/cpu.h"
 #include "cpu/opcodes.h"
+#include "tracelog.h"
 #include <string.h>
 
 static struct decoded_instruction temporary_placeholder = {
@@ -12,6 +13,7 @@ static uint32_t hash_eip(uint32_t phys)
 
 void cpu_trace_flush(void)
 {
+    TRACELOG(TRACE_CODE_FLUSH, 0, cpu.trace_cache_usage, 0, 0);
     h_memset(cpu.trace_info, 0, sizeof(struct trace_info) * TRACE_INFO_ENTRIES);
     cpu.trace_cache_usage = 0;
 }
@@ -33,11 +35,14 @@ struct decoded_instruction* cpu_get_trace(void)
             if (cpu_mmu_translate(lin_eip, cpu.tlb_shift_read | 8))
                 return &temporary_placeholder;
         }
-        cpu.phys_eip = PTR_TO_PHYS(cpu.tlb[lin_eip >> 12] + lin_eip);
+        cpu.phys_eip = TLB_TO_PHYS(lin_eip);
         cpu.eip_phys_bias = virt_eip - cpu.phys_eip;
         cpu.last_phys_eip = cpu.phys_eip & ~0xFFF;
     }
 
+    if (cpu_profile_enabled)
+        cpu_profile_trace();
+
     // Read the trace entry.
     struct trace_info* trace = &cpu.trace_info[hash_eip(cpu.phys_eip)];
     // If it matches, return the associated trace
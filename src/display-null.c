@@ -0,0 +1,182 @@
+// Null display driver, for running without a window (batch jobs, CI, servers)
+// The VGA still renders into a framebuffer, which can be written out as a PPM image. This is controlled through
+// environment variables:
+//   HALFIX_DUMP=prefix          Enable dumps. Images are written to prefix-000000.ppm, prefix-000001.ppm, ...
+//   HALFIX_DUMP_INTERVAL=ms     Write an image every "ms" milliseconds of emulated time (default: 1000, 0 to disable)
+// On POSIX systems, sending SIGUSR1 writes an image as soon as possible, regardless of the interval.
+// SIGINT and SIGTERM exit normally, so that the profile, trace and drift reports still get written.
+
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200112L // nanosleep, SIGUSR1
+#endif
+#include "display.h"
+#include "devices.h"
+#include "util.h"
+#include <signal.h>
+#include <stdlib.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#define DISPLAY_LOG(x, ...) LOG("DISPLAY", x, ##__VA_ARGS__)
+
+static uint32_t* pixels;
+static int w, h;
+
+static char* dump_prefix;
+static int dump_count;
+static itick_t dump_interval, dump_next;
+static volatile sig_atomic_t dump_requested, quit_requested;
+
+static void display_sigquit(int sig)
+{
+    UNUSED(sig);
+    quit_requested = 1;
+}
+
+#ifndef _WIN32
+static void display_sigusr1(int sig)
+{
+    UNUSED(sig);
+    dump_requested = 1;
+}
+#endif
+
+void display_init(void)
+{
+    char* interval;
+    signal(SIGINT, display_sigquit);
+    signal(SIGTERM, display_sigquit);
+
+    dump_prefix = getenv("HALFIX_DUMP");
+    if (!dump_prefix)
+        return;
+
+    interval = getenv("HALFIX_DUMP_INTERVAL");
+    dump_interval = (itick_t)(interval ? atoi(interval) : 1000) * ticks_per_second / 1000;
+    dump_next = get_now() + dump_interval;
+#ifndef _WIN32
+    signal(SIGUSR1, display_sigusr1);
+#endif
+}
+
+void display_quit(void)
+{
+}
+
+void display_update(int scanline_start, int scanlines)
+{
+    UNUSED(scanline_start | scanlines);
+}
+
+void display_set_resolution(int width, int height)
+{
+    if ((!width && !height)) {
+        display_set_resolution(640, 480);
+        return;
+    }
+    DISPLAY_LOG("Changed resolution to w=%d h=%d\n", width, height);
+    if (pixels)
+        h_free(pixels);
+    pixels = h_calloc(width * height, 4);
+    w = width;
+    h = height;
+}
+
+void* display_get_pixels(void)
+{
+    return pixels;
+}
+
+// Write the framebuffer as a binary PPM (P6)
+static void display_dump(void)
+{
+    char path[1024], header[32];
+    uint8_t* row;
+    void* f;
+    int len;
+
+    if (!pixels)
+        return;
+    len = h_sprintf(path, "%.1000s-%06d.ppm", dump_prefix, dump_count++);
+    UNUSED(len);
+    f = h_fopen(path, "wb");
+    if (!f) {
+        DISPLAY_LOG("Unable to open %s\n", path);
+        return;
+    }
+    len = h_sprintf(header, "P6\n%d %d\n255\n", w, h);
+    h_fwrite(header, len, 1, f);
+
+    row = h_malloc(w * 3);
+    for (int y = 0; y < h; y++) {
+        uint32_t* src = pixels + y * w;
+        for (int x = 0; x < w; x++) {
+            // The VGA renders 0xAARRGGBB pixels
+            row[x * 3 + 0] = src[x] >> 16;
+            row[x * 3 + 1] = src[x] >> 8;
+            row[x * 3 + 2] = src[x];
+        }
+        h_fwrite(row, w * 3, 1, f);
+    }
+    h_free(row);
+    h_fclose(f);
+}
+
+void display_handle_events(void)
+{
+    if (quit_requested)
+        exit(0);
+    if (!dump_prefix)
+        return;
+    if (dump_requested) {
+        dump_requested = 0;
+        display_dump();
+    }
+    if (dump_interval && get_now() >= dump_next) {
+        display_dump();
+        dump_next = get_now() + dump_interval;
+    }
+}
+
+void display_update_cycles(int cycles_elapsed, int us)
+{
+    UNUSED(cycles_elapsed | us);
+}
+
+void display_sleep(int ms)
+{
+#ifdef _WIN32
+    Sleep((DWORD)ms);
+#else
+    struct timespec ts;
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (long)(ms % 1000) * 1000000;
+    nanosleep(&ts, NULL);
+#endif
+}
+
+void display_wait(int us)
+{
+    // There are no host events to wake up for
+#ifdef _WIN32
+    Sleep((DWORD)((us + 999) / 1000));
+#else
+    struct timespec ts;
+    ts.tv_sec = us / 1000000;
+    ts.tv_nsec = (long)(us % 1000000) * 1000;
+    nanosleep(&ts, NULL);
+#endif
+}
+
+void* display_get_handle(int handle_id)
+{
+    UNUSED(handle_id);
+    return NULL;
+}
+
+void display_release_mouse(void)
+{
+}
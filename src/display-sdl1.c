@@ -387,6 +387,11 @@ void display_sleep(int ms)
 {
     SDL_Delay(ms);
 }
+void display_wait(int us)
+{
+    // SDL 1.2 has no way of waiting for events with a timeout
+    SDL_Delay((us + 999) / 1000);
+}
 
 #else // Headless mode
 #include "util.h"
@@ -24,7 +24,9 @@
 #include <stdlib.h>
 #include <stdbool.h>
 
-#define SDL2_LOCK_IMPL
+// The VGA only redraws the parts of the screen that changed, so the framebuffer has to keep its contents between
+// frames, which a locked streaming texture doesn't promise to do.
+// #define SDL2_LOCK_IMPL
 
 #define DISPLAY_LOG(x, ...) LOG("DISPLAY", x, ##__VA_ARGS__)
 #define DISPLAY_FATAL(x, ...)          \
@@ -176,14 +178,14 @@ void display_update(int scanline_start, int scanlines)
         SDL_RenderCopy(renderer, texture, NULL, &real_dst_rect);
         SDL_LockTexture(texture, NULL, &surface_pixels, &pitch);
 #else
-        SDL_UpdateTexture(texture, NULL, surface_pixels, 4 * w);
-        SDL_Rect src_rect = {
-            .x = 0, .y = scanline_start, .w = w, .h = scanlines
-        };
-        SDL_FRect dst_rect = {
-            .x = 0.0f, .y = (float)scanline_start * scale_y, .w = (float)w * scale_x, .h = (float)scanlines * scale_y
-        };
-        SDL_RenderCopyF(renderer, texture, &src_rect, &dst_rect);
+        // Only upload the scanlines that changed, but the whole screen has to be drawn again
+        if (scanlines) {
+            SDL_Rect src_rect = {
+                .x = 0, .y = scanline_start, .w = w, .h = scanlines
+            };
+            SDL_UpdateTexture(texture, &src_rect, (uint32_t*)surface_pixels + scanline_start * w, 4 * w);
+        }
+        SDL_RenderCopyF(renderer, texture, NULL, &dst_rect);
 #endif
 #ifdef MOBILE_BUILD
         if (!mouse_enabled) {
@@ -682,7 +684,9 @@ void display_handle_events(void)
                     def_real_scale_y = (float)ren_h / (float)win_h;
                 }
                 display_update_scale_mode();
-            }
+                display_update(0, 0);
+            } else if (event.window.event == SDL_WINDOWEVENT_EXPOSED)
+                display_update(0, 0);
             break;
         }
         }
@@ -851,6 +855,11 @@ void display_sleep(int ms)
 {
     SDL_Delay(ms);
 }
+void display_wait(int us)
+{
+    // Don't take the event off the queue, display_handle_events will get to it.
+    SDL_WaitEventTimeout(NULL, (us + 999) / 1000);
+}
 
 #else // Headless mode
 #include "util.h"
@@ -925,6 +925,11 @@ void display_sleep(int ms)
 {
     SDL_Delay(ms);
 }
+void display_wait(int us)
+{
+    // SDL 1.2 has no way of waiting for events with a timeout
+    SDL_Delay((us + 999) / 1000);
+}
 
 static void display_mouse_capture_update(int y)
 {
@@ -317,6 +317,14 @@ static LRESULT CALLBACK display_callback(HWND hwnd, UINT msg, WPARAM wparam, LPA
         screenx = windowx + LOWORD(lparam);
         screeny = windowy + HIWORD(lparam);
         break;
+    case WM_PAINT: {
+        // The VGA only sends the parts of the screen that changed, so anything else has to be repainted from here
+        PAINTSTRUCT ps;
+        HDC hdc = BeginPaint(hwnd, &ps);
+        BitBlt(hdc, 0, 0, cwidth, cheight, dc_src, 0, 0, SRCCOPY);
+        EndPaint(hwnd, &ps);
+        return 0;
+    }
     case WM_DESTROY:
         display_quit();
         ExitProcess(0);
@@ -660,6 +668,11 @@ void display_sleep(int ms)
 {
     Sleep((DWORD)ms);
 }
+void display_wait(int us)
+{
+    // Wakes up as soon as there's a message for display_handle_events
+    MsgWaitForMultipleObjects(0, NULL, FALSE, (DWORD)((us + 999) / 1000), QS_ALLINPUT);
+}
 
 #if 0
 void display_init(void);
@@ -4,6 +4,7 @@
 #include "drive.h"
 #include "platform.h"
 #include "state.h"
+#include "tracelog.h"
 #include "util.h"
 #include <stdlib.h>
 #include <string.h>
@@ -55,14 +56,17 @@ void drive_cancel_transfers(void)
 
 int drive_read(struct drive_info* info, void* a, void* b, uint32_t c, drv_offset_t d, drive_cb e)
 {
+    TRACELOG(TRACE_DISK_READ, 0, (uint32_t)d, (uint32_t)((uint64_t)d >> 32), c);
     return info->read(info->data, a, b, c, d, e);
 }
 int drive_prefetch(struct drive_info* info, void* a, uint32_t b, drv_offset_t c, drive_cb d)
 {
+    TRACELOG(TRACE_DISK_PREFETCH, 0, (uint32_t)c, (uint32_t)((uint64_t)c >> 32), b);
     return info->prefetch(info->data, a, b, c, d);
 }
 int drive_write(struct drive_info* info, void* a, void* b, uint32_t c, drv_offset_t d, drive_cb e)
 {
+    TRACELOG(TRACE_DISK_WRITE, 0, (uint32_t)d, (uint32_t)((uint64_t)d >> 32), c);
     return info->write(info->data, a, b, c, d, e);
 }
 
@@ -59,7 +59,7 @@ int emscripten_init(void){
 EMSCRIPTEN_KEEPALIVE
 int emscripten_run(void)
 {
-    int ms_to_sleep = pc_execute();
+    int ms_to_sleep = pc_execute() / 1000;
     vga_update();
     display_handle_events();
     return ms_to_sleep;
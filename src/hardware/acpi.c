@@ -11,6 +11,10 @@
 
 #define ACPI_CLOCK_SPEED 3579545
 
+// Power management status/enable register
+#define TMROF_STS (1 << 0)
+#define TMROF_EN (1 << 16)
+
 struct acpi_state {
     // <<< BEGIN STRUCT "struct" >>>
     int enabled;
@@ -59,9 +63,42 @@ static inline uint32_t read32le(uint8_t* x, uint32_t offset)
     return res;
 }
 
-static uint32_t acpi_get_clock(itick_t now)
+static itick_t acpi_get_clock(itick_t now)
+{
+    return (itick_t)((double)now * (double)ACPI_CLOCK_SPEED / (double)ticks_per_second);
+}
+
+// The SCI is asserted for as long as the overflow status bit is set and enabled.
+static void acpi_update_sci(void)
+{
+    if ((acpi.pmsts_en & TMROF_STS) && (acpi.pmsts_en & TMROF_EN))
+        pic_raise_irq(9);
+    else
+        pic_lower_irq(9);
+}
+
+// Schedule an event for the next time the 24-bit PM timer overflows
+static void acpi_timer_arm(itick_t now)
+{
+    if (!(acpi.pmsts_en & TMROF_EN)) {
+        timer_cancel(TIMER_ACPI);
+        return;
+    }
+    itick_t next = (acpi_get_clock(now) | 0xFFFFFF) + 1,
+            deadline = (itick_t)((double)next * (double)ticks_per_second / (double)ACPI_CLOCK_SPEED);
+    while (acpi_get_clock(deadline) < next)
+        deadline++;
+    timer_arm(TIMER_ACPI, deadline);
+}
+
+static void acpi_timer(itick_t now)
 {
-    return (uint32_t)((double)now * (double)ACPI_CLOCK_SPEED / (double)ticks_per_second);
+    uint32_t clock = (uint32_t)acpi_get_clock(now);
+    if ((clock ^ acpi.last_pm_clock) & 0xFF000000) // Bit 23 carried into bit 24
+        acpi.pmsts_en |= TMROF_STS;
+    acpi.last_pm_clock = clock;
+    acpi_update_sci();
+    acpi_timer_arm(now);
 }
 
 static uint32_t acpi_pm_read(uint32_t addr)
@@ -77,7 +114,7 @@ static uint32_t acpi_pm_read(uint32_t addr)
         break;
     case 8:
         // Timer
-        result = acpi_get_clock(get_now());
+        result = (uint32_t)acpi_get_clock(get_now());
         break;
     default:
         ACPI_FATAL("TODO: power management read: %04x\n", addr);
@@ -87,8 +124,10 @@ static uint32_t acpi_pm_read(uint32_t addr)
 static void acpi_pm_write(uint32_t addr, uint32_t data)
 {
     int shift = (addr & 3) * 8;
+    uint32_t old;
     switch (addr & 0x3C) {
     case 0:
+        old = acpi.pmsts_en;
         if ((addr & 2) == 0) {
             // Writing to this register clears some bits in the status register
             data = ~data;
@@ -98,6 +137,11 @@ static void acpi_pm_write(uint32_t addr, uint32_t data)
             acpi.pmsts_en &= 0xFF << (shift ^ 8);
             acpi.pmsts_en |= data << shift;
         }
+        if ((old ^ acpi.pmsts_en) & TMROF_EN) {
+            acpi.last_pm_clock = (uint32_t)acpi_get_clock(get_now());
+            acpi_timer_arm(get_now());
+        }
+        acpi_update_sci();
         break;
     case 4: // PM Control
         acpi.pmcntrl &= ~(0xFF << shift);
@@ -287,38 +331,6 @@ static int acpi_pci_write(uint8_t* ptr, uint8_t addr, uint8_t data)
     return 0;
 }
 
-// ACPI timer
-int acpi_next(itick_t now_tick)
-{
-    if (acpi.enabled == 0)
-        return -1;
-
-    // ACPI timer
-    uint32_t now = acpi_get_clock(now_tick) & 0x00FFFFFF,
-             then = acpi.last_pm_clock & 0x00FFFFFF,
-             raise_irq = 0;
-    if (now < then) { // overflowed from 0xFFFFFF --> 0
-        raise_irq = 1;
-    }
-    if (acpi.pmsts_en & (1 << 16)) {
-        // Find out when we overflow our 23 bit counter
-        acpi.pmsts_en |= 1;
-        if (raise_irq) {
-            pic_raise_irq(9);
-        }else
-            pic_lower_irq(9);
-
-        acpi.last_pm_clock = acpi_get_clock(now_tick);
-        // Now find transition time from now.
-        uint32_t ticks_left = 0x1000000 - now;
-        // Convert it into ticks
-        return (int)((double)ticks_left * (double)ticks_per_second / (double)ACPI_CLOCK_SPEED);
-    } else {
-        pic_lower_irq(9);
-        return -1; // No timer enabled, ignore
-    }
-}
-
 static void acpi_state(void)
 {
     // <<< BEGIN AUTOGENERATE "state" >>>
@@ -335,6 +347,9 @@ static void acpi_state(void)
     // Remap IO
     acpi_remap_pmba(acpi.pmba);
     acpi_remap_smba(acpi.smba);
+    // Arming from here, instead of running acpi_timer, keeps an overflow that didn't happen from being reported
+    if (state_is_reading())
+        acpi_timer_arm(get_now());
 }
 
 void acpi_init(struct pc_settings* pc)
@@ -350,6 +365,7 @@ void acpi_init(struct pc_settings* pc)
     // Now register PCI handlers and callbacks
     io_register_reset(acpi_reset);
     state_register(acpi_state);
+    timer_register(TIMER_ACPI, acpi_timer);
 
     // TODO: I randomly selected bus #7. Can we reconfigure this?
     uint8_t* ptr = pci_create_device(0, 7, 0, acpi_pci_write);
@@ -0,0 +1,1049 @@
+// AHCI SATA controller (modeled after the ICH9's)
+// Unlike IDE, where every command is set up one register at a time, the guest builds a list of up to 32 commands per
+// port in its own memory. Each one has the ATA command in the form of a register FIS, and a PRD table saying where the
+// data goes. Once the guest sets the command's bit in PxCI, everything is read straight out of guest RAM and the data
+// is moved between the drive and guest memory without any further register accesses. With NCQ (READ/WRITE FPDMA
+// QUEUED), the guest can have all 32 slots in flight at once. Those are worked through in order of their position on
+// the disk, and the ones that finish together are reported with a single interrupt.
+// https://www.intel.com/content/dam/www/public/us/en/documents/technical-specifications/serial-ata-ahci-spec-rev1-3-1.pdf
+#include "devices.h"
+#include "drive.h"
+#include "pc.h"
+#include "state.h"
+#include "util.h"
+#include <string.h>
+
+#define AHCI_LOG(x, ...) LOG("AHCI", x, ##__VA_ARGS__)
+
+#define AHCI_PCI_SLOT 6
+#define AHCI_MMIO_SIZE 4096
+// Where the registers are until the BIOS moves them
+#define AHCI_DEFAULT_BASE 0xFEBF0000
+#define AHCI_MSI_CAP 0x80
+#define AHCI_SLOTS 32
+
+// Generic host control registers
+#define HBA_CAP 0x00
+#define HBA_GHC 0x04
+#define HBA_IS 0x08
+#define HBA_PI 0x0C
+#define HBA_VS 0x10
+#define HBA_PORTS 0x100 // Each port has 0x80 bytes of registers, starting here
+
+#define CAP_ISS_GEN1 (1 << 20) // 1.5 Gbps
+#define CAP_SAM (1 << 18) // AHCI only, no legacy IDE mode
+#define CAP_SCLO (1 << 24) // Command list override
+#define CAP_SNCQ (1 << 30) // Native command queueing
+
+#define GHC_HR 1 // HBA reset
+#define GHC_IE 2 // Interrupt enable
+#define GHC_AE 0x80000000 // AHCI enable
+
+// Port registers
+#define PX_CLB 0x00
+#define PX_CLBU 0x04
+#define PX_FB 0x08
+#define PX_FBU 0x0C
+#define PX_IS 0x10
+#define PX_IE 0x14
+#define PX_CMD 0x18
+#define PX_TFD 0x20
+#define PX_SIG 0x24
+#define PX_SSTS 0x28
+#define PX_SCTL 0x2C
+#define PX_SERR 0x30
+#define PX_SACT 0x34
+#define PX_CI 0x38
+
+#define PX_IS_DHRS (1 << 0) // Register FIS received
+#define PX_IS_SDBS (1 << 3) // Set device bits FIS received
+#define PX_IS_DPS (1 << 5) // A PRD with the interrupt bit set was processed
+#define PX_IS_TFES (1 << 30) // Task file error
+#define PX_IS_MASK 0xFDC000FF
+
+#define PX_CMD_ST (1 << 0) // Start processing the command list
+#define PX_CMD_SUD (1 << 1)
+#define PX_CMD_POD (1 << 2)
+#define PX_CMD_CLO (1 << 3) // Command list override
+#define PX_CMD_FRE (1 << 4) // FIS receive enable
+#define PX_CMD_FR (1 << 14)
+#define PX_CMD_CR (1 << 15)
+
+// Device present, 1.5 Gbps, active
+#define PX_SSTS_UP 0x113
+
+// FIS types, and where received ones go
+#define FIS_REG_H2D 0x27
+#define FIS_REG_D2H 0x34
+#define FIS_SDB 0xA1
+#define FIS_OFFSET_D2H 0x40
+#define FIS_OFFSET_SDB 0x58
+
+#define ATA_STATUS_BSY 0x80
+#define ATA_STATUS_DRDY 0x40
+#define ATA_STATUS_DSC 0x10
+#define ATA_STATUS_DRQ 0x08
+#define ATA_STATUS_ERR 0x01
+#define ATA_ERROR_ABRT 0x04
+#define ATA_ERROR_IDNF 0x10
+#define ATA_ERROR_UNC 0x40
+#define ATA_STATUS_OK (ATA_STATUS_DRDY | ATA_STATUS_DSC)
+
+#define ATA_SIGNATURE_DISK 0x00000101
+// Status and error registers right after a reset (diagnostics passed)
+#define ATA_TFD_RESET (1 << 8 | ATA_STATUS_OK)
+#define ATA_TFD_NO_DEVICE 0x7F
+
+// How long to wait before trying again if the drive is busy with someone else's transfer
+#define AHCI_RETRY_INTERVAL (ticks_per_second / 1000)
+// PRDs that are mapped straight to guest RAM. Anything longer goes through the bounce buffer.
+#define AHCI_MAX_XFERS 256
+
+static struct ahci_port {
+    uint32_t clb, fb, is, ie, cmd, tfd, sig, ssts, sctl, serr, sact, ci;
+    // NCQ commands that are done, but haven't been reported to the guest yet
+    uint32_t sdb;
+    // Set after a task file error. Nothing else is done until the guest restarts the port.
+    int halted;
+    int multiple_count;
+    // Sector just after the last NCQ transfer. The next command is the first one after this.
+    uint64_t position;
+} ports[MAX_AHCI_PORTS];
+
+static struct {
+    uint32_t ghc, is;
+    // Interrupt pending at the last ahci_update_irq, and whether something new has happened since
+    int irq_level, irq_event;
+    int last_port;
+} hba;
+
+static struct drive_info* drives[MAX_AHCI_PORTS];
+static uint8_t* pci;
+static uint32_t mmio_base;
+
+// The command being worked on
+static int active; // Set while a command is unfinished
+static int waiting; // Waiting for the drive or for the retry timer
+static int cur_port, cur_slot;
+static uint8_t fis[20];
+static uint32_t prdt, prd_count;
+static int ncq, writing, prd_irq;
+static uint8_t status, error;
+static uint64_t lba;
+static drv_offset_t offset;
+static uint32_t data_len;
+
+// The current command's PRDs, in the form that they're handed to the drive
+static struct ahci_xfer {
+    void* ptr;
+    uint32_t addr, len;
+} xfer[AHCI_MAX_XFERS];
+static int xfer_count, xfer_index;
+// Used when the PRDs aren't split up along sector boundaries, and for commands that return data of their own
+static uint8_t* bounce;
+static uint32_t bounce_size;
+static int bounced;
+
+// Bumped whenever the current command is dropped (the port stopped, or the HBA was reset), so that the drive's callback
+// for it does nothing
+static uintptr_t generation;
+
+static void ahci_run(void);
+
+// ============================================================================
+// Interrupts
+// ============================================================================
+
+static void ahci_send_msi(void)
+{
+    uint32_t addr = pci[AHCI_MSI_CAP + 4] | pci[AHCI_MSI_CAP + 5] << 8 | pci[AHCI_MSI_CAP + 6] << 16 | (uint32_t)pci[AHCI_MSI_CAP + 7] << 24;
+    uint16_t data = pci[AHCI_MSI_CAP + 8] | pci[AHCI_MSI_CAP + 9] << 8;
+    if ((addr & 0xFFF00000) != 0xFEE00000 || !apic_is_enabled())
+        return;
+    // There's only one CPU, so the destination doesn't matter
+    int type = data >> 8 & 7;
+    if (type == 1)
+        type = 3; // Lowest priority, numbered the way the APIC wants it (see ioapic.c)
+    apic_receive_bus_message(data & 0xFF, type, 0);
+}
+
+// Raise the interrupt if a port has something to report, either with a message or through the PCI interrupt line
+static void ahci_update_irq(void)
+{
+    for (int i = 0; i < MAX_AHCI_PORTS; i++)
+        if (ports[i].is & ports[i].ie)
+            hba.is |= 1 << i;
+
+    int msi = pci[AHCI_MSI_CAP + 2] & 1, level = (hba.ghc & GHC_IE) && hba.is;
+    int raise = level && (!hba.irq_level || hba.irq_event);
+    hba.irq_level = level;
+    hba.irq_event = 0;
+
+    if (msi || (pci[0x05] & 4) || !level) {
+        pci_set_irq_line(AHCI_PCI_SLOT, 0);
+        if (raise && msi)
+            ahci_send_msi();
+    } else if (raise) {
+        pci_pulse_irq_line(AHCI_PCI_SLOT);
+    }
+}
+
+static void ahci_port_event(int p, uint32_t bits)
+{
+    ports[p].is |= bits;
+    if (bits & ports[p].ie)
+        hba.irq_event = 1;
+}
+
+// ============================================================================
+// FISes sent to the guest
+// ============================================================================
+
+static void ahci_post_d2h(int p, uint32_t irq, uint64_t fis_lba, uint16_t count)
+{
+    struct ahci_port* port = &ports[p];
+    uint8_t* d2h;
+    if ((port->cmd & PX_CMD_FRE) && (d2h = pci_dma_ptr(port->fb + FIS_OFFSET_D2H, 20)) != NULL) {
+        h_memset(d2h, 0, 20);
+        d2h[0] = FIS_REG_D2H;
+        d2h[1] = irq ? 0x40 : 0;
+        d2h[2] = port->tfd;
+        d2h[3] = port->tfd >> 8;
+        d2h[4] = fis_lba;
+        d2h[5] = fis_lba >> 8;
+        d2h[6] = fis_lba >> 16;
+        d2h[7] = 0x40;
+        d2h[8] = fis_lba >> 24;
+        d2h[9] = fis_lba >> 32;
+        d2h[10] = fis_lba >> 40;
+        d2h[12] = count;
+        d2h[13] = count >> 8;
+    }
+    if (irq)
+        ahci_port_event(p, PX_IS_DHRS);
+}
+
+// What the drive sends after it has been reset
+static void ahci_port_signature(int p)
+{
+    struct ahci_port* port = &ports[p];
+    if (!drives[p])
+        return;
+    port->sig = ATA_SIGNATURE_DISK;
+    port->tfd = ATA_TFD_RESET;
+    ahci_post_d2h(p, 0, 1, 1);
+}
+
+// Tell the guest about all the NCQ commands that have finished at once
+static void ahci_report_sdb(int p)
+{
+    struct ahci_port* port = &ports[p];
+    uint8_t* sdb;
+    if (!port->sdb)
+        return;
+    if ((port->cmd & PX_CMD_FRE) && (sdb = pci_dma_ptr(port->fb + FIS_OFFSET_SDB, 8)) != NULL) {
+        sdb[0] = FIS_SDB;
+        sdb[1] = 0x40; // Interrupt
+        sdb[2] = ATA_STATUS_OK & 0x77;
+        sdb[3] = 0;
+        h_memcpy(sdb + 4, &port->sdb, 4);
+    }
+    port->sact &= ~port->sdb;
+    port->sdb = 0;
+    ahci_port_event(p, PX_IS_SDBS);
+}
+
+// ============================================================================
+// PRD tables
+// ============================================================================
+
+// Copy between "buf" and the memory described by the PRD table. Returns the number of bytes copied.
+static uint32_t ahci_prdt_copy(void* buf, uint32_t len, int to_guest)
+{
+    uint8_t* buf8 = buf;
+    uint32_t copied = 0;
+    for (uint32_t i = 0; i < prd_count && copied < len; i++) {
+        uint32_t* prd = pci_dma_ptr(prdt + i * 16, 16);
+        if (!prd)
+            break;
+        uint32_t n = (prd[3] & 0x3FFFFF) + 1;
+        if (n > len - copied)
+            n = len - copied;
+        uint8_t* ptr = prd[1] ? NULL : pci_dma_ptr(prd[0], n);
+        if (!ptr)
+            break;
+        if (to_guest) {
+            h_memcpy(ptr, buf8 + copied, n);
+            pci_dma_written(prd[0], n);
+        } else
+            h_memcpy(buf8 + copied, ptr, n);
+        if (prd[3] & 0x80000000)
+            prd_irq = 1;
+        copied += n;
+    }
+    return copied;
+}
+
+static void ahci_bounce(uint32_t len)
+{
+    if (bounce_size < len) {
+        bounce = h_realloc(bounce, len);
+        bounce_size = len;
+    }
+}
+
+// Fill in xfer[] for the data part of a read or write. Returns 0 if the PRD table is too short.
+static int ahci_map_prdt(void)
+{
+    uint32_t left = data_len;
+    xfer_count = xfer_index = bounced = 0;
+    for (uint32_t i = 0; i < prd_count && left; i++) {
+        uint32_t* prd = pci_dma_ptr(prdt + i * 16, 16);
+        if (!prd)
+            return 0;
+        uint32_t len = (prd[3] & 0x3FFFFF) + 1;
+        if (len > left)
+            len = left;
+        void* ptr = prd[1] ? NULL : pci_dma_ptr(prd[0], len);
+        if (!ptr || (len & 511) || xfer_count == AHCI_MAX_XFERS) {
+            bounced = 1;
+            break;
+        }
+        if (prd[3] & 0x80000000)
+            prd_irq = 1;
+        xfer[xfer_count].ptr = ptr;
+        xfer[xfer_count].addr = prd[0];
+        xfer[xfer_count++].len = len;
+        left -= len;
+    }
+    if (!bounced)
+        return left == 0;
+
+    ahci_bounce(data_len);
+    xfer[0].ptr = bounce;
+    xfer[0].len = data_len;
+    xfer_count = 1;
+    prd_irq = 0;
+    if (writing)
+        return ahci_prdt_copy(bounce, data_len, 0) == data_len;
+    return 1;
+}
+
+// ============================================================================
+// ATA commands
+// ============================================================================
+
+static void ahci_store_string(uint16_t* id, int word, const char* str, int length)
+{
+    // Two characters per word, with the first one in the upper byte
+    for (int i = 0; i < length; i += 2) {
+        char a = *str ? *str++ : ' ';
+        char b = *str ? *str++ : ' ';
+        id[word + (i >> 1)] = (uint8_t)a << 8 | (uint8_t)b;
+    }
+}
+
+static void ahci_identify(int p, uint16_t* id)
+{
+    struct drive_info* drv = drives[p];
+    uint32_t chs = drv->cylinders_per_head * drv->heads * drv->sectors_per_cylinder;
+    char serial[21];
+
+    h_memset(id, 0, 512);
+    id[0] = 0x0040; // Fixed disk
+    id[1] = drv->cylinders_per_head;
+    id[3] = drv->heads;
+    id[6] = drv->sectors_per_cylinder;
+    h_sprintf(serial, "HFXSATA%05d", p);
+    ahci_store_string(id, 10, serial, 20);
+    ahci_store_string(id, 23, "0.0.1", 8);
+    ahci_store_string(id, 27, "Halfix Virtual SATA Drive", 40);
+    id[47] = 0x8000 | 16; // READ/WRITE MULTIPLE with up to 16 sectors
+    id[49] = (1 << 9) | (1 << 8); // LBA and DMA
+    id[50] = 0x4000;
+    id[53] = 7; // Words 54-58, 64-70, and 88 are valid
+    id[54] = drv->cylinders_per_head;
+    id[55] = drv->heads;
+    id[56] = drv->sectors_per_cylinder;
+    id[57] = chs;
+    id[58] = chs >> 16;
+    id[59] = ports[p].multiple_count ? 0x100 | ports[p].multiple_count : 0;
+    uint32_t lba28 = drv->sectors > 0x0FFFFFFF ? 0x0FFFFFFF : drv->sectors;
+    id[60] = lba28;
+    id[61] = lba28 >> 16;
+    id[63] = 0x07 | 0x0400; // MDMA 0-2, MDMA 2 selected
+    id[64] = 3; // PIO 3 and 4
+    id[65] = id[66] = id[67] = id[68] = 120;
+    id[75] = AHCI_SLOTS - 1; // Queue depth
+    id[76] = (1 << 8) | (1 << 1); // NCQ, 1.5 Gbps
+    id[80] = 0xF0; // ATA/ATAPI-4 to 7
+    id[82] = 1 << 14;
+    id[83] = (1 << 14) | (1 << 13) | (1 << 12) | (1 << 10); // FLUSH CACHE (EXT), LBA48
+    id[84] = 1 << 14;
+    id[85] = 1 << 14;
+    id[86] = (1 << 13) | (1 << 12) | (1 << 10);
+    id[87] = 1 << 14;
+    id[88] = 0x7F | 0x2000; // UDMA 0-6, UDMA 5 selected
+    id[100] = drv->sectors;
+    id[101] = drv->sectors >> 16;
+}
+
+// Work out the position and length of a read or write. Returns 0 if it's out of range.
+static int ahci_setup_rw(int lba48, int queued)
+{
+    struct drive_info* drv = drives[cur_port];
+    uint32_t sectors;
+    if (queued)
+        sectors = fis[3] | fis[11] << 8; // The sector count is in the features register
+    else if (lba48)
+        sectors = fis[12] | fis[13] << 8;
+    else
+        sectors = fis[12];
+    if (!sectors)
+        sectors = lba48 ? 65536 : 256;
+
+    if (lba48)
+        lba = fis[4] | fis[5] << 8 | fis[6] << 16 | (uint64_t)fis[8] << 24 | (uint64_t)fis[9] << 32 | (uint64_t)fis[10] << 40;
+    else if (fis[7] & 0x40)
+        lba = fis[4] | fis[5] << 8 | fis[6] << 16 | (fis[7] & 15) << 24;
+    else {
+        // CHS
+        uint32_t cylinder = fis[5] | fis[6] << 8, head = fis[7] & 15, sector = fis[4];
+        if (!sector)
+            return 0;
+        lba = ((uint64_t)cylinder * drv->heads + head) * drv->sectors_per_cylinder + sector - 1;
+    }
+    if (lba > drv->sectors || sectors > drv->sectors - lba)
+        return 0;
+    offset = (drv_offset_t)lba * 512;
+    data_len = sectors * 512;
+    return 1;
+}
+
+static void ahci_fail(uint8_t err)
+{
+    status = ATA_STATUS_DRDY | ATA_STATUS_ERR;
+    error = err;
+    data_len = 0;
+}
+
+// Parse the command in "fis". Anything that doesn't need the drive is finished here.
+static void ahci_start(void)
+{
+    struct ahci_port* port = &ports[cur_port];
+    status = ATA_STATUS_OK;
+    error = 0;
+    data_len = 0;
+    xfer_count = xfer_index = bounced = 0;
+    ncq = writing = prd_irq = 0;
+    lba = 0;
+    active = 1;
+
+    int lba48 = 0;
+    switch (fis[2]) {
+    case 0x60: // READ FPDMA QUEUED
+    case 0x61: // WRITE FPDMA QUEUED
+        ncq = 1;
+        lba48 = 1;
+        writing = fis[2] == 0x61;
+        goto rw;
+    case 0x24: // READ SECTORS EXT
+    case 0x25: // READ DMA EXT
+    case 0x29: // READ MULTIPLE EXT
+    case 0x34: // WRITE SECTORS EXT
+    case 0x35: // WRITE DMA EXT
+    case 0x39: // WRITE MULTIPLE EXT
+        lba48 = 1;
+    // fallthrough
+    case 0x20: // READ SECTORS
+    case 0x21:
+    case 0xC4: // READ MULTIPLE
+    case 0xC8: // READ DMA
+    case 0x30: // WRITE SECTORS
+    case 0x31:
+    case 0xC5: // WRITE MULTIPLE
+    case 0xCA: // WRITE DMA
+        // PIO or DMA makes no difference here, since the data goes through the PRD table either way
+        writing = (fis[2] & 0xF0) == 0x30 || fis[2] == 0xC5 || fis[2] == 0xCA;
+    rw:
+        if (!ahci_setup_rw(lba48, ncq))
+            ahci_fail(ATA_ERROR_IDNF);
+        else if (!ahci_map_prdt())
+            ahci_fail(ATA_ERROR_ABRT);
+        break;
+    case 0xEC: // IDENTIFY DEVICE
+        ahci_bounce(512);
+        ahci_identify(cur_port, (uint16_t*)bounce);
+        ahci_prdt_copy(bounce, 512, 1);
+        data_len = 512;
+        break;
+    case 0xC6: // SET MULTIPLE MODE
+        if (fis[12] > 16 || (fis[12] & (fis[12] - 1)))
+            ahci_fail(ATA_ERROR_ABRT);
+        else
+            port->multiple_count = fis[12];
+        break;
+    case 0xF8: // READ NATIVE MAX ADDRESS
+    case 0x27: // READ NATIVE MAX ADDRESS EXT
+        lba = drives[cur_port]->sectors - 1;
+        if (fis[2] == 0xF8 && lba > 0x0FFFFFFF)
+            lba = 0x0FFFFFFF;
+        break;
+    case 0x90: // EXECUTE DEVICE DIAGNOSTIC
+        error = 1;
+        break;
+    case 0xE5: // CHECK POWER MODE
+        lba = 0; // Reported in the sector count instead, see ahci_complete
+        break;
+    case 0xE7: // FLUSH CACHE
+    case 0xEA: // FLUSH CACHE EXT
+        // Commands are finished in order, so everything written before this has already gone to the drive
+    case 0xEF: // SET FEATURES
+    case 0x91: // INITIALIZE DEVICE PARAMETERS
+    case 0x10 ... 0x1F: // RECALIBRATE
+    case 0x40 ... 0x42: // READ VERIFY SECTORS
+    case 0x70: // SEEK
+    case 0xE0 ... 0xE3: // STANDBY, IDLE
+        break;
+    default:
+        AHCI_LOG("Port %d: unknown command %02x\n", cur_port, fis[2]);
+        ahci_fail(ATA_ERROR_ABRT);
+        break;
+    }
+}
+
+static void ahci_drive_cb(void* ptr, int result)
+{
+    if ((uintptr_t)ptr != generation)
+        return;
+    if (result)
+        ahci_fail(ATA_ERROR_UNC);
+    // The next PRD can't be started from in here, so ahci_run picks things up from the timer
+    timer_arm(TIMER_AHCI, get_now());
+}
+
+// Hand the rest of the current command to the drive. Returns 0 if it has to be waited for.
+static int ahci_continue(void)
+{
+    while (xfer_index < xfer_count && !(status & ATA_STATUS_ERR)) {
+        // IDE or virtio-blk might be in the middle of their own asynchronous transfer, and there's only room for one
+        if (drive_async_event_in_progress()) {
+            timer_arm(TIMER_AHCI, get_now() + AHCI_RETRY_INTERVAL);
+            return 0;
+        }
+        struct ahci_xfer* x = &xfer[xfer_index++];
+        int res;
+        if (writing)
+            res = drive_write(drives[cur_port], (void*)generation, x->ptr, x->len, offset, ahci_drive_cb);
+        else
+            res = drive_read(drives[cur_port], (void*)generation, x->ptr, x->len, offset, ahci_drive_cb);
+        offset += x->len;
+        if (res == DRIVE_RESULT_ASYNC)
+            return 0;
+        if (res != DRIVE_RESULT_SYNC)
+            ahci_fail(ATA_ERROR_UNC);
+    }
+    return 1;
+}
+
+static void ahci_complete(void)
+{
+    struct ahci_port* port = &ports[cur_port];
+    uint32_t bit = 1u << cur_slot;
+    active = 0;
+
+    if (!(status & ATA_STATUS_ERR) && !writing && xfer_count) {
+        if (bounced)
+            ahci_prdt_copy(bounce, data_len, 1);
+        else {
+            // ahci_prdt_copy takes care of this for the bounce buffer, but not for PRDs that the drive wrote to directly
+            for (int i = 0; i < xfer_count; i++)
+                pci_dma_written(xfer[i].addr, xfer[i].len);
+        }
+    }
+    uint32_t* header = pci_dma_ptr(port->clb + cur_slot * 32, 32);
+    if (header)
+        header[1] = data_len; // Bytes transferred
+    if (prd_irq)
+        ahci_port_event(cur_port, PX_IS_DPS);
+
+    port->tfd = error << 8 | status;
+    if (status & ATA_STATUS_ERR) {
+        // The command stays in PxCI, and the port stops until the guest has dealt with the error
+        ahci_post_d2h(cur_port, 1, lba, 0);
+        ahci_port_event(cur_port, PX_IS_TFES);
+        port->halted = 1;
+        return;
+    }
+    port->ci &= ~bit;
+    if (ncq) {
+        port->position = lba + data_len / 512;
+        port->sdb |= bit;
+    } else
+        ahci_post_d2h(cur_port, 1, lba, fis[2] == 0xE5 ? 0xFF : 0);
+}
+
+// ============================================================================
+// Command list processing
+// ============================================================================
+
+// Read the command FIS of a slot into "dest." Returns 0 if the command list or command table is outside of RAM.
+static int ahci_read_fis(int p, int slot, uint8_t* dest)
+{
+    uint32_t* header = pci_dma_ptr(ports[p].clb + slot * 32, 32);
+    uint8_t* cfis;
+    if (!header || !(cfis = pci_dma_ptr(header[2] & ~0x7F, 0x80)))
+        return 0;
+    h_memcpy(dest, cfis, 20);
+    return 1;
+}
+
+// Pick the slot to do next on a port, or return -1 if there's nothing to do. NCQ commands are taken in order of their
+// position on the disk, starting from where the last one left off.
+static int ahci_next_slot(int p)
+{
+    struct ahci_port* port = &ports[p];
+    uint32_t pending = port->ci;
+    if (!(port->cmd & PX_CMD_ST) || port->halted || !pending)
+        return -1;
+    if (!(pending & port->sact))
+        return __builtin_ctz(pending);
+
+    int best = -1, best_wrapped = 1;
+    uint64_t best_lba = 0;
+    uint8_t cfis[20];
+    for (int i = 0; i < AHCI_SLOTS; i++) {
+        if (!(pending & port->sact & (1u << i)) || !ahci_read_fis(p, i, cfis))
+            continue;
+        uint64_t pos = cfis[4] | cfis[5] << 8 | cfis[6] << 16 | (uint64_t)cfis[8] << 24 | (uint64_t)cfis[9] << 32 | (uint64_t)cfis[10] << 40;
+        int wrapped = pos < port->position;
+        if (best < 0 || wrapped < best_wrapped || (wrapped == best_wrapped && pos < best_lba)) {
+            best = i;
+            best_wrapped = wrapped;
+            best_lba = pos;
+        }
+    }
+    return best < 0 ? (int)__builtin_ctz(pending) : best;
+}
+
+// Find the next command, going around the ports in turn. Commands that don't involve the drive are finished here.
+static int ahci_next_command(void)
+{
+    for (int i = 1; i <= MAX_AHCI_PORTS; i++) {
+        int p = (hba.last_port + i) % MAX_AHCI_PORTS, slot;
+        while ((slot = ahci_next_slot(p)) >= 0) {
+            struct ahci_port* port = &ports[p];
+            cur_port = p;
+            cur_slot = slot;
+            hba.last_port = p;
+
+            uint32_t* header = pci_dma_ptr(port->clb + slot * 32, 32);
+            if (!drives[p] || !ahci_read_fis(p, slot, fis) || fis[0] != FIS_REG_H2D) {
+                AHCI_LOG("Port %d: bad command in slot %d\n", p, slot);
+                port->ci &= ~(1u << slot);
+                port->sact &= ~(1u << slot);
+                continue;
+            }
+            prdt = (header[2] & ~0x7F) + 0x80;
+            prd_count = header[0] >> 16;
+
+            if (!(fis[1] & 0x80)) {
+                // Device control register. The drive sends its signature once the soft reset is over.
+                if (!(fis[15] & 4))
+                    ahci_port_signature(p);
+                port->ci &= ~(1u << slot);
+                continue;
+            }
+            ahci_start();
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Work through the command lists until they're empty or something has to be waited for
+static void ahci_run(void)
+{
+    while (!waiting) {
+        if (!active && !ahci_next_command())
+            break;
+        if (!ahci_continue()) {
+            waiting = 1;
+            break;
+        }
+        ahci_complete();
+    }
+    for (int i = 0; i < MAX_AHCI_PORTS; i++)
+        ahci_report_sdb(i);
+    ahci_update_irq();
+}
+
+static void ahci_timer(itick_t now)
+{
+    UNUSED(now);
+    waiting = 0;
+    ahci_run();
+}
+
+// Drop the current command, if there is one, along with anything the drive is still doing for it
+static void ahci_cancel(void)
+{
+    active = waiting = 0;
+    generation++;
+    timer_cancel(TIMER_AHCI);
+}
+
+// ============================================================================
+// Registers
+// ============================================================================
+
+static void ahci_port_reset(int p)
+{
+    struct ahci_port* port = &ports[p];
+    h_memset(port, 0, sizeof(struct ahci_port));
+    port->cmd = PX_CMD_SUD | PX_CMD_POD;
+    port->tfd = ATA_TFD_NO_DEVICE;
+    port->sig = 0xFFFFFFFF;
+    if (drives[p]) {
+        port->ssts = PX_SSTS_UP;
+        ahci_port_signature(p);
+    }
+}
+
+static void ahci_reset(void)
+{
+    ahci_cancel();
+    hba.ghc = 0;
+    hba.is = 0;
+    for (int i = 0; i < MAX_AHCI_PORTS; i++)
+        ahci_port_reset(i);
+    ahci_update_irq();
+}
+
+static uint32_t ahci_port_read(struct ahci_port* port, uint32_t reg)
+{
+    switch (reg) {
+    case PX_CLB:
+        return port->clb;
+    case PX_FB:
+        return port->fb;
+    case PX_IS:
+        return port->is;
+    case PX_IE:
+        return port->ie;
+    case PX_CMD:
+        return port->cmd;
+    case PX_TFD:
+        return port->tfd;
+    case PX_SIG:
+        return port->sig;
+    case PX_SSTS:
+        return port->ssts;
+    case PX_SCTL:
+        return port->sctl;
+    case PX_SERR:
+        return port->serr;
+    case PX_SACT:
+        return port->sact;
+    case PX_CI:
+        return port->ci;
+    default: // Upper halves of 64-bit addresses, and vendor specific registers
+        return 0;
+    }
+}
+
+static uint32_t ahci_reg_read(uint32_t offset)
+{
+    if (offset >= HBA_PORTS) {
+        int p = (offset - HBA_PORTS) >> 7;
+        return p < MAX_AHCI_PORTS ? ahci_port_read(&ports[p], offset & 0x7F) : 0;
+    }
+    switch (offset) {
+    case HBA_CAP:
+        return (MAX_AHCI_PORTS - 1) | (AHCI_SLOTS - 1) << 8 | CAP_ISS_GEN1 | CAP_SAM | CAP_SCLO | CAP_SNCQ;
+    case HBA_GHC:
+        return hba.ghc | GHC_AE;
+    case HBA_IS:
+        return hba.is;
+    case HBA_PI:
+        return (1 << MAX_AHCI_PORTS) - 1;
+    case HBA_VS:
+        return 0x00010100; // 1.1
+    default:
+        return 0;
+    }
+}
+
+static void ahci_port_write_cmd(int p, uint32_t data)
+{
+    struct ahci_port* port = &ports[p];
+    uint32_t old = port->cmd;
+    port->cmd = data & (PX_CMD_ST | PX_CMD_SUD | PX_CMD_POD | PX_CMD_FRE);
+    if (port->cmd & PX_CMD_FRE)
+        port->cmd |= PX_CMD_FR;
+    if (port->cmd & PX_CMD_ST)
+        port->cmd |= PX_CMD_CR;
+    if (data & PX_CMD_CLO)
+        port->tfd &= ~(ATA_STATUS_BSY | ATA_STATUS_DRQ);
+
+    // The signature that the drive sent while the port wasn't listening
+    if (!(old & PX_CMD_FRE) && (port->cmd & PX_CMD_FRE) && drives[p])
+        ahci_post_d2h(p, 0, 1, 1);
+
+    if ((old & PX_CMD_ST) && !(port->cmd & PX_CMD_ST)) {
+        // Everything that was outstanding is thrown away
+        port->ci = port->sact = port->sdb = 0;
+        port->halted = 0;
+        if (active && cur_port == p) {
+            ahci_cancel();
+            ahci_run(); // Other ports might have been waiting
+        }
+    } else if (!(old & PX_CMD_ST) && (port->cmd & PX_CMD_ST))
+        port->halted = 0;
+}
+
+static void ahci_port_write_sctl(int p, uint32_t data)
+{
+    struct ahci_port* port = &ports[p];
+    int det = port->sctl & 15;
+    port->sctl = data;
+    if ((data & 15) == 1) {
+        // COMRESET: the link goes down until DET is cleared
+        port->ssts = 0;
+        port->tfd = ATA_TFD_NO_DEVICE;
+    } else if (det == 1 && drives[p]) {
+        port->ssts = PX_SSTS_UP;
+        ahci_port_signature(p);
+    }
+}
+
+static void ahci_port_write(int p, uint32_t reg, uint32_t data, uint32_t mask)
+{
+    struct ahci_port* port = &ports[p];
+#define MERGE(x) (((x) & ~mask) | (data & mask))
+    switch (reg) {
+    case PX_CLB:
+        port->clb = MERGE(port->clb) & ~0x3FF;
+        break;
+    case PX_FB:
+        port->fb = MERGE(port->fb) & ~0xFF;
+        break;
+    case PX_IS:
+        port->is &= ~(data & mask);
+        break;
+    case PX_IE:
+        port->ie = MERGE(port->ie) & PX_IS_MASK;
+        break;
+    case PX_CMD:
+        ahci_port_write_cmd(p, MERGE(port->cmd));
+        break;
+    case PX_SCTL:
+        ahci_port_write_sctl(p, MERGE(port->sctl));
+        break;
+    case PX_SERR:
+        port->serr &= ~(data & mask);
+        break;
+    case PX_SACT:
+        if (port->cmd & PX_CMD_ST)
+            port->sact |= data & mask;
+        break;
+    case PX_CI:
+        if (port->cmd & PX_CMD_ST) {
+            port->ci |= data & mask;
+            ahci_run();
+        }
+        break;
+    default: // Read only, or upper halves of 64-bit addresses (which are hardwired to zero)
+        break;
+    }
+#undef MERGE
+}
+
+// "mask" has the bits of the 32-bit register that are actually being written
+static void ahci_reg_write(uint32_t offset, uint32_t data, uint32_t mask)
+{
+    if (offset >= HBA_PORTS) {
+        int p = (offset - HBA_PORTS) >> 7;
+        if (p < MAX_AHCI_PORTS)
+            ahci_port_write(p, offset & 0x7F, data, mask);
+    } else if (offset == HBA_GHC) {
+        if (data & mask & GHC_HR) {
+            ahci_reset();
+            return;
+        }
+        hba.ghc = ((hba.ghc & ~mask) | (data & mask)) & GHC_IE;
+    } else if (offset == HBA_IS)
+        hba.is &= ~(data & mask);
+    ahci_update_irq();
+}
+
+static uint32_t ahci_readb(uint32_t addr)
+{
+    uint32_t offset = addr - mmio_base;
+    return ahci_reg_read(offset & ~3) >> ((offset & 3) << 3) & 0xFF;
+}
+static uint32_t ahci_readw(uint32_t addr)
+{
+    uint32_t offset = addr - mmio_base;
+    if (offset & 1)
+        return ahci_readb(addr) | ahci_readb(addr + 1) << 8;
+    return ahci_reg_read(offset & ~3) >> ((offset & 2) << 3) & 0xFFFF;
+}
+static uint32_t ahci_readd(uint32_t addr)
+{
+    uint32_t offset = addr - mmio_base;
+    if (offset & 3)
+        return ahci_readw(addr) | ahci_readw(addr + 2) << 16;
+    return ahci_reg_read(offset);
+}
+static void ahci_writeb(uint32_t addr, uint32_t data)
+{
+    uint32_t offset = addr - mmio_base, shift = (offset & 3) << 3;
+    ahci_reg_write(offset & ~3, (data & 0xFF) << shift, 0xFFu << shift);
+}
+static void ahci_writew(uint32_t addr, uint32_t data)
+{
+    uint32_t offset = addr - mmio_base, shift = (offset & 2) << 3;
+    if (offset & 1) {
+        ahci_writeb(addr, data);
+        ahci_writeb(addr + 1, data >> 8);
+    } else
+        ahci_reg_write(offset & ~3, (data & 0xFFFF) << shift, 0xFFFFu << shift);
+}
+static void ahci_writed(uint32_t addr, uint32_t data)
+{
+    uint32_t offset = addr - mmio_base;
+    if (offset & 3) {
+        ahci_writew(addr, data);
+        ahci_writew(addr + 2, data >> 16);
+    } else
+        ahci_reg_write(offset, data, 0xFFFFFFFF);
+}
+
+// ============================================================================
+// PCI
+// ============================================================================
+
+static void ahci_remap(uint32_t newbase)
+{
+    if (newbase == mmio_base)
+        return;
+    io_remap_mmio_read(mmio_base, newbase);
+    mmio_base = newbase;
+    AHCI_LOG("Registers mapped to %08x\n", newbase);
+}
+
+static int ahci_pci_write(uint8_t* ptr, uint8_t addr, uint8_t data)
+{
+    switch (addr) {
+    case 0x04:
+        ptr[0x04] = data & 6; // Memory space and bus mastering
+        return 1;
+    case 0x05:
+        ptr[0x05] = data & 4; // Interrupt disable
+        ahci_update_irq();
+        return 1;
+    case 0x24 ... 0x27: {
+        // BAR5 (ABAR). The low bits are hardwired so that the BIOS can figure out how big it is.
+        ptr[addr] = data;
+        uint32_t bar = (ptr[0x24] | ptr[0x25] << 8 | ptr[0x26] << 16 | (uint32_t)ptr[0x27] << 24) & ~(AHCI_MMIO_SIZE - 1);
+        ptr[0x24] = bar;
+        ptr[0x25] = bar >> 8;
+        ptr[0x26] = bar >> 16;
+        ptr[0x27] = bar >> 24;
+        // Move the registers once the top byte is in, but not while the BAR is being sized
+        if (addr == 0x27 && bar && bar != (uint32_t)-AHCI_MMIO_SIZE)
+            ahci_remap(bar);
+        return 1;
+    }
+    case 0x3C: // Interrupt line
+        return 0;
+    case AHCI_MSI_CAP + 2: // MSI enable. Only one message is supported.
+        ptr[addr] = data & 1;
+        ahci_update_irq();
+        return 1;
+    case AHCI_MSI_CAP + 4: // Message address
+        ptr[addr] = data & ~3;
+        return 1;
+    case AHCI_MSI_CAP + 5 ... AHCI_MSI_CAP + 9: // Message address and data
+        ptr[addr] = data;
+        return 1;
+    default:
+        return 1; // Everything else is read only
+    }
+}
+
+static void ahci_state(void)
+{
+    struct bjson_object* obj = state_obj("ahci", 2);
+    state_field(obj, sizeof(ports), "ahci.ports", ports);
+    state_field(obj, sizeof(hba), "ahci.hba", &hba);
+
+    char filename[100];
+    for (int i = 0; i < MAX_AHCI_PORTS; i++) {
+        if (drives[i]) {
+            h_sprintf(filename, "ahci%d", i);
+            drive_state(drives[i], filename);
+        }
+    }
+
+    if (state_is_reading()) {
+        ahci_remap(pci[0x24] | pci[0x25] << 8 | pci[0x26] << 16 | (uint32_t)pci[0x27] << 24);
+        // The command that was being worked on (if any) is still in PxCI, so it's simply started over
+        active = waiting = 0;
+        generation++;
+        timer_arm(TIMER_AHCI, 0);
+    }
+}
+
+void ahci_init(struct pc_settings* pc)
+{
+    int count = 0;
+    for (int i = 0; i < MAX_AHCI_PORTS; i++) {
+        struct drive_info* drv = &pc->ahci_drives[i];
+        if (drv->type == DRIVE_TYPE_DISK) {
+            drives[i] = drv;
+            count++;
+        }
+    }
+    if (!count)
+        return;
+    if (!pc->pci_enabled) {
+        h_fprintf(stderr, "AHCI: PCI is disabled - ignoring SATA drives\n");
+        return;
+    }
+
+    // Intel ICH9 AHCI controller
+    pci = pci_create_device(0, AHCI_PCI_SLOT, 0, ahci_pci_write);
+    pci[0x00] = 0x86;
+    pci[0x01] = 0x80;
+    pci[0x02] = 0x22;
+    pci[0x03] = 0x29;
+    pci[0x06] = 0x10; // Capabilities list
+    pci[0x08] = 2; // Revision
+    pci[0x09] = 1; // AHCI 1.0
+    pci[0x0A] = 6; // SATA
+    pci[0x0B] = 1; // Mass storage
+    mmio_base = AHCI_DEFAULT_BASE;
+    pci[0x24] = mmio_base;
+    pci[0x25] = mmio_base >> 8;
+    pci[0x26] = mmio_base >> 16;
+    pci[0x27] = mmio_base >> 24;
+    pci[0x2C] = 0x86;
+    pci[0x2D] = 0x80;
+    pci[0x2E] = 0x22;
+    pci[0x2F] = 0x29;
+    pci[0x34] = AHCI_MSI_CAP;
+    pci[0x3D] = 1; // INTA#
+    pci[AHCI_MSI_CAP] = 5; // MSI, 32-bit address, one message
+    pci[AHCI_MSI_CAP + 1] = 0;
+
+    io_register_mmio_read(mmio_base, AHCI_MMIO_SIZE, ahci_readb, ahci_readw, ahci_readd);
+    io_register_mmio_write(mmio_base, AHCI_MMIO_SIZE, ahci_writeb, ahci_writew, ahci_writed);
+
+    io_register_reset(ahci_reset);
+    state_register(ahci_state);
+    timer_register(TIMER_AHCI, ahci_timer);
+
+    AHCI_LOG("%d drive(s) attached\n", count);
+}
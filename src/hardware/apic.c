@@ -10,6 +10,7 @@
 #include "cpuapi.h"
 #include "devices.h"
 #include "mmio.h"
+#include "tracelog.h"
 #include "pc.h"
 #ifdef _MSC_VER
 #include <intrin.h>
@@ -87,6 +88,7 @@ static struct apic_info {
     // <<< END STRUCT "struct" >>>
 } apic;
 
+static void apic_timer_arm(void);
 static void apic_state(void)
 {
     // <<< BEGIN AUTOGENERATE "state" >>>
@@ -114,6 +116,8 @@ static void apic_state(void)
     state_field(obj, 4, "apic.enabled", &apic.enabled);
     state_field(obj, 4, "apic.temp_data", &apic.temp_data);
 // <<< END AUTOGENERATE "state" >>>
+    if (state_is_reading())
+        apic_timer_arm();
 }
 
 static inline void set_bit(uint32_t* ptr, int bitpos, int bit)
@@ -312,6 +316,17 @@ static itick_t apic_get_period(void)
     return (itick_t)apic.timer_initial_count << apic_get_clock_divide();
 }
 
+// Schedule the next timer interrupt, if the timer is running
+static void apic_timer_arm(void)
+{
+    // TODO: TSC Deadline mode
+    // "A write of 0 to the initial-count register effectively stops the local APIC timer, in both one-shot and periodic mode."
+    if (!apic.enabled || apic.timer_initial_count == 0 || apic.timer_next == (itick_t)-1)
+        timer_cancel(TIMER_APIC);
+    else
+        timer_arm(TIMER_APIC, apic.timer_next);
+}
+
 static uint32_t apic_read(uint32_t addr)
 {
     addr -= apic.base;
@@ -436,6 +451,7 @@ static void apic_write(uint32_t addr, uint32_t data)
     case 0x0B: { // EOI register
         int current_isr = highest_set_bit(apic.isr);
         if (current_isr != -1) {
+            TRACELOG(TRACE_IRQ_EOI, 0, current_isr, 0, 0);
             set_bit(apic.isr, current_isr, 0);
             if (get_bit(apic.tmr, current_isr)) {
                 // Level-triggered interrupt, EOI-broadcast supression unsupported.
@@ -551,14 +567,13 @@ static void apic_write(uint32_t addr, uint32_t data)
         apic.timer_initial_count = data;
         apic.timer_reload_time = get_now();
         apic.timer_next = apic.timer_reload_time + apic_get_period();
-        cpu_cancel_execution_cycle(EXIT_STATUS_NORMAL);
+        apic_timer_arm();
         break;
     case 0x39:
         break;
     case 0x3E:
         apic.timer_divide = data;
         APIC_LOG("Timer divide=%d\n", 1 << apic_get_clock_divide());
-        cpu_cancel_execution_cycle(EXIT_STATUS_NORMAL);
         break;
     default:
         APIC_FATAL("TODO: APIC write %08x data=%08x\n", addr, data);
@@ -604,52 +619,35 @@ static void apic_reset(void)
     io_register_mmio_write(apic.base, 4096, apic_writeb, NULL, apic_write);
 }
 
-// Find out how many ticks until next interrupt
-int apic_next(itick_t now)
+// Called when apic.timer_next has been reached
+static void apic_timer(itick_t now)
 {
-    // TODO: TSC Deadline mode
-    if (!apic.enabled)
-        return -1;
-    // "A write of 0 to the initial-count register effectively stops the local APIC timer, in both one-shot and periodic mode."
-    if (apic.timer_initial_count == 0)
-        return -1;
-
-    // We want to keep the APIC timer running in the background, but not sending any interrupts
-    int apic_timer_enabled = 1;
-    
+    UNUSED(now);
     // Information regarding lvt
     int info = apic.lvt[LVT_INDEX_TIMER] >> 16;
 
-    if (apic.timer_next <= now) {
-        // Raise interrupt
-        if(!(info & 1)) {// LVT_DISABLED set to 0
-            APIC_LOG("  timer period %llu cur=%llu next=%llu\n", apic_get_period(), now, apic.timer_next);
-            apic_receive_bus_message(apic.lvt[LVT_INDEX_TIMER] & 0xFF, LVT_DELIVERY_FIXED, 0);
-        }
-        else apic_timer_enabled = 0;
-        
-        switch (info >> 1 & 3) {
-        case 2:
-            APIC_FATAL("TODO: TSC Deadline\n");
-            break;
-        case 1: // Periodic
-            apic.timer_next += apic_get_period();
-            break;
-        case 0: // One shot
-            apic.timer_next = -1; // Disable timer
-            return -1; // no more interrupts
-        case 3:
-            APIC_LOG("Invalid timer mode set, ignoring\n");
-            return -1;
-        }
-
-        // If no interrupts, then return
-        if(apic_timer_enabled) return -1;
+    // We want to keep the APIC timer running in the background, but not sending any interrupts
+    if (!(info & 1)) { // LVT_DISABLED set to 0
+        APIC_LOG("  timer period %llu cur=%llu next=%llu\n", apic_get_period(), now, apic.timer_next);
+        apic_receive_bus_message(apic.lvt[LVT_INDEX_TIMER] & 0xFF, LVT_DELIVERY_FIXED, 0);
     }
 
-    itick_t next = apic.timer_next - now;
-    if(next > 0xFFFFFFFF) return -1; // Don't allow wrap-around of large integers
-    return (uint32_t)next;
+    switch (info >> 1 & 3) {
+    case 2:
+        APIC_FATAL("TODO: TSC Deadline\n");
+        break;
+    case 1: // Periodic
+        apic.timer_next += apic_get_period();
+        break;
+    case 0: // One shot
+        apic.timer_next = -1; // Disable timer
+        break;
+    case 3:
+        APIC_LOG("Invalid timer mode set, ignoring\n");
+        apic.timer_next = -1;
+        break;
+    }
+    apic_timer_arm();
 }
 
 void apic_init(struct pc_settings* pc)
@@ -659,6 +657,7 @@ void apic_init(struct pc_settings* pc)
         return;
     io_register_reset(apic_reset);
     state_register(apic_state);
+    timer_register(TIMER_APIC, apic_timer);
 }
 
 int apic_is_enabled(void)
@@ -34,6 +34,12 @@ struct cmos {
 };
 
 static struct cmos cmos;
+
+static void cmos_arm(void)
+{
+    timer_arm(TIMER_CMOS, cmos.last_called + cmos.period);
+}
+
 static void cmos_state(void)
 {
     // <<< BEGIN AUTOGENERATE "state" >>>
@@ -49,6 +55,8 @@ static void cmos_state(void)
     state_field(obj, 8, "cmos.uip_period", &cmos.uip_period);
     state_field(obj, 8, "cmos.last_second_update", &cmos.last_second_update);
 // <<< END AUTOGENERATE "state" >>>
+    if (state_is_reading())
+        cmos_arm();
 }
 
 #define is24hour() (cmos.ram[0x0B] & 2)
@@ -180,6 +188,7 @@ static inline void cmos_update_timer(void)
         cmos.period = ticks_per_second; // We simply need to keep calling every second.
     }
     cmos.last_called = get_now();
+    cmos_arm();
 }
 static inline int bcd(int data)
 {
@@ -266,15 +275,15 @@ static void cmos_raise_irq(int why)
     pic_raise_irq(8);
 }
 
-// Called whenever the CPU exits from its main loop
-int cmos_clock(itick_t now)
+// Called by the timer queue once cmos.period ticks have passed since the last call
+static void cmos_timer(itick_t now)
 {
     // Some things to deal with:
     //  - Periodic interrupt
     //  - Updating seconds
     //  - Alarm Interrupt
     //  - UIP Interrupt (basically every second)
-    // Note that one or more of these can happen per cmos_clock (required by OS/2 Warp 4.5)
+    // Note that one or more of these can happen per cmos_timer call (required by OS/2 Warp 4.5)
     // Also sets UIP timer (needed for Windows XP timing calibration loop)
 
     // We have two options when it comes to CMOS timing: we can update registers per second or per interrupt.
@@ -282,55 +291,44 @@ int cmos_clock(itick_t now)
     // If the periodic interrupt is enabled, then there's no reason to update the clock every second AND check
     // for the periodic interrupt -- every Nth periodic interrupt, there will be a clock update.
 
-    itick_t next = cmos.last_called + cmos.period;
+    int why = 0;
 
-    if (now >= next) {
-        int why = 0;
+    if (cmos.ram[0x0B] & 0x40) {
+        // Periodic interrupt is enabled.
+        why |= PERIODIC;
 
-        if (cmos.ram[0x0B] & 0x40) {
-            // Periodic interrupt is enabled.
-            why |= PERIODIC;
+        // Every Nth periodic interrupt, we will cause an alarm/UIP interrupt.
+        cmos.periodic_ticks++;
+        if (cmos.periodic_ticks != cmos.periodic_ticks_max)
+            goto done; // No, we haven't reached the Nth tick yet
 
-            // Every Nth periodic interrupt, we will cause an alarm/UIP interrupt.
-            cmos.periodic_ticks++;
-            if (cmos.periodic_ticks != cmos.periodic_ticks_max)
-                goto done; // No, we haven't reached the Nth tick yet
-            
-            cmos.periodic_ticks = 0; // Reset it back to zero since cmos.periodic_ticks == cmos.periodic_ticks_max
-        }
+        cmos.periodic_ticks = 0; // Reset it back to zero since cmos.periodic_ticks == cmos.periodic_ticks_max
+    }
 
-        // Otherwise, we're here to update seconds.
-        cmos.now++;
-        if (cmos.ram[0x0B] & 0x20) {
-            // XXX: there's got to be a more efficient way of doing this
-            int ok = 1;
-            ok &= cmos_ram_read(ALARM_SEC) == cmos_ram_read(0);
-            ok &= cmos_ram_read(ALARM_MIN) == cmos_ram_read(2);
-            ok &= cmos_ram_read(ALARM_HOUR) == cmos_ram_read(4); // Is this right?
-            if (ok)
-                why |= ALARM;
-        }
-        if (cmos.ram[0x0B] & 0x10) {
-            // Clock has completed an update cycle
-            why |= UPDATE;
-        }
+    // Otherwise, we're here to update seconds.
+    cmos.now++;
+    if (cmos.ram[0x0B] & 0x20) {
+        // XXX: there's got to be a more efficient way of doing this
+        int ok = 1;
+        ok &= cmos_ram_read(ALARM_SEC) == cmos_ram_read(0);
+        ok &= cmos_ram_read(ALARM_MIN) == cmos_ram_read(2);
+        ok &= cmos_ram_read(ALARM_HOUR) == cmos_ram_read(4); // Is this right?
+        if (ok)
+            why |= ALARM;
+    }
+    if (cmos.ram[0x0B] & 0x10) {
+        // Clock has completed an update cycle
+        why |= UPDATE;
+    }
 
-        // we just updated the seconds
-        cmos.last_second_update = now;
+    // we just updated the seconds
+    cmos.last_second_update = now;
 
-    done:
-        cmos.last_called = get_now();
-        if (why){
-            cmos_raise_irq(why);
-            return 1;
-        }
-    }
-    return 0;
-}
-int cmos_next(itick_t now)
-{
-    cmos_clock(now);
-    return (int)(cmos.last_called + cmos.period - now);
+done:
+    cmos.last_called = now;
+    cmos_arm();
+    if (why)
+        cmos_raise_irq(why);
 }
 
 void cmos_set(uint8_t where, uint8_t data)
@@ -365,4 +363,6 @@ void cmos_init(uint64_t now)
 
     cmos.last_called = get_now();
     cmos.period = ticks_per_second;
+    timer_register(TIMER_CMOS, cmos_timer);
+    cmos_arm();
 }
\ No newline at end of file
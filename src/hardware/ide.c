@@ -30,6 +30,13 @@
 #define ATA_ERROR_TK0NF 0x02 // Track 0 not found
 #define ATA_ERROR_AMNF 0x01 // No address mark
 
+// Interrupt reason, in the sector count register during queued commands
+#define ATA_IREASON_CD 0x01 // Command
+#define ATA_IREASON_IO 0x02 // Transfer to host
+#define ATA_IREASON_REL 0x04 // Bus released
+// The seek complete bit means "service requested" while commands are queued
+#define ATA_STATUS_SERV ATA_STATUS_DSC
+
 // https://www.bswd.com/sff8020i.pdf
 #define ATAPI_INTERRUPT_REASON_REL 0x04 // Always 0
 #define ATAPI_INTERRUPT_REASON_IO 0x02 // 1 if transferring data out
@@ -67,6 +74,18 @@
 #define MAX_MULTIPLE_SECTORS 16 // According to QEMU and Bochs
 #endif
 
+// Number of tags for READ/WRITE DMA QUEUED
+#define IDE_QUEUE_DEPTH 32
+// Most sectors that adjacent queued commands are merged into when they're fetched from the drive
+#define IDE_QUEUE_MAX_MERGE 65536
+
+enum {
+    IDE_TAG_FREE,
+    IDE_TAG_WAITING, // Accepted, but the drive hasn't been asked for the data yet
+    IDE_TAG_PREFETCHING, // Waiting for the drive
+    IDE_TAG_READY // Can be serviced
+};
+
 // We keep all fields inside one big struct to make it easy for the autogen savestate
 static struct ide_controller {
     // <<< BEGIN STRUCT "struct" >>>
@@ -172,8 +191,26 @@ static struct ide_controller {
     // <<< END STRUCT "struct" >>>
 
     struct drive_info* info[2];
+
+    // === Tagged command queueing (saved separately) ===
+
+    // Previous value of the features register, which holds the high byte of the sector count for queued LBA48 commands
+    uint8_t feature_hob;
+    // Set with SET FEATURES
+    uint8_t release_irq, service_irq;
+    // Tag of the command whose data is being transferred
+    int queue_active;
+    // Sector just after the last queued transfer. The next command serviced is the first one after this.
+    uint64_t queue_position;
+    struct ide_queued_command {
+        uint64_t lba;
+        uint32_t sectors;
+        uint8_t state, write, drive;
+    } queue[IDE_QUEUE_DEPTH];
 } ide[2];
 
+static void ide_queue_fetch(struct ide_controller* ctrl);
+
 static void ide_state(void)
 {
 
@@ -273,6 +310,23 @@ static void ide_state(void)
     state_field(obj, 1, "ide[1].atapi_dma_enabled", &ide[1].atapi_dma_enabled);
     // <<< END AUTOGENERATE "state" >>>
 
+    obj = state_obj("ide_queue", 6 * 2);
+    for (int i = 0; i < 2; i++) {
+        char name[100];
+        h_sprintf(name, "ide[%d].feature_hob", i);
+        state_field(obj, 1, name, &ide[i].feature_hob);
+        h_sprintf(name, "ide[%d].release_irq", i);
+        state_field(obj, 1, name, &ide[i].release_irq);
+        h_sprintf(name, "ide[%d].service_irq", i);
+        state_field(obj, 1, name, &ide[i].service_irq);
+        h_sprintf(name, "ide[%d].queue_active", i);
+        state_field(obj, 4, name, &ide[i].queue_active);
+        h_sprintf(name, "ide[%d].queue_position", i);
+        state_field(obj, 8, name, &ide[i].queue_position);
+        h_sprintf(name, "ide[%d].queue", i);
+        state_field(obj, sizeof(ide[i].queue), name, &ide[i].queue);
+    }
+
     char filename[1000];
     for (int i = 0; i < 2; i++) {
         for (int j = 0; j < 2; j++) {
@@ -283,6 +337,16 @@ static void ide_state(void)
             }
         }
     }
+
+    if (state_is_reading()) {
+        // Prefetches that were in progress were lost along with their callbacks, so they're started over
+        for (int i = 0; i < 2; i++) {
+            for (int j = 0; j < IDE_QUEUE_DEPTH; j++)
+                if (ide[i].queue[j].state == IDE_TAG_PREFETCHING)
+                    ide[i].queue[j].state = IDE_TAG_WAITING;
+            ide_queue_fetch(&ide[i]);
+        }
+    }
 }
 
 #define SELECTED(obj, field) obj->field[obj->selected]
@@ -343,6 +407,12 @@ static void ide_reset(void)
     ide[0].translated[1] = 0;
     ide[1].translated[0] = 0;
     ide[1].translated[1] = 0;
+
+    for (int i = 0; i < 2; i++) {
+        h_memset(ide[i].queue, 0, sizeof(ide[i].queue));
+        ide[i].release_irq = 0;
+        ide[i].service_irq = 0;
+    }
 }
 
 // Get the number of sectors specified by the sector_count register. Special case for zero
@@ -380,7 +450,7 @@ static uint64_t ide_get_sector_offset(struct ide_controller* ctrl, int lba48)
         res = ctrl->sector_number & 0xFF;
         res |= (uint64_t)(ctrl->cylinder_low & 0xFF) << 8L;
         res |= (uint64_t)(ctrl->cylinder_high & 0xFF) << 16L;
-        res |= (uint64_t)(ctrl->sector_count >> 8 & 0xFF) << 24L;
+        res |= (uint64_t)(ctrl->sector_number >> 8 & 0xFF) << 24L;
         res |= (uint64_t)(ctrl->cylinder_low >> 8 & 0xFF) << 32L;
         res |= (uint64_t)(ctrl->cylinder_high >> 8 & 0xFF) << 40L;
         break;
@@ -1540,13 +1610,16 @@ static void ide_identify(struct ide_controller* ctrl)
             ide_pio_store_word(ctrl, i << 1, 0x78);
         for (int i = 69; i < 80; i++)
             ide_pio_store_word(ctrl, i << 1, 0);
+        // Queued DMA commands: queue depth, release and service interrupts, and the commands themselves
+        int queued = -(ctrl->dma_enabled != 0);
+        ide_pio_store_word(ctrl, 75 << 1, queued & (IDE_QUEUE_DEPTH - 1));
         ide_pio_store_word(ctrl, 80 << 1, 0x7E);
         ide_pio_store_word(ctrl, 81 << 1, 0);
-        ide_pio_store_word(ctrl, 82 << 1, 1 << 14);
-        ide_pio_store_word(ctrl, 83 << 1, (1 << 14) | (1 << 13) | (1 << 12)); // TODO: Set bit 10 for LBA48
+        ide_pio_store_word(ctrl, 82 << 1, (1 << 14) | (queued & ((1 << 8) | (1 << 7))));
+        ide_pio_store_word(ctrl, 83 << 1, (1 << 14) | (1 << 13) | (1 << 12) | (queued & (1 << 1))); // TODO: Set bit 10 for LBA48
         ide_pio_store_word(ctrl, 84 << 1, 1 << 14);
-        ide_pio_store_word(ctrl, 85 << 1, 1 << 14);
-        ide_pio_store_word(ctrl, 86 << 1, (1 << 14) | (1 << 13) | (1 << 12)); // Same as word 83
+        ide_pio_store_word(ctrl, 85 << 1, (1 << 14) | (ctrl->service_irq << 8) | (ctrl->release_irq << 7));
+        ide_pio_store_word(ctrl, 86 << 1, (1 << 14) | (1 << 13) | (1 << 12) | (queued & (1 << 1))); // Same as word 83
         ide_pio_store_word(ctrl, 87 << 1, 1 << 14);
         ide_pio_store_word(ctrl, 88 << 1, -(ctrl->dma_enabled != 0) & (0x3F | ctrl->udma));
         for (int i = 89; i < 93; i++)
@@ -1563,18 +1636,17 @@ static void ide_identify(struct ide_controller* ctrl)
     ctrl->pio_position = 0;
 }
 
-static void ide_read_dma_handler(void* this, int status)
+// Transfer "sectors" sectors starting at "offset" between the drive and the buffers in the PRD table. The sectors must
+// have been prefetched already, so that every drive access completes immediately.
+static void ide_dma_transfer(struct ide_controller* ctrl, struct drive_info* drv, int write, uint64_t sector, uint32_t sectors)
 {
-    struct ide_controller* ctrl = this;
-    UNUSED(status);
     uint32_t prdt_addr = ctrl->prdt_address,
-             sectors = ide_get_sector_count(ctrl, ctrl->lba48),
              bytes_in_buffer = sectors * 512;
-    uint64_t offset = ide_get_sector_offset(ctrl, ctrl->lba48) * 512ULL;
-    struct drive_info* drv = SELECTED(ctrl, info);
+    uint64_t offset = sector * 512ULL;
 
     // XXX -- our goal should be to write it directly into memory
     void* temp = alloca(65536);
+    void* mem = cpu_get_ram_ptr();
     while (1) {
         // Read fields from PRDT
         uint32_t dest = cpu_read_phys(prdt_addr), other_stuff = cpu_read_phys(prdt_addr + 4),
@@ -1586,28 +1658,39 @@ static void ide_read_dma_handler(void* this, int status)
             dma_bytes = bytes_in_buffer;
 
         // This should be a sync read
-        /* IDE_LOG("PCI IDE read\n");
+        /* IDE_LOG("PCI IDE %s\n", write ? "write" : "read");
         IDE_LOG(" -- Destination: %08x\n", dest);
         IDE_LOG(" -- Length: %08x [real: %08x] End? %s\n", count, dma_bytes, end ? "Yes" : "No");
         IDE_LOG(" -- sector: %llx\n", (unsigned long long)offset >> 9); */
         //if(offset == 0x19ba15000) __asm__("int3");
 
-        // Invalidate the TLB for all the pages we are going to mess with
-        {
-            // Round up so that we catch every page
-            int count_rounded = ((count + 0xFFF) >> 12) << 12;
-            for (int i = 0; i < count_rounded; i += 4096)
-                cpu_init_dma(dest + i);
-        }
-        while (dma_bytes >= 512) {
-            int res = drive_read(drv, NULL, temp, 512, offset, NULL);
-            if (res != DRIVE_RESULT_SYNC)
-                IDE_FATAL("Expected sync response for prefetched data\n");
-
-            cpu_write_mem(dest, temp, 512);
-            dma_bytes -= 512;
-            dest += 512;
-            offset += 512;
+        if (write) {
+            while (dma_bytes >= 512) {
+                int res = drive_write(drv, NULL, (uint8_t *)mem + dest, 512, offset, NULL);
+                if (res != DRIVE_RESULT_SYNC)
+                    IDE_FATAL("Expected sync response for prefetched data\n");
+                dma_bytes -= 512;
+                dest += 512;
+                offset += 512;
+            }
+        } else {
+            // Invalidate the TLB for all the pages we are going to mess with
+            {
+                // Round up so that we catch every page
+                int count_rounded = ((count + 0xFFF) >> 12) << 12;
+                for (int i = 0; i < count_rounded; i += 4096)
+                    cpu_init_dma(dest + i);
+            }
+            while (dma_bytes >= 512) {
+                int res = drive_read(drv, NULL, temp, 512, offset, NULL);
+                if (res != DRIVE_RESULT_SYNC)
+                    IDE_FATAL("Expected sync response for prefetched data\n");
+
+                cpu_write_mem(dest, temp, 512);
+                dma_bytes -= 512;
+                dest += 512;
+                offset += 512;
+            }
         }
 
         // Move ourselves forward.
@@ -1618,13 +1701,27 @@ static void ide_read_dma_handler(void* this, int status)
         if (!bytes_in_buffer || end)
             break;
     }
+}
+
+static void ide_dma_handler(struct ide_controller* ctrl, int write)
+{
+    uint32_t sectors = ide_get_sector_count(ctrl, ctrl->lba48);
+    uint64_t sector = ide_get_sector_offset(ctrl, ctrl->lba48);
+    ide_dma_transfer(ctrl, SELECTED(ctrl, info), write, sector, sectors);
+
     ctrl->status = ATA_STATUS_DRDY | ATA_STATUS_DSC;
     ctrl->dma_status &= ~1;
     ctrl->dma_status |= 4;
-    ide_set_sector_offset(ctrl, ctrl->lba48, ide_get_sector_offset(ctrl, ctrl->lba48) + sectors);
+    ide_set_sector_offset(ctrl, ctrl->lba48, sector + sectors);
     ide_raise_irq(ctrl);
 }
 
+static void ide_read_dma_handler(void* this, int status)
+{
+    UNUSED(status);
+    ide_dma_handler(this, 0);
+}
+
 void drive_debug(int64_t x)
 {
     uint32_t offset = x & 511;
@@ -1641,53 +1738,8 @@ void drive_debug(int64_t x)
 
 static void ide_write_dma_handler(void* this, int status)
 {
-    struct ide_controller* ctrl = this;
     UNUSED(status);
-    uint32_t prdt_addr = ctrl->prdt_address,
-             sectors = ide_get_sector_count(ctrl, ctrl->lba48),
-             bytes_in_buffer = sectors * 512;
-    uint64_t offset = ide_get_sector_offset(ctrl, ctrl->lba48) * 512ULL;
-    struct drive_info* drv = SELECTED(ctrl, info);
-
-    void* mem = cpu_get_ram_ptr();
-
-    while (1) {
-        // Read fields from PRDT
-        uint32_t dest = cpu_read_phys(prdt_addr), other_stuff = cpu_read_phys(prdt_addr + 4),
-                 count = other_stuff & 0xFFFF, end = other_stuff & 0x80000000;
-        count |= !count << 16; // If count is zero, then we requested 0x10000 bytes.
-
-        uint32_t dma_bytes = count;
-        if (dma_bytes > bytes_in_buffer)
-            dma_bytes = bytes_in_buffer;
-
-        // This should be a sync read
-        /* IDE_LOG("PCI IDE write\n");
-        IDE_LOG(" -- Destination: %08x\n", dest);
-        IDE_LOG(" -- Length: %08x [real: %08x] End? %s\n", count, dma_bytes, end ? "Yes" : "No");
-        IDE_LOG(" -- sector: %llx\n", (unsigned long long)offset >> 9); */
-        while (dma_bytes >= 512) {
-            int res = drive_write(drv, NULL, (uint8_t *)mem + dest, 512, offset, NULL);
-            if (res != DRIVE_RESULT_SYNC)
-                IDE_FATAL("Expected sync response for prefetched data\n");
-            dma_bytes -= 512;
-            dest += 512;
-            offset += 512;
-        }
-
-        // Move ourselves forward.
-
-        bytes_in_buffer -= dma_bytes;
-        offset += dma_bytes;
-        prdt_addr += 8;
-        if (!bytes_in_buffer || end)
-            break;
-    }
-    ctrl->status = ATA_STATUS_DRDY | ATA_STATUS_DSC;
-    ctrl->dma_status &= ~1;
-    ctrl->dma_status |= 4;
-    ide_set_sector_offset(ctrl, ctrl->lba48, ide_get_sector_offset(ctrl, ctrl->lba48) + sectors);
-    ide_raise_irq(ctrl);
+    ide_dma_handler(this, 1);
 }
 
 static void ide_read_dma(struct ide_controller* ctrl, int lba48)
@@ -1705,6 +1757,170 @@ static void ide_write_dma(struct ide_controller* ctrl, int lba48)
     ctrl->lba48 = lba48;
 }
 
+// Tagged command queueing (ATA-6 section 6.19). A queued command is accepted and the bus is released right away, so the
+// driver can queue up more commands while the drive fetches the data for the earlier ones. Once a command's data is
+// ready, SERV is set, and the SERVICE command picks which command to transfer next. Commands are serviced in order of
+// their position on the disk instead of the order they arrived, and adjacent commands are fetched from the drive in one
+// go.
+
+static int ide_queue_empty(struct ide_controller* ctrl, int drive)
+{
+    for (int i = 0; i < IDE_QUEUE_DEPTH; i++)
+        if (ctrl->queue[i].state != IDE_TAG_FREE && ctrl->queue[i].drive == drive)
+            return 0;
+    return 1;
+}
+
+static void ide_queue_clear(struct ide_controller* ctrl, int drive)
+{
+    for (int i = 0; i < IDE_QUEUE_DEPTH; i++)
+        if (ctrl->queue[i].drive == drive)
+            ctrl->queue[i].state = IDE_TAG_FREE;
+}
+
+// Find the command in "state" that comes first at or after queue_position, wrapping around to the start of the disk
+static int ide_queue_next(struct ide_controller* ctrl, int drive, int state)
+{
+    int best = -1, best_wrapped = 1;
+    for (int i = 0; i < IDE_QUEUE_DEPTH; i++) {
+        struct ide_queued_command* cmd = &ctrl->queue[i];
+        if (cmd->state != state || cmd->drive != drive)
+            continue;
+        int wrapped = cmd->lba < ctrl->queue_position;
+        if (best < 0 || wrapped < best_wrapped || (wrapped == best_wrapped && cmd->lba < ctrl->queue[best].lba)) {
+            best = i;
+            best_wrapped = wrapped;
+        }
+    }
+    return best;
+}
+
+// Set SERV if the selected drive has a command that can be serviced
+static void ide_queue_update_serv(struct ide_controller* ctrl)
+{
+    if (ide_queue_next(ctrl, ctrl->selected, IDE_TAG_READY) < 0) {
+        ctrl->status &= ~ATA_STATUS_SERV;
+        return;
+    }
+    if (!(ctrl->status & ATA_STATUS_SERV) && ctrl->service_irq && !(ctrl->dma_status & 1))
+        ide_raise_irq(ctrl);
+    ctrl->status |= ATA_STATUS_SERV;
+}
+
+static void ide_queue_prefetch_done(void* this, int status)
+{
+    struct ide_controller* ctrl = this;
+    UNUSED(status);
+    for (int i = 0; i < IDE_QUEUE_DEPTH; i++)
+        if (ctrl->queue[i].state == IDE_TAG_PREFETCHING)
+            ctrl->queue[i].state = IDE_TAG_READY;
+    ide_queue_update_serv(ctrl);
+}
+
+// Ask the drive for the data of the commands that haven't been fetched yet. The drive only handles one asynchronous
+// request at a time, so this stops at the first one that has to be waited for, and is called again later.
+static void ide_queue_fetch(struct ide_controller* ctrl)
+{
+    for (int drive = 0; drive < 2; drive++) {
+        if (ide_queue_next(ctrl, drive, IDE_TAG_PREFETCHING) >= 0)
+            return;
+        int tag;
+        while ((tag = ide_queue_next(ctrl, drive, IDE_TAG_WAITING)) >= 0) {
+            struct ide_queued_command* cmd = &ctrl->queue[tag];
+            uint64_t start = cmd->lba, end = cmd->lba + cmd->sectors;
+            cmd->state = IDE_TAG_PREFETCHING;
+
+            // Pick up commands that continue where this one ends
+            for (int i = 0; i < IDE_QUEUE_DEPTH; i++) {
+                cmd = &ctrl->queue[i];
+                if (cmd->state == IDE_TAG_WAITING && cmd->drive == drive && cmd->lba == end && end - start + cmd->sectors <= IDE_QUEUE_MAX_MERGE) {
+                    cmd->state = IDE_TAG_PREFETCHING;
+                    end += cmd->sectors;
+                    i = -1;
+                }
+            }
+
+            int result = drive_prefetch(ctrl->info[drive], ctrl, end - start, start << (drv_offset_t)9, ide_queue_prefetch_done);
+            if (result != DRIVE_RESULT_SYNC)
+                return;
+            ide_queue_prefetch_done(ctrl, 0);
+        }
+    }
+}
+
+// Something went wrong: abort the command and everything that's queued on the drive
+static void ide_queue_abort(struct ide_controller* ctrl)
+{
+    ide_queue_clear(ctrl, ctrl->selected);
+    ide_abort_command(ctrl);
+}
+
+static void ide_queue_command(struct ide_controller* ctrl, int write, int lba48)
+{
+    int tag = ctrl->sector_count >> 3 & (IDE_QUEUE_DEPTH - 1);
+    struct ide_queued_command* cmd = &ctrl->queue[tag];
+    if (SELECTED(ctrl, type) != DRIVE_TYPE_DISK || !ctrl->dma_enabled || cmd->state != IDE_TAG_FREE) {
+        ide_queue_abort(ctrl);
+        return;
+    }
+
+    // The sector count is in the features register instead
+    uint32_t sectors = ctrl->feature;
+    if (lba48)
+        sectors |= ctrl->feature_hob << 8;
+    if (!sectors)
+        sectors = lba48 ? 65536 : 256;
+    cmd->lba = ide_get_sector_offset(ctrl, lba48);
+    if (cmd->lba + sectors > SELECTED(ctrl, total_sectors)) {
+        ide_queue_abort(ctrl);
+        return;
+    }
+    cmd->sectors = sectors;
+    cmd->write = write;
+    cmd->drive = ctrl->selected;
+    cmd->state = IDE_TAG_WAITING;
+
+    // Release the bus
+    ctrl->sector_count = tag << 3 | ATA_IREASON_REL;
+    ctrl->status = ATA_STATUS_DRDY;
+    ide_queue_fetch(ctrl);
+    ide_queue_update_serv(ctrl);
+    if (ctrl->release_irq)
+        ide_raise_irq(ctrl);
+}
+
+static void ide_queue_service(struct ide_controller* ctrl)
+{
+    ide_queue_fetch(ctrl);
+    int tag = ide_queue_next(ctrl, ctrl->selected, IDE_TAG_READY);
+    if (tag < 0) {
+        ide_abort_command(ctrl);
+        return;
+    }
+    ctrl->queue_active = tag;
+    ctrl->sector_count = tag << 3 | (ctrl->queue[tag].write ? 0 : ATA_IREASON_IO);
+    ctrl->status = ATA_STATUS_DRDY | ATA_STATUS_DRQ;
+    ctrl->dma_status |= 1;
+}
+
+// Called when the bus master is started after SERVICE
+static void ide_queue_transfer(struct ide_controller* ctrl)
+{
+    struct ide_queued_command* cmd = &ctrl->queue[ctrl->queue_active];
+    if (cmd->state != IDE_TAG_READY)
+        return;
+    ide_dma_transfer(ctrl, ctrl->info[cmd->drive], cmd->write, cmd->lba, cmd->sectors);
+    cmd->state = IDE_TAG_FREE;
+    ctrl->queue_position = cmd->lba + cmd->sectors;
+
+    ctrl->sector_count = ctrl->queue_active << 3 | ATA_IREASON_IO | ATA_IREASON_CD;
+    ctrl->status = ATA_STATUS_DRDY;
+    ctrl->dma_status &= ~1;
+    ide_queue_fetch(ctrl);
+    ide_queue_update_serv(ctrl);
+    ide_raise_irq(ctrl);
+}
+
 // Write to an IDE port
 static void ide_write(uint32_t port, uint32_t data)
 {
@@ -1712,6 +1928,7 @@ static void ide_write(uint32_t port, uint32_t data)
     int ctrl_has_media = -controller_has_media(ctrl);
     switch (port | 0x80) {
     case 0x1F1:
+        ctrl->feature_hob = ctrl->feature;
         ctrl->feature = ctrl_has_media & data;
         break;
     case 0x1F2:
@@ -1748,6 +1965,21 @@ static void ide_write(uint32_t port, uint32_t data)
         }
         ctrl->status &= ~ATA_STATUS_ERR;
         ctrl->command_issued = data;
+        if (!ide_queue_empty(ctrl, ctrl->selected)) {
+            switch (data) {
+            case 0x26:
+            case 0x36:
+            case 0xA2:
+            case 0xC7:
+            case 0xCC:
+                break;
+            default:
+                // Any other command throws away the queue
+                IDE_LOG("Command %02x issued with queued commands outstanding\n", data);
+                ide_queue_abort(ctrl);
+                return;
+            }
+        }
         switch (data) {
         case 8: // ATAPI Reset
             IDE_LOG("ATAPI Reset\n");
@@ -1799,6 +2031,20 @@ static void ide_write(uint32_t port, uint32_t data)
             IDE_LOG("Command: WRITE DMA [w/%s LBA48]\n", data == 0x35 ? "" : "o");
             ide_write_dma(ctrl, data == 0x35);
             break;
+        case 0x26: // Read DMA queued lba48
+        case 0xC7: // Read DMA queued
+            IDE_LOG("Command: READ DMA QUEUED [w/%s LBA48]\n", data == 0x26 ? "" : "o");
+            ide_queue_command(ctrl, 0, data == 0x26);
+            break;
+        case 0x36: // Write DMA queued lba48
+        case 0xCC: // Write DMA queued
+            IDE_LOG("Command: WRITE DMA QUEUED [w/%s LBA48]\n", data == 0x36 ? "" : "o");
+            ide_queue_command(ctrl, 1, data == 0x36);
+            break;
+        case 0xA2: // Service
+            IDE_LOG("Command: SERVICE\n");
+            ide_queue_service(ctrl);
+            break;
         case 0x29: // Read multiple, using LBA48
         case 0xC4: // Read multiple
             IDE_LOG("Command: READ MULTIPLE [w/%s LBA]\n", data == 0x29 ? "" : "o");
@@ -1957,6 +2203,18 @@ static void ide_write(uint32_t port, uint32_t data)
                 ide_abort_command(ctrl);
                 break;
 #endif
+            case 0x5D: // Enable release interrupt
+            case 0xDD: // Disable release interrupt
+                ctrl->release_irq = ctrl->feature == 0x5D;
+                ctrl->status = ATA_STATUS_DSC | ATA_STATUS_DRDY;
+                ide_raise_irq(ctrl);
+                break;
+            case 0x5E: // Enable SERVICE interrupt
+            case 0xDE: // Disable SERVICE interrupt
+                ctrl->service_irq = ctrl->feature == 0x5E;
+                ctrl->status = ATA_STATUS_DSC | ATA_STATUS_DRDY;
+                ide_raise_irq(ctrl);
+                break;
             case 2: // ?
             case 130: // ?
             case 0x66: // Windows XP writes to this one
@@ -2024,6 +2282,8 @@ static void ide_write(uint32_t port, uint32_t data)
 
                 // Reset to master after we have set the signature
                 ctrl->selected = 0;
+                ide_queue_clear(ctrl, 0);
+                ide_queue_clear(ctrl, 1);
 
                 // Cancel any pending requests, if any.
                 drive_cancel_transfers();
@@ -2067,6 +2327,9 @@ void ide_write_prdt(uint32_t addr, uint32_t data)
                 else
                     this->status |= ATA_STATUS_BSY;
                 break;
+            case 0xA2:
+                ide_queue_transfer(this);
+                break;
             }
         }
         break;
@@ -124,7 +124,7 @@ static void kbd_queue_state(struct bjson_object* obj, struct kbd_queue* y, int z
 static void kbd_state(void)
 {
     // <<< BEGIN AUTOGENERATE "state" >>>
-    struct bjson_object* obj = state_obj("kbd", 15 + 6);
+    struct bjson_object* obj = state_obj("kbd", 17 + 6);
     state_field(obj, 128, "kbd.ram", &kbd.ram);
     state_field(obj, 1, "kbd.data", &kbd.data);
     state_field(obj, 4, "kbd.data_has_been_read", &kbd.data_has_been_read);
@@ -676,8 +676,77 @@ void kbd_init(void)
     state_register(kbd_state);
 }
 
+// Input events from a display running on another thread. They are queued here and replayed by kbd_process_input on
+// the emulator thread. There is exactly one reader and one writer, so the queue needs no locks.
+enum {
+    INPUT_KEY,
+    INPUT_MOUSE_DOWN,
+    INPUT_MOUSE_MOVE
+};
+struct kbd_input_event {
+    int type, args[4];
+};
+#define INPUT_QUEUE_SIZE 256
+static struct kbd_input_event input_queue[INPUT_QUEUE_SIZE];
+static int input_read_pos, input_write_pos, input_deferred;
+
+static void kbd_add_key_now(uint8_t data);
+static void kbd_mouse_down_now(int left, int center, int right);
+static void kbd_send_mouse_move_now(int xrel, int yrel, int wxrel, int wyrel);
+
+static void kbd_input_push(int type, int a, int b, int c, int d)
+{
+    int pos = input_write_pos, next = (pos + 1) & (INPUT_QUEUE_SIZE - 1);
+    if (next == h_atomic_load(&input_read_pos)) {
+        KBD_LOG("Input queue full, dropping event\n");
+        return;
+    }
+    struct kbd_input_event* e = &input_queue[pos];
+    e->type = type;
+    e->args[0] = a;
+    e->args[1] = b;
+    e->args[2] = c;
+    e->args[3] = d;
+    h_atomic_store(&input_write_pos, next);
+}
+
+// Call before the display starts sending input from its own thread
+void kbd_defer_input(void)
+{
+    input_deferred = 1;
+}
+
+// Deliver all the input that the display thread has queued up
+void kbd_process_input(void)
+{
+    int pos = input_read_pos, end = h_atomic_load(&input_write_pos);
+    while (pos != end) {
+        struct kbd_input_event* e = &input_queue[pos];
+        switch (e->type) {
+        case INPUT_KEY:
+            kbd_add_key_now(e->args[0]);
+            break;
+        case INPUT_MOUSE_DOWN:
+            kbd_mouse_down_now(e->args[0], e->args[1], e->args[2]);
+            break;
+        case INPUT_MOUSE_MOVE:
+            kbd_send_mouse_move_now(e->args[0], e->args[1], e->args[2], e->args[3]);
+            break;
+        }
+        pos = (pos + 1) & (INPUT_QUEUE_SIZE - 1);
+    }
+    h_atomic_store(&input_read_pos, pos);
+}
+
 // Adds a key to the keyboard buffer.
 void kbd_add_key(uint8_t data)
+{
+    if (input_deferred)
+        kbd_input_push(INPUT_KEY, data, 0, 0, 0);
+    else
+        kbd_add_key_now(data);
+}
+static void kbd_add_key_now(uint8_t data)
 {
     if (!kbd.keyboard_disable_scanning) {
         kbd_add(KBD_QUEUE, data);
@@ -738,6 +807,13 @@ static void mouse_move(int clicked)
 }
 
 void kbd_mouse_down(int left, int center, int right)
+{
+    if (input_deferred)
+        kbd_input_push(INPUT_MOUSE_DOWN, left, center, right, 0);
+    else
+        kbd_mouse_down_now(left, center, right);
+}
+static void kbd_mouse_down_now(int left, int center, int right)
 {
     uint8_t mbs = kbd.mouse_button_state;
     if (left != MOUSE_STATUS_NOCHANGE) {
@@ -759,6 +835,13 @@ void kbd_mouse_down(int left, int center, int right)
 
 void display_release_mouse(void);
 void kbd_send_mouse_move(int xrel, int yrel, int wxrel, int wyrel)
+{
+    if (input_deferred)
+        kbd_input_push(INPUT_MOUSE_MOVE, xrel, yrel, wxrel, wyrel);
+    else
+        kbd_send_mouse_move_now(xrel, yrel, wxrel, wyrel);
+}
+static void kbd_send_mouse_move_now(int xrel, int yrel, int wxrel, int wyrel)
 {
     if (kbd.mouse_stream_mode && !kbd.mouse_stream_inactive) {
         kbd.xrel += xrel;
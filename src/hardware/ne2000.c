@@ -4,7 +4,7 @@
 // https://web.archive.org/web/20000229212715/https://www.national.com/pf/DP/DP8390D.html
 // https://www.cs.usfca.edu/~cruse/cs326/RTL8139_ProgrammersGuide.pdf
 #include "devices.h"
-#include "io.h"
+#include "mmio.h"
 #include "net.h"
 #include "pc.h"
 #include <string.h> // h_memcpy
@@ -38,6 +38,23 @@
 #define DCR_AR 0x10 // Auto-init remote
 #define DCR_FIFO_THRESH 0x60 // FIFO threshold
 
+#define RCR_AB 0x04 // Accept broadcast packets
+#define RCR_AM 0x08 // Accept multicast packets
+#define RCR_PRO 0x10 // Promiscuous mode
+
+#define RSR_PRX 0x01 // Packet received intact
+#define RSR_MPA 0x10 // Missed packet
+#define RSR_PHY 0x20 // Multicast/broadcast address
+
+// Largest and smallest Ethernet frames (without the CRC) that will be put in the receive ring
+#define NE2K_MAX_FRAME 1514
+#define NE2K_MIN_FRAME 60
+// Ring space that a single received frame can take up, including its header, in whole pages
+#define NE2K_MAX_FRAME_SPACE ((NE2K_MAX_FRAME + 4 + 255) & ~0xFF)
+
+// How often the host network device is checked for packets while the receiver is running
+#define NE2K_POLL_INTERVAL (ticks_per_second / 1000)
+
 #define NE2K_DEVID 5
 
 #define NE2K_MEMSTART
@@ -74,7 +91,7 @@ struct ne2000 {
     // Transfer count
     int tcnt;
 
-    // Boundary pointer
+    // Boundary pointer (a page number, unlike the other page registers)
     int bnry;
 
     // Current page register
@@ -99,8 +116,9 @@ static void ne2000_reset_internal(int software)
     } else {
         ne2000.pagestart = 0x40 << 8;
         ne2000.pagestop = 0x80 << 8;
-        ne2000.bnry = 0x4C << 8;
+        ne2000.bnry = 0x4C;
         ne2000.cmd = CMD_STP;
+        timer_cancel(TIMER_NE2000);
     }
 }
 static void ne2000_reset(void)
@@ -116,9 +134,7 @@ static void ne2000_trigger_irq(int flag)
 
     NE2K_DEBUG("Triggering IRQ! (isr=%02x imr=%02x &=%02x)\n", ne2000.isr, ne2000.imr, ne2000.isr & ne2000.imr);
 
-    // XXX -- the PIC doesn't support edge/level triggered interrupts yet, so we simulate it this way
-    pci_set_irq_line(NE2K_DEVID, 0);
-    pci_set_irq_line(NE2K_DEVID, 1);
+    pci_pulse_irq_line(NE2K_DEVID);
 }
 static void ne2000_lower_irq(void)
 {
@@ -183,7 +199,7 @@ static void ne2000_asic_mem_write(uint32_t data)
 
 static uint32_t ne2000_read0(uint32_t port)
 {
-    uint8_t retv;
+    uint8_t retv = 0;
     switch (port) {
     case 3: // Boundary pointer
         retv = ne2000.bnry;
@@ -211,7 +227,7 @@ static uint32_t ne2000_read0(uint32_t port)
 
 static uint32_t ne2000_read1(uint32_t port)
 {
-    uint8_t retv;
+    uint8_t retv = 0;
     switch (port) {
     case 1 ... 6:
         retv = ne2000.par[port - 1];
@@ -253,6 +269,7 @@ static uint32_t ne2000_read(uint32_t port)
     default:
         NE2K_FATAL("TODO: read port=%08x\n", port);
     }
+    return 0;
 }
 
 // Intended for port +0x10
@@ -295,7 +312,7 @@ static void ne2000_write0(uint32_t port, uint32_t data)
         break;
     case 3: // Boundary pointer
         NE2K_DEBUG("Boundary write: %02x\n", data);
-        ne2000.bnry = data;
+        ne2000.bnry = data & 0xFF;
         break;
     case 4:
         NE2K_DEBUG("TPSR: %02x\n", data);
@@ -383,8 +400,14 @@ static void ne2000_write(uint32_t port, uint32_t data)
             start = data & CMD_STA,
             transmit_packet = data & CMD_TXP,
             rdma_cmd = data >> 3 & 7,
-            psel = data >> 6 & 3;
+            psel = data >> 6 & 3,
+            was_stopped = ne2000.cmd & CMD_STP;
         ne2000.cmd = data;
+        // The host only has to be checked for packets while the receiver is running
+        if (was_stopped && !stop)
+            timer_arm(TIMER_NE2000, get_now() + NE2K_POLL_INTERVAL);
+        else if (stop && !was_stopped)
+            timer_cancel(TIMER_NE2000);
         UNUSED(psel); // psel is decoded elsewhere
         UNUSED(start); // ?
         if (!stop) {
@@ -505,6 +528,7 @@ static int ne2000_pci_write(uint8_t* ptr, uint8_t addr, uint8_t data)
     default:
         NE2K_FATAL("unknown pci value: offs=0x%02x data=%02x\n", addr, data);
     }
+    return 0;
 }
 
 static const uint8_t ne2000_config_space[16] = {
@@ -521,69 +545,104 @@ static void ne2000_pci_init(struct ne2000_settings* conf)
     ne2000_pci_remap(dev, conf->port_base);
 }
 
+// Bytes of the receive ring between CURR and BNRY that the guest has given back to us
+static int ne2000_rx_space(void)
+{
+    int bnry = ne2000.bnry << 8;
+    if (ne2000.pagestart >= ne2000.pagestop || ne2000.pagestop > NE2K_MEMSZ
+        || ne2000.curr < ne2000.pagestart || ne2000.curr >= ne2000.pagestop)
+        return 0; // The guest hasn't set up a sane ring yet
+    if (ne2000.curr < bnry)
+        return bnry - ne2000.curr;
+    return (ne2000.pagestop - ne2000.pagestart) - (ne2000.curr - bnry);
+}
+
+// Check the destination address against the receive configuration register. The host interface sees all traffic on
+// its segment, so this keeps frames that the guest would throw away anyways out of the ring.
+static int ne2000_accept(uint8_t* dest)
+{
+    static const uint8_t broadcast[6] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+    if (ne2000.rcr & RCR_PRO)
+        return 1;
+    if (!(dest[0] & 1))
+        return !memcmp(dest, ne2000.par, 6);
+    if (!memcmp(dest, broadcast, 6))
+        return ne2000.rcr & RCR_AB;
+    // XXX: let all multicast frames through instead of checking the hash filter
+    return ne2000.rcr & RCR_AM;
+}
+
 static void ne2000_receive(void* data, int len)
 {
+    uint8_t* data8 = data;
+    uint8_t runt[NE2K_MIN_FRAME];
+
     // Don't acknowledge if stop bit set
     // PCap gets some spurious packets before it's initialized
     if (ne2000.cmd & CMD_STP)
         return;
+    if (len < 6 || len > NE2K_MAX_FRAME || !ne2000_accept(data8))
+        return;
+    if (len < NE2K_MIN_FRAME) {
+        // Pad short frames out to the minimum size, like the sender's MAC would have
+        memcpy(runt, data8, len);
+        memset(runt + len, 0, NE2K_MIN_FRAME - len);
+        data8 = runt;
+        len = NE2K_MIN_FRAME;
+    }
 
     // Format of a packet (as received by the emulated system):
     //  [0] : Status
     //  [1] : Next page address
     //  [2 ... 3]: Size of packet
-
-    int length_plus_header = 4 + len;
-    int total_pages = (length_plus_header + 255) >> 8;
-
-    // Determine the start, end, etc.
-    int start = ne2000.curr;
-    // Determine the next page
-    int nextpg = ne2000.curr + ((255 + length_plus_header) & ~0xFF);
-    if (nextpg >= ne2000.pagestop) {
-        nextpg += ne2000.pagestart - ne2000.pagestop;
+    int length_plus_header = 4 + len,
+        size = (length_plus_header + 255) & ~0xFF;
+
+    // CURR must never catch up to BNRY, or the guest won't be able to tell a full ring from an empty one
+    if (size >= ne2000_rx_space()) {
+        NE2K_DEBUG("Receive ring full, dropping packet\n");
+        ne2000.rsr |= RSR_MPA;
+        ne2000.cntr[2]++;
+        ne2000_trigger_irq(ISR_OVW);
+        return;
     }
 
-    ne2000.rsr = 1; // properly received
+    int start = ne2000.curr,
+        nextpg = start + size;
+    if (nextpg >= ne2000.pagestop)
+        nextpg += ne2000.pagestart - ne2000.pagestop;
 
-    uint8_t *memstart = ne2000.mem + start,
-            *data8 = data;
+    ne2000.rsr = RSR_PRX; // properly received
     if (data8[0] & 1)
-        ne2000.rsr |= 0x20; // physical/multicast addr
+        ne2000.rsr |= RSR_PHY; // physical/multicast addr
 
+    uint8_t* memstart = ne2000.mem + start;
     memstart[0] = ne2000.rsr;
     memstart[1] = nextpg >> 8;
     memstart[2] = length_plus_header;
     memstart[3] = length_plus_header >> 8;
 
-    if ( // If our starting page is less than the next page...
-        (ne2000.curr < nextpg) ||
-        // Or if we fit perfectly into the pagestart-pageend area
-        (ne2000.curr + total_pages == ne2000.pagestop)) {
-        h_memcpy(memstart + 4, data, len); // We've already written the packet address
-    } else {
-        // What if the packet is too big?
-        int len1 = ne2000.pagestop - ne2000.curr;
-        h_memcpy(memstart + 4, data, len1 - 4);
-
-        memstart = ne2000.mem + ne2000.pagestart;
-        // Copy the rest of the bytes to the beginning of pagestart
-        h_printf("addr=%p len=%d\n", data + (len1 - 4), len - (len1 + 4));
-#if ENABLE_BREAKPOINTS
-        if ((len - (len1 + 4)) < 0)
-            __asm__("int3");
-#endif
-        h_memcpy(memstart, data + (len1 - 4), len - (len1 + 4));
+    // Copy the frame in at most two pieces, wrapping around to pagestart if it runs into pagestop
+    int first = ne2000.pagestop - (start + 4);
+    if (first >= len)
+        memcpy(memstart + 4, data8, len);
+    else {
+        memcpy(memstart + 4, data8, first);
+        memcpy(ne2000.mem + ne2000.pagestart, data8 + first, len - first);
     }
     ne2000.curr = nextpg;
     ne2000_trigger_irq(ISR_PRX);
 }
 
-void ne2000_poll(void)
+// Drain as many packets from the host as are sure to fit in the receive ring. Anything left over waits in the host's
+// queue until the guest has moved BNRY along.
+static void ne2000_timer(itick_t now)
 {
-    if (!ne2000.enabled)
-        return;
-    net_poll(ne2000_receive);
+    UNUSED(now);
+    int count = (ne2000_rx_space() - 1) / NE2K_MAX_FRAME_SPACE;
+    if (count > 0)
+        net_poll(ne2000_receive, count);
+    timer_arm(TIMER_NE2000, get_now() + NE2K_POLL_INTERVAL);
 }
 
 void ne2000_init(struct ne2000_settings* conf)
@@ -591,6 +650,7 @@ void ne2000_init(struct ne2000_settings* conf)
     if (!conf->enabled)
         return;
     ne2000.enabled = 1;
+    timer_register(TIMER_NE2000, ne2000_timer);
 
     if (conf->irq == 0)
         conf->irq = 3;
@@ -552,6 +552,7 @@ static int pci_82441fx_write(uint8_t* ptr, uint8_t addr, uint8_t data)
 }
 
 static uint8_t* ram; // Doesn't need to be saved since it will be different on each run.
+static uint32_t ram_size;
 
 static uint32_t mmio_readb(uint32_t addr)
 {
@@ -572,6 +573,22 @@ void pci_init_mem(void* a)
     ram = a;
 }
 
+void* pci_dma_ptr(uint32_t addr, uint32_t len)
+{
+    if (addr >= ram_size || len > ram_size - addr)
+        return NULL;
+    return ram + addr;
+}
+
+void pci_dma_written(uint32_t addr, uint32_t len)
+{
+    if (!len)
+        return;
+    // Throw away any code that was translated from these pages
+    for (uint32_t page = addr & ~0xFFF; page < addr + len; page += 4096)
+        cpu_init_dma(page);
+}
+
 static void pci_82441fx_init(void)
 {
     void* ptr = pci_create_device(0, 0, 0, pci_82441fx_write);
@@ -1299,6 +1316,7 @@ void pci_init(struct pc_settings* pc)
 {
     if (!pc->pci_enabled)
         return;
+    ram_size = pc->memory_size;
 
     io_register_read(0xCF8, 8, pci_read, pci_read16, pci_read32);
     io_register_write(0xCF8, 8, pci_write, pci_write16, pci_write32);
@@ -1337,4 +1355,12 @@ void pci_set_irq_line(int dev, int state)
     else
         pic_lower_irq(config[0x3C]);
 #endif
+}
+
+// XXX -- the PIC doesn't support edge/level triggered interrupts yet, so a device that has a new interrupt to report
+// drops its line and raises it again. This makes sure that the PIC sees an edge even if the line was already high.
+void pci_pulse_irq_line(int dev)
+{
+    pci_set_irq_line(dev, 0);
+    pci_set_irq_line(dev, 1);
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 #include "cpuapi.h"
 #include "devices.h"
 #include "state.h"
+#include "tracelog.h"
 
 // Emulation of an Intel 8259 PIC.
 // http://www.thesatya.com/8259.html
@@ -237,13 +238,17 @@ static uint8_t pic_internal_get_interrupt(struct pic_controller* this)
 uint8_t pic_get_interrupt(void)
 {   
     // If APIC is enabled in PC settings and it has an interrupt, get the interrupt!
-    if(apic_has_interrupt())
-        return apic_get_interrupt();
+    if(apic_has_interrupt()) {
+        int vector = apic_get_interrupt();
+        TRACELOG(TRACE_IRQ_ACK, 0, vector, 1, 0);
+        return vector;
+    }
     
     // This is our version of an IAC... the processor has indicated that it is ready to execute the interrupt.
     // All we have to do is fix up some state
     cpu_lower_intr_line();
     int x = pic_internal_get_interrupt(&pic.ctrl[0]);
+    TRACELOG(TRACE_IRQ_ACK, 0, x, 0, 0);
     return x;
 }
 
@@ -269,6 +274,7 @@ static void pic_internal_lower_irq(struct pic_controller* this, int irq)
 void pic_raise_irq(int a)
 {
     PIC_LOG("Raising IRQ %d\n", a);
+    TRACELOG(TRACE_IRQ_RAISE, 0, a, 0, 0);
     // Send to I/O APIC if needed. 
     // The signal is ignored if APIC is disabled
     ioapic_raise_irq(a);
@@ -278,6 +284,7 @@ void pic_raise_irq(int a)
 void pic_lower_irq(int a)
 {
     //PIC_LOG("Lowering IRQ %d\n", a);
+    TRACELOG(TRACE_IRQ_LOWER, 0, a, 0, 0);
     ioapic_lower_irq(a);
 
     pic_internal_lower_irq(&pic.ctrl[a > 7], a & 7);
@@ -352,6 +359,7 @@ static void pic_write_ocw(struct pic_controller* this, int index, int data){
     case 2: { // OCW2: EOI and rotate bits
         int rotate = data & 0x80, specific = data & 0x40, eoi = data & 0x20, l = data & 7;
         if (eoi) {
+            TRACELOG(TRACE_IRQ_PIC_EOI, 0, !is_master(this), this->isr, data);
             if (specific) {
                 // Specific EOI command
                 pic_clear_specific(this, l);
@@ -57,6 +57,7 @@ struct pit {
 };
 
 static struct pit pit;
+static void pit_arm(void);
 static void pit_state(void)
 {
     // <<< BEGIN AUTOGENERATE "state" >>>
@@ -118,6 +119,8 @@ static void pit_state(void)
 // <<< END AUTOGENERATE "state" >>>
     FIELD(pit.speaker);
     FIELD(pit.last);
+    if (state_is_reading())
+        pit_arm();
 }
 
 static inline itick_t pit_counter_to_itick(uint32_t c)
@@ -204,6 +207,8 @@ static void pit_set_count(struct pit_channel* this, int v)
     this->period = (uint32_t)pit_counter_to_itick(this->count);
     this->timer_running = 1;
     this->pit_last_count = pit_get_count(this); // should this be 0?
+    if (this == &CHAN0)
+        pit_arm();
 }
 static void pit_channel_latch_counter(struct pit_channel* this)
 {
@@ -362,6 +367,7 @@ static void pit_reset(void)
         pit.chan[i].gate = i != 2;
     }
     pit.speaker = 0;
+    timer_cancel(TIMER_PIT);
 }
 static void timer_cb(void)
 {
@@ -369,29 +375,32 @@ static void timer_cb(void)
     pic_raise_irq(0);
 }
 
-// Get the number of ticks, in the future, that the PIT needs to wait.
-int pit_next(itick_t now)
+// Schedule an interrupt for the next time channel 0 counts down to zero after its last interrupt
+static void pit_arm(void)
 {
-    UNUSED(now);
-    uint32_t count = pit_get_count(&pit.chan[0]), raise_irq = 0;
-    if (count > pit.chan[0].pit_last_count) {
-        // Count has gone from 0 --> 0xFFFF
-        raise_irq = 1;
+    struct pit_channel* chan = &CHAN0;
+    if (!chan->timer_running || !chan->count) {
+        timer_cancel(TIMER_PIT);
+        return;
     }
-    if (pit.chan[0].timer_running) {
-
-        int refill_count = pit.chan[0].count;
-        if (raise_irq) {
-            timer_cb();
-            if (pit.chan[0].mode != 2 && pit.chan[0].mode != 3) {
-                pit.chan[0].timer_running = 0;
-                return -1;
-            }
-        }
-        pit.chan[0].pit_last_count = count;
-        return (int)pit_counter_to_itick(refill_count - count);
-    }
-    return -1;
+
+    // Find the first tick at which the k-th reload has happened, where k is the first reload after last_irq_time.
+    itick_t elapsed = chan->last_irq_time - chan->last_load_time,
+            k = pit_itick_to_counter(elapsed) / chan->count + 1, deadline;
+    while ((deadline = pit_counter_to_itick(k * chan->count)) <= elapsed)
+        k++;
+    timer_arm(TIMER_PIT, chan->last_load_time + deadline);
+}
+
+static void pit_timer(itick_t now)
+{
+    struct pit_channel* chan = &CHAN0;
+    timer_cb();
+    chan->last_irq_time = now;
+    chan->pit_last_count = pit_get_count(chan);
+    if (chan->mode != 2 && chan->mode != 3)
+        chan->timer_running = 0; // One-shot modes only interrupt once
+    pit_arm();
 }
 
 static uint32_t pit_speaker_readb(uint32_t port)
@@ -419,4 +428,5 @@ void pit_init(void)
     io_register_read(0x61, 1, pit_speaker_readb, NULL, NULL);
     io_register_write(0x61, 1, pit_speaker_writeb, NULL, NULL);
     state_register(pit_state);
+    timer_register(TIMER_PIT, pit_timer);
 }
\ No newline at end of file
@@ -22,10 +22,15 @@
 
 #define VBE_LFB_BASE 0xE0000000
 
+#define VGA_PAGE_SHIFT 12
+#define VGA_DIRTY_BYTES(vram_size) (((((vram_size) >> VGA_PAGE_SHIFT) + 31) >> 5) * 4)
+#define TEXT_MAX_COLS 256
+#define TEXT_MAX_ROWS 128
+
 static struct vga_info {
     // <<< BEGIN STRUCT "struct" >>>
 
-    /// ignore: framebuffer, vram, scanlines_modified, scanlines_to_update, mem, rom, rom_size
+    /// ignore: framebuffer, vram, scanlines_modified, mem, rom, rom_size
 
     // CRT Controller
     uint8_t crt[256], crt_index;
@@ -63,7 +68,6 @@ static struct vga_info {
     uint32_t* framebuffer; // where pixel data is written to, created by SDL
     uint32_t framebuffer_offset; // the offset being written to right now
     uint32_t vram_addr; // Current VRAM offset being accessed by renderer
-    uint32_t scanlines_to_update; // Number of scanlines to update per vga_update
 
     // Memory access settings
     uint8_t write_access, read_access, write_mode;
@@ -88,10 +92,23 @@ static struct vga_info {
     // <<< END STRUCT "struct" >>>
 
     // These fields should not be saved in the VRAM savestate since they have to do with rendering.
-    uint8_t* vbe_scanlines_modified;
 
-    // Screen data cannot change if memory_modified is zero.
+    // One bit for each 4 KiB page of VRAM, set when the page is written to. A frame only redraws the scanlines that
+    // read from pages that were written before it started (frame_dirty). Writes made while it's being drawn go to
+    // dirty_pages, for the next frame.
+    uint32_t *dirty_pages, *frame_dirty;
+    // Nonzero if the next frame has to redraw everything, like after a register or palette change
     int memory_modified;
+
+    // Per-frame drawing state
+    int redraw_all, last_line_drawn;
+    uint32_t dirty_top, dirty_bottom; // The scanlines that were drawn in this frame
+
+    // Text mode: what each cell held when it was last drawn (character, attribute, cursor and blink state)
+    uint32_t* text_cells;
+    uint32_t text_row;
+    int text_row_pending, text_row_drawn;
+    uint8_t text_changed[TEXT_MAX_COLS]; // Which cells of the current row have to be redrawn
 } vga /* = { 0 }*/;
 
 #define VBE_DISPI_DISABLED 0x00
@@ -101,14 +118,67 @@ static struct vga_info {
 #define VBE_DISPI_LFB_ENABLED 0x40
 #define VBE_DISPI_NOCLEARMEM 0x80
 
+// With a render thread, the emulator thread hands frames to it through a copy of the VGA state, along with a copy of
+// VRAM that is brought up to date one dirty page at a time. The copy belongs to the render thread while render_pending
+// is set.
+static int render_thread = 0, render_pending = 0;
+
+// Time between frames, or 0 to draw one every time vga_update is called
+static uint64_t frame_interval_us, last_frame_us;
+static struct vga_info render;
+static int render_vram_size, render_width, render_height;
+static uint32_t* render_framebuffer;
+
 static void vga_update_size(void);
 
+static void vga_mark_all_dirty(void)
+{
+    h_memset(vga.dirty_pages, 0xFF, VGA_DIRTY_BYTES(vga.vram_size));
+    vga.memory_modified = 3;
+}
+
+static inline void vga_mark_dirty(uint32_t offset)
+{
+    vga.dirty_pages[offset >> (VGA_PAGE_SHIFT + 5)] |= 1 << (offset >> VGA_PAGE_SHIFT & 31);
+}
+
+// While it's enabled, the LFB is mapped straight to VRAM and guest writes to it never reach vga_mem_writeb. Instead, the
+// CPU reports the first write to each page after the LFB was protected, which happens every time the dirty bits are
+// cleared.
+static int lfb_region = -1;
+
+static void vga_lfb_dirty(uint32_t offset)
+{
+    vga_mark_dirty(offset);
+}
+
+static void vga_update_lfb(void)
+{
+    int lfb = VBE_DISPI_ENABLED | VBE_DISPI_LFB_ENABLED;
+    if (lfb_region >= 0)
+        cpu_set_ram_region(lfb_region, (vga.vbe_enable & lfb) == lfb ? vga.vram : NULL);
+}
+
+static void vga_protect_lfb(void)
+{
+    if (lfb_region >= 0)
+        cpu_protect_ram_region(lfb_region);
+}
+
 static void vga_alloc_mem(void)
 {
     if (vga.vram)
         afree(vga.vram);
     vga.vram = aalloc(vga.vram_size, 8);
     h_memset(vga.vram, 0, vga.vram_size);
+
+    h_free(vga.dirty_pages);
+    h_free(vga.frame_dirty);
+    vga.dirty_pages = h_malloc(VGA_DIRTY_BYTES(vga.vram_size));
+    vga.frame_dirty = h_calloc(VGA_DIRTY_BYTES(vga.vram_size), 1);
+    if (!vga.text_cells)
+        vga.text_cells = h_calloc(TEXT_MAX_COLS * TEXT_MAX_ROWS, sizeof(uint32_t));
+    vga_mark_all_dirty();
 }
 
 static void vga_state(void)
@@ -161,11 +231,12 @@ static void vga_state(void)
     if (state_is_reading()) {
         vga_update_size();
         vga_alloc_mem();
+        vga_update_lfb();
     }
     state_file(vga.vram_size, "vram", vga.vram);
 
     // Force a redraw.
-    vga.memory_modified = 3;
+    vga_mark_all_dirty();
 }
 
 enum {
@@ -210,14 +281,20 @@ static void vga_update_mem_access(void)
     vga.write_mode = vga.gfx[5] & 3;
     VGA_LOG("Updating Memory Access Constants: write=%d [mode=%d], read=%d\n", vga.write_access, vga.write_mode, vga.read_access);
 }
+static void vga_restart_frame(struct vga_info* v)
+{
+    v->current_scanline = 0;
+    v->character_scanline = v->crt[8] & 0x1F;
+    v->current_pixel_panning = v->pixel_panning;
+    v->vram_addr = ((v->crt[0x0C] << 8) | v->crt[0x0D]) << 2; // Video Address Start is done by planar offset
+    v->framebuffer_offset = 0;
+    v->text_row = 0;
+    v->text_row_pending = 1;
+}
 // despite its name, it only resets drawing state
 static void vga_complete_redraw(void)
 {
-    vga.current_scanline = 0;
-    vga.character_scanline = vga.crt[8] & 0x1F;
-    vga.current_pixel_panning = vga.pixel_panning;
-    vga.vram_addr = ((vga.crt[0x0C] << 8) | vga.crt[0x0D]) << 2; // Video Address Start is done by planar offset
-    vga.framebuffer_offset = 0;
+    vga_restart_frame(&vga);
 
     // Force a complete redraw of the screen, and to do that, pretend that memory has been written.
     vga.memory_modified = 3;
@@ -304,20 +381,15 @@ static void vga_update_size(void)
         height = vertical_display_enable_end < vertical_blanking_start ? vertical_display_enable_end : vertical_blanking_start;
     }
 
-    display_set_resolution(width, height);
-
-    vga.framebuffer = display_get_pixels();
+    // The render thread resizes the display itself when it sees the new size
+    if (!render_thread) {
+        display_set_resolution(width, height);
+        vga.framebuffer = display_get_pixels();
+    }
 
     vga.total_height = height;
     vga.total_width = width;
-
-    if (vga.vbe_scanlines_modified)
-        vga.vbe_scanlines_modified = h_realloc(vga.vbe_scanlines_modified, vga.total_height);
-    else
-        vga.vbe_scanlines_modified = h_malloc(vga.total_height);
-    h_memset(vga.vbe_scanlines_modified, 1, vga.total_height);
-
-    vga.scanlines_to_update = height >> 1;
+    vga.memory_modified = 3;
 }
 
 static uint8_t c6to8(uint8_t a)
@@ -402,6 +474,7 @@ static
                 }
                 VGA_LOG(" Set VBE enable=%04x bpp=%d diffxor=%04x current=%04x\n", data, vga.vbe_regs[3], diffxor, vga.vbe_enable);
                 vga.vbe_enable = data;
+                vga_update_lfb();
                 if (vga.vbe_regs[3] == 4)
                     VGA_FATAL("TODO: support VBE 4-bit modes\n");
 
@@ -425,6 +498,7 @@ static
                                 vga.vram[i + 2] = 0;
                                 vga.vram[i + 3] = 255;
                             }
+                            vga_mark_all_dirty();
                         }
                 }
 
@@ -480,6 +554,7 @@ static
             diffxor = vga.attr[index] ^ data;
             if (diffxor) {
                 vga.attr[index] = data;
+                vga.memory_modified = 3;
                 switch (index) {
                 case 0x00:
                 case 0x01:
@@ -631,6 +706,7 @@ bit   0  If set Color Emulation. Base Address=3Dxh else Mono Emulation. Base
                 break;
             case 1: // Clocking Mode
                 VGA_LOG("SEQ: Setting Clocking Mode to 0x%02x\n", data);
+                vga.memory_modified = 3;
                 if (diffxor & 0x20) // Screen Off
                     vga_change_renderer();
                 if (diffxor & 0x08) { // Dot Clock Divide (AKA Fat Screen). Each column will be duplicated
@@ -653,6 +729,7 @@ bit   0  If set Color Emulation. Base Address=3Dxh else Mono Emulation. Base
                 VGA_LOG("SEQ: Memory plane write access: 0x%02x\n", data);
                 vga.character_map[0] = vga_char_map_address((data >> 5 & 1) | (data >> 1 & 6));
                 vga.character_map[1] = vga_char_map_address((data >> 4 & 1) | (data << 1 & 6));
+                vga.memory_modified = 3;
                 break;
             case 4: // Memory Mode
                 VGA_LOG("SEQ: Memory Mode: 0x%02x\n", data);
@@ -680,6 +757,7 @@ bit   0  If set Color Emulation. Base Address=3Dxh else Mono Emulation. Base
         vga.dac[(vga.dac_address << 2) | vga.dac_color++] = data;
         if (vga.dac_color == 3) { // 0: red, 1: green, 2: blue, 3: ???
             update_one_dac_entry(vga.dac_address);
+            vga.memory_modified = 3;
             vga.dac_address++; // This will wrap around because it is a uint8_t
             vga.dac_color = 0;
         }
@@ -811,6 +889,9 @@ bit   0  If set Color Emulation. Base Address=3Dxh else Mono Emulation. Base
         diffxor = (data ^ vga.crt[vga.crt_index]) & mask[vga.crt_index];
         if (diffxor) {
             vga.crt[vga.crt_index] = data | (vga.crt[vga.crt_index] & ~mask[vga.crt_index]);
+            // Moving the cursor only redraws the text cells it moved between
+            if (vga.crt_index != 0x0E && vga.crt_index != 0x0F)
+                vga.memory_modified = 3;
             switch (vga.crt_index) {
             case 1:
                 VGA_LOG("End Horizontal Display: %02x\n", data);
@@ -857,6 +938,51 @@ bit   0  If set Color Emulation. Base Address=3Dxh else Mono Emulation. Base
     }
 }
 
+// Works out where the beam would be right now, going by the CRT timing registers and emulated time. Returns Input
+// Status #1 bit 3 (vertical retrace) and bit 0 (display disabled: horizontal or vertical blanking).
+static uint8_t vga_retrace_status(void)
+{
+    uint32_t htotal, hdisp, vtotal, vdisp, vretrace_start, vretrace_end, clock;
+    if (vga.vbe_enable & VBE_DISPI_ENABLED) {
+        // VBE modes don't program the CRTC, so give them the same proportions as 640x480 at 60 Hz
+        hdisp = vga.total_width;
+        htotal = hdisp * 800 / 640;
+        vdisp = vga.total_height;
+        vtotal = vdisp * 525 / 480;
+        vretrace_start = vdisp + (vtotal - vdisp) / 4;
+        vretrace_end = vretrace_start + 2;
+        clock = htotal * vtotal * 60;
+    } else {
+        // Horizontal values are in character clocks, vertical ones in scanlines
+        hdisp = (vga.crt[1] + 1) * vga.char_width;
+        htotal = (vga.crt[0] + 5) * vga.char_width;
+        vdisp = (vga.crt[0x12] | (vga.crt[7] >> 1 & 1) << 8 | (vga.crt[7] >> 6 & 1) << 9) + 1;
+        vtotal = (vga.crt[6] | (vga.crt[7] & 1) << 8 | (vga.crt[7] >> 5 & 1) << 9) + 2;
+        vretrace_start = vga.crt[0x10] | (vga.crt[7] >> 2 & 1) << 8 | (vga.crt[7] >> 7 & 1) << 9;
+        // CR11 only holds the low four bits of the line that retrace ends on
+        vretrace_end = (vretrace_start & ~15) | (vga.crt[0x11] & 15);
+        if (vretrace_end <= vretrace_start)
+            vretrace_end += 16;
+        clock = vga.misc & 4 ? 28322000 : 25175000;
+        if (vga.seq[1] & 8) // Dot clock divided by two
+            clock >>= 1;
+    }
+    if (!htotal || !vtotal)
+        return 0;
+
+    // Dot clocks since boot, split up so that it doesn't overflow
+    itick_t now = get_now();
+    uint64_t dots = (uint64_t)(now / ticks_per_second) * clock + (uint64_t)(now % ticks_per_second) * clock / ticks_per_second;
+    uint32_t pos = (uint32_t)(dots % ((uint64_t)htotal * vtotal)), line = pos / htotal, dot = pos % htotal;
+
+    uint8_t status = 0;
+    if (line >= vretrace_start && line < vretrace_end)
+        status |= 8;
+    if (line >= vdisp || dot >= hdisp)
+        status |= 1;
+    return status;
+}
+
 #ifndef VGA_LIBRARY
 static
 #endif
@@ -937,7 +1063,7 @@ static
     case 0x3DA: // Input status Register #1
         // Some programs poll this register to make sure that graphics registers are only being modified during vertical retrace periods
         // Not many programs require this feature to work. For now, we can fake this effect.
-        vga.status[1] ^= 9;
+        vga.status[1] = (vga.status[1] & ~9) | vga_retrace_status();
         vga.attr_index &= ~0x80; // Also clears attr flip flop
         return vga.status[1];
     case 0x3B5:
@@ -950,64 +1076,327 @@ static
     return 0;
 }
 
-static inline uint8_t bpp4_to_offset(uint8_t i, uint8_t j, uint8_t k)
+// Scanline conversion kernels
+// These turn one scanline of VRAM into 0xAARRGGBB pixels. The vector versions are picked at compile time, and each one
+// falls back to the scalar loop for the pixels that don't fill a whole vector. Emscripten wants its pixels byte-swapped,
+// so it always uses the scalar loops.
+#ifndef EMSCRIPTEN
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VGA_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(__SSSE3__) || defined(__AVX__)
+#define VGA_SSSE3
+#include <tmmintrin.h>
+#endif
+#ifdef __AVX2__
+#define VGA_AVX2
+#include <immintrin.h>
+#endif
+#endif
+
+#if defined(VGA_AVX2)
+#define VGA_KERNELS "AVX2"
+#elif defined(VGA_SSSE3)
+#define VGA_KERNELS "SSSE3"
+#elif defined(VGA_SSE2)
+#define VGA_KERNELS "SSE2"
+#else
+#define VGA_KERNELS "scalar"
+#endif
+
+// Every byte value, with bit 7 - n moved to bit 4 * n. ORing together the entries of the four planes, each shifted by
+// its plane number, gives eight 4-bit color indices at once.
+static uint32_t planar_spread[256];
+
+static void vga_init_kernels(void)
+{
+    for (int i = 0; i < 256; i++) {
+        uint32_t spread = 0;
+        for (int j = 0; j < 8; j++)
+            if (i & (0x80 >> j))
+                spread |= 1 << (j * 4);
+        planar_spread[i] = spread;
+    }
+}
+
+// 8-bit palette lookup
+static void vga_convert_8bpp(uint32_t* dst, uint8_t* src, unsigned int count, uint32_t* palette, uint8_t mask)
 {
-    return ((i & (0x80 >> j)) != 0) ? 1 << k : 0;
+    unsigned int i = 0;
+#ifdef VGA_AVX2
+    __m256i vmask = _mm256_set1_epi32(mask);
+    for (; i + 8 <= count; i += 8, src += 8) {
+        __m256i idx = _mm256_and_si256(_mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i*)src)), vmask);
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_i32gather_epi32((const int*)palette, idx, 4));
+    }
+#endif
+    for (; i < count; i++)
+        dst[i] = palette[*src++ & mask];
+}
+
+// Same as above, but every pixel is drawn twice
+static void vga_convert_8bpp_doubled(uint32_t* dst, uint8_t* src, unsigned int count, uint32_t* palette, uint8_t mask)
+{
+    unsigned int i = 0;
+#ifdef VGA_AVX2
+    __m256i vmask = _mm256_set1_epi32(mask);
+    for (; i + 8 <= count; i += 8, src += 8) {
+        __m256i idx = _mm256_and_si256(_mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i*)src)), vmask);
+        __m256i pixels = _mm256_i32gather_epi32((const int*)palette, idx, 4);
+        __m256i lo = _mm256_unpacklo_epi32(pixels, pixels), hi = _mm256_unpackhi_epi32(pixels, pixels);
+        _mm256_storeu_si256((__m256i*)(dst + i * 2), _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256((__m256i*)(dst + i * 2 + 8), _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+#endif
+    for (; i < count; i++)
+        dst[i * 2] = dst[i * 2 + 1] = palette[*src++ & mask];
+}
+
+// Mode 13h: four pixels from each 16-byte group
+static void vga_convert_chain4(uint32_t* dst, uint8_t* src, unsigned int count, uint32_t* palette, uint8_t mask)
+{
+    unsigned int i = 0;
+#ifdef VGA_AVX2
+    __m256i vmask = _mm256_set1_epi32(mask);
+    for (; i + 8 <= count; i += 8, src += 32) {
+        __m128i bytes = _mm_unpacklo_epi32(_mm_cvtsi32_si128(*(int*)src), _mm_cvtsi32_si128(*(int*)(src + 16)));
+        __m256i idx = _mm256_and_si256(_mm256_cvtepu8_epi32(bytes), vmask);
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_i32gather_epi32((const int*)palette, idx, 4));
+    }
+#endif
+    for (; i + 4 <= count; i += 4, src += 16) {
+        dst[i + 0] = palette[src[0] & mask];
+        dst[i + 1] = palette[src[1] & mask];
+        dst[i + 2] = palette[src[2] & mask];
+        dst[i + 3] = palette[src[3] & mask];
+    }
+    for (unsigned int j = 0; i < count; i++, j++)
+        dst[i] = palette[src[j] & mask];
+}
+
+// Planar 4bpp: decode "count" color indices, starting "skip" pixels into the first group of four planes
+static void vga_convert_planar(uint8_t* dst, uint8_t* src, unsigned int count, unsigned int skip)
+{
+    uint8_t group[8];
+    for (unsigned int i = 0; i < count; src += 4) {
+        uint32_t indices = planar_spread[src[0]] | planar_spread[src[1]] << 1 | planar_spread[src[2]] << 2 | planar_spread[src[3]] << 3;
+        for (int j = 0; j < 8; j++)
+            group[j] = indices >> (j * 4) & 15;
+        for (; skip < 8 && i < count; skip++)
+            dst[i++] = group[skip];
+        skip = 0;
+    }
+}
+
+// VBE 16-bit: RGB565
+static void vga_convert_16bpp(uint32_t* dst, uint8_t* src, unsigned int count)
+{
+    unsigned int i = 0;
+#ifdef VGA_SSE2
+    __m128i green_mask = _mm_set1_epi16(63 << 2), blue_mask = _mm_set1_epi16(31 << 3), alpha = _mm_set1_epi16((short)0xFF00);
+    for (; i + 8 <= count; i += 8) {
+        __m128i words = _mm_loadu_si128((__m128i*)(src + i * 2));
+        __m128i red = _mm_or_si128(_mm_slli_epi16(_mm_srli_epi16(words, 11), 3), alpha),
+                green = _mm_and_si128(_mm_srli_epi16(words, 3), green_mask),
+                blue = _mm_and_si128(_mm_slli_epi16(words, 3), blue_mask);
+        __m128i low = _mm_or_si128(_mm_slli_epi16(green, 8), blue);
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_unpacklo_epi16(low, red));
+        _mm_storeu_si128((__m128i*)(dst + i + 4), _mm_unpackhi_epi16(low, red));
+    }
+#endif
+    for (; i < count; i++) {
+        uint16_t word = *((uint16_t*)&src[i * 2]);
+        int red = word >> 11 << 3,
+            green = (word >> 5 & 63) << 2, // Note: 6 bits for green
+            blue = (word & 31) << 3;
+#ifndef EMSCRIPTEN
+        dst[i] = red << 16 | green << 8 | blue << 0 | 0xFF000000;
+#else
+        dst[i] = red << 0 | green << 8 | blue << 16 | 0xFF000000;
+#endif
+    }
+}
+
+// VBE 24-bit: BGR
+static void vga_convert_24bpp(uint32_t* dst, uint8_t* src, unsigned int count)
+{
+    unsigned int i = 0;
+#ifdef VGA_SSSE3
+    __m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1),
+            alpha = _mm_set1_epi32(0xFF000000);
+    // Each load reads 16 bytes but only uses 12, so stop before it would go past the end of the line
+    for (; i + 6 <= count; i += 4) {
+        __m128i bytes = _mm_loadu_si128((__m128i*)(src + i * 3));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_or_si128(_mm_shuffle_epi8(bytes, shuffle), alpha));
+    }
+#endif
+    for (; i < count; i++) {
+        uint8_t blue = src[i * 3],
+                green = src[i * 3 + 1],
+                red = src[i * 3 + 2];
+#ifndef EMSCRIPTEN
+        dst[i] = (blue) | (green << 8) | (red << 16) | 0xFF000000;
+#else
+        dst[i] = (blue << 16) | (green << 8) | (red) | 0xFF000000;
+#endif
+    }
+}
+
+// VBE 32-bit: only the alpha channel has to be filled in
+static void vga_convert_32bpp(uint32_t* dst, uint8_t* src, unsigned int count)
+{
+    unsigned int i = 0;
+#ifdef VGA_SSE2
+    __m128i alpha = _mm_set1_epi32(0xFF000000);
+    for (; i + 4 <= count; i += 4)
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_or_si128(_mm_loadu_si128((__m128i*)(src + i * 4)), alpha));
+#endif
+    for (; i < count; i++) {
+#ifndef EMSCRIPTEN
+        dst[i] = *((uint32_t*)&src[i * 4]) | 0xFF000000;
+#else
+        uint32_t num = *((uint32_t*)&src[i * 4]);
+        // Byte-swap framebuffer for easy ImageData blitting
+        dst[i] = (num >> 16 & 0xFF) | (num << 16 & 0xFF0000) | (num & 0xFF00) | 0xFF000000;
+#endif
+    }
 }
 
 static int framectr = 0;
-void vga_update(void)
+
+// Returns nonzero if any page in [addr, addr + length) was written to before the current frame started
+static int vga_range_dirty(struct vga_info* v, uint32_t addr, uint32_t length)
+{
+    uint32_t last = (addr + length - 1) >> VGA_PAGE_SHIFT, pages = v->vram_size >> VGA_PAGE_SHIFT;
+    if (last >= pages)
+        last = pages - 1;
+    for (uint32_t i = addr >> VGA_PAGE_SHIFT; i <= last; i++)
+        if (v->frame_dirty[i >> 5] >> (i & 31) & 1)
+            return 1;
+    return 0;
+}
+
+// How many bytes of VRAM one scanline is drawn from. Text mode is checked cell by cell instead.
+static uint32_t vga_line_bytes(struct vga_info* v)
+{
+    switch (v->renderer) {
+    case MODE_13H_RENDERER:
+        return v->total_width * 4;
+    case MODE_13H_RENDERER | 1:
+        return v->total_width >> 1;
+    case RENDER_4BPP:
+        return ((v->total_width >> 3) + 1) << 2;
+    case RENDER_4BPP | 1:
+        return ((v->total_width >> 4) + 1) << 2;
+    case RENDER_8BPP:
+        return v->total_width;
+    case RENDER_16BPP:
+        return v->total_width * 2;
+    case RENDER_24BPP:
+        return v->total_width * 3;
+    case RENDER_32BPP:
+        return v->total_width * 4;
+    default:
+        return 0;
+    }
+}
+
+// Compares the text row at "addr" with what was drawn there last time, and marks the cells that need to be redrawn.
+// Returns nonzero if any of them do.
+static int vga_text_row_changed(struct vga_info* v, uint32_t addr, uint32_t cursor_address, int blink)
+{
+    uint32_t* cells = v->text_row < TEXT_MAX_ROWS ? &v->text_cells[v->text_row * TEXT_MAX_COLS] : NULL;
+    int changed = 0;
+    for (unsigned int i = 0, col = 0; i < v->total_width; i += v->char_width, addr += 4, col++) {
+        uint32_t key = v->vram[addr << 1] | v->vram[(addr << 1) + 1] << 8;
+        if (addr == cursor_address)
+            key |= 1 << 16;
+        if (blink && (key & 0x8000))
+            key |= 1 << 17;
+        v->text_changed[col] = v->redraw_all || !cells || cells[col] != key;
+        changed |= v->text_changed[col];
+        if (cells)
+            cells[col] = key;
+    }
+    return changed;
+}
+
+// Draws the next "scanlines_to_update" scanlines of "v" into its framebuffer. Only scanlines that read from VRAM pages
+// written since the last frame (or, in text mode, rows with changed cells) are drawn, unless memory_modified asks for
+// the whole screen.
+static void vga_render(struct vga_info* v, int scanlines_to_update)
 {
     // Note: This function should NOT modify any VGA registers or memory!
 
     framectr = (framectr + 1) & 0x3F;
-    int scanlines_to_update = vga.scanlines_to_update; // XXX
 
     // Text Mode state
     unsigned int cursor_scanline_start = 0, cursor_scanline_end = 0, cursor_enabled = 0, cursor_address = 0,
                  underline_location = 0, line_graphics = 0;
     // 4BPP renderer
-    unsigned int enableMask = 0, address_bit_mapping = 0;
+    unsigned int address_bit_mapping = 0;
+    uint32_t planar_palette[16];
 
     // All non-VBE renderers
-    unsigned int offset_between_lines = (((!vga.crt[0x13]) << 8 | vga.crt[0x13]) * 2) << 2;
-    switch (vga.renderer & ~1) {
+    unsigned int offset_between_lines = (((!v->crt[0x13]) << 8 | v->crt[0x13]) * 2) << 2;
+    switch (v->renderer & ~1) {
     case BLANK_RENDERER:
         break;
     case ALPHANUMERIC_RENDERER:
-        cursor_scanline_start = vga.crt[0x0A] & 0x1F;
-        cursor_scanline_end = vga.crt[0x0B] & 0x1F;
+        cursor_scanline_start = v->crt[0x0A] & 0x1F;
+        cursor_scanline_end = v->crt[0x0B] & 0x1F;
         // Blinking doesn't look good since emulator doesn't sync
-        // cursor_enabled = (vga.crt[0x0B] & 0x20) || (framectr >= 0x20);
+        // cursor_enabled = (v->crt[0x0B] & 0x20) || (framectr >= 0x20);
         cursor_enabled = 1;
-        cursor_address = (vga.crt[0x0E] << 8 | vga.crt[0x0F]) << 2;
-        underline_location = vga.crt[0x14] & 0x1F;
-        line_graphics = vga.char_width == 9 ? ((vga.attr[0x10] & 4) ? 0xE0 : 0) : 0;
+        cursor_address = (v->crt[0x0E] << 8 | v->crt[0x0F]) << 2;
+        underline_location = v->crt[0x14] & 0x1F;
+        line_graphics = v->char_width == 9 ? ((v->attr[0x10] & 4) ? 0xE0 : 0) : 0;
         break;
-    case RENDER_4BPP:
-        enableMask = vga.attr[0x12] & 15;
-        address_bit_mapping = vga.crt[0x17] & 1;
+    case RENDER_4BPP: {
+        unsigned int enable_mask = v->attr[0x12] & 15;
+        for (int i = 0; i < 16; i++)
+            planar_palette[i] = v->dac_palette[v->dac_mask & v->attr_palette[i & enable_mask]];
+        address_bit_mapping = v->crt[0x17] & 1;
         break;
+    }
     case RENDER_16BPP: // VBE 16-bit BPP mode
-        offset_between_lines = vga.total_width * 2;
+        offset_between_lines = v->total_width * 2;
         break;
     case RENDER_24BPP: // VBE 24-bit BPP mode
-        offset_between_lines = vga.total_width * 3;
+        offset_between_lines = v->total_width * 3;
         break;
     case RENDER_32BPP: // VBE 32-bit BPP mode
-        offset_between_lines = vga.total_width * 4;
+        offset_between_lines = v->total_width * 4;
         break;
     }
-    if (!vga.memory_modified)
-        return;
-    vga.memory_modified &= ~(1 << (vga.current_scanline != 0));
+    uint32_t line_bytes = vga_line_bytes(v);
+
+    if (!v->current_scanline) {
+        // Start of a frame: it draws everything written up to now, and anything written while it's being drawn is left
+        // for the next one.
+        uint32_t* dirty = v->frame_dirty;
+        v->frame_dirty = v->dirty_pages;
+        v->dirty_pages = dirty;
+        h_memset(dirty, 0, VGA_DIRTY_BYTES(v->vram_size));
+        if (v == &vga)
+            vga_protect_lfb();
+
+        v->redraw_all = v->memory_modified;
+        v->memory_modified = 0;
+        v->dirty_top = v->total_height;
+        v->dirty_bottom = 0;
+        v->last_line_drawn = 0;
+        if (!v->redraw_all && (v->renderer & ~1) != ALPHANUMERIC_RENDERER && !vga_range_dirty(v, 0, v->vram_size))
+            return;
+    }
 
 #ifdef ALLEGRO_BUILD
-    vga.framebuffer = display_get_pixels();
+    v->framebuffer = display_get_pixels();
 #endif
 
     /* uint32_t
-        //current = vga.current_scanline,
+        //current = v->current_scanline,
         total_scanlines_drawn
         = 0; */
     while (scanlines_to_update--) {
@@ -1035,18 +1424,29 @@ void vga_update(void)
         //  6: ...
         //  7: (same as #6)
         // Therefore, we can come to the conclusion that if scanline doubling is enabled, then all odd scanlines are simply copies of the one preceding them
-        if ((vga.current_scanline & 1) && (vga.crt[9] & 0x80)) {
+        // VBE modes don't go through the CRT controller, so they are never doubled
+        if ((v->current_scanline & 1) && (v->crt[9] & 0x80) && v->renderer < RENDER_32BPP) {
             // See above for
-            h_memcpy(&vga.framebuffer[vga.framebuffer_offset], &vga.framebuffer[vga.framebuffer_offset - vga.total_width], vga.total_width);
+            if (v->last_line_drawn && v->current_scanline < v->total_height) {
+                h_memcpy(&v->framebuffer[v->framebuffer_offset], &v->framebuffer[v->framebuffer_offset - v->total_width], v->total_width * 4);
+                v->dirty_bottom = v->current_scanline + 1;
+            }
         } else {
-            if (vga.current_scanline < vga.total_height) {
-                uint32_t fboffset = vga.framebuffer_offset;
-                uint32_t vram_addr = vga.vram_addr;
-                switch (vga.renderer) {
+            if (v->current_scanline < v->total_height) {
+                uint32_t fboffset = v->framebuffer_offset;
+                uint32_t vram_addr = v->vram_addr;
+                uint32_t line_addr = vram_addr;
+                if (v->renderer == RENDER_4BPP && (v->character_scanline & address_bit_mapping))
+                    line_addr |= 0x8000;
+                int drawn = v->redraw_all || (line_bytes && vga_range_dirty(v, line_addr, line_bytes));
+
+                switch (v->renderer) {
                 case BLANK_RENDERER:
                 case BLANK_RENDERER | 1:
-                    for (unsigned int i = 0; i < vga.total_width; i++) {
-                        vga.framebuffer[fboffset + i] = 255 << 24;
+                    if (!drawn)
+                        break;
+                    for (unsigned int i = 0; i < v->total_width; i++) {
+                        v->framebuffer[fboffset + i] = 255 << 24;
                     }
                     break;
                 case ALPHANUMERIC_RENDERER: {
@@ -1056,14 +1456,24 @@ void vga_update(void)
                     // Plane 2: FF XX FF XX
                     // Plane 3: XX XX XX XX
                     // In a row: CC AA FF XX XX XX XX XX CC AA FF XX XX XX XX XX
-                    for (unsigned int i = 0; i < vga.total_width; i += vga.char_width, vram_addr += 4) {
-                        uint8_t character = vga.vram[vram_addr << 1];
-                        uint8_t attribute = vga.vram[(vram_addr << 1) + 1];
-                        uint8_t font = vga.vram[( //
+                    if (v->text_row_pending) {
+                        v->text_row_drawn = vga_text_row_changed(v, vram_addr, cursor_enabled ? cursor_address : (uint32_t)-1,
+                            (v->attr[0x10] & 8) && (framectr >= 32));
+                        v->text_row_pending = 0;
+                    }
+                    drawn = v->text_row_drawn;
+                    for (unsigned int i = 0, col = 0; i < v->total_width; i += v->char_width, vram_addr += 4, col++) {
+                        if (!v->text_changed[col]) {
+                            fboffset += v->char_width;
+                            continue;
+                        }
+                        uint8_t character = v->vram[vram_addr << 1];
+                        uint8_t attribute = v->vram[(vram_addr << 1) + 1];
+                        uint8_t font = v->vram[( //
                                                     ( //
-                                                        vga.character_scanline // Current character scanline
+                                                        v->character_scanline // Current character scanline
                                                         + character * 32 // Each character holds 32 bytes of font data in plane 2
-                                                        + vga.character_map[~attribute >> 3 & 1]) // Offset in plane to, decided by attribute byte
+                                                        + v->character_map[~attribute >> 3 & 1]) // Offset in plane to, decided by attribute byte
                                                     << 2)
                             + 2 // Select Plane 2
                         ];
@@ -1075,199 +1485,127 @@ void vga_update(void)
                         //  - Blinking
                         //  - Underline
                         if (cursor_enabled && vram_addr == cursor_address) {
-                            if ((vga.character_scanline >= cursor_scanline_start) && (vga.character_scanline <= cursor_scanline_end)) {
+                            if ((v->character_scanline >= cursor_scanline_start) && (v->character_scanline <= cursor_scanline_end)) {
                                 // cursor is enabled
                                 bg = fg;
                             }
                         }
 
                         // TODO: I've noticed that blinking is twice as slow as cursor blinks
-                        if ((vga.attr[0x10] & 8) && (framectr >= 32)) {
+                        if ((v->attr[0x10] & 8) && (framectr >= 32)) {
                             bg &= 7; // last bit is not interpreted
                             if (attribute & 0x80)
                                 fg = bg;
                         }
                         // Underline is simple
                         if ((attribute & 0b01110111) == 1) {
-                            if (vga.character_scanline == underline_location)
+                            if (v->character_scanline == underline_location)
                                 bg = fg;
                         }
 
                         // To draw the character quickly, use a method similar to do_mask
-                        fg = vga.dac_palette[vga.dac_mask & vga.attr_palette[fg]];
-                        bg = vga.dac_palette[vga.dac_mask & vga.attr_palette[bg]];
+                        fg = v->dac_palette[v->dac_mask & v->attr_palette[fg]];
+                        bg = v->dac_palette[v->dac_mask & v->attr_palette[bg]];
                         uint32_t xorvec = fg ^ bg;
                         // The following is equivalent to the following:
-                        //  if(font & bit) vga.framebuffer[fboffset] = fg; else vga.framebuffer[fboffset] = bg;
-                        vga.framebuffer[fboffset + 0] = ((xorvec & -(font >> 7))) ^ bg;
-                        vga.framebuffer[fboffset + 1] = ((xorvec & -(font >> 6 & 1))) ^ bg;
-                        vga.framebuffer[fboffset + 2] = ((xorvec & -(font >> 5 & 1))) ^ bg;
-                        vga.framebuffer[fboffset + 3] = ((xorvec & -(font >> 4 & 1))) ^ bg;
-                        vga.framebuffer[fboffset + 4] = ((xorvec & -(font >> 3 & 1))) ^ bg;
-                        vga.framebuffer[fboffset + 5] = ((xorvec & -(font >> 2 & 1))) ^ bg;
-                        vga.framebuffer[fboffset + 6] = ((xorvec & -(font >> 1 & 1))) ^ bg;
-                        vga.framebuffer[fboffset + 7] = ((xorvec & -(font >> 0 & 1))) ^ bg;
+                        //  if(font & bit) v->framebuffer[fboffset] = fg; else v->framebuffer[fboffset] = bg;
+                        v->framebuffer[fboffset + 0] = ((xorvec & -(font >> 7))) ^ bg;
+                        v->framebuffer[fboffset + 1] = ((xorvec & -(font >> 6 & 1))) ^ bg;
+                        v->framebuffer[fboffset + 2] = ((xorvec & -(font >> 5 & 1))) ^ bg;
+                        v->framebuffer[fboffset + 3] = ((xorvec & -(font >> 4 & 1))) ^ bg;
+                        v->framebuffer[fboffset + 4] = ((xorvec & -(font >> 3 & 1))) ^ bg;
+                        v->framebuffer[fboffset + 5] = ((xorvec & -(font >> 2 & 1))) ^ bg;
+                        v->framebuffer[fboffset + 6] = ((xorvec & -(font >> 1 & 1))) ^ bg;
+                        v->framebuffer[fboffset + 7] = ((xorvec & -(font >> 0 & 1))) ^ bg;
 
                         if ((character & line_graphics) == 0xC0) {
-                            vga.framebuffer[fboffset + 8] = ((xorvec & -(font >> 0 & 1))) ^ bg;
-                        } else if (vga.char_width == 9)
-                            vga.framebuffer[fboffset + 8] = bg;
-                        fboffset += vga.char_width;
+                            v->framebuffer[fboffset + 8] = ((xorvec & -(font >> 0 & 1))) ^ bg;
+                        } else if (v->char_width == 9)
+                            v->framebuffer[fboffset + 8] = bg;
+                        fboffset += v->char_width;
                     }
                     break;
                 }
-                case MODE_13H_RENDERER: {
-                    //if(!vga.vbe_scanlines_modified[vga.current_scanline]) break;
+                case MODE_13H_RENDERER:
+                    if (!drawn)
+                        break;
                     // CHAIN4 Memory Layout:
                     //  Plane 0: AA 00 00 00 AA 00 00 00
                     //  Plane 1: BB 00 00 00 BB 00 00 00
                     //  Plane 2: CC 00 00 00 CC 00 00 00
                     //  Plane 3: DD 00 00 00 DD 00 00 00
-                    // Draw four clumps of pixels together
-                    // XXX: What if screen isn't a multiple of four pixels wide?
-                    for (unsigned int i = 0; i < vga.total_width; i += 4, vram_addr += 16) {
-                        for (int j = 0; j < 4; j++) { // hopefully, compiler unrolls loop
-                            vga.framebuffer[fboffset + j] = vga.dac_palette[vga.vram[vram_addr | j] & vga.dac_mask];
-                        }
-                        fboffset += 4;
-                    }
-                    //vga.vbe_scanlines_modified[vga.current_scanline] = 0;
+                    vga_convert_chain4(&v->framebuffer[fboffset], &v->vram[vram_addr], v->total_width, v->dac_palette, v->dac_mask);
                     break;
-                }
                 case MODE_13H_RENDERER | 1:
-                    //if(!vga.vbe_scanlines_modified[vga.current_scanline]) break;
-                    for (unsigned int i = 0; i < vga.total_width; i += 8, vram_addr += 4) {
-                        for (int j = 0, k = 0; j < 4; j++, k += 2) {
-                            vga.framebuffer[fboffset + k] = vga.framebuffer[fboffset + k + 1] = vga.dac_palette[vga.vram[vram_addr | j] & vga.dac_mask];
-                        }
-                        fboffset += 8;
-                    }
-                    //vga.vbe_scanlines_modified[vga.current_scanline] = 0;
-                    break;
-                case RENDER_4BPP: {
-                    //if(!vga.vbe_scanlines_modified[vga.current_scanline]) break;
-                    uint32_t addr = vram_addr;
-                    if (vga.character_scanline & address_bit_mapping)
-                        addr |= 0x8000;
-                    uint8_t p0 = vga.vram[addr | 0];
-                    uint8_t p1 = vga.vram[addr | 1];
-                    uint8_t p2 = vga.vram[addr | 2];
-                    uint8_t p3 = vga.vram[addr | 3];
-
-                    for (unsigned int x = 0, px = vga.current_pixel_panning; x < vga.total_width; x++, fboffset++, px++) {
-                        if (px > 7) {
-                            px = 0;
-                            addr += 4;
-                            p0 = vga.vram[addr | 0];
-                            p1 = vga.vram[addr | 1];
-                            p2 = vga.vram[addr | 2];
-                            p3 = vga.vram[addr | 3];
-                        }
-                        int pixel = bpp4_to_offset(p0, px, 0) | bpp4_to_offset(p1, px, 1) | bpp4_to_offset(p2, px, 2) | bpp4_to_offset(p3, px, 3);
-                        pixel &= enableMask;
-                        vga.framebuffer[fboffset] = vga.dac_palette[vga.dac_mask & vga.attr_palette[pixel]];
-                    }
-                    //vga.vbe_scanlines_modified[vga.current_scanline] = 0;
+                    if (!drawn)
+                        break;
+                    vga_convert_8bpp_doubled(&v->framebuffer[fboffset], &v->vram[vram_addr], v->total_width >> 1, v->dac_palette, v->dac_mask);
                     break;
-                }
+                case RENDER_4BPP:
                 case RENDER_4BPP | 1: {
-                    // 4BPP rendering mode, but lower resolution
-                    //if(!vga.vbe_scanlines_modified[vga.current_scanline]) break;
-                    uint32_t addr = vram_addr;
-                    uint8_t p0 = vga.vram[addr | 0];
-                    uint8_t p1 = vga.vram[addr | 1];
-                    uint8_t p2 = vga.vram[addr | 2];
-                    uint8_t p3 = vga.vram[addr | 3];
-                    for (unsigned int x = 0, px = vga.current_pixel_panning; x < vga.total_width; x += 2, fboffset += 2, px++) {
-                        if (px > 7) {
-                            px = 0;
-                            addr += 4;
-                            p0 = vga.vram[addr | 0];
-                            p1 = vga.vram[addr | 1];
-                            p2 = vga.vram[addr | 2];
-                            p3 = vga.vram[addr | 3];
-                        }
-                        int pixel = bpp4_to_offset(p0, px, 0) | bpp4_to_offset(p1, px, 1) | bpp4_to_offset(p2, px, 2) | bpp4_to_offset(p3, px, 3);
-                        pixel &= enableMask;
-                        uint32_t result = vga.dac_palette[vga.dac_mask & vga.attr_palette[pixel]];
-                        vga.framebuffer[fboffset] = result;
-                        vga.framebuffer[fboffset + 1] = result;
+                    if (!drawn)
+                        break;
+                    uint32_t* fb = &v->framebuffer[fboffset];
+                    unsigned int wide = v->renderer & 1, count = v->total_width >> wide;
+                    uint8_t indices[2048];
+                    if (count > sizeof(indices))
+                        count = sizeof(indices);
+                    vga_convert_planar(indices, &v->vram[wide ? vram_addr : line_addr], count, v->current_pixel_panning > 8 ? 8 : v->current_pixel_panning);
+                    if (wide) {
+                        for (unsigned int x = 0; x < count; x++)
+                            fb[x * 2] = fb[x * 2 + 1] = planar_palette[indices[x]];
+                    } else {
+                        for (unsigned int x = 0; x < count; x++)
+                            fb[x] = planar_palette[indices[x]];
                     }
-                    //vga.vbe_scanlines_modified[vga.current_scanline] = 0;
                     break;
                 }
                 case RENDER_32BPP:
-                    if (!vga.vbe_scanlines_modified[vga.current_scanline])
+                    if (!drawn)
                         break;
-                    for (unsigned int i = 0; i < vga.total_width; i++, vram_addr += 4) {
-#ifndef EMSCRIPTEN
-                        vga.framebuffer[fboffset++] = *((uint32_t*)&vga.vram[vram_addr]) | 0xFF000000;
-#else
-                        uint32_t num = *((uint32_t*)&vga.vram[vram_addr]);
-                        // Byte-swap framebuffer for easy ImageData blitting
-                        vga.framebuffer[fboffset++] = (num >> 16 & 0xFF) | (num << 16 & 0xFF0000) | (num & 0xFF00) | 0xFF000000;
-#endif
-                    }
-                    vga.vbe_scanlines_modified[vga.current_scanline] = 0;
+                    vga_convert_32bpp(&v->framebuffer[fboffset], &v->vram[vram_addr], v->total_width);
                     break;
                 case RENDER_8BPP:
-                    if (!vga.vbe_scanlines_modified[vga.current_scanline])
+                    if (!drawn)
                         break;
-                    for (unsigned int i = 0; i < vga.total_width; i++, vram_addr++)
-                        vga.framebuffer[fboffset++] = vga.dac_palette[vga.vram[vram_addr]];
-
-                    vga.vbe_scanlines_modified[vga.current_scanline] = 0;
+                    vga_convert_8bpp(&v->framebuffer[fboffset], &v->vram[vram_addr], v->total_width, v->dac_palette, 0xFF);
                     break;
                 case RENDER_16BPP:
-                    if (!vga.vbe_scanlines_modified[vga.current_scanline])
+                    if (!drawn)
                         break;
-                    for (unsigned int i = 0; i < vga.total_width; i++, vram_addr += 2) {
-                        uint16_t word = *((uint16_t*)&vga.vram[vram_addr]);
-                        int red = word >> 11 << 3,
-                            green = (word >> 5 & 63) << 2, // Note: 6 bits for green
-                            blue = (word & 31) << 3;
-#ifndef EMSCRIPTEN
-                        vga.framebuffer[fboffset++] = red << 16 | green << 8 | blue << 0 | 0xFF000000;
-#else
-                        vga.framebuffer[fboffset++] = red << 0 | green << 8 | blue << 16 | 0xFF000000;
-#endif
-                    }
-
-                    vga.vbe_scanlines_modified[vga.current_scanline] = 0;
+                    vga_convert_16bpp(&v->framebuffer[fboffset], &v->vram[vram_addr], v->total_width);
                     break;
                 case RENDER_24BPP:
-                    if (!vga.vbe_scanlines_modified[vga.current_scanline])
+                    if (!drawn)
                         break;
-                    for (unsigned int i = 0; i < vga.total_width; i++, vram_addr += 3) {
-                        uint8_t blue = vga.vram[vram_addr],
-                                green = vga.vram[vram_addr + 1],
-                                red = vga.vram[vram_addr + 2];
-#ifndef EMSCRIPTEN
-                        vga.framebuffer[fboffset++] = (blue) | (green << 8) | (red << 16) | 0xFF000000;
-#else
-                        vga.framebuffer[fboffset++] = (blue << 16) | (green << 8) | (red) | 0xFF000000;
-#endif
-                    }
-                    vga.vbe_scanlines_modified[vga.current_scanline] = 0;
+                    vga_convert_24bpp(&v->framebuffer[fboffset], &v->vram[vram_addr], v->total_width);
                     break;
                 }
-                if ((vga.crt[9] & 0x1F) == vga.character_scanline) {
-                    vga.character_scanline = 0;
-                    vga.vram_addr += offset_between_lines; // TODO: Dword Mode
+                v->last_line_drawn = drawn;
+                if (drawn) {
+                    if (v->dirty_top > v->current_scanline)
+                        v->dirty_top = v->current_scanline;
+                    v->dirty_bottom = v->current_scanline + 1;
+                }
+                if ((v->crt[9] & 0x1F) == v->character_scanline) {
+                    v->character_scanline = 0;
+                    v->vram_addr += offset_between_lines; // TODO: Dword Mode
+                    v->text_row++;
+                    v->text_row_pending = 1;
                 } else
-                    vga.character_scanline++;
+                    v->character_scanline++;
             }
         }
-        vga.current_scanline = (vga.current_scanline + 1) & 0x0FFF; // Increment current scan line
-        vga.framebuffer_offset += vga.total_width;
-        if (vga.current_scanline >= vga.total_height) {
+        v->current_scanline = (v->current_scanline + 1) & 0x0FFF; // Increment current scan line
+        v->framebuffer_offset += v->total_width;
+        if (v->current_scanline >= v->total_height) {
             // Technically, we should draw output to the value specified by the CRT Vertical Total Register, but why bother?
 
-            // Update the display when all the scanlines have been drawn
-            //display_update(current, total_scanlines_drawn);
-            display_update(0, vga.total_height);
+            // Update the display when all the scanlines have been drawn, but only the part that changed
+            if (v->dirty_bottom > v->dirty_top)
+                display_update(v->dirty_top, v->dirty_bottom - v->dirty_top);
 
-            vga_complete_redraw(); // contrary to its name, it only resets drawing state
+            vga_restart_frame(v);
             //current = 0;
 
             // total_scanlines_drawn = 0;
@@ -1278,6 +1616,121 @@ void vga_update(void)
     }
 }
 
+void vga_use_render_thread(void)
+{
+    render_thread = 1;
+}
+
+// Emulator thread: give the current frame to the render thread, unless it is still busy with the last one
+static void vga_snapshot(void)
+{
+    if (h_atomic_load(&render_pending))
+        return;
+
+    uint8_t* vram = render.vram;
+    uint32_t *dirty = render.dirty_pages, *frame_dirty = render.frame_dirty, *cells = render.text_cells;
+    if (render_vram_size != vga.vram_size) {
+        if (vram)
+            afree(vram);
+        vram = aalloc(vga.vram_size, 8);
+        h_free(dirty);
+        h_free(frame_dirty);
+        dirty = h_calloc(VGA_DIRTY_BYTES(vga.vram_size), 1);
+        frame_dirty = h_calloc(VGA_DIRTY_BYTES(vga.vram_size), 1);
+        render_vram_size = vga.vram_size;
+        vga_mark_all_dirty();
+    }
+    if (!cells)
+        cells = h_calloc(TEXT_MAX_COLS * TEXT_MAX_ROWS, sizeof(uint32_t));
+
+    // Copy the pages that were written since the last snapshot, and pass their dirty bits on
+    for (int i = 0; i < VGA_DIRTY_BYTES(vga.vram_size) / 4; i++) {
+        uint32_t bits = vga.dirty_pages[i];
+        if (!bits)
+            continue;
+        dirty[i] |= bits;
+        vga.dirty_pages[i] = 0;
+        for (int j = 0; j < 32; j++) {
+            if (bits >> j & 1) {
+                uint32_t offset = (i * 32 + j) << VGA_PAGE_SHIFT;
+                h_memcpy(vram + offset, vga.vram + offset, 1 << VGA_PAGE_SHIFT);
+            }
+        }
+    }
+    vga_protect_lfb();
+
+    render = vga;
+    render.vram = vram;
+    render.dirty_pages = dirty;
+    render.frame_dirty = frame_dirty;
+    render.text_cells = cells;
+    render.framebuffer = render_framebuffer;
+    vga.memory_modified = 0;
+
+    h_atomic_store(&render_pending, 1);
+}
+
+// Render thread: draw the frame that the emulator thread handed over, if there is one. Returns 1 if a frame was drawn.
+int vga_render_snapshot(void)
+{
+    if (!h_atomic_load(&render_pending))
+        return 0;
+    if (render.total_width != (uint32_t)render_width || render.total_height != (uint32_t)render_height) {
+        display_set_resolution(render.total_width, render.total_height);
+        render_framebuffer = display_get_pixels();
+        render_width = render.total_width;
+        render_height = render.total_height;
+        render.memory_modified = 3;
+    }
+    render.framebuffer = render_framebuffer;
+    vga_restart_frame(&render);
+    vga_render(&render, render.total_height);
+    h_atomic_store(&render_pending, 0);
+    return 1;
+}
+
+// Redraw the whole screen "frames" times and report how long it took. Loading a savestate first replays a captured
+// screen, VRAM and registers included.
+void vga_benchmark(int frames)
+{
+    uint64_t start, elapsed;
+    double pixels = (double)vga.total_width * vga.total_height * frames;
+
+    vga_restart_frame(&vga);
+    start = h_get_us();
+    for (int i = 0; i < frames; i++) {
+        vga.memory_modified = 3;
+        vga_render(&vga, vga.total_height);
+    }
+    elapsed = h_get_us() - start;
+    if (!elapsed)
+        elapsed = 1;
+
+    h_printf("VGA benchmark: %d frames at %dx%d, renderer %d, %s kernels\n", frames, vga.total_width, vga.total_height,
+        vga.renderer, VGA_KERNELS);
+    h_printf("%llu us total, %.1f us per frame, %.1f Mpixels/s\n", (unsigned long long)elapsed, (double)elapsed / frames,
+        pixels / elapsed);
+}
+
+// Called whenever the CPU stops running. A whole frame is drawn at a time, so the guest can't change anything halfway
+// through one, and no more often than the host refresh rate no matter how often the CPU stops.
+void vga_update(void)
+{
+    if (frame_interval_us) {
+        uint64_t now = h_get_us();
+        if (now - last_frame_us < frame_interval_us)
+            return;
+        // Don't try to catch up on frames that were missed while the CPU was busy
+        last_frame_us = now - last_frame_us < frame_interval_us * 2 ? last_frame_us + frame_interval_us : now;
+    }
+    if (render_thread)
+        vga_snapshot();
+    else {
+        vga_restart_frame(&vga);
+        vga_render(&vga, vga.total_height);
+    }
+}
+
 static void vga_reset(void)
 {
     // No need to reset registers that are "undefined" during bootup; the VGA BIOS will set them anyways
@@ -1414,11 +1867,7 @@ static
             else
                 vga.vram[vram_offset] = data;
         }
-        // Determine the scanline that was modified
-        uint32_t scanline = vram_offset / (vga.total_width * ((vga.vbe_regs[3] + 7) >> 3));
-        if (scanline < vga.total_height)
-            vga.vbe_scanlines_modified[scanline] = 1;
-        vga.memory_modified = 1;
+        vga_mark_dirty(vram_offset);
         return;
     }
 
@@ -1491,25 +1940,10 @@ static
     uint32_t* vram_ptr = (uint32_t*)&vga.vram[plane_addr << 2];
     *vram_ptr = do_mask(*vram_ptr, data32, plane);
 
-    // Update scanline
-    uint32_t offs = (plane_addr << 2) - (((vga.crt[0x0C] << 8) | vga.crt[0x0D]) << 2),
-             offset_between_lines = (((!vga.crt[0x13]) << 8 | vga.crt[0x13]) * 2) << 2;
-
-    unsigned int scanline = offs / offset_between_lines;
-    if (vga.total_height > scanline) {
-        switch (vga.renderer >> 1) {
-        case MODE_13H_RENDERER >> 1:
-            // Determine the scanline that it has been written to.
-            vga.vbe_scanlines_modified[scanline] = 1;
-            break;
-        case RENDER_4BPP >> 1:
-            // todo: what about bit13 replacement?
-            vga.vbe_scanlines_modified[scanline] = 1;
-            break;
-        }
-    }
-
-    vga.memory_modified = 3;
+    vga_mark_dirty(plane_addr << 2);
+    // Text cells are only compared by character and attribute, so a change to the font in plane 2 redraws everything
+    if ((plane & 4) && (vga.renderer & ~1) == ALPHANUMERIC_RENDERER)
+        vga.memory_modified = 3;
 
 #if 0
     VGA_LOG("Writing %02x to vram=0x%08x, phys=%08x [%c%c%c%c, offset: 0x%x] d32: %08x vram: %08x latch: %08x wmode: %d\n", data, addr, vga.vram_window_base + addr,
@@ -1522,6 +1956,150 @@ static
 #endif
 }
 
+// Block version of vga_mem_writeb for REP MOVS/STOS. Nothing that the write pipeline depends on can change in the
+// middle of a span, so the masks are worked out once, and each byte only costs a few 32-bit operations on all four
+// planes at once.
+static void vga_mem_write_block(uint32_t addr, const uint8_t* data, uint32_t length)
+{
+    if (vga.vbe_enable & VBE_DISPI_ENABLED) {
+        // Same four cases as vga_mem_writeb
+        int lfb = (addr & 0x80000000) != 0;
+        if (lfb != ((vga.vbe_enable & VBE_DISPI_LFB_ENABLED) != 0))
+            return;
+        uint32_t vram_offset = lfb ? addr - VBE_LFB_BASE : vga.vbe_regs[5] + (addr & 0x1FFFF);
+        if (vram_offset + length > (uint32_t)vga.vram_size)
+            return;
+        h_memcpy(&vga.vram[vram_offset], data, length);
+        for (uint32_t page = vram_offset >> VGA_PAGE_SHIFT; page <= (vram_offset + length - 1) >> VGA_PAGE_SHIFT; page++)
+            vga_mark_dirty(page << VGA_PAGE_SHIFT);
+        return;
+    }
+
+    uint32_t offset = addr - vga.vram_window_base, last = offset + length - 1, last_index = 0;
+    switch (vga.write_access) {
+    case CHAIN4:
+        last_index = last >> 2;
+        break;
+    case ODDEVEN:
+        last_index = last & ~1;
+        break;
+    case NORMAL:
+        last_index = last;
+        break;
+    }
+    // Let vga_mem_writeb deal with anything that is partly out of bounds
+    if (offset > vga.vram_window_size || last > vga.vram_window_size || last_index > 65536) {
+        for (uint32_t i = 0; i < length; i++)
+            vga_mem_writeb(addr + i, data[i]);
+        return;
+    }
+
+    uint32_t set_reset = expand32(vga.gfx[0]), enable_set_reset = expand32(vga.gfx[1]), bit_mask = b8to32(vga.gfx[8]),
+             planes = expand32(vga.seq[2]), latch = vga.latch32, result = 0, first_index = -1, *vram = (uint32_t*)vga.vram;
+    int rotate = vga.gfx[3] & 7, op = vga.gfx[3] & 0x18, last_byte = -1;
+    if (vga.write_mode == 1) {
+        // Latches are written as-is
+        op = 0;
+        bit_mask = 0xFFFFFFFF;
+    }
+    for (uint32_t i = 0; i < length; i++) {
+        // Fills write the same byte over and over, so the pipeline only has to be run when it changes
+        if (data[i] != last_byte) {
+            uint32_t value = latch, mask = bit_mask;
+            uint8_t rotated = (uint8_t)(data[i] >> rotate | data[i] << (8 - rotate));
+            last_byte = data[i];
+            switch (vga.write_mode) {
+            case 0:
+                value = (b8to32(rotated) & ~enable_set_reset) | (set_reset & enable_set_reset);
+                break;
+            case 2:
+                value = expand32(last_byte);
+                break;
+            case 3:
+                value = set_reset;
+                mask &= b8to32(rotated);
+                break;
+            }
+            switch (op) {
+            case 0x08: // AND
+                value &= latch;
+                break;
+            case 0x10: // OR
+                value |= latch;
+                break;
+            case 0x18: // XOR
+                value ^= latch;
+                break;
+            }
+            result = (value & mask) | (latch & ~mask);
+        }
+
+        uint32_t a = offset + i, index = a, lanes = planes;
+        switch (vga.write_access) {
+        case CHAIN4:
+            index = a >> 2;
+            lanes &= 0xFF << ((a & 3) * 8);
+            break;
+        case ODDEVEN:
+            index = a & ~1;
+            lanes &= 0x00FF00FF << ((a & 1) * 8);
+            break;
+        }
+        if (first_index == (uint32_t)-1)
+            first_index = index;
+        vram[index] = (vram[index] & ~lanes) | (result & lanes);
+    }
+
+    for (uint32_t page = first_index >> (VGA_PAGE_SHIFT - 2); page <= last_index >> (VGA_PAGE_SHIFT - 2); page++)
+        vga_mark_dirty(page << VGA_PAGE_SHIFT);
+    if ((planes & 0xFF0000) && (vga.renderer & ~1) == ALPHANUMERIC_RENDERER)
+        vga.memory_modified = 3;
+}
+
+// Word and dword versions of vga_mem_readb/writeb. SVGA modes store pixels as a flat array, so they take the whole value
+// at once. The planar pipeline works on bytes, so everything else still goes through it one byte at a time.
+static uint32_t vga_mem_read_multi(uint32_t addr, int bytes)
+{
+    uint32_t result = 0;
+    if (vga.vbe_enable & VBE_DISPI_ENABLED) {
+        uint8_t* ptr = addr & 0x80000000 ? &vga.vram[addr - VBE_LFB_BASE] : &vga.vram[vga.vbe_regs[5] + (addr & 0x1FFFF)];
+        for (int i = 0; i < bytes; i++)
+            result |= ptr[i] << (i * 8);
+        return result;
+    }
+    for (int i = 0; i < bytes; i++)
+        result |= (vga_mem_readb(addr + i) & 0xFF) << (i * 8);
+    return result;
+}
+static void vga_mem_write_multi(uint32_t addr, uint32_t data, int bytes)
+{
+    uint8_t buf[4];
+    for (int i = 0; i < bytes; i++)
+        buf[i] = data >> (i * 8);
+    if (vga.vbe_enable & VBE_DISPI_ENABLED)
+        vga_mem_write_block(addr, buf, bytes);
+    else {
+        for (int i = 0; i < bytes; i++)
+            vga_mem_writeb(addr + i, buf[i]);
+    }
+}
+static uint32_t vga_mem_readw(uint32_t addr)
+{
+    return vga_mem_read_multi(addr, 2);
+}
+static uint32_t vga_mem_readd(uint32_t addr)
+{
+    return vga_mem_read_multi(addr, 4);
+}
+static void vga_mem_writew(uint32_t addr, uint32_t data)
+{
+    vga_mem_write_multi(addr, data, 2);
+}
+static void vga_mem_writed(uint32_t addr, uint32_t data)
+{
+    vga_mem_write_multi(addr, data, 4);
+}
+
 static const uint8_t pci_config_space[16] = { 0x34, 0x12, 0x11, 0x11, 0, 0, 0, 0, 0, 0, 0, 3, 0, 0, 0, 0 };
 static int vga_pci_write(uint8_t* ptr, uint8_t addr, uint8_t data)
 {
@@ -1590,6 +2168,8 @@ static void vga_pci_init(struct loaded_file* vgabios)
 
 void vga_init(struct pc_settings* pc)
 {
+    vga_init_kernels();
+    frame_interval_us = pc->refresh_rate > 0 ? 1000000 / pc->refresh_rate : 0;
     io_register_reset(vga_reset);
     io_register_read(0x3B0, 48, vga_read, NULL, NULL);
     io_register_write(0x3B0, 48, vga_write, NULL, NULL);
@@ -1600,15 +2180,18 @@ void vga_init(struct pc_settings* pc)
 
     state_register(vga_state);
 
-    io_register_mmio_read(0xA0000, 0x20000 - 1, vga_mem_readb, NULL, NULL);
-    io_register_mmio_write(0xA0000, 0x20000 - 1, vga_mem_writeb, NULL, NULL);
+    io_register_mmio_read(0xA0000, 0x20000, vga_mem_readb, vga_mem_readw, vga_mem_readd);
+    io_register_mmio_write(0xA0000, 0x20000, vga_mem_writeb, vga_mem_writew, vga_mem_writed);
+    io_register_mmio_write_block(0xA0000, vga_mem_write_block);
 
     int memory_size = pc->vga_memory_size < (256 << 10) ? 256 << 10 : pc->vga_memory_size;
-    io_register_mmio_read(VBE_LFB_BASE, memory_size, vga_mem_readb, NULL, NULL);
-    io_register_mmio_write(VBE_LFB_BASE, memory_size, vga_mem_writeb, NULL, NULL);
+    io_register_mmio_read(VBE_LFB_BASE, memory_size, vga_mem_readb, vga_mem_readw, vga_mem_readd);
+    io_register_mmio_write(VBE_LFB_BASE, memory_size, vga_mem_writeb, vga_mem_writew, vga_mem_writed);
+    io_register_mmio_write_block(VBE_LFB_BASE, vga_mem_write_block);
 
     vga.vram_size = memory_size;
     vga_alloc_mem();
+    lfb_region = cpu_add_ram_region(VBE_LFB_BASE, memory_size, NULL, vga_lfb_dirty);
 
     if (pc->pci_vga_enabled) {
         vga_pci_init(&pc->vgabios);
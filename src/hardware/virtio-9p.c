@@ -0,0 +1,1313 @@
+// Virtio 9P shared folder
+// Serves a host directory to the guest over 9P2000.L, so that files can be moved in and out without touching disk
+// images. In a Linux guest:
+//   mount -t 9p -o trans=virtio,version=9p2000.L,msize=524288 <tag> /mnt
+// Requests are handled synchronously, as soon as the guest kicks the queue. File contents are moved with preadv and
+// pwritev directly between the host file and the guest's buffers, without going through a bounce buffer.
+// Paths are kept relative to the shared directory, and are looked up one name at a time from a descriptor for it, so
+// symlinks can be created and read, but are never followed on the host.
+// http://ericvh.github.io/9p-rfc/rfc9p2000.html
+// https://github.com/chaos/diod/blob/master/protocol.md (9P2000.L)
+
+#ifndef _WIN32
+#define _GNU_SOURCE
+#endif
+
+#include "devices.h"
+#include "pc.h"
+#include "virtio.h"
+
+#ifdef _WIN32
+void virtio_9p_init(struct virtio_9p_cfg* cfg)
+{
+    UNUSED(cfg);
+    h_fprintf(stderr, "virtio-9p is not supported on this platform - ignoring\n");
+}
+#else
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define P9_LOG(x, ...) LOG("9P", x, ##__VA_ARGS__)
+
+// Used for directories that are only looked up in
+#ifdef O_PATH
+#define P9_DIR_FLAGS (O_PATH | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC)
+#else
+#define P9_DIR_FLAGS (O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC)
+#endif
+
+#define VIRTIO_9P_MOUNT_TAG 1
+#define P9_MAX_TAG 64
+
+// Largest message that we'll negotiate. Linux can't use more than this over virtio anyways.
+#define P9_MAX_MSIZE (512 * 1024)
+#define P9_MIN_MSIZE 4096
+#define P9_HDR_SIZE 7 // size[4] type[1] tag[2]
+#define P9_READ_HDR_SIZE 11 // Rread: header, count[4]
+#define P9_WRITE_HDR_SIZE 23 // Twrite: header, fid[4] offset[8] count[4]
+#define P9_MAX_WALK 16
+#define P9_MAX_NAME 256
+#define P9_FID_BUCKETS 256
+// Most segments that a single read or write will be split into
+#define P9_MAX_IOV 256
+
+// Message types. Replies are always the request type + 1.
+enum {
+    P9_TLERROR = 6,
+    P9_RLERROR,
+    P9_TSTATFS = 8,
+    P9_TLOPEN = 12,
+    P9_TLCREATE = 14,
+    P9_TSYMLINK = 16,
+    P9_TMKNOD = 18,
+    P9_TRENAME = 20,
+    P9_TREADLINK = 22,
+    P9_TGETATTR = 24,
+    P9_TSETATTR = 26,
+    P9_TXATTRWALK = 30,
+    P9_TXATTRCREATE = 32,
+    P9_TREADDIR = 40,
+    P9_TFSYNC = 50,
+    P9_TLOCK = 52,
+    P9_TGETLOCK = 54,
+    P9_TLINK = 70,
+    P9_TMKDIR = 72,
+    P9_TRENAMEAT = 74,
+    P9_TUNLINKAT = 76,
+    P9_TVERSION = 100,
+    P9_TAUTH = 102,
+    P9_TATTACH = 104,
+    P9_TFLUSH = 108,
+    P9_TWALK = 110,
+    P9_TREAD = 116,
+    P9_TWRITE = 118,
+    P9_TCLUNK = 120,
+    P9_TREMOVE = 122
+};
+
+#define P9_QTDIR 0x80
+#define P9_QTSYMLINK 0x02
+
+// Linux open flags, as sent by Tlopen and Tlcreate
+#define P9_L_WRONLY 01
+#define P9_L_RDWR 02
+#define P9_L_CREAT 0100
+#define P9_L_EXCL 0200
+#define P9_L_TRUNC 01000
+#define P9_L_APPEND 02000
+#define P9_L_DIRECTORY 0200000
+
+#define P9_SETATTR_MODE 0x01
+#define P9_SETATTR_UID 0x02
+#define P9_SETATTR_GID 0x04
+#define P9_SETATTR_SIZE 0x08
+#define P9_SETATTR_ATIME 0x10
+#define P9_SETATTR_MTIME 0x20
+#define P9_SETATTR_ATIME_SET 0x80
+#define P9_SETATTR_MTIME_SET 0x100
+#define P9_GETATTR_BASIC 0x7FF
+
+#define P9_AT_REMOVEDIR 0x200
+#define P9_LOCK_SUCCESS 0
+#define P9_LOCK_TYPE_UNLCK 2
+#define P9_STATFS_MAGIC 0x01021997
+
+struct p9_dirent {
+    uint64_t ino;
+    uint8_t type; // DT_*
+    char* name;
+};
+
+struct p9_fid {
+    uint32_t id;
+    char* path; // Relative to the shared directory, which is "."
+
+    int fd; // -1 until Tlopen/Tlcreate
+    // Directory entries, read in one go when the guest starts reading the directory and served from here until it
+    // rewinds
+    struct p9_dirent* dir;
+    int dir_count;
+    struct p9_fid* next;
+};
+
+// A message being parsed or built. Running off the end sets "overflow" instead of touching anything.
+struct p9_buf {
+    uint8_t* data;
+    uint32_t pos, len;
+    int overflow;
+};
+
+static struct virtio_device dev;
+static uint8_t config[2 + P9_MAX_TAG];
+
+static char* root_path;
+static int root_fd = -1;
+static int readonly;
+static uint32_t msize = 8192;
+
+static struct p9_fid* fids[P9_FID_BUCKETS];
+
+static struct virtq_elem elem;
+static uint8_t request[P9_MAX_MSIZE], reply[P9_MAX_MSIZE];
+static struct iovec iov[P9_MAX_IOV];
+static uint32_t iov_addr[P9_MAX_IOV]; // Guest addresses of the segments in "iov"
+
+static uint8_t get8(struct p9_buf* b)
+{
+    if (b->pos + 1 > b->len) {
+        b->overflow = 1;
+        return 0;
+    }
+    return b->data[b->pos++];
+}
+static uint16_t get16(struct p9_buf* b)
+{
+    uint16_t lo = get8(b);
+    return lo | get8(b) << 8;
+}
+static uint32_t get32(struct p9_buf* b)
+{
+    uint32_t lo = get16(b);
+    return lo | (uint32_t)get16(b) << 16;
+}
+static uint64_t get64(struct p9_buf* b)
+{
+    uint64_t lo = get32(b);
+    return lo | (uint64_t)get32(b) << 32;
+}
+// Copy a string into "dst", which can hold "max" bytes including the terminator
+static void get_str(struct p9_buf* b, char* dst, int max)
+{
+    int len = get16(b);
+    if (len >= max || b->pos + len > b->len || memchr(b->data + b->pos, 0, len)) {
+        b->overflow = 1;
+        dst[0] = 0;
+        return;
+    }
+    h_memcpy(dst, b->data + b->pos, len);
+    dst[len] = 0;
+    b->pos += len;
+}
+
+static void put8(struct p9_buf* b, uint8_t v)
+{
+    if (b->pos + 1 > b->len) {
+        b->overflow = 1;
+        return;
+    }
+    b->data[b->pos++] = v;
+}
+static void put16(struct p9_buf* b, uint16_t v)
+{
+    put8(b, v);
+    put8(b, v >> 8);
+}
+static void put32(struct p9_buf* b, uint32_t v)
+{
+    put16(b, v);
+    put16(b, v >> 16);
+}
+static void put64(struct p9_buf* b, uint64_t v)
+{
+    put32(b, v);
+    put32(b, v >> 32);
+}
+static void put_str(struct p9_buf* b, const char* str)
+{
+    int len = h_strlen(str);
+    put16(b, len);
+    if (b->pos + len > b->len) {
+        b->overflow = 1;
+        return;
+    }
+    h_memcpy(b->data + b->pos, str, len);
+    b->pos += len;
+}
+static void put_qid(struct p9_buf* b, struct stat* st)
+{
+    put8(b, S_ISDIR(st->st_mode) ? P9_QTDIR : S_ISLNK(st->st_mode) ? P9_QTSYMLINK : 0);
+    // Changes whenever the file does, so that the guest knows when to throw away cached data
+    put32(b, st->st_mtime ^ (st->st_size << 8));
+    put64(b, st->st_ino);
+}
+
+// Fid table
+
+static struct p9_fid* fid_get(uint32_t id)
+{
+    for (struct p9_fid* fid = fids[id % P9_FID_BUCKETS]; fid; fid = fid->next)
+        if (fid->id == id)
+            return fid;
+    return NULL;
+}
+
+static struct p9_fid* fid_new(uint32_t id, char* path)
+{
+    struct p9_fid* fid = h_calloc(1, sizeof(struct p9_fid));
+    fid->id = id;
+    fid->path = path;
+    fid->fd = -1;
+    fid->next = fids[id % P9_FID_BUCKETS];
+    fids[id % P9_FID_BUCKETS] = fid;
+    return fid;
+}
+
+static void dir_invalidate(struct p9_fid* fid)
+{
+    for (int i = 0; i < fid->dir_count; i++)
+        h_free(fid->dir[i].name);
+    h_free(fid->dir);
+    fid->dir = NULL;
+    fid->dir_count = 0;
+}
+
+static void fid_free(uint32_t id)
+{
+    struct p9_fid** link = &fids[id % P9_FID_BUCKETS];
+    while (*link && (*link)->id != id)
+        link = &(*link)->next;
+    struct p9_fid* fid = *link;
+    if (!fid)
+        return;
+    *link = fid->next;
+    if (fid->fd >= 0)
+        close(fid->fd);
+    dir_invalidate(fid);
+    h_free(fid->path);
+    h_free(fid);
+}
+
+static void fid_free_all(void)
+{
+    for (int i = 0; i < P9_FID_BUCKETS; i++)
+        while (fids[i])
+            fid_free(fids[i]->id);
+}
+
+// Paths
+
+static char* dupstr(const char* str)
+{
+    char* res = h_malloc(h_strlen(str) + 1);
+    h_strcpy(res, str);
+    return res;
+}
+
+// Names that can be created or removed in a directory
+static int bad_name(const char* name)
+{
+    return !name[0] || strchr(name, '/') || !strcmp(name, ".") || !strcmp(name, "..");
+}
+
+// "dir/name", except that "." and ".." are resolved here so that the guest can't walk out of the shared directory
+static char* path_join(const char* dir, const char* name)
+{
+    if (!strcmp(name, ".") || (!strcmp(name, "..") && !strcmp(dir, ".")))
+        return dupstr(dir);
+    if (!strcmp(name, "..")) {
+        char* res = dupstr(dir);
+        char* slash = strrchr(res, '/');
+        if (slash)
+            *slash = 0;
+        else
+            h_strcpy(res, ".");
+        return res;
+    }
+    if (!strcmp(dir, "."))
+        return dupstr(name);
+    int dirlen = h_strlen(dir), namelen = h_strlen(name);
+    char* res = h_malloc(dirlen + namelen + 2);
+    h_memcpy(res, dir, dirlen);
+    res[dirlen] = '/';
+    h_memcpy(res + dirlen + 1, name, namelen + 1);
+    return res;
+}
+
+// After a rename, fix up every fid that was at or below the old path
+static void fid_rename(const char* oldpath, const char* newpath)
+{
+    int oldlen = h_strlen(oldpath), newlen = h_strlen(newpath);
+    for (int i = 0; i < P9_FID_BUCKETS; i++)
+        for (struct p9_fid* fid = fids[i]; fid; fid = fid->next) {
+            if (strncmp(fid->path, oldpath, oldlen) || (fid->path[oldlen] && fid->path[oldlen] != '/'))
+                continue;
+            int restlen = h_strlen(fid->path + oldlen);
+            char* path = h_malloc(newlen + restlen + 1);
+            h_memcpy(path, newpath, newlen);
+            h_memcpy(path + newlen, fid->path + oldlen, restlen + 1);
+            h_free(fid->path);
+            fid->path = path;
+        }
+}
+
+// Open the directory that holds the last name in "path", going down from the shared directory one name at a time.
+// Anything on the way that isn't a real directory, including a symlink, stops the lookup. Returns the directory, or -1
+// with errno set, and points "name" at the last name in the path.
+static int path_parent(const char* path, const char** name)
+{
+    char part[P9_MAX_NAME];
+    const char* slash;
+    int dir = fcntl(root_fd, F_DUPFD_CLOEXEC, 0);
+    while (dir >= 0 && (slash = strchr(path, '/'))) {
+        int len = slash - path, next = -1, err = ENAMETOOLONG;
+        if (len < P9_MAX_NAME) {
+            h_memcpy(part, path, len);
+            part[len] = 0;
+            next = openat(dir, part, P9_DIR_FLAGS);
+            err = errno;
+        }
+        close(dir);
+        errno = err;
+        dir = next;
+        path = slash + 1;
+    }
+    *name = path;
+    return dir;
+}
+
+// Close a directory from path_parent without losing the errno of whatever was done with it
+static int path_done(int dir, int failed)
+{
+    int err = failed ? errno : 0;
+    close(dir);
+    return err;
+}
+
+// lstat, but relative to the shared directory. Returns 0 or an errno value.
+static int path_stat(const char* path, struct stat* st)
+{
+    const char* name;
+    int dir = path_parent(path, &name);
+    if (dir < 0)
+        return errno;
+    return path_done(dir, fstatat(dir, name, st, AT_SYMLINK_NOFOLLOW));
+}
+
+// Open a file in the shared directory. The last name isn't followed if it's a symlink either.
+static int path_open(const char* path, int flags, int mode)
+{
+    const char* name;
+    int dir = path_parent(path, &name);
+    if (dir < 0)
+        return -1;
+    int fd = openat(dir, name, flags | O_NOFOLLOW | O_CLOEXEC, mode);
+    errno = path_done(dir, fd < 0);
+    return fd;
+}
+
+// Link or rename between two paths in the shared directory. Neither one is followed if it's a symlink.
+static int p9_at2(const char* oldpath, const char* newpath, int rename)
+{
+    const char *oldname, *newname;
+    int olddir = path_parent(oldpath, &oldname), newdir, err;
+    if (olddir < 0)
+        return errno;
+    newdir = path_parent(newpath, &newname);
+    if (newdir < 0)
+        err = errno;
+    else
+        err = path_done(newdir, rename ? renameat(olddir, oldname, newdir, newname) : linkat(olddir, oldname, newdir, newname, 0));
+    close(olddir);
+    return err;
+}
+
+static int fid_stat(struct p9_fid* fid, struct stat* st)
+{
+    // An open file might have been unlinked already
+    if (fid->fd >= 0)
+        return fstat(fid->fd, st) ? errno : 0;
+    return path_stat(fid->path, st);
+}
+
+// Build an I/O vector out of part of a descriptor chain
+static int build_iov(struct virtq_seg* segs, int count, uint32_t offset, uint32_t len)
+{
+    int n = 0;
+    for (int i = 0; i < count && len && n < P9_MAX_IOV; i++) {
+        if (offset >= segs[i].len) {
+            offset -= segs[i].len;
+            continue;
+        }
+        uint32_t seglen = segs[i].len - offset;
+        if (seglen > len)
+            seglen = len;
+        void* ptr = pci_dma_ptr(segs[i].addr + offset, seglen);
+        if (!ptr)
+            break;
+        iov_addr[n] = segs[i].addr + offset;
+        iov[n].iov_base = ptr;
+        iov[n++].iov_len = seglen;
+        len -= seglen;
+        offset = 0;
+    }
+    return n;
+}
+
+// Message handlers. Each one parses the rest of the request and writes the body of the reply, returning 0 or an errno
+// value to send back in Rlerror.
+
+static int p9_version(struct p9_buf* req, struct p9_buf* res)
+{
+    char version[32];
+    uint32_t size = get32(req);
+    get_str(req, version, sizeof(version));
+    if (req->overflow || size < P9_MIN_MSIZE)
+        return EINVAL;
+    // Starts a new session
+    fid_free_all();
+    msize = size < P9_MAX_MSIZE ? size : P9_MAX_MSIZE;
+    put32(res, msize);
+    put_str(res, strcmp(version, "9P2000.L") ? "unknown" : "9P2000.L");
+    return 0;
+}
+
+static int p9_attach(struct p9_buf* req, struct p9_buf* res)
+{
+    char name[P9_MAX_NAME];
+    uint32_t id = get32(req);
+    get32(req); // afid
+    get_str(req, name, sizeof(name)); // uname
+    get_str(req, name, sizeof(name)); // aname
+    if (req->overflow)
+        return EINVAL;
+    if (fid_get(id))
+        return EBADF;
+    struct stat st;
+    if (fstat(root_fd, &st))
+        return errno;
+    fid_new(id, dupstr("."));
+    put_qid(res, &st);
+    return 0;
+}
+
+static int p9_walk(struct p9_buf* req, struct p9_buf* res)
+{
+    char name[P9_MAX_NAME];
+    struct stat st[P9_MAX_WALK];
+    uint32_t id = get32(req), newid = get32(req);
+    int count = get16(req);
+    struct p9_fid* fid = fid_get(id);
+    if (!fid)
+        return ENOENT;
+    if (count > P9_MAX_WALK)
+        return EINVAL;
+    if (newid != id && fid_get(newid))
+        return EBADF;
+
+    char* path = dupstr(fid->path);
+    int walked = 0;
+    for (; walked < count; walked++) {
+        get_str(req, name, sizeof(name));
+        if (req->overflow || strchr(name, '/')) {
+            h_free(path);
+            return EINVAL;
+        }
+        char* next = path_join(path, name);
+        int err = path_stat(next, &st[walked]);
+        if (err) {
+            h_free(next);
+            if (walked == 0) {
+                h_free(path);
+                return err;
+            }
+            break;
+        }
+        h_free(path);
+        path = next;
+    }
+
+    put16(res, walked);
+    for (int i = 0; i < walked; i++)
+        put_qid(res, &st[i]);
+    // A partial walk only returns the qids that it got through, and doesn't touch newfid
+    if (walked < count)
+        h_free(path);
+    else if (newid == id) {
+        h_free(fid->path);
+        fid->path = path;
+        dir_invalidate(fid);
+    } else
+        fid_new(newid, path);
+    return 0;
+}
+
+static int p9_clunk(struct p9_buf* req, struct p9_buf* res)
+{
+    UNUSED(res);
+    uint32_t id = get32(req);
+    if (req->overflow)
+        return EINVAL;
+    if (!fid_get(id))
+        return ENOENT;
+    fid_free(id);
+    return 0;
+}
+
+static int p9_remove(struct p9_buf* req, struct p9_buf* res)
+{
+    UNUSED(res);
+    uint32_t id = get32(req);
+    struct p9_fid* fid = fid_get(id);
+    if (req->overflow)
+        return EINVAL;
+    if (!fid)
+        return ENOENT;
+    int err = 0;
+    if (readonly)
+        err = EROFS;
+    else {
+        const char* name;
+        struct stat st;
+        int dir = path_parent(fid->path, &name);
+        if (dir < 0)
+            err = errno;
+        else if (fstatat(dir, name, &st, AT_SYMLINK_NOFOLLOW))
+            err = path_done(dir, 1);
+        else
+            err = path_done(dir, unlinkat(dir, name, S_ISDIR(st.st_mode) ? AT_REMOVEDIR : 0));
+    }
+    // The fid is clunked even if the file couldn't be removed
+    fid_free(id);
+    return err;
+}
+
+static int p9_getattr(struct p9_buf* req, struct p9_buf* res)
+{
+    struct p9_fid* fid = fid_get(get32(req));
+    struct stat st;
+    if (!fid)
+        return ENOENT;
+    int err = fid_stat(fid, &st);
+    if (err)
+        return err;
+    put64(res, P9_GETATTR_BASIC);
+    put_qid(res, &st);
+    put32(res, st.st_mode);
+    put32(res, st.st_uid);
+    put32(res, st.st_gid);
+    put64(res, st.st_nlink);
+    put64(res, st.st_rdev);
+    put64(res, st.st_size);
+    put64(res, st.st_blksize);
+    put64(res, st.st_blocks);
+    put64(res, st.st_atim.tv_sec);
+    put64(res, st.st_atim.tv_nsec);
+    put64(res, st.st_mtim.tv_sec);
+    put64(res, st.st_mtim.tv_nsec);
+    put64(res, st.st_ctim.tv_sec);
+    put64(res, st.st_ctim.tv_nsec);
+    put64(res, 0); // btime
+    put64(res, 0);
+    put64(res, 0); // gen
+    put64(res, 0); // data_version
+    return 0;
+}
+
+// chmod for a file that isn't open, and was just checked not to be a symlink. Returns -1 with errno set on failure.
+static int p9_chmod(const char* path, uint32_t mode)
+{
+    const char* name;
+    int dir = path_parent(path, &name);
+    if (dir < 0)
+        return -1;
+    errno = path_done(dir, fchmodat(dir, name, mode, 0));
+    return errno ? -1 : 0;
+}
+
+static int p9_setattr(struct p9_buf* req, struct p9_buf* res)
+{
+    UNUSED(res);
+    struct p9_fid* fid = fid_get(get32(req));
+    uint32_t valid = get32(req), mode = get32(req);
+    get32(req); // uid
+    get32(req); // gid
+    uint64_t size = get64(req);
+    struct timespec times[2];
+    times[0].tv_sec = get64(req);
+    times[0].tv_nsec = get64(req);
+    times[1].tv_sec = get64(req);
+    times[1].tv_nsec = get64(req);
+    if (req->overflow)
+        return EINVAL;
+    if (!fid)
+        return ENOENT;
+    if (readonly)
+        return EROFS;
+
+    // Ownership is left alone: everything in the shared directory belongs to whoever is running the emulator
+    if (valid & P9_SETATTR_MODE) {
+        struct stat st;
+        int err = fid_stat(fid, &st);
+        if (err)
+            return err;
+        // Symlinks don't have permissions of their own, and chmod would change whatever they point to
+        if (S_ISLNK(st.st_mode))
+            return EOPNOTSUPP;
+        if (fid->fd >= 0 ? fchmod(fid->fd, mode & 07777) : p9_chmod(fid->path, mode & 07777))
+            return errno;
+    }
+    if (valid & P9_SETATTR_SIZE) {
+        int fd = fid->fd >= 0 ? fid->fd : path_open(fid->path, O_WRONLY | O_NONBLOCK, 0);
+        if (fd < 0)
+            return errno;
+        int err = ftruncate(fd, size) ? errno : 0;
+        if (fd != fid->fd)
+            close(fd);
+        if (err)
+            return err;
+    }
+    if (valid & (P9_SETATTR_ATIME | P9_SETATTR_MTIME)) {
+        if (!(valid & P9_SETATTR_ATIME))
+            times[0].tv_nsec = UTIME_OMIT;
+        else if (!(valid & P9_SETATTR_ATIME_SET))
+            times[0].tv_nsec = UTIME_NOW;
+        if (!(valid & P9_SETATTR_MTIME))
+            times[1].tv_nsec = UTIME_OMIT;
+        else if (!(valid & P9_SETATTR_MTIME_SET))
+            times[1].tv_nsec = UTIME_NOW;
+        if (fid->fd >= 0) {
+            if (futimens(fid->fd, times))
+                return errno;
+        } else {
+            const char* name;
+            int dir = path_parent(fid->path, &name), err;
+            if (dir < 0)
+                return errno;
+            if ((err = path_done(dir, utimensat(dir, name, times, AT_SYMLINK_NOFOLLOW))))
+                return err;
+        }
+    }
+    return 0;
+}
+
+// O_NOFOLLOW and O_CLOEXEC are added by path_open
+static int open_flags(uint32_t flags)
+{
+    int res = 0;
+    if (flags & P9_L_RDWR)
+        res |= O_RDWR;
+    else if (flags & P9_L_WRONLY)
+        res |= O_WRONLY;
+    if (flags & P9_L_CREAT)
+        res |= O_CREAT;
+    if (flags & P9_L_EXCL)
+        res |= O_EXCL;
+    if (flags & P9_L_TRUNC)
+        res |= O_TRUNC;
+    if (flags & P9_L_APPEND)
+        res |= O_APPEND;
+    if (flags & P9_L_DIRECTORY)
+        res |= O_DIRECTORY;
+    return res;
+}
+
+static int p9_lopen(struct p9_buf* req, struct p9_buf* res)
+{
+    struct p9_fid* fid = fid_get(get32(req));
+    int flags = open_flags(get32(req) & ~P9_L_CREAT);
+    struct stat st;
+    if (req->overflow)
+        return EINVAL;
+    if (!fid)
+        return ENOENT;
+    if (fid->fd >= 0)
+        return EBADF;
+    if (readonly && (flags & (O_WRONLY | O_RDWR | O_TRUNC)))
+        return EROFS;
+    fid->fd = path_open(fid->path, flags, 0);
+    if (fid->fd < 0 || fstat(fid->fd, &st))
+        return errno;
+    put_qid(res, &st);
+    put32(res, 0); // iounit
+    return 0;
+}
+
+static int p9_lcreate(struct p9_buf* req, struct p9_buf* res)
+{
+    char name[P9_MAX_NAME];
+    struct p9_fid* fid = fid_get(get32(req));
+    get_str(req, name, sizeof(name));
+    int flags = open_flags(get32(req) | P9_L_CREAT);
+    uint32_t mode = get32(req);
+    struct stat st;
+    if (req->overflow || bad_name(name))
+        return EINVAL;
+    if (!fid)
+        return ENOENT;
+    if (fid->fd >= 0)
+        return EBADF;
+    if (readonly)
+        return EROFS;
+    char* path = path_join(fid->path, name);
+    int fd = path_open(path, flags, mode & 07777);
+    if (fd < 0 || fstat(fd, &st)) {
+        int err = errno;
+        h_free(path);
+        return err;
+    }
+    // The fid now refers to the new file instead of the directory
+    h_free(fid->path);
+    dir_invalidate(fid);
+    fid->path = path;
+    fid->fd = fd;
+    put_qid(res, &st);
+    put32(res, 0);
+    return 0;
+}
+
+// Checks shared by everything that creates a new directory entry without opening it
+static int check_create(struct p9_buf* req, struct p9_fid* dir, const char* name)
+{
+    if (req->overflow || bad_name(name))
+        return EINVAL;
+    if (!dir)
+        return ENOENT;
+    if (readonly)
+        return EROFS;
+    return 0;
+}
+
+// Reply with the qid of a freshly created entry
+static int p9_created(struct p9_buf* res, int dir, const char* name, int failed)
+{
+    struct stat st;
+    int err = path_done(dir, failed || fstatat(dir, name, &st, AT_SYMLINK_NOFOLLOW));
+    if (!err)
+        put_qid(res, &st);
+    return err;
+}
+
+static int p9_mkdir(struct p9_buf* req, struct p9_buf* res)
+{
+    char name[P9_MAX_NAME];
+    struct p9_fid* dir = fid_get(get32(req));
+    get_str(req, name, sizeof(name));
+    uint32_t mode = get32(req);
+    int err = check_create(req, dir, name);
+    if (err)
+        return err;
+    char* path = path_join(dir->path, name);
+    const char* last;
+    int fd = path_parent(path, &last);
+    err = fd < 0 ? errno : p9_created(res, fd, last, mkdirat(fd, last, mode & 07777));
+    h_free(path);
+    return err;
+}
+
+static int p9_symlink(struct p9_buf* req, struct p9_buf* res)
+{
+    static char target[PATH_MAX];
+    char name[P9_MAX_NAME];
+    struct p9_fid* dir = fid_get(get32(req));
+    get_str(req, name, sizeof(name));
+    get_str(req, target, sizeof(target));
+    int err = check_create(req, dir, name);
+    if (err)
+        return err;
+    // The target is stored as it is. It's never followed on the host, so it doesn't matter where it points.
+    char* path = path_join(dir->path, name);
+    const char* last;
+    int fd = path_parent(path, &last);
+    err = fd < 0 ? errno : p9_created(res, fd, last, symlinkat(target, fd, last));
+    h_free(path);
+    return err;
+}
+
+static int p9_mknod(struct p9_buf* req, struct p9_buf* res)
+{
+    char name[P9_MAX_NAME];
+    struct p9_fid* dir = fid_get(get32(req));
+    get_str(req, name, sizeof(name));
+    uint32_t mode = get32(req);
+    int err = check_create(req, dir, name);
+    if (err)
+        return err;
+    // Device nodes on the host would be a bad idea
+    if (!S_ISFIFO(mode) && !S_ISSOCK(mode) && !S_ISREG(mode))
+        return EPERM;
+    char* path = path_join(dir->path, name);
+    const char* last;
+    int fd = path_parent(path, &last);
+    err = fd < 0 ? errno : p9_created(res, fd, last, mknodat(fd, last, mode & (S_IFMT | 07777), 0));
+    h_free(path);
+    return err;
+}
+
+static int p9_link(struct p9_buf* req, struct p9_buf* res)
+{
+    UNUSED(res);
+    char name[P9_MAX_NAME];
+    struct p9_fid *dir = fid_get(get32(req)), *target = fid_get(get32(req));
+    get_str(req, name, sizeof(name));
+    if (req->overflow || bad_name(name))
+        return EINVAL;
+    if (!dir || !target)
+        return ENOENT;
+    if (readonly)
+        return EROFS;
+    char* path = path_join(dir->path, name);
+    int err = p9_at2(target->path, path, 0);
+    h_free(path);
+    return err;
+}
+
+static int p9_readlink(struct p9_buf* req, struct p9_buf* res)
+{
+    static char target[PATH_MAX];
+    struct p9_fid* fid = fid_get(get32(req));
+    if (!fid)
+        return ENOENT;
+    const char* name;
+    int dir = path_parent(fid->path, &name);
+    if (dir < 0)
+        return errno;
+    ssize_t len = readlinkat(dir, name, target, sizeof(target) - 1);
+    int err = path_done(dir, len < 0);
+    if (err)
+        return err;
+    target[len] = 0;
+    put_str(res, target);
+    return 0;
+}
+
+static int p9_do_rename(char* oldpath, char* newpath)
+{
+    int err = p9_at2(oldpath, newpath, 1);
+    if (!err)
+        fid_rename(oldpath, newpath);
+    h_free(oldpath);
+    h_free(newpath);
+    return err;
+}
+
+static int p9_rename(struct p9_buf* req, struct p9_buf* res)
+{
+    UNUSED(res);
+    char name[P9_MAX_NAME];
+    struct p9_fid *fid = fid_get(get32(req)), *dir = fid_get(get32(req));
+    get_str(req, name, sizeof(name));
+    if (req->overflow || bad_name(name))
+        return EINVAL;
+    if (!fid || !dir)
+        return ENOENT;
+    if (readonly)
+        return EROFS;
+    return p9_do_rename(dupstr(fid->path), path_join(dir->path, name));
+}
+
+static int p9_renameat(struct p9_buf* req, struct p9_buf* res)
+{
+    UNUSED(res);
+    char oldname[P9_MAX_NAME], newname[P9_MAX_NAME];
+    struct p9_fid* olddir = fid_get(get32(req));
+    get_str(req, oldname, sizeof(oldname));
+    struct p9_fid* newdir = fid_get(get32(req));
+    get_str(req, newname, sizeof(newname));
+    if (req->overflow || bad_name(oldname) || bad_name(newname))
+        return EINVAL;
+    if (!olddir || !newdir)
+        return ENOENT;
+    if (readonly)
+        return EROFS;
+    return p9_do_rename(path_join(olddir->path, oldname), path_join(newdir->path, newname));
+}
+
+static int p9_unlinkat(struct p9_buf* req, struct p9_buf* res)
+{
+    UNUSED(res);
+    char name[P9_MAX_NAME];
+    struct p9_fid* dir = fid_get(get32(req));
+    get_str(req, name, sizeof(name));
+    uint32_t flags = get32(req);
+    if (req->overflow || bad_name(name))
+        return EINVAL;
+    if (!dir)
+        return ENOENT;
+    if (readonly)
+        return EROFS;
+    char* path = path_join(dir->path, name);
+    const char* last;
+    int fd = path_parent(path, &last);
+    int err = fd < 0 ? errno : path_done(fd, unlinkat(fd, last, (flags & P9_AT_REMOVEDIR) ? AT_REMOVEDIR : 0));
+    h_free(path);
+    return err;
+}
+
+static int dir_load(struct p9_fid* fid)
+{
+    dir_invalidate(fid);
+    int fd = path_open(fid->path, O_RDONLY | O_DIRECTORY, 0);
+    DIR* d = fd < 0 ? NULL : fdopendir(fd);
+    if (!d) {
+        int err = errno;
+        if (fd >= 0)
+            close(fd);
+        return err;
+    }
+    int capacity = 0;
+    struct dirent* ent;
+    while ((ent = readdir(d))) {
+        if (fid->dir_count == capacity) {
+            capacity = capacity ? capacity * 2 : 32;
+            fid->dir = h_realloc(fid->dir, capacity * sizeof(struct p9_dirent));
+        }
+        struct p9_dirent* de = &fid->dir[fid->dir_count++];
+        de->ino = ent->d_ino;
+        de->type = ent->d_type;
+        de->name = dupstr(ent->d_name);
+    }
+    closedir(d);
+    return 0;
+}
+
+static int p9_readdir(struct p9_buf* req, struct p9_buf* res)
+{
+    struct p9_fid* fid = fid_get(get32(req));
+    uint64_t offset = get64(req);
+    uint32_t count = get32(req);
+    if (req->overflow || elem.in_len < P9_READ_HDR_SIZE)
+        return EINVAL;
+    if (!fid)
+        return ENOENT;
+    // Starting over picks up any changes made since the directory was last read
+    if (offset == 0 || !fid->dir) {
+        int err = dir_load(fid);
+        if (err)
+            return err;
+    }
+
+    uint32_t limit = (res->len < elem.in_len ? res->len : elem.in_len) - P9_READ_HDR_SIZE;
+    if (count > limit)
+        count = limit;
+    uint32_t start = res->pos;
+    put32(res, 0);
+    // Offsets are indexes into the cached entries, plus one
+    for (uint64_t i = offset; i < (uint64_t)fid->dir_count; i++) {
+        struct p9_dirent* de = &fid->dir[i];
+        uint32_t len = 13 + 8 + 1 + 2 + h_strlen(de->name);
+        if (res->pos + len - start - 4 > count)
+            break;
+        put8(res, de->type == DT_DIR ? P9_QTDIR : de->type == DT_LNK ? P9_QTSYMLINK : 0);
+        put32(res, 0);
+        put64(res, de->ino);
+        put64(res, i + 1);
+        put8(res, de->type);
+        put_str(res, de->name);
+    }
+    uint32_t end = res->pos;
+    res->pos = start;
+    put32(res, end - start - 4);
+    res->pos = end;
+    return 0;
+}
+
+static int p9_statfs(struct p9_buf* req, struct p9_buf* res)
+{
+    struct p9_fid* fid = fid_get(get32(req));
+    struct statvfs st;
+    if (!fid)
+        return ENOENT;
+    // The directory that the file is in is on the same filesystem, unless the file is a mount point
+    const char* name;
+    int dir = fid->fd >= 0 ? fid->fd : path_parent(fid->path, &name);
+    if (dir < 0)
+        return errno;
+    int err = fstatvfs(dir, &st) ? errno : 0;
+    if (dir != fid->fd)
+        close(dir);
+    if (err)
+        return err;
+    put32(res, P9_STATFS_MAGIC);
+    put32(res, st.f_bsize);
+    put64(res, st.f_blocks);
+    put64(res, st.f_bfree);
+    put64(res, st.f_bavail);
+    put64(res, st.f_files);
+    put64(res, st.f_ffree);
+    put64(res, st.f_fsid);
+    put32(res, st.f_namemax);
+    return 0;
+}
+
+static int p9_fsync(struct p9_buf* req, struct p9_buf* res)
+{
+    UNUSED(res);
+    struct p9_fid* fid = fid_get(get32(req));
+    if (req->overflow)
+        return EINVAL;
+    if (!fid)
+        return ENOENT;
+    if (fid->fd >= 0 && fsync(fid->fd))
+        return errno;
+    return 0;
+}
+
+// Locks are advisory, and the guest is the only one using them, so every lock is granted
+static int p9_lock(struct p9_buf* req, struct p9_buf* res)
+{
+    if (!fid_get(get32(req)))
+        return ENOENT;
+    put8(res, P9_LOCK_SUCCESS);
+    return 0;
+}
+
+static int p9_getlock(struct p9_buf* req, struct p9_buf* res)
+{
+    char client[P9_MAX_NAME];
+    struct p9_fid* fid = fid_get(get32(req));
+    get8(req); // type
+    uint64_t start = get64(req), length = get64(req);
+    uint32_t proc_id = get32(req);
+    get_str(req, client, sizeof(client));
+    if (req->overflow)
+        return EINVAL;
+    if (!fid)
+        return ENOENT;
+    put8(res, P9_LOCK_TYPE_UNLCK);
+    put64(res, start);
+    put64(res, length);
+    put32(res, proc_id);
+    put_str(res, client);
+    return 0;
+}
+
+// Tread: the data goes straight from the file into the guest's buffers, after the reply header
+static int p9_read(struct p9_buf* req, struct p9_buf* res, uint32_t* payload)
+{
+    struct p9_fid* fid = fid_get(get32(req));
+    uint64_t offset = get64(req);
+    uint32_t count = get32(req);
+    if (req->overflow || elem.in_len < P9_READ_HDR_SIZE)
+        return EINVAL;
+    if (!fid)
+        return ENOENT;
+    if (fid->fd < 0)
+        return EBADF;
+    if (count > msize - P9_READ_HDR_SIZE)
+        count = msize - P9_READ_HDR_SIZE;
+    if (count > elem.in_len - P9_READ_HDR_SIZE)
+        count = elem.in_len - P9_READ_HDR_SIZE;
+
+    int n = build_iov(elem.in, elem.in_count, P9_READ_HDR_SIZE, count);
+    ssize_t len = n ? preadv(fid->fd, iov, n, offset) : 0;
+    if (len < 0)
+        return errno;
+    for (int i = 0, left = len; i < n && left; i++) {
+        int seglen = (size_t)left < iov[i].iov_len ? left : (int)iov[i].iov_len;
+        pci_dma_written(iov_addr[i], seglen);
+        left -= seglen;
+    }
+    put32(res, len);
+    *payload = len;
+    return 0;
+}
+
+// Twrite: the data is taken straight out of the request
+static int p9_write(struct p9_buf* req, struct p9_buf* res)
+{
+    struct p9_fid* fid = fid_get(get32(req));
+    uint64_t offset = get64(req);
+    uint32_t count = get32(req);
+    if (req->overflow)
+        return EINVAL;
+    if (!fid)
+        return ENOENT;
+    if (fid->fd < 0)
+        return EBADF;
+    if (readonly)
+        return EROFS;
+    if (count > elem.out_len - P9_WRITE_HDR_SIZE)
+        count = elem.out_len - P9_WRITE_HDR_SIZE;
+
+    int n = build_iov(elem.out, elem.out_count, P9_WRITE_HDR_SIZE, count);
+    ssize_t len = n ? pwritev(fid->fd, iov, n, offset) : 0;
+    if (len < 0)
+        return errno;
+    put32(res, len);
+    return 0;
+}
+
+static void p9_process(void)
+{
+    struct p9_buf req = { request, 0, 0, 0 }, res = { reply, P9_HDR_SIZE, msize, 0 };
+    uint32_t payload = 0;
+
+    if (elem.out_len < P9_HDR_SIZE || elem.in_len < P9_HDR_SIZE) {
+        P9_LOG("Request too short\n");
+        virtq_push(&dev, 0, &elem, 0);
+        return;
+    }
+    // Only the fixed part of a write is copied out of the chain, since the data is handed straight to pwritev
+    uint8_t type = 0;
+    virtq_read(&elem, 4, &type, 1);
+    uint32_t len = type == P9_TWRITE ? P9_WRITE_HDR_SIZE : elem.out_len;
+    req.len = virtq_read(&elem, 0, request, len < sizeof(request) ? len : sizeof(request));
+    get32(&req);
+    get8(&req);
+    uint16_t tag = get16(&req);
+
+    int err;
+    switch (type) {
+    case P9_TVERSION:
+        err = p9_version(&req, &res);
+        break;
+    case P9_TATTACH:
+        err = p9_attach(&req, &res);
+        break;
+    case P9_TWALK:
+        err = p9_walk(&req, &res);
+        break;
+    case P9_TCLUNK:
+        err = p9_clunk(&req, &res);
+        break;
+    case P9_TREMOVE:
+        err = p9_remove(&req, &res);
+        break;
+    case P9_TGETATTR:
+        err = p9_getattr(&req, &res);
+        break;
+    case P9_TSETATTR:
+        err = p9_setattr(&req, &res);
+        break;
+    case P9_TLOPEN:
+        err = p9_lopen(&req, &res);
+        break;
+    case P9_TLCREATE:
+        err = p9_lcreate(&req, &res);
+        break;
+    case P9_TMKDIR:
+        err = p9_mkdir(&req, &res);
+        break;
+    case P9_TSYMLINK:
+        err = p9_symlink(&req, &res);
+        break;
+    case P9_TMKNOD:
+        err = p9_mknod(&req, &res);
+        break;
+    case P9_TLINK:
+        err = p9_link(&req, &res);
+        break;
+    case P9_TREADLINK:
+        err = p9_readlink(&req, &res);
+        break;
+    case P9_TRENAME:
+        err = p9_rename(&req, &res);
+        break;
+    case P9_TRENAMEAT:
+        err = p9_renameat(&req, &res);
+        break;
+    case P9_TUNLINKAT:
+        err = p9_unlinkat(&req, &res);
+        break;
+    case P9_TREADDIR:
+        err = p9_readdir(&req, &res);
+        break;
+    case P9_TSTATFS:
+        err = p9_statfs(&req, &res);
+        break;
+    case P9_TFSYNC:
+        err = p9_fsync(&req, &res);
+        break;
+    case P9_TLOCK:
+        err = p9_lock(&req, &res);
+        break;
+    case P9_TGETLOCK:
+        err = p9_getlock(&req, &res);
+        break;
+    case P9_TREAD:
+        err = p9_read(&req, &res, &payload);
+        break;
+    case P9_TWRITE:
+        err = p9_write(&req, &res);
+        break;
+    case P9_TFLUSH: // Requests are finished as soon as they arrive, so there's never anything to cancel
+        err = 0;
+        break;
+    case P9_TXATTRWALK:
+    case P9_TXATTRCREATE:
+        err = EOPNOTSUPP;
+        break;
+    default:
+        P9_LOG("Unsupported message type %d\n", type);
+        err = EOPNOTSUPP;
+        break;
+    }
+    if (!err && (req.overflow || res.overflow))
+        err = req.overflow ? EINVAL : ERANGE;
+    if (err) {
+        res.pos = P9_HDR_SIZE;
+        payload = 0;
+        type = P9_TLERROR;
+        put32(&res, err);
+    }
+
+    uint32_t end = res.pos;
+    res.pos = 0;
+    put32(&res, end + payload);
+    put8(&res, type + 1);
+    put16(&res, tag);
+    virtq_write(&elem, 0, reply, end);
+    virtq_push(&dev, 0, &elem, end + payload);
+}
+
+// Every request that's waiting is handled before the guest hears back
+static void p9_notify(struct virtio_device* d, int queue)
+{
+    UNUSED(d);
+    UNUSED(queue);
+    int handled = 0;
+    while (virtq_pop(&dev, 0, &elem) == 0) {
+        p9_process();
+        handled++;
+    }
+    if (handled)
+        virtq_notify(&dev, 0);
+}
+
+static void p9_reset(struct virtio_device* d)
+{
+    UNUSED(d);
+    fid_free_all();
+    msize = 8192;
+}
+
+void virtio_9p_init(struct virtio_9p_cfg* cfg)
+{
+    char* tag = cfg->tag ? cfg->tag : "host0";
+    int taglen = h_strlen(tag);
+    if (!cfg->path || !(root_path = realpath(cfg->path, NULL)) || (root_fd = open(root_path, P9_DIR_FLAGS)) < 0) {
+        h_fprintf(stderr, "virtio-9p: unable to share directory %s - ignoring\n", cfg->path ? cfg->path : "(none)");
+        return;
+    }
+    if (taglen > P9_MAX_TAG)
+        taglen = P9_MAX_TAG;
+    readonly = cfg->ro;
+    config[0] = taglen;
+    config[1] = taglen >> 8;
+    h_memcpy(config + 2, tag, taglen);
+
+    dev.device_id = VIRTIO_ID_9P;
+    dev.class_code = 0x018000; // Other mass storage controller
+    dev.host_features = VIRTIO_9P_MOUNT_TAG;
+    dev.queue_count = 1;
+    dev.queue_size = 128;
+    dev.config = config;
+    dev.config_size = 2 + taglen;
+    dev.notify = p9_notify;
+    dev.reset = p9_reset;
+    virtio_register(&dev);
+
+    P9_LOG("Sharing %s as \"%.*s\"%s\n", root_path, taglen, tag, readonly ? " (read only)" : "");
+}
+
+#endif
@@ -0,0 +1,336 @@
+// Virtio block device
+// Each request is a descriptor chain with a header, the data, and a status byte. The data is handed to the drive layer
+// one segment at a time, directly to and from guest RAM, so there is no PIO, no PRD table, and no bounce buffer in the
+// common case. The guest can queue up as many requests as the ring holds. They're worked through in order, and the
+// guest is interrupted once for everything that finished in one go.
+// https://ozlabs.org/~rusty/virtio-spec/virtio-0.9.5.pdf (Appendix D)
+#include "devices.h"
+#include "drive.h"
+#include "pc.h"
+#include "state.h"
+#include "virtio.h"
+#include <stdint.h>
+#include <string.h>
+
+#define VBLK_LOG(x, ...) LOG("VBLK", x, ##__VA_ARGS__)
+
+#define VBLK_QUEUE_SIZE 128
+
+#define VIRTIO_BLK_F_SEG_MAX (1 << 2)
+#define VIRTIO_BLK_F_GEOMETRY (1 << 4)
+#define VIRTIO_BLK_F_BLK_SIZE (1 << 6)
+#define VIRTIO_BLK_F_FLUSH (1 << 9)
+#define VIRTIO_BLK_F_DISCARD (1 << 13)
+
+#define VIRTIO_BLK_T_IN 0
+#define VIRTIO_BLK_T_OUT 1
+#define VIRTIO_BLK_T_FLUSH 4
+#define VIRTIO_BLK_T_GET_ID 8
+#define VIRTIO_BLK_T_DISCARD 11
+
+#define VIRTIO_BLK_S_OK 0
+#define VIRTIO_BLK_S_IOERR 1
+#define VIRTIO_BLK_S_UNSUPP 2
+
+#define VBLK_HDR_SIZE 16 // type[4] ioprio[4] sector[8]
+#define VBLK_ID_SIZE 20
+#define VBLK_DISCARD_SIZE 16 // sector[8] num_sectors[4] flags[4]
+#define VBLK_MAX_DISCARD_SEGS 32
+
+// How long to wait before trying again if the drive is busy with an IDE transfer
+#define VBLK_RETRY_INTERVAL (ticks_per_second / 1000)
+
+static struct virtio_device dev;
+static struct drive_info* drive;
+
+static struct {
+    uint64_t capacity; // In 512-byte sectors
+    uint32_t size_max, seg_max;
+    uint16_t cylinders;
+    uint8_t heads, sectors;
+    uint32_t blk_size;
+    uint8_t physical_block_exp, alignment_offset;
+    uint16_t min_io_size;
+    uint32_t opt_io_size;
+    uint8_t writeback, unused0[3];
+    uint32_t max_discard_sectors, max_discard_seg, discard_sector_alignment;
+} __attribute__((packed)) config;
+
+// The request being worked on
+static struct virtq_elem elem;
+static int active; // "elem" holds a request that isn't finished yet
+static int waiting; // Waiting for the drive or for the retry timer
+static int type, status;
+static drv_offset_t offset;
+static uint32_t data_len;
+
+// Pieces of the transfer, each of which is a whole number of sectors
+static struct vblk_xfer {
+    void* ptr;
+    uint32_t len;
+} xfer[VIRTQ_MAX_SEGS];
+static int xfer_count, xfer_index;
+// Used when the guest's buffers aren't split up along sector boundaries
+static uint8_t* bounce;
+static uint32_t bounce_size;
+static int bounced;
+
+// Requests that are still waiting on the drive after a reset are ignored when they finish
+static uintptr_t generation;
+
+// Fill in xfer[] for the data part of a chain: the readable part after the header for writes, or the writable part
+// before the status byte for reads
+static void vblk_map_data(struct virtq_seg* segs, int count, uint32_t skip)
+{
+    uint32_t left = data_len;
+    xfer_count = xfer_index = bounced = 0;
+    for (int i = 0; i < count && left; i++) {
+        if (skip >= segs[i].len) {
+            skip -= segs[i].len;
+            continue;
+        }
+        uint32_t len = segs[i].len - skip;
+        if (len > left)
+            len = left;
+        void* ptr = pci_dma_ptr(segs[i].addr + skip, len);
+        if (!ptr || (len & 511)) {
+            bounced = 1;
+            break;
+        }
+        xfer[xfer_count].ptr = ptr;
+        xfer[xfer_count++].len = len;
+        left -= len;
+        skip = 0;
+    }
+    if (!bounced)
+        return;
+
+    if (bounce_size < data_len) {
+        bounce = h_realloc(bounce, data_len);
+        bounce_size = data_len;
+    }
+    xfer[0].ptr = bounce;
+    xfer[0].len = data_len;
+    xfer_count = 1;
+    if (type == VIRTIO_BLK_T_OUT)
+        virtq_read(&elem, VBLK_HDR_SIZE, bounce, data_len);
+}
+
+// Check the discard ranges. The drive layer has nowhere to drop the sectors, so they're kept as they are, which is all
+// that discard promises.
+static int vblk_discard(void)
+{
+    uint8_t range[VBLK_DISCARD_SIZE];
+    uint32_t count = (elem.out_len - VBLK_HDR_SIZE) / VBLK_DISCARD_SIZE;
+    if (count > VBLK_MAX_DISCARD_SEGS)
+        return VIRTIO_BLK_S_IOERR;
+    for (uint32_t i = 0; i < count; i++) {
+        virtq_read(&elem, VBLK_HDR_SIZE + i * VBLK_DISCARD_SIZE, range, VBLK_DISCARD_SIZE);
+        uint64_t sector, sectors = 0;
+        h_memcpy(&sector, range, 8);
+        h_memcpy(&sectors, range + 8, 4);
+        if (sector > config.capacity || sectors > config.capacity - sector)
+            return VIRTIO_BLK_S_IOERR;
+    }
+    return VIRTIO_BLK_S_OK;
+}
+
+// Parse a new request. Anything that doesn't need the drive is finished here.
+static void vblk_start(void)
+{
+    uint8_t hdr[VBLK_HDR_SIZE];
+    uint64_t sector;
+    active = 1;
+    status = VIRTIO_BLK_S_OK;
+    xfer_count = xfer_index = 0;
+    data_len = 0;
+    if (elem.in_len < 1 || virtq_read(&elem, 0, hdr, VBLK_HDR_SIZE) != VBLK_HDR_SIZE) {
+        status = VIRTIO_BLK_S_IOERR;
+        type = -1;
+        return;
+    }
+    h_memcpy(&type, hdr, 4);
+    h_memcpy(&sector, hdr + 8, 8);
+
+    switch (type) {
+    case VIRTIO_BLK_T_IN:
+    case VIRTIO_BLK_T_OUT:
+        data_len = type == VIRTIO_BLK_T_IN ? elem.in_len - 1 : elem.out_len - VBLK_HDR_SIZE;
+        if ((data_len & 511) || sector > config.capacity || data_len / 512 > config.capacity - sector) {
+            status = VIRTIO_BLK_S_IOERR;
+            data_len = 0;
+            break;
+        }
+        offset = (drv_offset_t)sector * 512;
+        if (type == VIRTIO_BLK_T_IN)
+            vblk_map_data(elem.in, elem.in_count, 0);
+        else
+            vblk_map_data(elem.out, elem.out_count, VBLK_HDR_SIZE);
+        break;
+    case VIRTIO_BLK_T_FLUSH:
+        // Requests are finished in order, so everything written before this has already gone to the drive
+        break;
+    case VIRTIO_BLK_T_GET_ID: {
+        char id[VBLK_ID_SIZE];
+        h_memset(id, 0, sizeof(id));
+        h_memcpy(id, "HALFIX-VIRTIO-BLK", 17);
+        virtq_write(&elem, 0, id, elem.in_len - 1 < VBLK_ID_SIZE ? elem.in_len - 1 : VBLK_ID_SIZE);
+        break;
+    }
+    case VIRTIO_BLK_T_DISCARD:
+        status = vblk_discard();
+        break;
+    default:
+        status = VIRTIO_BLK_S_UNSUPP;
+        break;
+    }
+}
+
+static void vblk_drive_cb(void* ptr, int result)
+{
+    if ((uintptr_t)ptr != generation)
+        return;
+    if (result)
+        status = VIRTIO_BLK_S_IOERR;
+    // Carry on from the timer, since the drive layer isn't done with this transfer until the callback returns
+    timer_arm(TIMER_VIRTIO_BLK, get_now());
+}
+
+// Hand the rest of the current request to the drive. Returns 0 if it has to be waited for.
+static int vblk_continue(void)
+{
+    while (xfer_index < xfer_count && status == VIRTIO_BLK_S_OK) {
+        // The drive layer only keeps track of one asynchronous transfer at a time, and the IDE controller might be
+        // using it
+        if (drive_async_event_in_progress()) {
+            timer_arm(TIMER_VIRTIO_BLK, get_now() + VBLK_RETRY_INTERVAL);
+            return 0;
+        }
+        struct vblk_xfer* x = &xfer[xfer_index++];
+        int res;
+        if (type == VIRTIO_BLK_T_IN)
+            res = drive_read(drive, (void*)generation, x->ptr, x->len, offset, vblk_drive_cb);
+        else
+            res = drive_write(drive, (void*)generation, x->ptr, x->len, offset, vblk_drive_cb);
+        offset += x->len;
+        if (res == DRIVE_RESULT_ASYNC)
+            return 0;
+        if (res != DRIVE_RESULT_SYNC)
+            status = VIRTIO_BLK_S_IOERR;
+    }
+    return 1;
+}
+
+static void vblk_complete(void)
+{
+    uint8_t s = status;
+    uint32_t written = 0;
+    if (type == VIRTIO_BLK_T_IN && status == VIRTIO_BLK_S_OK) {
+        if (bounced)
+            virtq_write(&elem, 0, bounce, data_len);
+        else {
+            // Data went straight into guest RAM, so code translated from it has to be thrown away
+            for (int i = 0, pos = 0; i < elem.in_count && pos < (int)data_len; pos += elem.in[i++].len)
+                pci_dma_written(elem.in[i].addr, data_len - pos < elem.in[i].len ? data_len - pos : elem.in[i].len);
+        }
+        written = data_len;
+    } else if (type == VIRTIO_BLK_T_GET_ID)
+        written = elem.in_len - 1;
+    virtq_write(&elem, elem.in_len - 1, &s, 1);
+    virtq_push(&dev, 0, &elem, written + 1);
+    active = 0;
+}
+
+// Work through the queue until it's empty or something has to be waited for
+static void vblk_run(void)
+{
+    int finished = 0;
+    while (!waiting) {
+        if (!active) {
+            if (virtq_pop(&dev, 0, &elem) < 0)
+                break;
+            vblk_start();
+        }
+        if (!vblk_continue()) {
+            waiting = 1;
+            break;
+        }
+        vblk_complete();
+        finished++;
+    }
+    if (finished)
+        virtq_notify(&dev, 0);
+}
+
+static void vblk_timer(itick_t now)
+{
+    UNUSED(now);
+    waiting = 0;
+    vblk_run();
+}
+
+static void vblk_notify(struct virtio_device* d, int queue)
+{
+    UNUSED(d);
+    UNUSED(queue);
+    vblk_run();
+}
+
+static void vblk_reset(struct virtio_device* d)
+{
+    UNUSED(d);
+    active = waiting = 0;
+    generation++;
+    timer_cancel(TIMER_VIRTIO_BLK);
+}
+
+static void vblk_state(struct virtio_device* d)
+{
+    UNUSED(d);
+    struct bjson_object* obj = state_obj("virtio-blk", 1);
+    state_field(obj, 4, "vblk.active", &active);
+    drive_state(drive, "vblk");
+
+    if (state_is_reading()) {
+        // The request that was being worked on was never handed back to the guest, so it's popped and started over
+        if (active)
+            dev.queue[0].last_avail--;
+        active = waiting = 0;
+        generation++;
+        timer_arm(TIMER_VIRTIO_BLK, get_now());
+    }
+}
+
+void virtio_blk_init(struct virtio_blk_cfg* cfg)
+{
+    drive = &cfg->drive;
+    if (!drive->read) {
+        h_fprintf(stderr, "virtio-blk: no disk image - ignoring\n");
+        return;
+    }
+
+    config.capacity = drive->sectors;
+    config.seg_max = VBLK_QUEUE_SIZE - 2; // Header and status byte
+    config.cylinders = drive->cylinders_per_head;
+    config.heads = drive->heads;
+    config.sectors = drive->sectors_per_cylinder;
+    config.blk_size = 512;
+    config.max_discard_sectors = drive->sectors;
+    config.max_discard_seg = VBLK_MAX_DISCARD_SEGS;
+    config.discard_sector_alignment = 1;
+
+    dev.device_id = VIRTIO_ID_BLOCK;
+    dev.class_code = 0x010000; // SCSI storage controller, like QEMU
+    dev.host_features = VIRTIO_BLK_F_SEG_MAX | VIRTIO_BLK_F_GEOMETRY | VIRTIO_BLK_F_BLK_SIZE | VIRTIO_BLK_F_FLUSH | VIRTIO_BLK_F_DISCARD;
+    dev.queue_count = 1;
+    dev.queue_size = VBLK_QUEUE_SIZE;
+    dev.config = (uint8_t*)&config;
+    dev.config_size = sizeof(config);
+    dev.notify = vblk_notify;
+    dev.reset = vblk_reset;
+    dev.state = vblk_state;
+    virtio_register(&dev);
+    timer_register(TIMER_VIRTIO_BLK, vblk_timer);
+
+    VBLK_LOG("%u sectors\n", drive->sectors);
+}
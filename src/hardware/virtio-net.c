@@ -0,0 +1,167 @@
+// Virtio network card
+// Frames are exchanged through two virtqueues in guest RAM instead of being copied through I/O ports a word at a time
+// like on the NE2000, and the guest is interrupted once per batch instead of once per frame.
+// https://ozlabs.org/~rusty/virtio-spec/virtio-0.9.5.pdf (Appendix C)
+#include "devices.h"
+#include "net.h"
+#include "pc.h"
+#include "state.h"
+#include "virtio.h"
+#include <string.h>
+
+#define VNET_LOG(x, ...) LOG("VNET", x, ##__VA_ARGS__)
+
+#define VNET_RX 0
+#define VNET_TX 1
+#define VNET_QUEUE_SIZE 256
+
+#define VIRTIO_NET_F_MAC (1 << 5)
+#define VIRTIO_NET_F_STATUS (1 << 16)
+#define VIRTIO_NET_S_LINK_UP 1
+
+// struct virtio_net_hdr. We don't offer checksum or segmentation offloading, so it's always zero in received frames.
+#define VNET_HDR_SIZE 10
+// Largest frame we'll send, with a VLAN tag but without the CRC
+#define VNET_MAX_FRAME 1518
+
+#define VNET_POLL_INTERVAL (ticks_per_second / 1000)
+
+static struct virtio_device dev;
+
+static struct {
+    uint8_t mac[6];
+    uint16_t status;
+} __attribute__((packed)) config;
+
+static int polling; // Set while the receive timer is armed
+static int received; // Frames delivered during the current poll
+
+static struct virtq_elem elem;
+static uint8_t tx_frame[VNET_MAX_FRAME];
+
+static void vnet_tx(void)
+{
+    int sent = 0;
+    while (virtq_pop(&dev, VNET_TX, &elem) == 0) {
+        uint32_t len = elem.out_len - VNET_HDR_SIZE;
+        if (elem.out_len < VNET_HDR_SIZE || len > VNET_MAX_FRAME)
+            VNET_LOG("Dropping frame of %d bytes\n", (int)elem.out_len);
+        else {
+            // Linux puts the header and the frame in separate descriptors, so the frame can usually be sent right out of
+            // guest memory
+            void* frame = NULL;
+            if (elem.out_count == 2 && elem.out[0].len == VNET_HDR_SIZE)
+                frame = pci_dma_ptr(elem.out[1].addr, len);
+            if (!frame) {
+                virtq_read(&elem, VNET_HDR_SIZE, tx_frame, len);
+                frame = tx_frame;
+            }
+            net_send(frame, len);
+        }
+        virtq_push(&dev, VNET_TX, &elem, 0);
+        sent++;
+    }
+    if (sent)
+        virtq_notify(&dev, VNET_TX);
+}
+
+static int vnet_accept(uint8_t* data)
+{
+    // Broadcast and multicast frames have the lowest bit of the destination set
+    if (data[0] & 1)
+        return 1;
+    return !memcmp(data, config.mac, 6);
+}
+
+static void vnet_receive(void* data, int len)
+{
+    if (len < 6 || !vnet_accept(data))
+        return;
+    if (virtq_pop(&dev, VNET_RX, &elem) < 0)
+        return;
+    static const uint8_t hdr[VNET_HDR_SIZE];
+    if (elem.in_len < VNET_HDR_SIZE + (uint32_t)len) {
+        VNET_LOG("Receive buffer too small for a frame of %d bytes\n", len);
+        virtq_push(&dev, VNET_RX, &elem, 0);
+    } else {
+        virtq_write(&elem, 0, hdr, VNET_HDR_SIZE);
+        virtq_write(&elem, VNET_HDR_SIZE, data, len);
+        virtq_push(&dev, VNET_RX, &elem, VNET_HDR_SIZE + len);
+    }
+    received++;
+}
+
+// Pull in as many frames as there are receive buffers for, and keep polling for as long as the guest has buffers left
+static void vnet_timer(itick_t now)
+{
+    UNUSED(now);
+    received = 0;
+    net_poll(vnet_receive, virtq_pending(&dev, VNET_RX));
+    if (received)
+        virtq_notify(&dev, VNET_RX);
+    polling = virtq_pending(&dev, VNET_RX) != 0;
+    if (polling)
+        timer_arm(TIMER_VIRTIO_NET, get_now() + VNET_POLL_INTERVAL);
+}
+
+static void vnet_notify(struct virtio_device* d, int queue)
+{
+    UNUSED(d);
+    if (queue == VNET_TX)
+        vnet_tx();
+    else if (queue == VNET_RX && !polling) {
+        // New receive buffers -- start polling the backend again
+        polling = 1;
+        timer_arm(TIMER_VIRTIO_NET, get_now() + VNET_POLL_INTERVAL);
+    }
+}
+
+static void vnet_reset(struct virtio_device* d)
+{
+    UNUSED(d);
+    polling = 0;
+    timer_cancel(TIMER_VIRTIO_NET);
+}
+
+static void vnet_state(struct virtio_device* d)
+{
+    UNUSED(d);
+    // Nothing to save, but polling has to start again if the guest left receive buffers behind
+    if (state_is_reading()) {
+        polling = virtq_pending(&dev, VNET_RX) != 0;
+        if (polling)
+            timer_arm(TIMER_VIRTIO_NET, get_now() + VNET_POLL_INTERVAL);
+        else
+            timer_cancel(TIMER_VIRTIO_NET);
+    }
+}
+
+void virtio_net_init(struct virtio_net_cfg* cfg)
+{
+    int macsum = 0;
+    for (int i = 0; i < 6; i++)
+        macsum |= cfg->mac_address[i];
+    if (!macsum) {
+        // Locally administered QEMU-style address
+        static const uint8_t default_mac[6] = { 0x52, 0x54, 0x00, 0x12, 0x34, 0x56 };
+        h_memcpy(config.mac, default_mac, 6);
+    } else
+        h_memcpy(config.mac, cfg->mac_address, 6);
+    config.status = VIRTIO_NET_S_LINK_UP;
+
+    dev.device_id = VIRTIO_ID_NET;
+    dev.class_code = 0x020000; // Ethernet controller
+    dev.host_features = VIRTIO_NET_F_MAC | VIRTIO_NET_F_STATUS;
+    dev.queue_count = 2;
+    dev.queue_size = VNET_QUEUE_SIZE;
+    dev.config = (uint8_t*)&config;
+    dev.config_size = sizeof(config);
+    dev.notify = vnet_notify;
+    dev.reset = vnet_reset;
+    dev.state = vnet_state;
+    virtio_register(&dev);
+    timer_register(TIMER_VIRTIO_NET, vnet_timer);
+
+    VNET_LOG("MAC address %02x:%02x:%02x:%02x:%02x:%02x\n", config.mac[0], config.mac[1], config.mac[2],
+        config.mac[3], config.mac[4], config.mac[5]);
+}
@@ -0,0 +1,500 @@
+// Legacy virtio PCI transport
+// Every device gets an I/O BAR with the legacy register layout:
+//  +0x00: Host features (32-bit, read only)
+//  +0x04: Guest features (32-bit)
+//  +0x08: Page frame number of the selected queue (32-bit)
+//  +0x0C: Size of the selected queue (16-bit, read only)
+//  +0x0E: Queue select (16-bit)
+//  +0x10: Queue notify (16-bit, write only)
+//  +0x12: Device status (8-bit)
+//  +0x13: ISR status (8-bit, read only, cleared on read)
+//  +0x14: Device-specific configuration
+// The queues live in guest RAM, and are read and written in place.
+#include "virtio.h"
+#include "devices.h"
+#include "pc.h"
+#include "state.h"
+#include "util.h"
+#include <string.h>
+
+#define VIRTIO_LOG(x, ...) LOG("VIRTIO", x, ##__VA_ARGS__)
+#define VIRTIO_FATAL(x, ...) FATAL("VIRTIO", x, ##__VA_ARGS__)
+
+#define VIRTIO_PCI_VENDOR 0x1AF4
+// Legacy devices are numbered 0x1000 + device ID - 1
+#define VIRTIO_PCI_DEVICE(id) (0x1000 + (id)-1)
+// Virtio devices take up PCI slots starting here
+#define VIRTIO_PCI_FIRST_SLOT 8
+
+#define VIRTIO_MAX_DEVICES MAX_VIRTIO_DEVICES
+
+#define VIRTIO_REG_CONFIG 0x14
+
+#define VIRTQ_DESC_F_NEXT 1
+#define VIRTQ_DESC_F_WRITE 2
+#define VIRTQ_AVAIL_F_NO_INTERRUPT 1
+
+static struct virtio_device* devices[VIRTIO_MAX_DEVICES];
+static int device_count;
+
+static inline uint16_t virtio_read16(uint32_t addr)
+{
+    uint16_t* ptr = pci_dma_ptr(addr, 2);
+    return ptr ? *ptr : 0;
+}
+static inline void virtio_write16(uint32_t addr, uint16_t data)
+{
+    uint16_t* ptr = pci_dma_ptr(addr, 2);
+    if (ptr)
+        *ptr = data;
+}
+
+static void virtio_raise_irq(struct virtio_device* dev)
+{
+    if (dev->isr & 1)
+        return;
+    dev->isr |= 1;
+    pci_pulse_irq_line(dev->pci_slot);
+}
+
+static void virtio_reset_device(struct virtio_device* dev)
+{
+    dev->guest_features = 0;
+    dev->queue_select = 0;
+    dev->status = 0;
+    if (dev->isr)
+        pci_set_irq_line(dev->pci_slot, 0);
+    dev->isr = 0;
+    for (int i = 0; i < dev->queue_count; i++) {
+        struct virtq* q = &dev->queue[i];
+        q->pfn = q->desc = q->avail = q->used = 0;
+        q->last_avail = 0;
+    }
+    if (dev->reset)
+        dev->reset(dev);
+}
+
+// Work out where the parts of a ring are from q->pfn
+static void virtq_layout(struct virtq* q)
+{
+    if (!q->pfn) {
+        q->desc = q->avail = q->used = 0;
+        return;
+    }
+    // Descriptor table, then the available ring, then the used ring on the next page boundary
+    q->desc = q->pfn << 12;
+    q->avail = q->desc + q->size * 16;
+    q->used = (q->avail + 6 + q->size * 2 + 4095) & ~4095;
+    if (!pci_dma_ptr(q->desc, q->used + 6 + q->size * 8 - q->desc)) {
+        VIRTIO_LOG("Queue placed outside of RAM (pfn=%x)\n", q->pfn);
+        q->pfn = q->desc = q->avail = q->used = 0;
+    }
+}
+
+static void virtio_set_pfn(struct virtio_device* dev, uint32_t pfn)
+{
+    if (dev->queue_select >= dev->queue_count)
+        return;
+    struct virtq* q = &dev->queue[dev->queue_select];
+    q->pfn = pfn;
+    q->last_avail = 0;
+    virtq_layout(q);
+}
+
+static struct virtio_device* virtio_find(uint32_t port)
+{
+    for (int i = 0; i < device_count; i++) {
+        struct virtio_device* dev = devices[i];
+        if (port - dev->iobase < dev->iosize)
+            return dev;
+    }
+    VIRTIO_FATAL("No device at port %x\n", port);
+    return NULL;
+}
+
+static uint8_t virtio_reg_readb(struct virtio_device* dev, uint32_t offset)
+{
+    int shift = (offset & 3) << 3;
+    switch (offset & ~3) {
+    case 0x00:
+        return dev->host_features >> shift;
+    case 0x04:
+        return dev->guest_features >> shift;
+    case 0x08:
+        return dev->queue_select < dev->queue_count ? dev->queue[dev->queue_select].pfn >> shift : 0;
+    case 0x0C:
+        if (offset < 0x0E)
+            return dev->queue_select < dev->queue_count ? dev->queue[dev->queue_select].size >> shift : 0;
+        return dev->queue_select >> (shift - 16);
+    case 0x10:
+        if (offset == 0x12)
+            return dev->status;
+        if (offset == 0x13) {
+            uint8_t isr = dev->isr;
+            dev->isr = 0;
+            pci_set_irq_line(dev->pci_slot, 0);
+            return isr;
+        }
+        return 0;
+    default:
+        offset -= VIRTIO_REG_CONFIG;
+        return offset < (uint32_t)dev->config_size ? dev->config[offset] : 0xFF;
+    }
+}
+
+static uint32_t virtio_reg_read(uint32_t port, int size)
+{
+    struct virtio_device* dev = virtio_find(port);
+    uint32_t offset = port - dev->iobase, result = 0;
+    for (int i = 0; i < size; i++)
+        result |= (uint32_t)virtio_reg_readb(dev, offset + i) << (i << 3);
+    return result;
+}
+static uint32_t virtio_readb(uint32_t port)
+{
+    return virtio_reg_read(port, 1);
+}
+static uint32_t virtio_readw(uint32_t port)
+{
+    return virtio_reg_read(port, 2);
+}
+static uint32_t virtio_readd(uint32_t port)
+{
+    return virtio_reg_read(port, 4);
+}
+
+static void virtio_reg_writeb(struct virtio_device* dev, uint32_t offset, uint8_t data)
+{
+    int shift = (offset & 3) << 3;
+    struct virtq* q = dev->queue_select < dev->queue_count ? &dev->queue[dev->queue_select] : NULL;
+    switch (offset) {
+    case 0x00 ... 0x03: // Host features
+    case 0x0C ... 0x0D: // Queue size
+    case 0x11:
+    case 0x13: // ISR status
+        break;
+    case 0x04 ... 0x07:
+        dev->guest_features = ((dev->guest_features & ~(0xFFu << shift)) | data << shift) & dev->host_features;
+        break;
+    case 0x08 ... 0x0B:
+        // The ring moves once the last byte has been written
+        if (q) {
+            q->pfn = (q->pfn & ~(0xFFu << shift)) | data << shift;
+            if (offset == 0x0B)
+                virtio_set_pfn(dev, q->pfn);
+        }
+        break;
+    case 0x0E:
+        dev->queue_select = (dev->queue_select & 0xFF00) | data;
+        break;
+    case 0x0F:
+        dev->queue_select = (dev->queue_select & 0xFF) | data << 8;
+        break;
+    case 0x10:
+        // Some drivers fill their queues and kick them before setting DRIVER_OK, so that isn't checked here
+        if (data < dev->queue_count && dev->queue[data].pfn)
+            dev->notify(dev, data);
+        break;
+    case 0x12:
+        dev->status = data;
+        if (!data)
+            virtio_reset_device(dev);
+        break;
+    default:
+        offset -= VIRTIO_REG_CONFIG;
+        if (offset < (uint32_t)dev->config_size)
+            dev->config[offset] = data;
+        break;
+    }
+}
+
+// Wider accesses are split up into bytes, lowest first, so that registers can be written a piece at a time
+static void virtio_reg_write(uint32_t port, uint32_t data, int size)
+{
+    struct virtio_device* dev = virtio_find(port);
+    uint32_t offset = port - dev->iobase;
+    for (int i = 0; i < size; i++)
+        virtio_reg_writeb(dev, offset + i, data >> (i << 3));
+}
+static void virtio_writeb(uint32_t port, uint32_t data)
+{
+    virtio_reg_write(port, data, 1);
+}
+static void virtio_writew(uint32_t port, uint32_t data)
+{
+    virtio_reg_write(port, data, 2);
+}
+static void virtio_writed(uint32_t port, uint32_t data)
+{
+    virtio_reg_write(port, data, 4);
+}
+
+static void virtio_remap(struct virtio_device* dev, uint32_t newbase)
+{
+    if (newbase == dev->iobase)
+        return;
+    if (dev->iobase) {
+        io_unregister_read(dev->iobase, dev->iosize);
+        io_unregister_write(dev->iobase, dev->iosize);
+    }
+    dev->iobase = newbase;
+    if (newbase) {
+        io_register_read(newbase, dev->iosize, virtio_readb, virtio_readw, virtio_readd);
+        io_register_write(newbase, dev->iosize, virtio_writeb, virtio_writew, virtio_writed);
+        VIRTIO_LOG("Device %d mapped to port %04x\n", dev->device_id, newbase);
+    }
+}
+
+// Port that the BAR points to, or 0 if it's somewhere that isn't decoded
+static uint32_t virtio_bar_base(struct virtio_device* dev)
+{
+    // Only ports below 64K are decoded
+    uint32_t base = (dev->pci[0x10] | dev->pci[0x11] << 8) & 0xFFFC;
+    return base + dev->iosize <= 0xFFFF ? base : 0;
+}
+
+static int virtio_pci_write(uint8_t* ptr, uint8_t addr, uint8_t data)
+{
+    struct virtio_device* dev = NULL;
+    for (int i = 0; i < device_count; i++)
+        if (devices[i]->pci == ptr)
+            dev = devices[i];
+    if (!dev)
+        return 1;
+
+    switch (addr) {
+    case 0x04:
+        ptr[0x04] = data & 5; // I/O space and bus mastering
+        return 1;
+    case 0x05:
+        ptr[0x05] = data & 1;
+        return 1;
+    case 0x10 ... 0x13: {
+        // I/O BAR. The low bits are hardwired so that the BIOS can figure out how big it is.
+        ptr[addr] = data;
+        uint32_t bar = ((ptr[0x10] | ptr[0x11] << 8 | ptr[0x12] << 16 | ptr[0x13] << 24) & ~(dev->iosize - 1)) | 1;
+        ptr[0x10] = bar;
+        ptr[0x11] = bar >> 8;
+        ptr[0x12] = bar >> 16;
+        ptr[0x13] = bar >> 24;
+        // Remap once the upper byte of the port number is in, and leave the BAR unmapped while it's being sized
+        if (addr == 0x11)
+            virtio_remap(dev, virtio_bar_base(dev));
+        return 1;
+    }
+    case 0x3C: // Interrupt line
+        return 0;
+    default:
+        return 1; // Everything else is read only
+    }
+}
+
+static void virtio_state(void)
+{
+    char name[50];
+    for (int i = 0; i < device_count; i++) {
+        struct virtio_device* dev = devices[i];
+        h_sprintf(name, "virtio%d", i);
+        struct bjson_object* obj = state_obj(name, 5 + VIRTIO_MAX_QUEUES * 2);
+        state_field(obj, 4, "virtio.guest_features", &dev->guest_features);
+        state_field(obj, 4, "virtio.queue_select", &dev->queue_select);
+        state_field(obj, 1, "virtio.status", &dev->status);
+        state_field(obj, 1, "virtio.isr", &dev->isr);
+        for (int j = 0; j < dev->queue_count; j++) {
+            h_sprintf(name, "virtio.queue[%d].pfn", j);
+            state_field(obj, 4, name, &dev->queue[j].pfn);
+            h_sprintf(name, "virtio.queue[%d].last_avail", j);
+            state_field(obj, 2, name, &dev->queue[j].last_avail);
+        }
+
+        if (state_is_reading()) {
+            for (int j = 0; j < dev->queue_count; j++)
+                virtq_layout(&dev->queue[j]);
+            virtio_remap(dev, virtio_bar_base(dev));
+        }
+        if (dev->state)
+            dev->state(dev);
+    }
+}
+
+static void virtio_reset(void)
+{
+    for (int i = 0; i < device_count; i++)
+        virtio_reset_device(devices[i]);
+}
+
+void virtio_register(struct virtio_device* dev)
+{
+    if (device_count == VIRTIO_MAX_DEVICES)
+        VIRTIO_FATAL("Too many virtio devices\n");
+    devices[device_count] = dev;
+    dev->pci_slot = VIRTIO_PCI_FIRST_SLOT + device_count++;
+
+    // Smallest power of two that holds all the registers
+    dev->iosize = 32;
+    while (dev->iosize < (uint32_t)(VIRTIO_REG_CONFIG + dev->config_size))
+        dev->iosize <<= 1;
+    for (int i = 0; i < dev->queue_count; i++)
+        dev->queue[i].size = dev->queue_size;
+
+    uint8_t* pci = dev->pci = pci_create_device(0, dev->pci_slot, 0, virtio_pci_write);
+    uint16_t device = VIRTIO_PCI_DEVICE(dev->device_id);
+    pci[0x00] = VIRTIO_PCI_VENDOR & 0xFF;
+    pci[0x01] = VIRTIO_PCI_VENDOR >> 8;
+    pci[0x02] = device & 0xFF;
+    pci[0x03] = device >> 8;
+    pci[0x09] = dev->class_code;
+    pci[0x0A] = dev->class_code >> 8;
+    pci[0x0B] = dev->class_code >> 16;
+    pci[0x10] = 1; // I/O BAR
+    pci[0x2C] = VIRTIO_PCI_VENDOR & 0xFF;
+    pci[0x2D] = VIRTIO_PCI_VENDOR >> 8;
+    pci[0x2E] = dev->device_id;
+    pci[0x3D] = 1; // INTA#
+}
+
+int virtq_pending(struct virtio_device* dev, int queue)
+{
+    struct virtq* q = &dev->queue[queue];
+    if (!q->pfn)
+        return 0;
+    return (uint16_t)(virtio_read16(q->avail + 2) - q->last_avail);
+}
+
+int virtq_pop(struct virtio_device* dev, int queue, struct virtq_elem* elem)
+{
+    struct virtq* q = &dev->queue[queue];
+    if (!virtq_pending(dev, queue))
+        return -1;
+    int head = virtio_read16(q->avail + 4 + (q->last_avail % q->size) * 2), index = head;
+    q->last_avail++;
+
+    elem->head = head;
+    elem->out_count = elem->in_count = 0;
+    elem->out_len = elem->in_len = 0;
+    for (int i = 0;; i++) {
+        if (index >= q->size || i == q->size || i == VIRTQ_MAX_SEGS) {
+            VIRTIO_LOG("Bad descriptor chain on queue %d\n", queue);
+            virtq_push(dev, queue, elem, 0);
+            return -1;
+        }
+        uint8_t* desc = pci_dma_ptr(q->desc + index * 16, 16);
+        uint32_t addr = *(uint32_t*)desc, len = *(uint32_t*)(desc + 8);
+        uint16_t flags = *(uint16_t*)(desc + 12);
+        // Upper half of the address is ignored, since RAM is well below 4G
+        if (flags & VIRTQ_DESC_F_WRITE) {
+            elem->in[elem->in_count].addr = addr;
+            elem->in[elem->in_count++].len = len;
+            elem->in_len += len;
+        } else {
+            elem->out[elem->out_count].addr = addr;
+            elem->out[elem->out_count++].len = len;
+            elem->out_len += len;
+        }
+        if (!(flags & VIRTQ_DESC_F_NEXT))
+            break;
+        index = *(uint16_t*)(desc + 14);
+    }
+    return 0;
+}
+
+void virtq_push(struct virtio_device* dev, int queue, struct virtq_elem* elem, uint32_t len)
+{
+    struct virtq* q = &dev->queue[queue];
+    uint16_t idx = virtio_read16(q->used + 2);
+    uint32_t* entry = pci_dma_ptr(q->used + 4 + (idx % q->size) * 8, 8);
+    entry[0] = elem->head;
+    entry[1] = len;
+    virtio_write16(q->used + 2, idx + 1);
+}
+
+void virtq_notify(struct virtio_device* dev, int queue)
+{
+    if (!(virtio_read16(dev->queue[queue].avail) & VIRTQ_AVAIL_F_NO_INTERRUPT))
+        virtio_raise_irq(dev);
+}
+
+uint32_t virtq_read(struct virtq_elem* elem, uint32_t offset, void* dst, uint32_t len)
+{
+    uint8_t* dst8 = dst;
+    uint32_t copied = 0;
+    for (int i = 0; i < elem->out_count && copied < len; i++) {
+        struct virtq_seg* seg = &elem->out[i];
+        if (offset >= seg->len) {
+            offset -= seg->len;
+            continue;
+        }
+        uint32_t n = seg->len - offset;
+        if (n > len - copied)
+            n = len - copied;
+        uint8_t* src = pci_dma_ptr(seg->addr + offset, n);
+        if (!src)
+            break;
+        h_memcpy(dst8 + copied, src, n);
+        copied += n;
+        offset = 0;
+    }
+    return copied;
+}
+
+uint32_t virtq_write(struct virtq_elem* elem, uint32_t offset, const void* src, uint32_t len)
+{
+    const uint8_t* src8 = src;
+    uint32_t copied = 0;
+    for (int i = 0; i < elem->in_count && copied < len; i++) {
+        struct virtq_seg* seg = &elem->in[i];
+        if (offset >= seg->len) {
+            offset -= seg->len;
+            continue;
+        }
+        uint32_t n = seg->len - offset;
+        if (n > len - copied)
+            n = len - copied;
+        uint8_t* dst = pci_dma_ptr(seg->addr + offset, n);
+        if (!dst)
+            break;
+        h_memcpy(dst, src8 + copied, n);
+        pci_dma_written(seg->addr + offset, n);
+        copied += n;
+        offset = 0;
+    }
+    return copied;
+}
+
+void virtio_init(struct pc_settings* pc)
+{
+    int used = 0;
+    for (int i = 0; i < MAX_VIRTIO_DEVICES; i++) {
+        struct virtio_cfg* cfg = &pc->virtio[i];
+        if (cfg->type == -1)
+            continue;
+        if (!pc->pci_enabled) {
+            h_fprintf(stderr, "virtio%d needs PCI to be enabled - ignoring\n", i);
+            continue;
+        }
+        // The devices keep their state in static variables, so a second one of the same type would clobber the first
+        if (used & (1 << cfg->type)) {
+            h_fprintf(stderr, "virtio%d: only one device of each type is supported - ignoring\n", i);
+            continue;
+        }
+        used |= 1 << cfg->type;
+        switch (cfg->type) {
+        case VIRTIO_9P:
+            virtio_9p_init(&cfg->fs9p);
+            break;
+        case VIRTIO_NET:
+            virtio_net_init(&cfg->net);
+            break;
+        case VIRTIO_BLK:
+            virtio_blk_init(&cfg->blk);
+            break;
+        default:
+            h_fprintf(stderr, "virtio%d: device type not supported yet - ignoring\n", i);
+            break;
+        }
+    }
+    if (device_count) {
+        io_register_reset(virtio_reset);
+        state_register(virtio_state);
+    }
+}
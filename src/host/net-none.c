@@ -11,6 +11,9 @@ int net_send(void* req, int reqlen)
     UNUSED(reqlen);
     return -1;
 }
-void net_poll(void)
+int net_poll(void (*cb)(void* data, int len), int max)
 {
+    UNUSED(cb);
+    UNUSED(max);
+    return 0;
 }
\ No newline at end of file
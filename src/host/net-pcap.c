@@ -74,19 +74,15 @@ static void (*recv_cb)(void* data, int len);
 static void pcap_recv(u_char* param, const struct pcap_pkthdr* header, const u_char* pkt_data)
 {
     UNUSED(param);
-    h_printf("packet recv: len=%d data=%p\n", header->caplen, pkt_data);
     recv_cb((void*)pkt_data, header->caplen);
 }
 
-// Poll pcap network device
-void net_poll(void (*cb)(void* data, int len))
+// Poll pcap network device. The handle is non-blocking, so this returns right away if nothing has arrived.
+int net_poll(void (*cb)(void* data, int len), int max)
 {
     recv_cb = cb;
-    int retv = pcap_dispatch(pcap_adhandle, 1, pcap_recv, NULL);
+    int retv = pcap_dispatch(pcap_adhandle, max, pcap_recv, NULL);
     if (retv < 0)
-        FATAL("NET", "Failed to poll for packets\n");
-    else if (retv == 0) { // ?
-    }
-    else { // retv > 0, ??
-    }
+        FATAL("NET", "Failed to poll for packets: %s\n", pcap_geterr(pcap_adhandle));
+    return retv;
 }
\ No newline at end of file
@@ -0,0 +1,147 @@
+// TAP-based network handler
+// Attaches the guest to a Linux TAP device, which can then be bridged or routed like any other interface. Unlike pcap,
+// frames don't go through a capture filter or get copied into a capture buffer first: reads land in the buffer that is
+// handed to the NE2000, and writes go straight out of NE2000 memory.
+//
+// The "arg" field of the [ne2000] section is the name of the TAP device, which has to exist already if we aren't
+// allowed to create it. For example:
+//   ip tuntap add dev tap0 mode tap user $USER && ip link set tap0 up
+
+#define _GNU_SOURCE
+
+#include "util.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/if.h>
+#include <linux/if_tun.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#define NET_LOG(x, ...) LOG("NET", x, ##__VA_ARGS__)
+
+// Largest frame that the NE2000 will take, without the CRC. Anything longer gets cut short by read() and dropped.
+#define TAP_MAX_FRAME 1514
+// Frames that the host wasn't ready for when the guest sent them, kept around until the next poll
+#define TAP_TX_POOL 32
+
+static int tap_fd = -1;
+
+static uint8_t rx_frame[TAP_MAX_FRAME + 1];
+
+static struct {
+    int len;
+    uint8_t data[TAP_MAX_FRAME];
+} tx_pool[TAP_TX_POOL];
+static int tx_head, tx_count;
+
+static struct {
+    uint64_t rx_packets, rx_bytes, rx_dropped;
+    uint64_t tx_packets, tx_bytes, tx_deferred, tx_dropped;
+} stats;
+
+static void tap_report(void)
+{
+    h_printf("TAP: received %llu packets (%llu bytes, %llu dropped), sent %llu packets (%llu bytes, %llu deferred, %llu dropped)\n",
+        (unsigned long long)stats.rx_packets, (unsigned long long)stats.rx_bytes, (unsigned long long)stats.rx_dropped,
+        (unsigned long long)stats.tx_packets, (unsigned long long)stats.tx_bytes,
+        (unsigned long long)stats.tx_deferred, (unsigned long long)stats.tx_dropped);
+}
+
+int net_init(char* netarg)
+{
+    struct ifreq ifr;
+    if (!netarg || h_strlen(netarg) >= IFNAMSIZ) {
+        h_fprintf(stderr, "TAP backend needs the name of a TAP device in [ne2000] arg\n");
+        return -1;
+    }
+    tap_fd = open("/dev/net/tun", O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (tap_fd < 0) {
+        perror("open /dev/net/tun");
+        return -1;
+    }
+    h_memset(&ifr, 0, sizeof(ifr));
+    // No packet information or virtio-net headers, so the kernel doesn't hand us offloaded (oversized) frames
+    ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+    h_strcpy(ifr.ifr_name, netarg);
+    if (ioctl(tap_fd, TUNSETIFF, &ifr) < 0) {
+        perror("TUNSETIFF");
+        close(tap_fd);
+        tap_fd = -1;
+        return -1;
+    }
+    NET_LOG("Attached to TAP device %s\n", ifr.ifr_name);
+    atexit(tap_report);
+    return 0;
+}
+
+// Try to write out everything that was deferred, oldest first. Returns 0 if something is still left over.
+static int tap_flush(void)
+{
+    while (tx_count) {
+        int n = write(tap_fd, tx_pool[tx_head].data, tx_pool[tx_head].len);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return 0;
+        if (n < 0)
+            stats.tx_dropped++;
+        else {
+            stats.tx_packets++;
+            stats.tx_bytes += n;
+        }
+        tx_head = (tx_head + 1) % TAP_TX_POOL;
+        tx_count--;
+    }
+    return 1;
+}
+
+int net_send(void* req, int reqlen)
+{
+    // Keep frames in order behind anything that was deferred
+    if (tap_flush()) {
+        int n = write(tap_fd, req, reqlen);
+        if (n >= 0) {
+            stats.tx_packets++;
+            stats.tx_bytes += n;
+            return 0;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            stats.tx_dropped++;
+            return -1;
+        }
+    }
+    if (tx_count == TAP_TX_POOL || reqlen > TAP_MAX_FRAME) {
+        stats.tx_dropped++;
+        return -1;
+    }
+    int slot = (tx_head + tx_count++) % TAP_TX_POOL;
+    h_memcpy(tx_pool[slot].data, req, reqlen);
+    tx_pool[slot].len = reqlen;
+    stats.tx_deferred++;
+    return 0;
+}
+
+// Read up to "max" frames, stopping early once the device has nothing more for us
+int net_poll(void (*cb)(void* data, int len), int max)
+{
+    int count = 0;
+    tap_flush();
+    while (count < max) {
+        int n = read(tap_fd, rx_frame, sizeof(rx_frame));
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                NET_LOG("Unable to read from TAP device: %s\n", strerror(errno));
+            break;
+        }
+        if (n > TAP_MAX_FRAME) {
+            stats.rx_dropped++;
+            continue;
+        }
+        stats.rx_packets++;
+        stats.rx_bytes += n;
+        cb(rx_frame, n);
+        count++;
+    }
+    return count;
+}
@@ -0,0 +1,735 @@
+// User-mode network handler
+// Puts the guest on a small virtual network and NATs its TCP and UDP traffic through ordinary host sockets, so neither
+// root nor a dedicated interface is needed. Layout of the virtual network, which is the same as QEMU's:
+//   10.0.2.2: gateway (connections to it go to the host's loopback interface)
+//   10.0.2.3: DNS server (forwarded to the first nameserver in /etc/resolv.conf)
+//   10.0.2.15: the guest, handed out by the built-in DHCP server
+// The link to the guest never loses frames, so nothing is retransmitted on its side. Only connections opened by the
+// guest are supported, and IP fragments are dropped.
+//
+// The "arg" field of the [ne2000] section is a comma-separated list of options:
+//   loopback: only let the guest reach the gateway (the host's loopback interface). Nothing leaves the host.
+
+#define _GNU_SOURCE
+
+#include "util.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define NET_LOG(x, ...) LOG("NET", x, ##__VA_ARGS__)
+
+#define NET_ADDR(a, b, c, d) ((uint32_t)(a) << 24 | (b) << 16 | (c) << 8 | (d))
+#define NET_NETWORK NET_ADDR(10, 0, 2, 0)
+#define NET_MASK NET_ADDR(255, 255, 255, 0)
+#define NET_GATEWAY NET_ADDR(10, 0, 2, 2)
+#define NET_DNS NET_ADDR(10, 0, 2, 3)
+#define NET_GUEST NET_ADDR(10, 0, 2, 15)
+
+#define ETH_HLEN 14
+#define IP_HLEN 20
+#define UDP_HLEN 8
+#define TCP_HLEN 20
+#define ETH_MTU 1500
+#define TCP_MSS (ETH_MTU - IP_HLEN - TCP_HLEN)
+// Where the payload starts in frames that we build
+#define UDP_DATA (ETH_HLEN + IP_HLEN + UDP_HLEN)
+#define TCP_DATA (ETH_HLEN + IP_HLEN + TCP_HLEN)
+
+#define ETHERTYPE_IP 0x0800
+#define ETHERTYPE_ARP 0x0806
+#define PROTO_ICMP 1
+#define PROTO_TCP 6
+#define PROTO_UDP 17
+
+#define TCP_FIN 0x01
+#define TCP_SYN 0x02
+#define TCP_RST 0x04
+#define TCP_PSH 0x08
+#define TCP_ACK 0x10
+// Window that we advertise to the guest. Window scaling is never negotiated.
+#define TCP_WINDOW 65535
+
+#define DHCP_MAGIC 0x63825363
+#define DHCP_LEASE (24 * 60 * 60)
+
+// Frames waiting to be picked up by the NE2000
+#define NET_QUEUE_SIZE 64
+// Host sockets open at once
+#define NET_MAX_CONNS 256
+// Unused UDP sockets are closed after this many seconds
+#define UDP_TIMEOUT 60
+
+enum {
+    CONN_FREE,
+    CONN_UDP,
+    CONN_TCP_CONNECTING, // Waiting for the host's connect() to finish before we answer the guest's SYN
+    CONN_TCP_ESTABLISHED
+};
+#define FIN_GUEST 1 // The guest has closed its side
+#define FIN_HOST 2 // The host socket has hit EOF, and we sent a FIN
+
+struct net_conn {
+    int state, fd, events;
+    // The address and port that the guest thinks it's talking to, and the guest's own port
+    uint32_t addr;
+    uint16_t port, guest_port;
+    uint64_t last_used; // UDP only, in microseconds
+
+    // TCP only. Sequence numbers are the ones we use towards the guest.
+    uint32_t iss, snd_una, snd_nxt, rcv_nxt;
+    int window, mss, fin;
+};
+
+static struct net_conn conns[NET_MAX_CONNS];
+static int epoll_fd = -1;
+
+static struct {
+    int len;
+    uint8_t data[ETH_HLEN + ETH_MTU];
+} queue[NET_QUEUE_SIZE];
+static int queue_head, queue_count;
+
+static const uint8_t gateway_mac[6] = { 0x52, 0x55, 0x0A, 0x00, 0x02, 0x02 };
+static uint8_t guest_mac[6] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+static uint32_t guest_ip = NET_GUEST, dns_addr;
+static uint16_t ip_id;
+static int loopback_only;
+static uint64_t last_expire;
+
+static inline uint16_t rd16(const uint8_t* p)
+{
+    return p[0] << 8 | p[1];
+}
+static inline uint32_t rd32(const uint8_t* p)
+{
+    return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+static inline void wr16(uint8_t* p, uint16_t v)
+{
+    p[0] = v >> 8;
+    p[1] = v;
+}
+static inline void wr32(uint8_t* p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+// One's complement sum, without the final fold
+static uint32_t net_sum(const uint8_t* p, int len, uint32_t sum)
+{
+    for (; len > 1; p += 2, len -= 2)
+        sum += p[0] << 8 | p[1];
+    if (len)
+        sum += p[0] << 8;
+    return sum;
+}
+static uint16_t net_checksum(uint32_t sum)
+{
+    while (sum >> 16)
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    return ~sum;
+}
+
+// Frames for the guest are built in place in the queue, and handed to the NE2000 straight from there. frame_alloc
+// returns the next free slot (or NULL if the guest is behind), which only gets used once frame_queue is called.
+static uint8_t* frame_alloc(void)
+{
+    if (queue_count == NET_QUEUE_SIZE)
+        return NULL;
+    return queue[(queue_head + queue_count) % NET_QUEUE_SIZE].data;
+}
+static void frame_queue(int len)
+{
+    queue[(queue_head + queue_count) % NET_QUEUE_SIZE].len = len;
+    queue_count++;
+}
+
+static void eth_header(uint8_t* f, int type)
+{
+    h_memcpy(f, guest_mac, 6);
+    h_memcpy(f + 6, gateway_mac, 6);
+    wr16(f + 12, type);
+}
+
+// Fill in the Ethernet and IP headers (and the TCP/UDP checksum) of a packet whose "len" bytes of payload have already
+// been written after them, and queue it
+static void ip_queue(uint8_t* f, int proto, uint32_t src, uint32_t dst, int len)
+{
+    uint8_t *ip = f + ETH_HLEN, *l4 = ip + IP_HLEN;
+    eth_header(f, ETHERTYPE_IP);
+    ip[0] = 0x45;
+    ip[1] = 0;
+    wr16(ip + 2, IP_HLEN + len);
+    wr16(ip + 4, ip_id++);
+    wr16(ip + 6, 0x4000); // Don't fragment
+    ip[8] = 64;
+    ip[9] = proto;
+    wr16(ip + 10, 0);
+    wr32(ip + 12, src);
+    wr32(ip + 16, dst);
+    wr16(ip + 10, net_checksum(net_sum(ip, IP_HLEN, 0)));
+
+    if (proto != PROTO_ICMP) {
+        int offset = proto == PROTO_TCP ? 16 : 6;
+        uint32_t pseudo = (src >> 16) + (src & 0xFFFF) + (dst >> 16) + (dst & 0xFFFF) + proto + len;
+        wr16(l4 + offset, 0);
+        uint16_t sum = net_checksum(net_sum(l4, len, pseudo));
+        if (proto == PROTO_UDP && !sum)
+            sum = 0xFFFF;
+        wr16(l4 + offset, sum);
+    }
+    frame_queue(ETH_HLEN + IP_HLEN + len);
+}
+
+static void udp_queue(uint8_t* f, uint32_t src, int sport, uint32_t dst, int dport, int len)
+{
+    uint8_t* udp = f + ETH_HLEN + IP_HLEN;
+    wr16(udp, sport);
+    wr16(udp + 2, dport);
+    wr16(udp + 4, UDP_HLEN + len);
+    ip_queue(f, PROTO_UDP, src, dst, UDP_HLEN + len);
+}
+
+// Figure out where a packet that the guest sent to "addr" should really go. Returns -1 if it can't go anywhere.
+static int net_host_addr(uint32_t addr, int port, int proto, struct sockaddr_in* sa)
+{
+    h_memset(sa, 0, sizeof(struct sockaddr_in));
+    sa->sin_family = AF_INET;
+    sa->sin_port = htons(port);
+    if (addr == NET_GATEWAY)
+        addr = INADDR_LOOPBACK;
+    else if (addr == NET_DNS) {
+        if (proto != PROTO_UDP || port != 53 || !dns_addr)
+            return -1;
+        addr = dns_addr;
+    } else if ((addr & NET_MASK) == NET_NETWORK || addr >= NET_ADDR(224, 0, 0, 0) || loopback_only)
+        return -1; // Nothing else on the virtual network, and no broadcasts or multicasts
+    sa->sin_addr.s_addr = htonl(addr);
+    return 0;
+}
+
+static struct net_conn* conn_find(int proto, int guest_port, uint32_t addr, int port)
+{
+    for (int i = 0; i < NET_MAX_CONNS; i++) {
+        struct net_conn* c = &conns[i];
+        if (c->state == CONN_FREE || (c->state == CONN_UDP) != (proto == PROTO_UDP))
+            continue;
+        if (c->guest_port == guest_port && c->addr == addr && c->port == port)
+            return c;
+    }
+    return NULL;
+}
+
+// Set which epoll events we're interested in for a connection
+static void conn_watch(struct net_conn* c, int events)
+{
+    if (c->events == events)
+        return;
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.u32 = (uint32_t)(c - conns);
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+    c->events = events;
+}
+
+// Create a non-blocking socket and start connecting it to the host side of a connection
+static struct net_conn* conn_open(int proto, int guest_port, uint32_t addr, int port)
+{
+    struct sockaddr_in sa;
+    if (net_host_addr(addr, port, proto, &sa) < 0)
+        return NULL;
+
+    struct net_conn* c = NULL;
+    for (int i = 0; i < NET_MAX_CONNS; i++)
+        if (conns[i].state == CONN_FREE) {
+            c = &conns[i];
+            break;
+        }
+    if (!c) {
+        NET_LOG("Out of connections\n");
+        return NULL;
+    }
+
+    int fd = socket(AF_INET, (proto == PROTO_TCP ? SOCK_STREAM : SOCK_DGRAM) | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return NULL;
+    if (connect(fd, (struct sockaddr*)&sa, sizeof(sa)) < 0 && errno != EINPROGRESS) {
+        close(fd);
+        return NULL;
+    }
+    struct epoll_event ev;
+    ev.events = 0;
+    ev.data.u32 = (uint32_t)(c - conns);
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        close(fd);
+        return NULL;
+    }
+
+    h_memset(c, 0, sizeof(struct net_conn));
+    c->state = proto == PROTO_TCP ? CONN_TCP_CONNECTING : CONN_UDP;
+    c->fd = fd;
+    c->addr = addr;
+    c->port = port;
+    c->guest_port = guest_port;
+    return c;
+}
+
+static void conn_close(struct net_conn* c)
+{
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    c->state = CONN_FREE;
+}
+
+// Send a TCP segment to the guest. If there's data, "f" is a frame from frame_alloc with "len" bytes already written at
+// TCP_DATA. Otherwise "f" can be NULL.
+static void tcp_send(struct net_conn* c, int flags, uint8_t* f, int len)
+{
+    if (!f && !(f = frame_alloc()))
+        return;
+    uint8_t* tcp = f + ETH_HLEN + IP_HLEN;
+    int hlen = TCP_HLEN;
+    if (flags & TCP_SYN) {
+        // Maximum segment size option
+        tcp[20] = 2;
+        tcp[21] = 4;
+        wr16(tcp + 22, TCP_MSS);
+        hlen += 4;
+    }
+    wr16(tcp, c->port);
+    wr16(tcp + 2, c->guest_port);
+    wr32(tcp + 4, c->snd_nxt);
+    wr32(tcp + 8, c->rcv_nxt);
+    tcp[12] = (hlen >> 2) << 4;
+    tcp[13] = flags;
+    wr16(tcp + 14, TCP_WINDOW);
+    wr16(tcp + 18, 0);
+    ip_queue(f, PROTO_TCP, c->addr, guest_ip, hlen + len);
+    c->snd_nxt += len + ((flags & (TCP_SYN | TCP_FIN)) != 0);
+}
+
+// Tell the guest that its connection is gone, and forget about it
+static void tcp_reset(struct net_conn* c)
+{
+    tcp_send(c, TCP_RST | TCP_ACK, NULL, 0);
+    conn_close(c);
+}
+
+static void tcp_check_close(struct net_conn* c)
+{
+    if (c->fin == (FIN_GUEST | FIN_HOST) && c->snd_una == c->snd_nxt)
+        conn_close(c);
+}
+
+// Host socket is readable: forward as much as the guest's window and our queue allow
+static void tcp_host_read(struct net_conn* c)
+{
+    while (1) {
+        int space = c->window - (int)(c->snd_nxt - c->snd_una);
+        if (space <= 0) {
+            // Picked up again once the guest acknowledges something
+            conn_watch(c, 0);
+            return;
+        }
+        uint8_t* f = frame_alloc();
+        if (!f)
+            return;
+        int n = recv(c->fd, f + TCP_DATA, space < c->mss ? space : c->mss, 0);
+        if (n > 0)
+            tcp_send(c, TCP_ACK | TCP_PSH, f, n);
+        else if (n == 0) {
+            tcp_send(c, TCP_FIN | TCP_ACK, f, 0);
+            c->fin |= FIN_HOST;
+            conn_watch(c, 0);
+            tcp_check_close(c);
+            return;
+        } else {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                tcp_reset(c);
+            return;
+        }
+    }
+}
+
+static void tcp_event(struct net_conn* c)
+{
+    if (c->state == CONN_TCP_CONNECTING) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err) {
+            tcp_reset(c);
+            return;
+        }
+        c->state = CONN_TCP_ESTABLISHED;
+        tcp_send(c, TCP_SYN | TCP_ACK, NULL, 0);
+        conn_watch(c, EPOLLIN);
+        return;
+    }
+    tcp_host_read(c);
+}
+
+static void tcp_input(uint32_t dst, uint8_t* tcp, int len)
+{
+    if (len < TCP_HLEN)
+        return;
+    int hlen = (tcp[12] >> 4) << 2, flags = tcp[13];
+    if (hlen < TCP_HLEN || hlen > len)
+        return;
+    uint16_t sport = rd16(tcp), dport = rd16(tcp + 2);
+    uint32_t seq = rd32(tcp + 4), ack = rd32(tcp + 8);
+    uint8_t* data = tcp + hlen;
+    int datalen = len - hlen;
+
+    struct net_conn* c = conn_find(PROTO_TCP, sport, dst, dport);
+    if (!c) {
+        if (flags & TCP_RST)
+            return;
+        if ((flags & (TCP_SYN | TCP_ACK)) == TCP_SYN && (c = conn_open(PROTO_TCP, sport, dst, dport))) {
+            c->mss = TCP_MSS;
+            for (int i = TCP_HLEN; i + 1 < hlen && tcp[i];) {
+                if (tcp[i] == 1) { // No-op
+                    i++;
+                    continue;
+                }
+                if (tcp[i] == 2 && tcp[i + 1] == 4 && i + 4 <= hlen && rd16(tcp + i + 2) < c->mss)
+                    c->mss = rd16(tcp + i + 2);
+                if (tcp[i + 1] < 2)
+                    break;
+                i += tcp[i + 1];
+            }
+            c->iss = c->snd_una = c->snd_nxt = (uint32_t)h_get_us() << 6;
+            c->rcv_nxt = seq + 1;
+            c->window = rd16(tcp + 14);
+            conn_watch(c, EPOLLOUT);
+            return;
+        }
+        // Nobody's listening. Answer with a reset, like a real host would.
+        struct net_conn tmp;
+        h_memset(&tmp, 0, sizeof(tmp));
+        tmp.addr = dst;
+        tmp.port = dport;
+        tmp.guest_port = sport;
+        tmp.snd_nxt = flags & TCP_ACK ? ack : 0;
+        tmp.rcv_nxt = seq + datalen + ((flags & TCP_SYN) != 0) + ((flags & TCP_FIN) != 0);
+        tcp_send(&tmp, TCP_RST | TCP_ACK, NULL, 0);
+        return;
+    }
+
+    if (flags & TCP_RST) {
+        conn_close(c);
+        return;
+    }
+    if (c->state != CONN_TCP_ESTABLISHED)
+        return; // Still connecting -- the guest will retransmit its SYN if it gets impatient
+    if (flags & TCP_SYN) {
+        // Our SYN-ACK never made it
+        if (c->snd_una == c->iss) {
+            c->snd_nxt = c->iss;
+            tcp_send(c, TCP_SYN | TCP_ACK, NULL, 0);
+        }
+        return;
+    }
+    if (flags & TCP_ACK) {
+        if ((int32_t)(ack - c->snd_una) > 0 && (int32_t)(ack - c->snd_nxt) <= 0)
+            c->snd_una = ack;
+        c->window = rd16(tcp + 14);
+        if (!(c->fin & FIN_HOST) && c->window > (int)(c->snd_nxt - c->snd_una))
+            conn_watch(c, EPOLLIN);
+    }
+
+    if (datalen || (flags & TCP_FIN)) {
+        int32_t old = c->rcv_nxt - seq;
+        if (old >= 0 && old <= datalen && !(c->fin & FIN_GUEST)) {
+            // Whatever the host socket won't take now is left unacknowledged, and the guest will send it again
+            int sent = 0;
+            if (datalen > old) {
+                sent = send(c->fd, data + old, datalen - old, MSG_NOSIGNAL);
+                if (sent < 0) {
+                    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                        tcp_reset(c);
+                        return;
+                    }
+                    sent = 0;
+                }
+            }
+            c->rcv_nxt += sent;
+            if ((flags & TCP_FIN) && old + sent == datalen) {
+                c->rcv_nxt++;
+                c->fin |= FIN_GUEST;
+                shutdown(c->fd, SHUT_WR);
+            }
+        }
+        // Anything out of order or already seen just gets the current ACK again
+        tcp_send(c, TCP_ACK, NULL, 0);
+    }
+    tcp_check_close(c);
+}
+
+static void udp_event(struct net_conn* c)
+{
+    while (1) {
+        uint8_t* f = frame_alloc();
+        if (!f)
+            return;
+        // Anything that doesn't fit in one frame is cut short, since we don't fragment
+        int n = recv(c->fd, f + UDP_DATA, ETH_MTU - IP_HLEN - UDP_HLEN, MSG_TRUNC);
+        if (n < 0)
+            return; // Nothing left, or an ICMP error that the guest doesn't need to hear about
+        if (n > ETH_MTU - IP_HLEN - UDP_HLEN)
+            n = ETH_MTU - IP_HLEN - UDP_HLEN;
+        c->last_used = h_get_us();
+        udp_queue(f, c->addr, c->port, guest_ip, c->guest_port, n);
+    }
+}
+
+static void dhcp_input(uint8_t* req, int len)
+{
+    enum {
+        DHCPDISCOVER = 1,
+        DHCPOFFER,
+        DHCPREQUEST,
+        DHCPDECLINE,
+        DHCPACK
+    };
+    if (len < 240 || req[0] != 1 || rd32(req + 236) != DHCP_MAGIC)
+        return;
+    int type = 0;
+    for (int i = 240; i + 1 < len && req[i] != 255;) {
+        if (req[i] == 0) {
+            i++;
+            continue;
+        }
+        if (req[i] == 53 && req[i + 1] && i + 2 < len)
+            type = req[i + 2];
+        i += 2 + req[i + 1];
+    }
+    if (type != DHCPDISCOVER && type != DHCPREQUEST)
+        return;
+
+    uint8_t *f = frame_alloc(), *p, *opt;
+    if (!f)
+        return;
+    p = f + UDP_DATA;
+    h_memset(p, 0, 240);
+    p[0] = 2; // Reply
+    p[1] = 1; // Ethernet
+    p[2] = 6;
+    h_memcpy(p + 4, req + 4, 4); // Transaction ID
+    h_memcpy(p + 10, req + 10, 2); // Flags
+    wr32(p + 16, NET_GUEST);
+    wr32(p + 20, NET_GATEWAY);
+    h_memcpy(p + 28, req + 28, 16); // Client hardware address
+    wr32(p + 236, DHCP_MAGIC);
+
+    opt = p + 240;
+    *opt++ = 53;
+    *opt++ = 1;
+    *opt++ = type == DHCPDISCOVER ? DHCPOFFER : DHCPACK;
+    *opt++ = 54; // Server identifier
+    *opt++ = 4;
+    wr32(opt, NET_GATEWAY), opt += 4;
+    *opt++ = 51; // Lease time
+    *opt++ = 4;
+    wr32(opt, DHCP_LEASE), opt += 4;
+    *opt++ = 1; // Subnet mask
+    *opt++ = 4;
+    wr32(opt, NET_MASK), opt += 4;
+    *opt++ = 3; // Router
+    *opt++ = 4;
+    wr32(opt, NET_GATEWAY), opt += 4;
+    if (dns_addr) {
+        *opt++ = 6; // DNS server
+        *opt++ = 4;
+        wr32(opt, NET_DNS), opt += 4;
+    }
+    *opt++ = 255;
+    udp_queue(f, NET_GATEWAY, 67, 0xFFFFFFFF, 68, (int)(opt - p));
+}
+
+static void udp_input(uint32_t dst, uint8_t* udp, int len)
+{
+    if (len < UDP_HLEN || rd16(udp + 4) < UDP_HLEN || rd16(udp + 4) > len)
+        return;
+    uint16_t sport = rd16(udp), dport = rd16(udp + 2);
+    len = rd16(udp + 4) - UDP_HLEN;
+    udp += UDP_HLEN;
+
+    if (dport == 67 && (dst == 0xFFFFFFFF || dst == NET_GATEWAY)) {
+        dhcp_input(udp, len);
+        return;
+    }
+    struct net_conn* c = conn_find(PROTO_UDP, sport, dst, dport);
+    if (!c) {
+        if (!(c = conn_open(PROTO_UDP, sport, dst, dport)))
+            return;
+        conn_watch(c, EPOLLIN);
+    }
+    c->last_used = h_get_us();
+    send(c->fd, udp, len, 0);
+}
+
+static void icmp_input(uint32_t src, uint32_t dst, uint8_t* icmp, int len)
+{
+    // Only the addresses on the virtual network answer pings. ICMP sockets on the host usually need special permission.
+    if (len < 8 || icmp[0] != 8 || (dst != NET_GATEWAY && dst != NET_DNS) || len > ETH_MTU - IP_HLEN)
+        return;
+    uint8_t* f = frame_alloc();
+    if (!f)
+        return;
+    uint8_t* reply = f + ETH_HLEN + IP_HLEN;
+    h_memcpy(reply, icmp, len);
+    reply[0] = 0; // Echo reply
+    wr16(reply + 2, 0);
+    wr16(reply + 2, net_checksum(net_sum(reply, len, 0)));
+    ip_queue(f, PROTO_ICMP, dst, src, len);
+}
+
+static void ip_input(uint8_t* ip, int len)
+{
+    if (len < IP_HLEN || (ip[0] >> 4) != 4)
+        return;
+    int hlen = (ip[0] & 15) << 2, total = rd16(ip + 2);
+    if (hlen < IP_HLEN || total < hlen || total > len)
+        return;
+    if (rd16(ip + 6) & 0x3FFF)
+        return; // Fragmented
+    uint32_t src = rd32(ip + 12), dst = rd32(ip + 16);
+    if ((src & NET_MASK) == NET_NETWORK)
+        guest_ip = src;
+
+    switch (ip[9]) {
+    case PROTO_ICMP:
+        icmp_input(src, dst, ip + hlen, total - hlen);
+        break;
+    case PROTO_TCP:
+        tcp_input(dst, ip + hlen, total - hlen);
+        break;
+    case PROTO_UDP:
+        udp_input(dst, ip + hlen, total - hlen);
+        break;
+    }
+}
+
+static void arp_input(uint8_t* arp, int len)
+{
+    if (len < 28 || rd16(arp) != 1 || rd16(arp + 2) != ETHERTYPE_IP || rd16(arp + 6) != 1)
+        return;
+    uint32_t target = rd32(arp + 24);
+    if (target != NET_GATEWAY && target != NET_DNS)
+        return;
+    uint8_t* f = frame_alloc();
+    if (!f)
+        return;
+    uint8_t* reply = f + ETH_HLEN;
+    eth_header(f, ETHERTYPE_ARP);
+    h_memcpy(reply, arp, 6); // Hardware type, protocol type, and address sizes
+    wr16(reply + 6, 2); // Reply
+    h_memcpy(reply + 8, gateway_mac, 6);
+    wr32(reply + 14, target);
+    h_memcpy(reply + 18, arp + 8, 10); // Back to whoever asked
+    frame_queue(ETH_HLEN + 28);
+}
+
+int net_init(char* netarg)
+{
+    for (char* opt = netarg; opt && *opt;) {
+        char* end = opt;
+        while (*end && *end != ',')
+            end++;
+        if (end - opt == 8 && !memcmp(opt, "loopback", 8))
+            loopback_only = 1;
+        else
+            h_fprintf(stderr, "Unknown network option: %.*s\n", (int)(end - opt), opt);
+        opt = *end ? end + 1 : end;
+    }
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        perror("epoll_create1");
+        return -1;
+    }
+
+    if (!loopback_only) {
+        void* f = h_fopen("/etc/resolv.conf", "rb");
+        if (f) {
+            char buf[4096];
+            int len = (int)h_fread(buf, 1, sizeof(buf) - 1, f);
+            h_fclose(f);
+            buf[len] = 0;
+            for (char* line = buf; line && !dns_addr; line = strchr(line, '\n'), line = line ? line + 1 : NULL) {
+                unsigned int a, b, c, d;
+                if (sscanf(line, "nameserver %u.%u.%u.%u", &a, &b, &c, &d) == 4)
+                    dns_addr = NET_ADDR(a & 255, b & 255, c & 255, d & 255);
+            }
+        }
+        if (!dns_addr)
+            NET_LOG("No IPv4 nameserver in /etc/resolv.conf, DNS will not be available\n");
+    }
+    NET_LOG("User-mode networking started%s\n", loopback_only ? " (loopback only)" : "");
+    return 0;
+}
+
+int net_send(void* req, int reqlen)
+{
+    uint8_t* frame = req;
+    if (reqlen < ETH_HLEN)
+        return -1;
+    h_memcpy(guest_mac, frame + 6, 6);
+    switch (rd16(frame + 12)) {
+    case ETHERTYPE_ARP:
+        arp_input(frame + ETH_HLEN, reqlen - ETH_HLEN);
+        break;
+    case ETHERTYPE_IP:
+        ip_input(frame + ETH_HLEN, reqlen - ETH_HLEN);
+        break;
+    }
+    return 0;
+}
+
+static int net_deliver(void (*cb)(void* data, int len), int max)
+{
+    int count = 0;
+    while (count < max && queue_count) {
+        cb(queue[queue_head].data, queue[queue_head].len);
+        queue_head = (queue_head + 1) % NET_QUEUE_SIZE;
+        queue_count--;
+        count++;
+    }
+    return count;
+}
+
+// Hand queued frames to the guest, then see what the host sockets have for it
+int net_poll(void (*cb)(void* data, int len), int max)
+{
+    struct epoll_event events[64];
+    int count = net_deliver(cb, max);
+    if (count < max && queue_count < NET_QUEUE_SIZE) {
+        int n = epoll_wait(epoll_fd, events, 64, 0);
+        for (int i = 0; i < n; i++) {
+            struct net_conn* c = &conns[events[i].data.u32];
+            if (c->state == CONN_UDP)
+                udp_event(c);
+            else if (c->state != CONN_FREE)
+                tcp_event(c);
+        }
+        count += net_deliver(cb, max - count);
+    }
+
+    uint64_t now = h_get_us();
+    if (now - last_expire > 1000000) {
+        for (int i = 0; i < NET_MAX_CONNS; i++)
+            if (conns[i].state == CONN_UDP && now - conns[i].last_used > UDP_TIMEOUT * 1000000ULL)
+                conn_close(&conns[i]);
+        last_expire = now;
+    }
+    return count;
+}
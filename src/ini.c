@@ -3,6 +3,7 @@
 
 #include "net.h"
 #include "pc.h"
+#include "tracelog.h"
 #include "util.h"
 #include <stdlib.h>
 #include <string.h>
@@ -187,6 +188,29 @@ static int get_field_enum(struct ini_section* sect, char* name, const struct ini
     h_printf("Unknown value: %s\n", name);
     return def;
 }
+// Turns a comma separated list of names from "vals" into a bitmask, with bit n standing for value n
+static uint32_t get_field_flags(struct ini_section* sect, char* name, const struct ini_enum* vals)
+{
+    char* x = get_field_string(sect, name);
+    uint32_t flags = 0;
+    while (x && *x) {
+        char *end = x, next;
+        while (*end && *end != ',')
+            end++;
+        next = *end;
+        *end = 0;
+        int i = 0;
+        while (vals[i].name && h_strcmp(vals[i].name, x))
+            i++;
+        if (vals[i].name)
+            flags |= 1 << vals[i].value;
+        else
+            h_printf("Unknown value for %s: %s\n", name, x);
+        *end = next;
+        x = next ? end + 1 : end;
+    }
+    return flags;
+}
 static int get_field_int(struct ini_section* sect, char* name, int def)
 {
     char* str = get_field_string(sect, name);
@@ -291,6 +315,20 @@ static const struct ini_enum virtio_types[] = {
     { "p9", VIRTIO_9P },
     { "9pfs", VIRTIO_9P },
     { "p9fs", VIRTIO_9P },
+    { "net", VIRTIO_NET },
+    { "network", VIRTIO_NET },
+    { "blk", VIRTIO_BLK },
+    { "block", VIRTIO_BLK },
+    { "disk", VIRTIO_BLK },
+    { NULL, 0 }
+};
+static const struct ini_enum trace_categories[] = {
+    { "io", TRACELOG_IO },
+    { "mmio", TRACELOG_MMIO },
+    { "irq", TRACELOG_IRQ },
+    { "disk", TRACELOG_DISK },
+    { "tlb", TRACELOG_TLB },
+    { "flush", TRACELOG_FLUSH },
     { NULL, 0 }
 };
 static const struct ini_enum cpu_types[] = {
@@ -301,16 +339,10 @@ static const struct ini_enum cpu_types[] = {
     { NULL, 0 }
 };
 
-static int parse_disk(struct drive_info* drv, struct ini_section* s, int id)
+// Open the image described by the "file," "driver," and "writeback" fields
+static int parse_drive_image(struct drive_info* drv, struct ini_section* s, int id, int inserted)
 {
-    if (s == NULL) {
-        drv->type = DRIVE_TYPE_NONE;
-        return 0;
-    }
-
-    // Determine the media type
-    drv->type = get_field_enum(s, "type", drive_types, DRIVE_TYPE_DISK);
-    int driver = get_field_enum(s, "driver", driver_types, -1), inserted = get_field_int(s, "inserted", 0), wb = get_field_int(s, "writeback", 0);
+    int driver = get_field_enum(s, "driver", driver_types, -1), wb = get_field_int(s, "writeback", 0);
     char* path = get_field_string(s, "file");
 
     if (driver < 0 && inserted) {
@@ -318,7 +350,7 @@ static int parse_disk(struct drive_info* drv, struct ini_section* s, int id)
         // Try auto-detecting driver type if not specified.
         driver = drive_autodetect_type(path);
         if (driver < 0)
-            FATAL("INI", "Unable to determine driver to use for ata%d-%s!\n", id >> 1, id & 1 ? "slave" : "master");
+            FATAL("INI", "Unable to determine driver to use for %s!\n", path ? path : "(no file)");
 
 #else
         // The wrapper code already knows what driver we have. It knows best.
@@ -345,6 +377,18 @@ static int parse_disk(struct drive_info* drv, struct ini_section* s, int id)
     return 0;
 }
 
+static int parse_disk(struct drive_info* drv, struct ini_section* s, int id)
+{
+    if (s == NULL) {
+        drv->type = DRIVE_TYPE_NONE;
+        return 0;
+    }
+
+    // Determine the media type
+    drv->type = get_field_enum(s, "type", drive_types, DRIVE_TYPE_DISK);
+    return parse_drive_image(drv, s, id, get_field_int(s, "inserted", 0));
+}
+
 static char* dupstr(char* src)
 {
     if (!src)
@@ -355,6 +399,35 @@ static char* dupstr(char* src)
     return res;
 }
 
+// MAC addresses must be in the form AA:AA:AA:AA:AA:AA. If there isn't one, the address is set to all zeros, which lets
+// the device pick its own.
+static void parse_mac(uint8_t* dest, char* mac)
+{
+    h_memset(dest, 0, 6);
+    if (!mac)
+        return;
+    for (int k = 0, i = 0; k < 6; k++) {
+        if (k != 0 && mac[i++] != ':')
+            FATAL("INI", "Malformed MAC address\n");
+        int mac_part = 0;
+        for (int j = 0; j < 2; j++, i++) {
+            int n;
+            if (mac[i] >= '0' && mac[i] <= '9')
+                n = mac[i] - '0';
+            else if (mac[i] >= 'A' && mac[i] <= 'F')
+                n = mac[i] - 'A' + 10;
+            else if (mac[i] >= 'a' && mac[i] <= 'f')
+                n = mac[i] - 'a' + 10;
+            else {
+                FATAL("INI", "Malformed MAC address\n");
+                n = 0;
+            }
+            mac_part = (mac_part << 4) | n;
+        }
+        dest[k] = mac_part;
+    }
+}
+
 #ifdef EMSCRIPTEN
 EMSCRIPTEN_KEEPALIVE
 #endif
@@ -377,6 +450,7 @@ int parse_cfg(struct pc_settings* pc, char* data)
     // Determine memory size
     pc->memory_size = get_field_int(global, "memory", 32 * 1024 * 1024);
     pc->vga_memory_size = get_field_int(global, "vgamemory", 4 * 1024 * 1024);
+    pc->refresh_rate = get_field_int(global, "refresh", 60);
 
     // Set emulator time
     pc->current_time = get_field_long(global, "now", 0);
@@ -415,36 +489,7 @@ int parse_cfg(struct pc_settings* pc, char* data)
         pc->ne2000.pci = get_field_int(net, "pci", pc->pci_enabled);
         pc->ne2000.port_base = get_field_int(net, "iobase", 0x300);
         pc->ne2000.irq = get_field_int(net, "irq", 3);
-        char* mac = get_field_string(net, "mac");
-        if (!mac) {
-            for (int i = 0; i < 6; i++)
-                pc->ne2000.mac_address[i] = 0; // Setting address to all zeros will let the controller decide.
-        } else {
-            // XXX - messy loop
-            for (int k = 0, i = 0; k < 6; k++) {
-                // MAC addresses must be in the form AA:AA:AA:AA:AA:AA
-                int mac_part = 0;
-                if (k != 0)
-                    if (mac[i++] != ':')
-                        h_fprintf(stderr, "Malformed MAC address\n");
-
-                for (int j = 0; j < 2; j++) {
-                    int n;
-                    if (mac[j + i] >= '0' && mac[j + i] <= '9')
-                        n = mac[j + i] - '0';
-                    else if (mac[j + i] >= 'A' && mac[j + i] <= 'F')
-                        n = mac[j + i] - 'A';
-                    else if (mac[j + i] >= 'a' && mac[j + i] <= 'f')
-                        n = mac[j + i] - 'a';
-                    else {
-                        FATAL("INI", "Malformed MAC address\n");
-                        n = 0;
-                    }
-                    mac_part = (mac_part << 4) | n;
-                }
-                i += 2;
-            }
-        }
+        parse_mac(pc->ne2000.mac_address, get_field_string(net, "mac"));
 #ifndef EMSCRIPTEN
         if (pc->ne2000.enabled) {
             // Emscripten network configuration is done in libhalfix.js -- there's nothing to do here.
@@ -466,6 +511,7 @@ int parse_cfg(struct pc_settings* pc, char* data)
     }
 
     char sid[50];
+    int virtio_used = 0; // One bit for each type that's been set up already
     for (int i = 0; i < MAX_VIRTIO_DEVICES; i++) {
         h_sprintf(sid, "virtio%d", i);
         struct ini_section* virtio = get_section(global, sid);
@@ -479,12 +525,60 @@ int parse_cfg(struct pc_settings* pc, char* data)
             h_fprintf(stderr, "Unknown virtio%d type - ignoring\n", i);
             continue;
         }
+        // Each device type keeps its state in one place, so there can only be one of each
+        if (virtio_used & (1 << x)) {
+            h_fprintf(stderr, "virtio%d: only one device of each type is supported - ignoring\n", i);
+            continue;
+        }
+        virtio_used |= 1 << x;
         cfg->type = x;
         switch (x) {
         case VIRTIO_9P:
             cfg->fs9p.path = dupstr(get_field_string(virtio, "path"));
+            cfg->fs9p.tag = dupstr(get_field_string(virtio, "tag"));
             cfg->fs9p.ro = get_field_int(virtio, "readonly", 1);
             break;
+        case VIRTIO_NET:
+            // Both network cards would be fighting over the same host backend
+            if (pc->ne2000.enabled) {
+                h_fprintf(stderr, "virtio%d: only one network card can be used, and the NE2000 is enabled - ignoring\n", i);
+                cfg->type = -1;
+                break;
+            }
+            parse_mac(cfg->net.mac_address, get_field_string(virtio, "mac"));
+#ifndef EMSCRIPTEN
+            net_init(get_field_string(virtio, "arg"));
+#endif
+            break;
+        case VIRTIO_BLK:
+            // Floppy drives use IDs 4 and 5
+            cfg->blk.drive.type = DRIVE_TYPE_DISK;
+            if (parse_drive_image(&cfg->blk.drive, virtio, 6 + i, get_field_int(virtio, "inserted", 1))) {
+                h_fprintf(stderr, "virtio%d: unable to open disk image - ignoring\n", i);
+                cfg->type = -1;
+            }
+            break;
+        }
+    }
+
+    for (int i = 0; i < MAX_AHCI_PORTS; i++) {
+        h_sprintf(sid, "sata%d", i);
+        struct ini_section* sata = get_section(global, sid);
+        struct drive_info* drv = &pc->ahci_drives[i];
+        drv->type = DRIVE_TYPE_NONE;
+        if (!sata)
+            continue;
+
+        // There's no ATAPI support, so only hard drives can be attached
+        if (get_field_enum(sata, "type", drive_types, DRIVE_TYPE_DISK) != DRIVE_TYPE_DISK) {
+            h_fprintf(stderr, "sata%d: only hard drives are supported - ignoring\n", i);
+            continue;
+        }
+        // Virtio disks use IDs 6 and 7
+        drv->type = DRIVE_TYPE_DISK;
+        if (parse_drive_image(drv, sata, 8 + i, get_field_int(sata, "inserted", 1))) {
+            h_fprintf(stderr, "sata%d: unable to open disk image - ignoring\n", i);
+            drv->type = DRIVE_TYPE_NONE;
         }
     }
 
@@ -504,9 +598,20 @@ int parse_cfg(struct pc_settings* pc, char* data)
     struct ini_section* cpu = get_section(global, "cpu");
     if (cpu == NULL) {
         pc->cpu.cpuid_limit_winnt = 0;
+        pc->cpu_mips = 0;
     } else {
         pc->cpu.cpuid_limit_winnt = get_field_int(cpu, "cpuid_limit_winnt", 0);
         pc->cpu.type = get_field_enum(cpu, "type", cpu_types, CPU_TYPE_ATOM_N270);
+        pc->cpu_mips = get_field_int(cpu, "mips", 0);
+    }
+
+    // Event tracing
+    struct ini_section* trace = get_section(global, "trace");
+    if (trace) {
+        pc->trace.categories = get_field_flags(trace, "events", trace_categories);
+        pc->trace.entries = get_field_int(trace, "entries", 1 << 20);
+        char* file = get_field_string(trace, "file");
+        pc->trace.file = dupstr(file ? file : "halfix.trace");
     }
 
     UNUSED(get_section);
@@ -1,5 +1,6 @@
 #include "mmio.h"
 #include "cpuapi.h"
+#include "tracelog.h"
 #include "util.h"
 #include <stdint.h>
 #include <stdio.h>
@@ -121,6 +122,7 @@ uint8_t io_readb(uint32_t port)
     ioport_in = port;
 #endif
     uint8_t data = read[port & 0xFFFF][0](port);
+    TRACELOG(TRACE_IO_READ, 1, port, data, 0);
     //cpu_io_read(port, data, 1);
 #ifndef LOG_ALL_IO
     if(port != 0x1F7 && port != 0x92 && port != 0x3c9 && (port & ~1) != 0x70 && port != 0x1F0)
@@ -134,6 +136,7 @@ uint16_t io_readw(uint32_t port)
     ioport_in = port;
 #endif
     uint16_t data = read[port & 0xFFFF][1](port);
+    TRACELOG(TRACE_IO_READ, 2, port, data, 0);
     //cpu_io_read(port, data, 2);
 #ifndef LOG_ALL_IO
     if(port != 0x1F0)
@@ -147,6 +150,7 @@ uint32_t io_readd(uint32_t port)
     ioport_in = port;
 #endif
     uint32_t data = read[port & 0xFFFF][2](port);
+    TRACELOG(TRACE_IO_READ, 4, port, data, 0);
     //cpu_io_read(port, data, 4);
 #ifndef LOG_ALL_IO
     if(port != 0x1F0)
@@ -161,6 +165,7 @@ void io_writeb(uint32_t port, uint8_t data)
 #endif
         IO_LOG("writeb: port=0x%04x data=0x%02x\n", port, data);
     //cpu_io_write(port, 1);
+    TRACELOG(TRACE_IO_WRITE, 1, port, data, 0);
     write[port & 0xFFFF][0](port, data);
 }
 void io_writew(uint32_t port, uint16_t data)
@@ -168,6 +173,7 @@ void io_writew(uint32_t port, uint16_t data)
     if(port != 0x1F0)
     IO_LOG("writew: port=0x%04x data=0x%04x\n", port, data);
     //cpu_io_write(port, 2);
+    TRACELOG(TRACE_IO_WRITE, 2, port, data, 0);
     write[port & 0xFFFF][1](port, data);
 }
 void io_writed(uint32_t port, uint32_t data)
@@ -177,6 +183,7 @@ void io_writed(uint32_t port, uint32_t data)
     if(port != 0x1F0)
     IO_LOG("writed: port=0x%04x data=0x%08x\n", port, data);
 #endif
+    TRACELOG(TRACE_IO_WRITE, 4, port, data, 0);
     write[port & 0xFFFF][2](port, data);
 }
 
@@ -187,21 +194,6 @@ static void io_default_mmio_writeb(uint32_t addr, uint32_t data)
     //abort();
     return;
 }
-// XXX: Increase performance
-static void io_default_mmio_writew(uint32_t addr, uint32_t data)
-{
-    //IO_LOG("Default writew to 0x%x: %04x\n", addr, data);
-    io_handle_mmio_write(addr, data & 0xFF, 0);
-    io_handle_mmio_write(addr + 1, data >> 8 & 0xFF, 0);
-}
-static void io_default_mmio_writed(uint32_t addr, uint32_t data)
-{
-    //IO_LOG("Default writed to 0x%x: %08x\n", addr, data);
-    io_handle_mmio_write(addr, data & 0xFF, 0);
-    io_handle_mmio_write(addr + 1, data >> 8 & 0xFF, 0);
-    io_handle_mmio_write(addr + 2, data >> 16 & 0xFF, 0);
-    io_handle_mmio_write(addr + 3, data >> 24 & 0xFF, 0);
-}
 static uint32_t io_default_mmio_readb(uint32_t addr)
 {
     //IO_LOG("Unhandled MMIO readb: %08x\n", addr);
@@ -209,117 +201,196 @@ static uint32_t io_default_mmio_readb(uint32_t addr)
     UNUSED(addr);
     return -1;
 }
-// XXX: Increase performance
-static uint32_t io_default_mmio_readw(uint32_t addr)
+
+// MMIO areas are found through a two-level table with an entry for every 4 KiB page, so an access costs the same no
+// matter how many areas there are or where they are. Area 0 stands for everything that no device has claimed. Reads and
+// writes have separate tables since devices can register one without the other.
+#define MAX_MMIO 32
+#define MMIO_LEAF_PAGES 1024 // 4 MiB per leaf
+struct mmio_area {
+    io_read r[3];
+    io_write w[3]; // Word and dword handlers are optional
+    io_write_block wb; // Optional
+    uint32_t begin, length;
+    uint32_t first_page, last_page; // first_page > last_page if the area doesn't map anything
+};
+struct mmio_map {
+    struct mmio_area areas[MAX_MMIO];
+    int count;
+    uint8_t* leaves[(1 << 20) / MMIO_LEAF_PAGES];
+};
+static struct mmio_map mmio_read_map, mmio_write_map;
+// Shared by every 4 MiB block that has no areas in it
+static uint8_t mmio_empty_leaf[MMIO_LEAF_PAGES];
+
+static inline struct mmio_area* mmio_lookup(struct mmio_map* map, uint32_t addr)
 {
-    uint16_t result = io_handle_mmio_read(addr, 0);
-    return result | io_handle_mmio_read(addr + 1, 0) << 8;
+    return &map->areas[map->leaves[addr >> 22][addr >> 12 & (MMIO_LEAF_PAGES - 1)]];
 }
-static uint32_t io_default_mmio_readd(uint32_t addr)
+
+static void mmio_set_range(struct mmio_area* area, uint32_t start, uint32_t length)
 {
-    uint32_t result = io_handle_mmio_read(addr, 0);
-    result |= io_handle_mmio_read(addr + 1, 0) << 8;
-    result |= io_handle_mmio_read(addr + 2, 0) << 16;
-    return result | io_handle_mmio_read(addr + 3, 0) << 24;
+    area->begin = start;
+    area->length = length;
+    // An area that would wrap around the top of the address space, like a PCI ROM whose BAR is being sized, isn't mapped
+    if (!length || start + length - 1 < start) {
+        area->first_page = 1;
+        area->last_page = 0;
+    } else {
+        area->first_page = start >> 12;
+        area->last_page = (start + length - 1) >> 12;
+    }
 }
 
-// Memory mapped locations are so few and far in between that it's ok to do it the simple way:
-#define MAX_MMIO 10
-struct mmio {
-    io_read r[3];
-    io_write w[3];
-    uint32_t begin, end;
-};
+// Points every page in the range at the area registered first out of the ones covering it
+static void mmio_update_pages(struct mmio_map* map, uint32_t first, uint32_t last)
+{
+    for (uint32_t page = first; page <= last; page++) {
+        int id = 0;
+        for (int i = 1; i < map->count; i++) {
+            if (page >= map->areas[i].first_page && page <= map->areas[i].last_page) {
+                id = i;
+                break;
+            }
+        }
+        uint8_t** leaf = &map->leaves[page / MMIO_LEAF_PAGES];
+        if (*leaf == mmio_empty_leaf) {
+            if (!id)
+                continue;
+            *leaf = h_calloc(1, MMIO_LEAF_PAGES);
+        }
+        (*leaf)[page % MMIO_LEAF_PAGES] = id;
+    }
+}
 
-static struct mmio mmio[MAX_MMIO + 1];
-static int mmio_pos[2] = { 0, 0 },
-           tf = 0; // Ugly hack, but necessary
-void io_register_mmio_read(uint32_t start, uint32_t length, io_read b, io_read w, io_read d)
+static struct mmio_area* mmio_add(struct mmio_map* map, uint32_t start, uint32_t length)
 {
-    if (tf && mmio_pos[0] == MAX_MMIO) {
-        IO_LOG("Too many read areas\n");
-        // abort();
+    if (map->count == MAX_MMIO) {
+        IO_LOG("Too many MMIO areas\n");
+        return NULL;
     }
-    mmio[mmio_pos[0]].begin = start;
-    mmio[mmio_pos[0]].end = start + length;
-    mmio[mmio_pos[0]].r[0] = b ? b : io_default_mmio_readb;
-    mmio[mmio_pos[0]].r[1] = w ? w : io_default_mmio_readw;
-    mmio[mmio_pos[0]].r[2] = d ? d : io_default_mmio_readd;
+    struct mmio_area* area = &map->areas[map->count++];
+    mmio_set_range(area, start, length);
+    return area;
+}
 
-    mmio_pos[0]++;
+void io_register_mmio_read(uint32_t start, uint32_t length, io_read b, io_read w, io_read d)
+{
+    struct mmio_area* area = mmio_add(&mmio_read_map, start, length);
+    if (!area)
+        return;
+    area->r[0] = b ? b : io_default_mmio_readb;
+    area->r[1] = w;
+    area->r[2] = d;
+    mmio_update_pages(&mmio_read_map, area->first_page, area->last_page);
 }
 void io_register_mmio_write(uint32_t start, uint32_t length, io_write b, io_write w, io_write d)
 {
-    if (tf && mmio_pos[1] == MAX_MMIO) {
-        IO_LOG("Too many write areas\n");
-        // abort();
-    }
-
-    mmio[mmio_pos[1]].begin = start;
-    mmio[mmio_pos[1]].end = start + length;
-    mmio[mmio_pos[1]].w[0] = b ? b : io_default_mmio_writeb;
-    mmio[mmio_pos[1]].w[1] = w ? w : io_default_mmio_writew;
-    mmio[mmio_pos[1]].w[2] = d ? d : io_default_mmio_writed;
-
-    mmio_pos[1]++;
+    struct mmio_area* area = mmio_add(&mmio_write_map, start, length);
+    if (!area)
+        return;
+    area->w[0] = b ? b : io_default_mmio_writeb;
+    area->w[1] = w;
+    area->w[2] = d;
+    area->wb = NULL;
+    mmio_update_pages(&mmio_write_map, area->first_page, area->last_page);
 }
-void io_remap_mmio_read(uint32_t oldstart, uint32_t newstart){
-    for(int i=0;i<MAX_MMIO;i++){
-        if(mmio[i].begin == oldstart){
-            mmio[i].begin = newstart;
-            mmio[i].end = (mmio[i].end - oldstart) + newstart;
+// Lets REP MOVS/STOS hand the write area at "start" a whole span of bytes at once instead of one element at a time
+void io_register_mmio_write_block(uint32_t start, io_write_block cb)
+{
+    for (int i = 1; i < mmio_write_map.count; i++) {
+        if (mmio_write_map.areas[i].begin == start) {
+            mmio_write_map.areas[i].wb = cb;
             return;
         }
     }
-    IO_LOG("Unable to remap MMIO range at %08x to %08x\n", oldstart, newstart);
+    IO_LOG("Unable to find MMIO write area at %08x\n", start);
+}
+
+static int mmio_remap(struct mmio_map* map, uint32_t oldstart, uint32_t newstart)
+{
+    for (int i = 1; i < map->count; i++) {
+        struct mmio_area* area = &map->areas[i];
+        if (area->begin != oldstart)
+            continue;
+        uint32_t first = area->first_page, last = area->last_page;
+        mmio_set_range(area, newstart, area->length);
+        // Whatever was hidden under the old location shows through again
+        mmio_update_pages(map, first, last);
+        mmio_update_pages(map, area->first_page, area->last_page);
+        return 1;
+    }
+    return 0;
+}
+// Moves both the read and the write area at "oldstart". Only the pages the area covers are touched.
+void io_remap_mmio_read(uint32_t oldstart, uint32_t newstart)
+{
+    int found = mmio_remap(&mmio_read_map, oldstart, newstart);
+    found |= mmio_remap(&mmio_write_map, oldstart, newstart);
+    if (!found)
+        IO_LOG("Unable to remap MMIO range at %08x to %08x\n", oldstart, newstart);
 }
 
 void io_handle_mmio_write(uint32_t addr, uint32_t data, int size)
 {
     //if(addr == 0x004abc95) __asm__("int3");
-    for (int i = 0; i <= MAX_MMIO; i++) {
-        if (addr >= mmio[i].begin && mmio[i].end >= addr) {
-            //h_printf("'%c' %08x %08x %08x %d %d size: %d\n", data, mmio[i].begin, addr, mmio[i].end, addr >= mmio[i].begin, addr < mmio[i].end, size);
-            mmio[i].w[size](addr, data);
-            return;
-        }
+    TRACELOG(TRACE_MMIO_WRITE, 1 << size, addr, data, 0);
+    struct mmio_area* area = mmio_lookup(&mmio_write_map, addr);
+    if (area->w[size]) {
+        area->w[size](addr, data);
+        return;
     }
-    // abort();
+    // Split it up into bytes. Each one is looked up again in case the access runs into the next page.
+    for (int i = 0; i < 1 << size; i++, addr++, data >>= 8)
+        mmio_lookup(&mmio_write_map, addr)->w[0](addr, data & 0xFF);
+}
+// Returns 1 if the device took the span, or 0 if it has to be written with io_handle_mmio_write instead
+int io_handle_mmio_write_block(uint32_t addr, const uint8_t* data, uint32_t length)
+{
+    struct mmio_area* area = mmio_lookup(&mmio_write_map, addr);
+    uint32_t last = addr + length - 1;
+    if (!area->wb || last < addr || addr - area->begin >= area->length || last - area->begin >= area->length)
+        return 0;
+    TRACELOG(TRACE_MMIO_WRITE_BLOCK, 0, addr, length, 0);
+    area->wb(addr, data, length);
+    return 1;
 }
 uint32_t io_handle_mmio_read(uint32_t addr, int size)
 {
-    for (int i = 0; i <= MAX_MMIO; i++) {
-        if (addr >= mmio[i].begin && mmio[i].end >= addr) {
-            uint32_t res = mmio[i].r[size](addr); 
-            //h_printf("%08x\n", res);
-            return res;
-        }
+    struct mmio_area* area = mmio_lookup(&mmio_read_map, addr);
+    uint32_t result = 0;
+    if (area->r[size])
+        result = area->r[size](addr);
+    else {
+        for (int i = 0; i < 1 << size; i++)
+            result |= (mmio_lookup(&mmio_read_map, addr + i)->r[0](addr + i) & 0xFF) << (i * 8);
     }
-    IO_LOG(" ??? should not be here ??? Unknown mmio read: %08x\n", addr);
-    return 0;
-    // abort();
+    TRACELOG(TRACE_MMIO_READ, 1 << size, addr, result, 0);
+    return result;
 }
 
 // Checks if address is mmapped for reading
 int io_addr_mmio_read(uint32_t addr){
-    for (int i = 0; i <= MAX_MMIO; i++) {
-        if (addr >= mmio[i].begin && mmio[i].end >= addr) {
-            return mmio[i].begin != 0;
-        }
+    return mmio_lookup(&mmio_read_map, addr) != mmio_read_map.areas;
+}
+
+static void mmio_init(struct mmio_map* map)
+{
+    for (int i = 0; i < (1 << 20) / MMIO_LEAF_PAGES; i++) {
+        if (map->leaves[i] && map->leaves[i] != mmio_empty_leaf)
+            h_free(map->leaves[i]);
+        map->leaves[i] = mmio_empty_leaf;
     }
-    return 0;
+    h_memset(map->areas, 0, sizeof(map->areas));
+    map->areas[0].r[0] = io_default_mmio_readb;
+    map->areas[0].w[0] = io_default_mmio_writeb;
+    map->count = 1;
 }
 
 void io_init(void)
 {
     io_register_read(0, 65536, NULL, NULL, NULL);
     io_register_write(0, 65536, NULL, NULL, NULL);
-    tf = 0;
-    for (int i = 0; i < (MAX_MMIO + 1); i++) {
-        io_register_mmio_read(0, -1, NULL, NULL, NULL); // Cover an address space from 0 ... 0xFFFFFFFF
-        io_register_mmio_write(0, -1, NULL, NULL, NULL);
-    }
-    mmio_pos[0] = 0;
-    mmio_pos[1] = 0;
-    tf = 1;
+    mmio_init(&mmio_read_map);
+    mmio_init(&mmio_write_map);
 }
\ No newline at end of file
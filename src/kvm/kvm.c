@@ -373,6 +373,31 @@ void cpu_write_mem(uint32_t addr, void* data, uint32_t length)
     h_memcpy(data + addr, data, length);
 }
 
+// Not supported yet. Returning -1 leaves these ranges to the MMIO handlers.
+int cpu_add_ram_region(uint32_t base, uint32_t size, void* ptr, cpu_region_dirty dirty)
+{
+    UNUSED(base | size);
+    UNUSED(ptr);
+    UNUSED(dirty);
+    return -1;
+}
+void cpu_set_ram_region(int id, void* ptr)
+{
+    UNUSED(id);
+    UNUSED(ptr);
+}
+void cpu_protect_ram_region(int id)
+{
+    UNUSED(id);
+}
+
+// Guest code runs natively, so there's nothing to sample
+void cpu_profile_init(const char* path)
+{
+    UNUSED(path);
+    h_fprintf(stderr, "profiling is not supported with KVM - ignoring\n");
+}
+
 void cpu_request_fast_return(int e)
 {
     fast_return_requested = 1;
@@ -4,6 +4,7 @@
 #include "drive.h"
 #include "pc.h"
 #include "platform.h"
+#include "state.h"
 #include "util.h"
 #ifdef MOBILE_BUILD
 #include "ui-mobile.h"
@@ -32,19 +33,68 @@ struct option {
 
 #define HASARG 1
 
+// How often the display thread checks for new frames
+#define RENDER_POLL_US 4000
+
+// How many frames --vga-benchmark draws
+#define VGA_BENCHMARK_FRAMES 500
+
 enum {
     OPTION_HELP,
     OPTION_CONFIG,
-    OPTION_REALTIME
+    OPTION_REALTIME,
+    OPTION_PROFILE,
+    OPTION_RENDER_THREAD,
+    OPTION_VGA_BENCHMARK
 };
 
 static const struct option options[] = {
     { "h", "help", 0, OPTION_HELP, "Show available options" },
     { "c", "config", HASARG, OPTION_CONFIG, "Use custom config file [arg]" },
-    { "r", "realtime", 0, OPTION_REALTIME, "Try to sync internal emulator clock with wall clock" },
+    { "r", "realtime", 0, OPTION_REALTIME, "Keep emulated time in step with the wall clock" },
+    { "p", "profile", HASARG, OPTION_PROFILE, "Write a profile of guest code to [arg] on exit" },
+    { "t", "render-thread", 0, OPTION_RENDER_THREAD, "Emulate on a separate thread from the display" },
+    { "b", "vga-benchmark", HASARG, OPTION_VGA_BENCHMARK, "Load the savestate in [arg], time how fast its screen is drawn, and exit" },
     { NULL, NULL, 0, 0, NULL }
 };
 
+static void pace_report(void)
+{
+    struct pace_stats s;
+    pace_get_stats(&s);
+    h_printf("Clock drift: %lld us now, %lld us max ahead, %lld us max behind. Slept %llu ms, dropped %llu ms of lag\n",
+        (long long)s.drift_us, (long long)s.max_ahead_us, (long long)s.max_behind_us,
+        (unsigned long long)(s.slept_us / 1000), (unsigned long long)(s.dropped_us / 1000));
+}
+
+// How long to sleep after a call to pc_execute that started at "before" and returned "wait"
+static int slice_sleep(itick_t before, int wait, int realtime)
+{
+    // Emulated time only stands still when the CPU is halted with interrupts off. Nothing but a reset can wake it up,
+    // so there's no point in spinning.
+    if (get_now() == before)
+        return wait;
+    // Sleep off however far the guest has run ahead of the wall clock, including any time it skipped over while idle.
+    // Without -r, it just runs as fast as it can.
+    return realtime ? pace_sync() : 0;
+}
+
+// Runs the PC when the display has the main thread to itself
+static int emulator_thread(void* arg)
+{
+    int realtime = *(int*)arg;
+    while (1) {
+        itick_t before = get_now();
+        int wait = pc_execute();
+        // Hand the frame over to the display thread
+        vga_update();
+        int us_to_sleep = slice_sleep(before, wait, realtime);
+        if (us_to_sleep)
+            display_sleep((us_to_sleep + 999) / 1000);
+    }
+    return 0;
+}
+
 static void generic_help(const struct option* options)
 {
     int i = 0;
@@ -71,8 +121,8 @@ static void generic_help(const struct option* options)
 
 int main(int argc, char* argv[])
 {
-    char* configfile = "default.conf";
-    int filesz, realtime = 0;
+    char *configfile = "default.conf", *profile = NULL, *vga_benchmark_state = NULL;
+    int filesz, realtime = 0, render_thread = 0;
     void* f;
     char* buf;
 
@@ -105,7 +155,16 @@ int main(int argc, char* argv[])
                     configfile = data;
                     continue;
                 case OPTION_REALTIME:
-                    realtime = -1;
+                    realtime = 1;
+                    continue;
+                case OPTION_PROFILE:
+                    profile = data;
+                    continue;
+                case OPTION_RENDER_THREAD:
+                    render_thread = 1;
+                    continue;
+                case OPTION_VGA_BENCHMARK:
+                    vga_benchmark_state = data;
                     continue;
                 }
                 break;
@@ -157,6 +216,32 @@ parse_config:
         h_fprintf(stderr, "Unable to initialize PC\n");
         return -1;
     }
+    if (vga_benchmark_state) {
+        // The savestate has to come from the same configuration
+        state_read_from_file(vga_benchmark_state);
+        vga_benchmark(VGA_BENCHMARK_FRAMES);
+        return 0;
+    }
+    if (profile)
+        cpu_profile_init(profile);
+    if (realtime) {
+        pace_init();
+        atexit(pace_report);
+    }
+    if (render_thread) {
+        // The display keeps the main thread, since that's where most windowing systems want their events handled
+        vga_use_render_thread();
+        kbd_defer_input();
+        if (h_thread_create(emulator_thread, &realtime) == -1) {
+            h_fprintf(stderr, "Unable to create emulator thread\n");
+            return -1;
+        }
+        while (1) {
+            vga_render_snapshot();
+            display_handle_events();
+            display_wait(RENDER_POLL_US);
+        }
+    }
 #if 0
     // Good for debugging
     while(1){
@@ -165,14 +250,14 @@ parse_config:
 #else
     // Good for real-world stuff
     while (1) {
-        int ms_to_sleep = pc_execute();
+        itick_t before = get_now();
+        int wait = pc_execute();
         // Update our screen/devices here
         vga_update();
         display_handle_events();
-        ms_to_sleep &= realtime;
-        if (ms_to_sleep)
-            display_sleep(ms_to_sleep * 5);
-        //display_sleep(5);
+        int us_to_sleep = slice_sleep(before, wait, realtime);
+        if (us_to_sleep)
+            display_wait(us_to_sleep);
     }
 #endif
 }
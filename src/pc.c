@@ -4,6 +4,7 @@
 #include "display.h"
 #include "mmio.h"
 #include "state.h"
+#include "tracelog.h"
 #include "util.h"
 
 // Comment below line to disable automatic loading of savestate
@@ -218,9 +219,17 @@ void util_state(void);
 
 int pc_init(struct pc_settings* pc)
 {
+    // Devices read ticks_per_second during initialization, so this has to be set first
+    if (pc->cpu_mips > 4000) {
+        h_fprintf(stderr, "CPU speed of %d MIPS is too high\n", pc->cpu_mips);
+        return -1;
+    }
+    if (pc->cpu_mips > 0)
+        set_ticks_per_second(pc->cpu_mips * 1000000);
     if (cpu_init() == -1)
         return -1;
     cpu_set_cpuid(&pc->cpu);
+    tracelog_init(pc->trace.categories, pc->trace.entries, pc->trace.file);
     io_init();
     dma_init();
     cmos_init(pc->current_time);
@@ -237,6 +246,9 @@ int pc_init(struct pc_settings* pc)
     apic_init(pc);
     ioapic_init(pc);
     acpi_init(pc);
+    ne2000_init(&pc->ne2000);
+    virtio_init(pc);
+    ahci_init(pc);
 
     //cpu_set_a20(0); // causes code to be prefetched from 0xFFEFxxxx at boot
     cpu_set_a20(1);
@@ -354,36 +366,22 @@ int pc_init(struct pc_settings* pc)
 
     return 0;
 }
-static uint32_t devices_get_next_raw(itick_t now)
-{
-    uint32_t next[4], min = -1;
-    next[0] = cmos_next(now);
-    next[1] = pit_next(now);
-    next[2] = apic_next(now);
-    next[3] = acpi_next(now);
-    for (int i = 0; i < 4; i++) {
-        if (next[i] < min)
-            min = next[i];
-    }
-    return min;
-}
+// The longest that pc_execute will keep the CPU running before returning, so that the display and input devices are
+// serviced even if the guest has no timers armed.
+#define MAX_SLICE (ticks_per_second / 25)
 
-static uint32_t devices_get_next(itick_t now, int* devices_need_servicing)
+// Run any device events that are due, and return the number of ticks until the next one (but no later than "limit")
+static uint32_t devices_get_next(itick_t now, itick_t limit)
 {
-    int min = devices_get_next_raw(now);
-    if (cpu_get_exit_reason() == EXIT_STATUS_HLT)
-        return min;
-    if ((unsigned int)min > 200000) {
-        if(devices_need_servicing)
-            *devices_need_servicing = min - 200000;
-        return 200000;
-    } else {
-        if(devices_need_servicing)
-            *devices_need_servicing = 0;
-        return min;
-    }
+    itick_t next = timer_run(now);
+    if (next > limit)
+        next = limit;
+    return (uint32_t)(next - now);
 }
 
+// How long, in microseconds, the host should wait before calling pc_execute again if the CPU has halted with IF=0
+#define PC_HLT_IF_0_WAIT 10000
+
 void pc_hlt_if_0(void)
 {
     // Called when HLT with IF=0 was called
@@ -403,11 +401,13 @@ void pc_set_fast(int yes){
     fast = yes;
 }
 #endif
+// Run the emulator for a while. Returns the number of microseconds that the guest is idle for. Emulated time has
+// already been moved forward by this amount, so callers that want to keep up with the wall clock should sleep for it.
 int pc_execute(void)
 {
     // This function is called repeatedly.
-    int frames = 10, cycles_to_run, cycles_run, exit_reason, devices_need_servicing = 0;
-    itick_t now;
+    int cycles_to_run, cycles_run, exit_reason;
+    itick_t now, limit;
 
 #ifdef EMSCRIPTEN
     uint64_t cur_now;
@@ -417,6 +417,8 @@ int pc_execute(void)
 
     // Call the callback if needed, for async drive cases
     drive_check_complete();
+    // Pick up any input that a display thread has sent
+    kbd_process_input();
 
     sync++;
     if (!drive_async_event_in_progress() && (cpu_get_cycles() - last) > INSNS_PER_FRAME) {
@@ -430,44 +432,53 @@ int pc_execute(void)
         sync = 0;
         last = cpu_get_cycles();
     }
+    limit = get_now() + MAX_SLICE;
     do {
         now = get_now();
-        cycles_to_run = devices_get_next(now, &devices_need_servicing);
+        cycles_to_run = devices_get_next(now, limit);
 // Run a number of cycles.
 
 #if 0
         uint64_t before = get_now();
 #endif
+        timer_set_run_limit(now + cycles_to_run);
         cycles_run = cpu_run(cycles_to_run);
-//LOG("PC", "Exited from loop (cycles to run: %d, extra: %d)\n", cycles_to_run, devices_need_servicing);
+        timer_set_run_limit(0);
+//LOG("PC", "Exited from loop (cycles to run: %d)\n", cycles_to_run);
 #if 0
         if ((before + cycles_run) != get_now()) {
-            h_printf("Before: %ld Ideal: %ld Current: %ld [diff: %ld] total insn should be run: %d dev need serv %d\n", before, cycles_run + before, get_now(), cycles_run + before - get_now(), cycles_run, devices_need_servicing);
+            h_printf("Before: %ld Ideal: %ld Current: %ld [diff: %ld] total insn should be run: %d\n", before, cycles_run + before, get_now(), cycles_run + before - get_now(), cycles_run);
             //abort();
         }
 #endif
         if ((exit_reason = cpu_get_exit_reason())) {
             // We exited the loop because of a HLT instruction or an async function needs to be called.
-            // Now skip forward a number of cycles, and determine how many ms we should sleep for
-            int cycles_to_move_forward, wait_time, moveforward;
+            // Now skip forward a number of cycles, and determine how many microseconds we should sleep for
+            int cycles_to_move_forward, wait_time;
             cycles_to_move_forward = cycles_to_run - cycles_run;
 
             if (exit_reason == EXIT_STATUS_HLT) {
-                // The below line should prevent the browser version from locking up
-                if(!cpu_interrupts_masked()) return 0;
-                moveforward = devices_get_next(get_now(), NULL);
-                cycles_to_move_forward += moveforward;
+                // Only a reset can wake us up now, so don't come back too often.
+                if (!cpu_interrupts_masked())
+                    return PC_HLT_IF_0_WAIT;
+
+                // Nothing can happen until the next timer event (or host input), so skip straight to it.
+                itick_t next = timer_get_next();
+                now = get_now();
+                if (next > now + ticks_per_second)
+                    next = now + ticks_per_second;
+                cycles_to_move_forward = next > now ? (int)(next - now) : 0;
             }
             add_now(cycles_to_move_forward);
-            wait_time = (cycles_to_move_forward * 1000) / ticks_per_second;
+            wait_time = (int)((itick_t)cycles_to_move_forward * 1000000 / ticks_per_second);
 #ifdef EMSCRIPTEN
             if (!fast) {
                 if (wait_time != 0)
                     return wait_time;
             }
 #else
-            if(wait_time != 0) return 0; // try to match with emscripten
-            UNUSED(wait_time);
+            if (wait_time != 0)
+                return wait_time;
 #endif
             // Just continue since wait time is negligable
         }
@@ -476,9 +487,9 @@ int pc_execute(void)
             if ((cpu_get_cycles() - cur_now) > 2000000)
                 return 0;
             else
-                frames = -1;
+                limit = get_now() + MAX_SLICE;
         }
 #endif
-    } while (frames--);
+    } while (get_now() < limit);
     return 0;
 }
\ No newline at end of file
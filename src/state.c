@@ -453,8 +453,7 @@ void state_read_from_file(char* fn)
     void* fh = h_fopen(path, "rb");
     if (!fh)
         STATE_FATAL("Cannot open file %s\n", fn);
-    int size = h_fseek(fh, 0, SEEK_END);
-    h_fseek(fh, 0, SEEK_SET);
+    int size = (int)h_fsize(fh);
     void* buf = h_malloc(size);
     if (h_fread(buf, 1, size, fh) != (size_t)size)
         STATE_FATAL("Cannot read from file %s\n", fn);
@@ -0,0 +1,125 @@
+// Timer event queue
+// Every timed device owns one slot, and keeps it armed with the absolute time (in ticks) of its next event. The slots are
+// kept in a binary min-heap so that the main loop can find the next deadline without asking every device.
+#include "cpuapi.h"
+#include "devices.h"
+#include "util.h"
+
+struct timer_slot {
+    itick_t deadline;
+    timer_handler cb;
+    int heap_index; // -1 if not armed
+};
+
+static struct timer_slot slots[TIMER_COUNT];
+static int heap[TIMER_COUNT], heap_size = 0;
+
+// The time at which the currently executing cpu_run will stop, or 0 if the CPU is not running.
+static itick_t run_limit = 0;
+
+static inline void timer_heap_set(int pos, int id)
+{
+    heap[pos] = id;
+    slots[id].heap_index = pos;
+}
+
+static void timer_sift_up(int pos)
+{
+    int id = heap[pos];
+    itick_t deadline = slots[id].deadline;
+    while (pos) {
+        int parent = (pos - 1) >> 1;
+        if (slots[heap[parent]].deadline <= deadline)
+            break;
+        timer_heap_set(pos, heap[parent]);
+        pos = parent;
+    }
+    timer_heap_set(pos, id);
+}
+
+static void timer_sift_down(int pos)
+{
+    int id = heap[pos];
+    itick_t deadline = slots[id].deadline;
+    while (1) {
+        int child = pos * 2 + 1;
+        if (child >= heap_size)
+            break;
+        if (child + 1 < heap_size && slots[heap[child + 1]].deadline < slots[heap[child]].deadline)
+            child++;
+        if (deadline <= slots[heap[child]].deadline)
+            break;
+        timer_heap_set(pos, heap[child]);
+        pos = child;
+    }
+    timer_heap_set(pos, id);
+}
+
+static void timer_remove(int id)
+{
+    int pos = slots[id].heap_index, last;
+    slots[id].heap_index = -1;
+    last = heap[--heap_size];
+    if (pos == heap_size)
+        return;
+    timer_heap_set(pos, last);
+    timer_sift_down(pos);
+    timer_sift_up(slots[last].heap_index);
+}
+
+// Must be called before the slot is armed for the first time
+void timer_register(int id, timer_handler cb)
+{
+    slots[id].cb = cb;
+    slots[id].heap_index = -1;
+}
+
+// Schedule the handler for "id" to be called once get_now() reaches "deadline". Replaces any earlier deadline.
+void timer_arm(int id, itick_t deadline)
+{
+    struct timer_slot* slot = &slots[id];
+    slot->deadline = deadline;
+    if (slot->heap_index < 0) {
+        slot->heap_index = heap_size;
+        heap[heap_size++] = id;
+    } else
+        timer_sift_down(slot->heap_index);
+    timer_sift_up(slot->heap_index);
+
+    // If the CPU was told to run past this point, then stop it early.
+    if (deadline < run_limit) {
+        run_limit = deadline;
+        cpu_cancel_execution_cycle(EXIT_STATUS_NORMAL);
+    }
+}
+
+void timer_cancel(int id)
+{
+    if (slots[id].heap_index >= 0)
+        timer_remove(id);
+}
+
+// Call the handlers of all events that are due. Returns the time of the next event, or TIMER_NONE if nothing is armed.
+itick_t timer_run(itick_t now)
+{
+    run_limit = 0;
+    while (heap_size && slots[heap[0]].deadline <= now) {
+        int id = heap[0];
+        itick_t deadline = slots[id].deadline;
+        timer_remove(id);
+        slots[id].cb(deadline);
+    }
+    return heap_size ? slots[heap[0]].deadline : TIMER_NONE;
+}
+
+// Returns the time of the next event without running anything, or TIMER_NONE if nothing is armed.
+itick_t timer_get_next(void)
+{
+    return heap_size ? slots[heap[0]].deadline : TIMER_NONE;
+}
+
+// Tell the queue how far the CPU is about to run, so that newly-armed events before that point can interrupt it
+void timer_set_run_limit(itick_t limit)
+{
+    run_limit = limit;
+}
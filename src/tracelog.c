@@ -0,0 +1,77 @@
+// Event trace ring buffer
+// Trace points append fixed-size records with tracelog_add. Once the ring is full, the oldest records are overwritten,
+// so the file always holds whatever led up to the exit or crash. File layout, all little endian:
+//   "HFXTRACE", u32 version, u32 record size, u32 records in the file, u32 records ever added (mod 2^32),
+//   u32 ticks per second, u32 category mask, then the records from oldest to newest.
+#include "tracelog.h"
+#include <stdlib.h>
+
+#define TRACELOG_LOG(x, ...) LOG("TRACE", x, ##__VA_ARGS__)
+
+#define TRACELOG_VERSION 1
+
+uint32_t tracelog_mask = 0;
+
+static struct tracelog_record* ring;
+static uint32_t ring_mask;
+// Counts every record ever added. Only the emulator thread adds records, and it publishes the new head with a release
+// store, so the ring never needs a lock.
+static uint32_t ring_head;
+static char* trace_path;
+
+void tracelog_add(int event, int size, uint32_t a, uint32_t b, uint32_t c)
+{
+    uint32_t head = ring_head;
+    struct tracelog_record* r = &ring[head & ring_mask];
+    r->time = get_now();
+    r->event = event;
+    r->size = size;
+    r->a = a;
+    r->b = b;
+    r->c = c;
+    h_atomic_store(&ring_head, head + 1);
+}
+
+// Writes out the ring. Called on exit and from util_abort, and safe to call more than once.
+void tracelog_dump(void)
+{
+    if (!ring)
+        return;
+    uint32_t head = h_atomic_load(&ring_head), size = ring_mask + 1, count = head < size ? head : size;
+    uint32_t header[6] = { TRACELOG_VERSION, sizeof(struct tracelog_record), count, head, ticks_per_second, tracelog_mask };
+
+    void* f = h_fopen(trace_path, "wb");
+    if (!f) {
+        h_fprintf(stderr, "Unable to open trace file %s\n", trace_path);
+        return;
+    }
+    h_fwrite("HFXTRACE", 8, 1, f);
+    h_fwrite(header, sizeof(header), 1, f);
+    // The oldest record sits right after the newest one once the ring has wrapped
+    uint32_t start = (head - count) & ring_mask, first = size - start < count ? size - start : count;
+    h_fwrite(&ring[start], sizeof(struct tracelog_record), first, f);
+    if (count > first)
+        h_fwrite(ring, sizeof(struct tracelog_record), count - first, f);
+    h_fclose(f);
+    TRACELOG_LOG("Wrote %u of %u events to %s\n", count, head, trace_path);
+}
+
+// Start recording the categories in "categories" (a bitmask of TRACELOG_*) into a ring of at least "entries" records.
+// The ring is written to "path" when the emulator exits.
+void tracelog_init(uint32_t categories, int entries, const char* path)
+{
+    if (!categories)
+        return;
+    uint32_t size = 1;
+    while (size < (uint32_t)entries && size < (1u << 24))
+        size <<= 1;
+    ring = h_calloc(size, sizeof(struct tracelog_record));
+    ring_mask = size - 1;
+
+    size_t len = h_strlen(path) + 1;
+    trace_path = h_malloc(len);
+    h_memcpy(trace_path, path, len);
+
+    tracelog_mask = categories;
+    atexit(tracelog_dump);
+}
@@ -1,13 +1,19 @@
 // All platform-dependent stuff
 
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200112L // clock_gettime
+#endif
 #include "util.h"
 #include "cpuapi.h"
 #include "display.h"
 #include "state.h"
+#include "tracelog.h"
 #include <stdlib.h>
 #include <string.h>
 #ifdef _WIN32
 #include <windows.h>
+#elif !defined(NOSTDLIB)
+#include <pthread.h>
 #endif
 #if defined(MOBILE_BUILD) && !defined(MOBILE_WIP)
 #include <SDL.h>
@@ -148,7 +154,7 @@ size_t h_fwrite(const void* buf, size_t elem_size, size_t elem_count, void* file
 #elif defined(PREFER_SDL2) && !defined(PREFER_STD)
     return SDL_RWwrite(file, buf, elem_size, elem_count);
 #else
-    return fread((void*)buf, elem_size, elem_count, file);
+    return fwrite(buf, elem_size, elem_count, file);
 #endif
 }
 
@@ -420,7 +426,27 @@ void afree(void* ptr)
 
 // Timing functions
 
-// TODO: Make this configurable
+// Host time in microseconds, from a clock that never goes backwards
+uint64_t h_get_us(void)
+{
+#if defined(_WIN32) && (!defined(PREFER_SDL2) || defined(PREFER_STD))
+    LARGE_INTEGER freq, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (uint64_t)(now.QuadPart / freq.QuadPart) * 1000000 + (uint64_t)(now.QuadPart % freq.QuadPart) * 1000000 / freq.QuadPart;
+#elif defined(PREFER_SDL2) && !defined(PREFER_STD)
+    uint64_t freq = SDL_GetPerformanceFrequency(), now = SDL_GetPerformanceCounter();
+    return now / freq * 1000000 + now % freq * 1000000 / freq;
+#elif !defined(NOSTDLIB)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#else
+    return 0;
+#endif
+}
+
+// Number of emulated instructions per emulated second. Can be changed with the "mips" option in the [cpu] section
 #ifndef REALTIME_TIMING
 uint32_t ticks_per_second = 50000000;
 #else
@@ -430,7 +456,11 @@ itick_t base;
 
 void set_ticks_per_second(uint32_t value)
 {
+#ifndef REALTIME_TIMING
     ticks_per_second = value;
+#else
+    UNUSED(value); // Ticks are always microseconds
+#endif
 }
 
 static itick_t tick_base;
@@ -463,6 +493,118 @@ void add_now(itick_t a)
     tick_base += a;
 }
 
+// Wall clock pacing
+// Emulated time still advances by one tick per instruction (so delay loops calibrate to the same CPU speed every time),
+// but the main loop can use pace_sync to keep it from running ahead of the host clock. If the host can't keep up, the
+// guest runs flat out until it has caught up, but no more than PACE_MAX_LAG_US of lag is ever made up.
+#define PACE_MAX_LAG_US 100000
+
+static uint64_t pace_wall_base, pace_last_wall;
+static itick_t pace_tick_base;
+static int pace_last_sleep;
+static struct pace_stats pace;
+
+void pace_init(void)
+{
+    pace_wall_base = h_get_us();
+    pace_tick_base = get_now();
+    pace_last_sleep = 0;
+    h_memset(&pace, 0, sizeof(struct pace_stats));
+}
+
+// Returns the number of microseconds that emulated time is ahead of the wall clock, which is how long the caller should
+// sleep for
+int pace_sync(void)
+{
+    uint64_t wall = h_get_us();
+    itick_t ticks = get_now() - pace_tick_base;
+    int64_t emulated = (int64_t)(ticks / ticks_per_second * 1000000 + ticks % ticks_per_second * 1000000 / ticks_per_second),
+            drift = emulated - (int64_t)(wall - pace_wall_base);
+
+    // The host may have woken up early to handle input
+    if (pace_last_sleep)
+        pace.slept_us += wall - pace_last_wall < (uint64_t)pace_last_sleep ? wall - pace_last_wall : (uint64_t)pace_last_sleep;
+    pace_last_wall = wall;
+
+    if (drift > pace.max_ahead_us)
+        pace.max_ahead_us = drift;
+    if (-drift > pace.max_behind_us)
+        pace.max_behind_us = -drift;
+    if (drift < -PACE_MAX_LAG_US) {
+        // Forget about the time we can't make up by moving the wall clock's starting point forward
+        uint64_t excess = -drift - PACE_MAX_LAG_US;
+        pace.dropped_us += excess;
+        pace_wall_base += excess;
+        drift = -PACE_MAX_LAG_US;
+    }
+    pace.drift_us = drift;
+    pace.syncs++;
+
+    if (drift > 1000000)
+        drift = 1000000; // Don't hang if someone messed with the time
+    pace_last_sleep = drift > 0 ? (int)drift : 0;
+    return pace_last_sleep;
+}
+
+void pace_get_stats(struct pace_stats* stats)
+{
+    *stats = pace;
+}
+
+#if !(defined(PREFER_SDL2) && !defined(PREFER_STD)) && !defined(NOSTDLIB)
+struct thread_start {
+    h_thread_func func;
+    void* arg;
+};
+#ifdef _WIN32
+static DWORD WINAPI thread_trampoline(LPVOID ptr)
+#else
+static void* thread_trampoline(void* ptr)
+#endif
+{
+    struct thread_start start = *(struct thread_start*)ptr;
+    h_free(ptr);
+    start.func(start.arg);
+    return 0;
+}
+#endif
+
+// Starts "func" on a new, detached thread. Returns -1 if the thread could not be created
+int h_thread_create(h_thread_func func, void* arg)
+{
+#if defined(PREFER_SDL2) && !defined(PREFER_STD)
+    SDL_Thread* thread = SDL_CreateThread(func, "halfix", arg);
+    if (!thread)
+        return -1;
+    SDL_DetachThread(thread);
+    return 0;
+#elif !defined(NOSTDLIB)
+    struct thread_start* start = h_malloc(sizeof(struct thread_start));
+    start->func = func;
+    start->arg = arg;
+#ifdef _WIN32
+    HANDLE thread = CreateThread(NULL, 0, thread_trampoline, start, 0, NULL);
+    if (!thread) {
+        h_free(start);
+        return -1;
+    }
+    CloseHandle(thread);
+#else
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, thread_trampoline, start)) {
+        h_free(start);
+        return -1;
+    }
+    pthread_detach(thread);
+#endif
+    return 0;
+#else
+    UNUSED(func);
+    UNUSED(arg);
+    return -1;
+#endif
+}
+
 void util_debug(void)
 {
     display_release_mouse();
@@ -482,5 +624,6 @@ void util_debug(void)
 void util_abort(void)
 {
     display_release_mouse();
+    tracelog_dump();
     // abort();
 }
\ No newline at end of file
@@ -61,6 +61,17 @@ int movs$4$3(int flags)
         cpu.reg$2DI] += add;
         return 0;
     }
+    if (add > 0) {
+        int done = movs_block(ds_base, cpu.reg$2SI], cpu.reg$2DI], $5, $6, count);
+        if (done < 0)
+            EXCEPTION_HANDLER;
+        if (done) {
+            cpu.reg$2SI] += done * add;
+            cpu.reg$2DI] += done * add;
+            cpu.reg$2CX] -= done;
+            return cpu.reg$2CX] != 0;
+        }
+    }
     for (int i = 0; i < count; i++) {
         cpu_read$0(ds_base + cpu.reg$2SI], src, cpu.tlb_shift_read);
         cpu_write$0(cpu.seg_base[ES] + cpu.reg$2DI], src, cpu.tlb_shift_write);
@@ -72,7 +83,7 @@ int movs$4$3(int flags)
     return cpu.reg$2CX] != 0;
 }
             */
-        }, szspc, add, regspec, asize, size_endings[osize]);
+        }, szspc, add, regspec, asize, size_endings[osize], asize === 16 ? "0xFFFF" : "0xFFFFFFFF", osize);
     },
     "stos": function (osize, asize) {
         var add = "-" + osize + " : " + osize,
@@ -103,6 +114,16 @@ int stos$5$3(int flags)
         cpu.reg$2DI] += add;
         return 0;
     }
+    if (add > 0) {
+        int done = stos_block(cpu.reg$2DI], $6, src, $7, count);
+        if (done < 0)
+            EXCEPTION_HANDLER;
+        if (done) {
+            cpu.reg$2DI] += done * add;
+            cpu.reg$2CX] -= done;
+            return cpu.reg$2CX] != 0;
+        }
+    }
     for (int i = 0; i < count; i++) {
         cpu_write$0(cpu.seg_base[ES] + cpu.reg$2DI], src, cpu.tlb_shift_write);
         cpu.reg$2DI] += add;
@@ -112,7 +133,7 @@ int stos$5$3(int flags)
     return cpu.reg$2CX] != 0;
 }
             */
-        }, szspc, add, regspec, asize, al, size_endings[osize]);
+        }, szspc, add, regspec, asize, al, size_endings[osize], asize === 16 ? "0xFFFF" : "0xFFFFFFFF", osize);
     },
     "scas": function (osize, asize) {
         var add = "-" + osize + " : " + osize,
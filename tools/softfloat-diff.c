@@ -0,0 +1,249 @@
+// Differential test for the host floating-point fast paths in src/cpu/softfloat.c
+// Build this file twice, once as-is and once with the fast paths disabled, and compare what the two print:
+//   gcc -O2 -Iinclude tools/softfloat-diff.c src/cpu/softfloat.c -lm -o softfloat-host
+//   gcc -O2 -Iinclude -DSOFTFLOAT_NO_HOST_FASTPATH tools/softfloat-diff.c src/cpu/softfloat.c -lm -o softfloat-ref
+//   ./softfloat-host > host.txt & ./softfloat-ref > ref.txt; wait; diff ref.txt host.txt
+// Each line is a digest of the results and exception flags of one operation under one set of rounding mode, DAZ/FTZ
+// and exception mask settings. The operands are pseudo-random, but biased towards zeros, denormals, infinities, NaNs,
+// exponents close to the edges of the range, short significands and (nearly) cancelling pairs. The
+// float32_sqrt/nearest/.../all groups try every possible input, since round-to-nearest-even is the only rounding mode
+// that the fast paths are used in. The whole run takes a few minutes.
+//
+// Usage: softfloat-diff [cases per group] [group]
+// The default is 1000000 cases per group. If a group is named (i.e. float64_div/nearest/daz0/masked), only that group
+// is run, and every case in it is printed, so diffing the output of both builds shows the inputs that differ. The
+// float32_sqrt/.../all groups print a digest for every 4096 inputs instead.
+
+#include "softfloat/softfloat.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum {
+    OP_FLOAT32_ADD,
+    OP_FLOAT32_SUB,
+    OP_FLOAT32_MUL,
+    OP_FLOAT32_DIV,
+    OP_FLOAT32_SQRT,
+    OP_FLOAT64_ADD,
+    OP_FLOAT64_SUB,
+    OP_FLOAT64_MUL,
+    OP_FLOAT64_DIV,
+    OP_FLOAT64_SQRT,
+    OP_COUNT
+};
+
+static const char* op_names[OP_COUNT] = {
+    "float32_add", "float32_sub", "float32_mul", "float32_div", "float32_sqrt",
+    "float64_add", "float64_sub", "float64_mul", "float64_div", "float64_sqrt"
+};
+
+static const struct {
+    const char* name;
+    int mode;
+} rounding_modes[] = {
+    { "nearest", float_round_nearest_even },
+    { "down", float_round_down },
+    { "up", float_round_up },
+    { "zero", float_round_to_zero }
+};
+
+// xorshift64, restarted for every group so that a single group can be run again on its own
+static uint64_t rng_state;
+static uint64_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static float32 random_float32(void)
+{
+    uint64_t r = rng();
+    uint32_t bits = (uint32_t)(r >> 32), exp = (r >> 8) & 31;
+    switch (r & 7) {
+    case 0: // Zero or denormal
+        return bits & (r & 8 ? 0x80000000 : 0x807FFFFF);
+    case 1: // Infinity or NaN
+        return (bits | 0x7F800000) & (r & 8 ? 0xFF800000 : 0xFFFFFFFF);
+    case 2: // Close to the smallest or largest exponent
+        exp = r & 16 ? 1 + (exp & 15) : 0xFE - (exp & 15);
+        return (bits & 0x807FFFFF) | exp << 23;
+    case 3: // Few significand bits, so that results are often exact
+        return (bits & 0x807F0000) | (0x7F - 16 + exp) << 23;
+    default:
+        return bits;
+    }
+}
+
+static float64 random_float64(void)
+{
+    uint64_t r = rng(), bits = rng(), exp = (r >> 8) & 31;
+    switch (r & 7) {
+    case 0: // Zero or denormal
+        return bits & (r & 8 ? U64(0x8000000000000000) : U64(0x800FFFFFFFFFFFFF));
+    case 1: // Infinity or NaN
+        return (bits | U64(0x7FF0000000000000)) & (r & 8 ? U64(0xFFF0000000000000) : U64(0xFFFFFFFFFFFFFFFF));
+    case 2: // Close to the edges of the range, or of the range that the fast paths multiply and divide in
+        switch ((r >> 4) & 3) {
+        case 0:
+            exp = 1 + (exp & 15);
+            break;
+        case 1:
+            exp = 0x7FE - (exp & 15);
+            break;
+        case 2:
+            exp = 0x3FF - 480 - 16 + exp;
+            break;
+        case 3:
+            exp = 0x3FF + 480 - 16 + exp;
+            break;
+        }
+        return (bits & U64(0x800FFFFFFFFFFFFF)) | exp << 52;
+    case 3: // Few significand bits, so that results are often exact
+        return (bits & U64(0x800FFFFF00000000)) | (0x3FF - 16 + exp) << 52;
+    default:
+        return bits;
+    }
+}
+
+static uint64_t run_op(int op, uint64_t a, uint64_t b, float_status_t* status)
+{
+    switch (op) {
+    case OP_FLOAT32_ADD:
+        return float32_add((float32)a, (float32)b, status);
+    case OP_FLOAT32_SUB:
+        return float32_sub((float32)a, (float32)b, status);
+    case OP_FLOAT32_MUL:
+        return float32_mul((float32)a, (float32)b, status);
+    case OP_FLOAT32_DIV:
+        return float32_div((float32)a, (float32)b, status);
+    case OP_FLOAT32_SQRT:
+        return float32_sqrt((float32)a, status);
+    case OP_FLOAT64_ADD:
+        return float64_add(a, b, status);
+    case OP_FLOAT64_SUB:
+        return float64_sub(a, b, status);
+    case OP_FLOAT64_MUL:
+        return float64_mul(a, b, status);
+    case OP_FLOAT64_DIV:
+        return float64_div(a, b, status);
+    default: // OP_FLOAT64_SQRT
+        return float64_sqrt(a, status);
+    }
+}
+
+static void init_status(float_status_t* status, int rounding_mode, int daz, int masked)
+{
+    memset(status, 0, sizeof(float_status_t));
+    status->float_rounding_mode = rounding_mode;
+    status->float_exception_masks = masked ? 0x3F : 0;
+    status->float_nan_handling_mode = float_first_operand_nan;
+    status->flush_underflow_to_zero = daz;
+    status->denormals_are_zeros = daz;
+}
+
+// FNV-1a style digest of everything that a group produced
+static uint64_t digest;
+static void digest_add(uint64_t value)
+{
+    digest = (digest ^ value) * U64(0x100000001B3);
+}
+
+// Runs one case, and prints it if the group is being dumped
+static void run_case(int op, uint64_t a, uint64_t b, int rounding_mode, int daz, int masked, int dump)
+{
+    float_status_t status;
+    uint64_t z;
+
+    init_status(&status, rounding_mode, daz, masked);
+    z = run_op(op, a, b, &status);
+    digest_add(z);
+    digest_add(status.float_exception_flags);
+    if (dump) {
+        if (op < OP_FLOAT64_ADD)
+            printf("%08" PRIx32 " %08" PRIx32 " -> %08" PRIx32 " flags=%02x\n", (uint32_t)a, (uint32_t)b, (uint32_t)z, status.float_exception_flags);
+        else
+            printf("%016" PRIx64 " %016" PRIx64 " -> %016" PRIx64 " flags=%02x\n", a, b, z, status.float_exception_flags);
+    }
+}
+
+static void run_group(int op, int rounding, int daz, int masked, long cases, const char* only)
+{
+    char name[128];
+    int mode = rounding_modes[rounding].mode, dump = only != NULL;
+    uint64_t a, b;
+
+    sprintf(name, "%s/%s/daz%d/%s", op_names[op], rounding_modes[rounding].name, daz, masked ? "masked" : "unmasked");
+    if (only && strcmp(only, name))
+        return;
+
+    rng_state = U64(88172645463325252);
+    digest = U64(0xCBF29CE484222325);
+    for (long i = 0; i < cases; i++) {
+        if (op < OP_FLOAT64_ADD) {
+            a = random_float32();
+            b = random_float32();
+        } else {
+            a = random_float64();
+            b = random_float64();
+        }
+        // Cancelling and nearly cancelling operands
+        switch (i & 15) {
+        case 0:
+            b = a ^ (op < OP_FLOAT64_ADD ? 0x80000000 : U64(0x8000000000000000));
+            break;
+        case 1:
+            b = a;
+            break;
+        case 2:
+            b = a ^ (rng() & 0xFF);
+            break;
+        }
+        run_case(op, a, b, mode, daz, masked, dump);
+    }
+
+    printf("%s %016" PRIx64 "\n", name, digest);
+    fflush(stdout);
+}
+
+// float32_sqrt with every possible input
+static void run_sqrt_group(int rounding, int daz, int masked, const char* only)
+{
+    char name[128];
+    uint64_t total = U64(0xCBF29CE484222325);
+
+    sprintf(name, "float32_sqrt/%s/daz%d/%s/all", rounding_modes[rounding].name, daz, masked ? "masked" : "unmasked");
+    if (only && strcmp(only, name))
+        return;
+
+    for (uint64_t block = 0; block <= 0xFFFFFFFF; block += 4096) {
+        digest = U64(0xCBF29CE484222325);
+        for (uint64_t x = block; x < block + 4096; x++)
+            run_case(OP_FLOAT32_SQRT, x, 0, rounding_modes[rounding].mode, daz, masked, 0);
+        if (only)
+            printf("%08" PRIx64 " %016" PRIx64 "\n", block, digest);
+        total = (total ^ digest) * U64(0x100000001B3);
+    }
+
+    printf("%s %016" PRIx64 "\n", name, total);
+    fflush(stdout);
+}
+
+int main(int argc, char** argv)
+{
+    long cases = argc > 1 ? atol(argv[1]) : 1000000;
+    const char* only = argc > 2 ? argv[2] : NULL;
+
+    for (int op = 0; op < OP_COUNT; op++)
+        for (int rounding = 0; rounding < 4; rounding++)
+            for (int daz = 0; daz < 2; daz++)
+                for (int masked = 1; masked >= 0; masked--)
+                    run_group(op, rounding, daz, masked, cases, only);
+    for (int daz = 0; daz < 2; daz++)
+        for (int masked = 1; masked >= 0; masked--)
+            run_sqrt_group(0, daz, masked, only);
+    return 0;
+}
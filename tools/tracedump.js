@@ -0,0 +1,91 @@
+// Decode an event trace written by src/tracelog.c
+// Usage: node tools/tracedump.js [trace file] [category ...]
+// If any categories are given (io, mmio, irq, disk, tlb, flush), only those events are printed.
+var fs = require("fs");
+
+var file = process.argv[2] || "halfix.trace",
+    only = process.argv.slice(3);
+
+var categories = ["io", "mmio", "irq", "disk", "tlb", "flush"];
+
+function hex(n, digits) {
+    var y = (n >>> 0).toString(16);
+    while (y.length < digits) y = "0" + y;
+    return y;
+}
+function offset(r) {
+    return (r.b ? hex(r.b, 1) : "") + hex(r.a, 8);
+}
+function data(r) {
+    return hex(r.b, r.size * 2);
+}
+
+// Keep in sync with include/tracelog.h
+var events = {};
+events[0x000] = ["IO_READ", function(r) { return "port=" + hex(r.a, 4) + " data=" + data(r); }];
+events[0x001] = ["IO_WRITE", function(r) { return "port=" + hex(r.a, 4) + " data=" + data(r); }];
+events[0x100] = ["MMIO_READ", function(r) { return "addr=" + hex(r.a, 8) + " data=" + data(r); }];
+events[0x101] = ["MMIO_WRITE", function(r) { return "addr=" + hex(r.a, 8) + " data=" + data(r); }];
+events[0x102] = ["MMIO_WRITE_BLOCK", function(r) { return "addr=" + hex(r.a, 8) + " length=" + r.b; }];
+events[0x200] = ["IRQ_RAISE", function(r) { return "line=" + r.a; }];
+events[0x201] = ["IRQ_LOWER", function(r) { return "line=" + r.a; }];
+events[0x202] = ["IRQ_ACK", function(r) { return "vector=" + hex(r.a, 2) + (r.b ? " (apic)" : " (pic)"); }];
+events[0x203] = ["IRQ_EOI", function(r) { return "vector=" + hex(r.a, 2); }];
+events[0x204] = ["IRQ_PIC_EOI", function(r) { return (r.a ? "slave" : "master") + " isr=" + hex(r.b, 2) + " ocw2=" + hex(r.c, 2); }];
+events[0x300] = ["DISK_READ", function(r) { return "offset=" + offset(r) + " length=" + r.c; }];
+events[0x301] = ["DISK_WRITE", function(r) { return "offset=" + offset(r) + " length=" + r.c; }];
+events[0x302] = ["DISK_PREFETCH", function(r) { return "offset=" + offset(r) + " length=" + r.c; }];
+events[0x400] = ["TLB_MISS", function(r) { return "lin=" + hex(r.a, 8) + " shift=" + r.b; }];
+events[0x401] = ["TLB_FLUSH", function(r) { return "entries=" + r.a + (r.b ? " (non-global)" : ""); }];
+events[0x500] = ["CODE_FLUSH", function(r) { return "used=" + r.a; }];
+
+var buf = fs.readFileSync(file);
+if (buf.toString("latin1", 0, 8) !== "HFXTRACE") {
+    console.error(file + " is not a trace file");
+    process.exit(1);
+}
+var version = buf.readUInt32LE(8),
+    record_size = buf.readUInt32LE(12),
+    count = buf.readUInt32LE(16),
+    total = buf.readUInt32LE(20),
+    ticks_per_second = buf.readUInt32LE(24),
+    mask = buf.readUInt32LE(28);
+if (version !== 1) {
+    console.error("Unsupported trace version " + version);
+    process.exit(1);
+}
+
+var enabled = [];
+for (var i = 0; i < categories.length; i++)
+    if (mask & (1 << i)) enabled.push(categories[i]);
+console.log("# " + count + " events (" + total + " recorded), categories: " + enabled.join(", "));
+
+var filter = 0;
+for (var i = 0; i < only.length; i++) {
+    var id = categories.indexOf(only[i]);
+    if (id === -1) {
+        console.error("Unknown category " + only[i]);
+        process.exit(1);
+    }
+    filter |= 1 << id;
+}
+
+var out = [];
+for (var i = 0, pos = 32; i < count; i++, pos += record_size) {
+    var r = {
+        time: buf.readUInt32LE(pos + 4) * 4294967296 + buf.readUInt32LE(pos),
+        event: buf.readUInt16LE(pos + 8),
+        size: buf.readUInt16LE(pos + 10),
+        a: buf.readUInt32LE(pos + 12),
+        b: buf.readUInt32LE(pos + 16),
+        c: buf.readUInt32LE(pos + 20)
+    };
+    if (filter && !(filter & (1 << (r.event >> 8)))) continue;
+    var desc = events[r.event] || ["EVENT_" + hex(r.event, 3), function(r) { return "a=" + hex(r.a, 8) + " b=" + hex(r.b, 8) + " c=" + hex(r.c, 8); }];
+    out.push((r.time / ticks_per_second).toFixed(6) + " " + desc[0] + " " + desc[1](r));
+    if (out.length === 4096) {
+        console.log(out.join("\n"));
+        out = [];
+    }
+}
+if (out.length) console.log(out.join("\n"));